@@ -13,6 +13,7 @@
 #include "util/arguments.h"
 #include "util/tokenizer.h"
 #include "util/progress_counter.h"
+#include "util/task_scheduler.h"
 
 #include "mve/scene.h"
 #include "mve/mesh_io_ply.h"
@@ -178,8 +179,9 @@ int main(int argc, char **argv) {
         glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, image->begin());
         ogl::check_gl_error();
 
-        futures.push_back(std::async(std::launch::async,
-            [view, &image_name] (mve::FloatImage::Ptr image) {
+        /* Blocks while too many images are pending - bounds the memory. */
+        futures.push_back(TaskScheduler::global().async_io(
+            [view, image, &image_name] () {
                 mve::image::flip<float>(image, mve::image::FLIP_VERTICAL);
 
                 image->delete_channel(3);
@@ -187,11 +189,13 @@ int main(int argc, char **argv) {
                 view->set_image(mve::image::float_to_byte_image(image), image_name);
                 view->save_view();
                 view->cache_cleanup();
-            }, image)
+            })
         );
 
         view_counter.inc();
     }
 
+    for (std::future<void> & future : futures) future.get();
+
     return EXIT_SUCCESS;
 }
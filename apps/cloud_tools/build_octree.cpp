@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <iostream>
+
+#include "util/system.h"
+#include "util/arguments.h"
+#include "util/file_system.h"
+
+#include "geom/point_octree_builder.h"
+
+struct Arguments {
+    std::string in_cloud;
+    std::string out_dir;
+    std::uint32_t grid_size;
+    std::size_t chunk_points;
+    std::size_t leaf_points;
+};
+
+Arguments parse_args(int argc, char **argv) {
+    util::Arguments args;
+    args.set_exit_on_error(true);
+    args.set_nonopt_minnum(2);
+    args.set_nonopt_maxnum(2);
+    args.set_usage("Usage: " + std::string(argv[0]) + " [OPTS] IN_CLOUD OUT_DIR");
+    args.set_description("Builds a multi-resolution point octree for streaming "
+        "visualization out-of-core. The ply cloud is streamed from disk, "
+        "spatially partitioned into chunks which fit into memory and each "
+        "chunk is subdivided into nodes with subsampled points.");
+    args.add_option('g', "grid-size", true, "subsampling grid size per node [128]");
+    args.add_option('c', "chunk-points", true, "maximum number of points per chunk [16777216]");
+    args.add_option('l', "leaf-points", true, "maximum number of points per leaf [20000]");
+    args.parse(argc, argv);
+
+    Arguments conf;
+    conf.in_cloud = args.get_nth_nonopt(0);
+    conf.out_dir = args.get_nth_nonopt(1);
+    conf.grid_size = 128;
+    conf.chunk_points = 1 << 24;
+    conf.leaf_points = 20000;
+
+    for (util::ArgResult const* i = args.next_option();
+         i != 0; i = args.next_option()) {
+        switch (i->opt->sopt) {
+        case 'g':
+            conf.grid_size = i->get_arg<std::uint32_t>();
+        break;
+        case 'c':
+            conf.chunk_points = i->get_arg<std::size_t>();
+        break;
+        case 'l':
+            conf.leaf_points = i->get_arg<std::size_t>();
+        break;
+        default:
+            throw std::invalid_argument("Invalid option");
+        }
+    }
+
+    if (conf.grid_size == 0 || conf.chunk_points == 0) {
+        throw std::invalid_argument("Grid size and chunk points have to be positive");
+    }
+
+    return conf;
+}
+
+int main(int argc, char **argv) {
+    util::system::register_segfault_handler();
+    util::system::print_build_timestamp(argv[0]);
+
+    Arguments args = parse_args(argc, argv);
+
+    if (!util::fs::dir_exists(args.out_dir.c_str())
+        && !util::fs::mkdir(args.out_dir.c_str())) {
+        std::cerr << "Could not create output directory" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    PointOctree octree;
+    try {
+        std::cout << "Building octree... " << std::flush;
+        octree = build_point_octree(args.in_cloud, args.out_dir,
+            args.grid_size, args.chunk_points, args.leaf_points);
+        std::cout << "done." << std::endl;
+    } catch (std::exception& e) {
+        std::cerr << "\tCould not build octree: " << e.what() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::cout << "Wrote " << octree.nodes.size() << " nodes" << std::endl;
+
+    return EXIT_SUCCESS;
+}
@@ -7,3 +7,14 @@ project "convert-cloud"
     files { "convert.cpp" }
 
     mve.use({ "util" })
+
+project "build_octree-cloud"
+    kind "ConsoleApp"
+    language "C++"
+
+    buildoptions { "-fopenmp" }
+    files { "build_octree.cpp" }
+
+    mve.use({ "util" })
+
+    links { "gomp" }
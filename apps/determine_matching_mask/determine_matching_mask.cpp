@@ -13,12 +13,13 @@
 
 #include "util/io.h"
 
-#include "mve/scene.h"
 #include "mve/image_io.h"
 #include "mve/mesh_io_ply.h"
 
 #include "acc/bvh_tree.h"
 
+#include "geom/projection.h"
+
 constexpr float inf = std::numeric_limits<float>::infinity();
 
 struct Arguments {
@@ -72,19 +73,19 @@ int main(int argc, char **argv) {
     }
     std::vector<math::Vec3f> const & verts = cloud->get_vertices();
 
-    mve::Scene::Ptr scene;
+    std::vector<SceneView> views;
     try {
-        scene = mve::Scene::create(args.scene);
+        views = load_scene_views(args.scene);
     } catch (std::exception& e) {
         std::cerr << "Could not open scene: " << e.what() << std::endl;
         std::exit(EXIT_FAILURE);
     }
 
     std::vector<mve::CameraInfo> cams;
-    for (mve::View::Ptr view : scene->get_views()) {
-        if (view == nullptr) continue;
-        if (!view->is_camera_valid()) continue;
-        cams.push_back(view->get_camera());
+    for (SceneView const & view : views) {
+        if (view.id < 0) continue;
+        if (view.camera.flen == 0.0f) continue;
+        cams.push_back(view.camera);
     }
 
     std::size_t const num_cams = cams.size();
@@ -103,28 +104,23 @@ int main(int argc, char **argv) {
     }
 
     std::vector<std::vector<uint> > vis(num_cams);
+    PointBatch points(verts);
 
     #pragma omp parallel for
     for (std::size_t i = 0; i < num_cams; ++i) {
-        mve::CameraInfo const & cam = cams[i];
-        math::Matrix3f calib;
-        cam.fill_calibration(calib.begin(), width, height);
-        math::Matrix4f w2c;
-        cam.fill_world_to_cam(w2c.begin());
-        math::Vec3f view_pos;
-        cam.fill_camera_pos(view_pos.begin());
+        CameraProjection proj = camera_projection(cams[i], width, height);
+        math::Vec3f view_pos(proj.pos);
+
+        std::vector<std::uint32_t> ids;
+        points_in_frustum(proj, points, FrustumBounds(), &ids);
 
         std::vector<uint> & vvis = vis[i];
 
-        for (std::size_t j = 0; j < verts.size(); ++j) {
+        for (std::uint32_t j : ids) {
             math::Vec3f v = verts[j];
 
             math::Vec3f v2c = view_pos - v;
             float n = v2c.norm();
-            math::Vec3f pt = calib * w2c.mult(v, 1.0f);
-            math::Vec2f p(pt[0] / pt[2] - 0.5f, pt[1] / pt[2] - 0.5f);
-
-            if (p[0] < 0.0f || width <= p[0] || p[1] < 0.0f || height <= p[1]) continue;
 
             if (bvh_tree != nullptr) {
                 acc::Ray<math::Vec3f> ray;
@@ -6,57 +6,127 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <limits>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
 
 #include "util/system.h"
 #include "util/arguments.h"
+#include "util/tokenizer.h"
 
 #include "util/numpy_io.h"
 
 #include "mve/scene.h"
 #include "mve/image.h"
+#include "mve/mesh_io_ply.h"
 
 #include "mve/depthmap.h"
 
+#include "acc/bvh_tree.h"
+
+#include "geom/projection.h"
+
+#include "utp/trajectory_io.h"
+
 struct Arguments {
     std::string scene;
     std::string image;
     std::string file;
+    std::string trajectory;
+    std::string proxy_mesh;
+    std::string cloud;
+    std::string count_cloud;
+    float target_gsd;
+    int width;
+    int height;
 };
 
 Arguments parse_args(int argc, char **argv) {
     util::Arguments args;
     args.set_exit_on_error(true);
-    args.set_nonopt_minnum(3);
+    args.set_nonopt_minnum(2);
     args.set_nonopt_maxnum(3);
     args.set_usage("Usage: " + std::string(argv[0]) +
-        " [OPTS] SCENE IMAGE FILE");
-    args.set_description("Evaluates ground sampling of a mesh.");
+        " [OPTS] SCENE IMAGE FILE\n"
+        "       " + std::string(argv[0]) +
+        " [OPTS] --trajectory=TRAJECTORY PROXY_MESH FILE");
+    args.set_description("Evaluates ground sampling of a mesh (pixel "
+        "footprints of the depth maps). With a trajectory the best ground "
+        "sampling distance of each proxy mesh vertex is predicted from the "
+        "poses, intrinsics and visibility instead.");
+    args.add_option('t', "trajectory", true, "predict from trajectory");
+    args.add_option('r', "resolution", true, "image resolution (prediction) [1920x1080]");
+    args.add_option('g', "target-gsd", true, "count views reaching this "
+        "ground sampling distance (prediction) [0.0]");
+    args.add_option('\0', "cloud", true, "save proxy mesh vertices with "
+        "predicted best ground sampling distance (-1 unobserved)");
+    args.add_option('\0', "count-cloud", true, "save proxy mesh vertices with "
+        "number of views reaching the target ground sampling distance");
     args.parse(argc, argv);
 
     Arguments conf;
-    conf.scene = args.get_nth_nonopt(0);
-    conf.image = args.get_nth_nonopt(1);
-    conf.file = args.get_nth_nonopt(2);
+    conf.target_gsd = 0.0f;
+    conf.width = 1920;
+    conf.height = 1080;
 
     for (util::ArgResult const* i = args.next_option();
          i != 0; i = args.next_option()) {
         switch (i->opt->sopt) {
+        case 't':
+            conf.trajectory = i->arg;
+        break;
+        case 'r':
+        {
+            util::Tokenizer tok;
+            tok.split(i->arg, 'x');
+            if (tok.size() != 2) throw std::invalid_argument("Invalid resolution");
+            conf.width = tok.get_as<int>(0);
+            conf.height = tok.get_as<int>(1);
+        }
+        break;
+        case 'g':
+            conf.target_gsd = i->get_arg<float>();
+        break;
+        case '\0':
+            if (i->opt->lopt == "cloud") {
+                conf.cloud = i->arg;
+            } else if (i->opt->lopt == "count-cloud") {
+                conf.count_cloud = i->arg;
+            } else {
+                throw std::invalid_argument("Invalid option");
+            }
+        break;
         default:
             throw std::invalid_argument("Invalid option");
         }
     }
 
-    return conf;
-}
+    if (conf.trajectory.empty()) {
+        if (args.get_nth_nonopt(2).empty()) {
+            throw std::invalid_argument("Requires SCENE IMAGE FILE");
+        }
+        conf.scene = args.get_nth_nonopt(0);
+        conf.image = args.get_nth_nonopt(1);
+        conf.file = args.get_nth_nonopt(2);
+    } else {
+        if (!args.get_nth_nonopt(2).empty()) {
+            throw std::invalid_argument("Requires PROXY_MESH FILE");
+        }
+        conf.proxy_mesh = args.get_nth_nonopt(0);
+        conf.file = args.get_nth_nonopt(1);
+    }
 
-int main(int argc, char **argv) {
-    util::system::register_segfault_handler();
-    util::system::print_build_timestamp(argv[0]);
+    if (!conf.count_cloud.empty() && conf.target_gsd <= 0.0f) {
+        throw std::invalid_argument("Count cloud requires a target GSD");
+    }
 
-    Arguments args = parse_args(argc, argv);
+    return conf;
+}
 
+/* Pixel footprints of the depth maps. */
+std::vector<float>
+evaluate(Arguments const & args) {
     mve::Scene::Ptr scene;
     try {
         scene = mve::Scene::create(args.scene);
@@ -104,7 +174,165 @@ int main(int argc, char **argv) {
         }
     }
 
+    return gsds;
+}
+
+/* Best ground sampling distance of each vertex (infinity if unobserved) and
+ * number of views reaching the target ground sampling distance - vertices
+ * are observed by views which contain them in their frustum, face them and
+ * are not occluded by the mesh. */
+void
+predict(mve::TriangleMesh::ConstPtr mesh,
+    std::vector<mve::CameraInfo> const & trajectory, Arguments const & args,
+    std::vector<float> * best_gsds, std::vector<float> * counts)
+{
+    std::vector<math::Vec3f> const & verts = mesh->get_vertices();
+    std::vector<math::Vec3f> const & normals = mesh->get_vertex_normals();
+    acc::BVHTree<uint, math::Vec3f>::Ptr bvh_tree;
+    bvh_tree = acc::BVHTree<uint, math::Vec3f>::create(mesh->get_faces(), verts);
+
+    std::size_t const num_views = trajectory.size();
+    std::vector<CameraProjection> projs(num_views);
+    for (std::size_t i = 0; i < num_views; ++i) {
+        projs[i] = camera_projection(trajectory[i], args.width, args.height);
+    }
+
+    best_gsds->assign(verts.size(), std::numeric_limits<float>::infinity());
+    counts->assign(verts.size(), 0.0f);
+
+    PointBatch points(verts);
+    std::size_t const block_size = GEOM_PROJECTION_BLOCK_SIZE;
+    std::size_t const num_blocks = (verts.size() + block_size - 1) / block_size;
+
+    /* Project blocks of vertices into one view at a time. */
+    #pragma omp parallel for schedule(dynamic)
+    for (std::size_t b = 0; b < num_blocks; ++b) {
+        std::size_t first = b * block_size;
+        std::size_t count = std::min(block_size, verts.size() - first);
+
+        ProjectedPoints projected;
+        for (std::size_t j = 0; j < num_views; ++j) {
+            CameraProjection const & proj = projs[j];
+            if (project_points(proj, points, first, count,
+                    FrustumBounds(), &projected) == 0) continue;
+
+            math::Vec3f pos(proj.pos);
+            math::Matrix3f invcalib(proj.invcalib);
+            for (std::size_t k = 0; k < count; ++k) {
+                if (!projected.inside[k]) continue;
+
+                std::size_t i = first + k;
+                math::Vec3f const & v = verts[i];
+                math::Vec3f const & n = normals[i];
+
+                math::Vec3f v2c = pos - v;
+                float l = v2c.norm();
+                if (n.dot(v2c) <= 0.0f) continue;
+
+                float & best_gsd = best_gsds->at(i);
+                float gsd = mve::geom::pixel_footprint(projected.x[k],
+                    projected.y[k], l, invcalib);
+                if (gsd >= best_gsd && gsd > args.target_gsd) continue;
+
+                acc::Ray<math::Vec3f> ray;
+                ray.origin = v;
+                ray.dir = v2c / l;
+                ray.tmin = l * 0.001f;
+                ray.tmax = l;
+                if (bvh_tree->intersect(ray)) continue;
+
+                best_gsd = std::min(best_gsd, gsd);
+                if (gsd <= args.target_gsd) counts->at(i) += 1.0f;
+            }
+        }
+    }
+}
+
+void
+save_cloud(mve::TriangleMesh::ConstPtr mesh, std::vector<float> const & values,
+    std::string const & path)
+{
+    mve::TriangleMesh::Ptr cloud = mve::TriangleMesh::create();
+    cloud->get_vertices() = mesh->get_vertices();
+    cloud->get_vertex_normals() = mesh->get_vertex_normals();
+    cloud->get_vertex_values() = values;
+
+    mve::geom::SavePLYOptions opts;
+    opts.write_vertex_normals = true;
+    opts.write_vertex_values = true;
+    try {
+        mve::geom::save_ply_mesh(cloud, path, opts);
+    } catch (std::exception& e) {
+        std::cerr << "Could not save cloud: " << e.what() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char **argv) {
+    util::system::register_segfault_handler();
+    util::system::print_build_timestamp(argv[0]);
+
+    Arguments args = parse_args(argc, argv);
+
+    if (args.trajectory.empty()) {
+        save_numpy_file(evaluate(args), args.file);
+        return EXIT_SUCCESS;
+    }
+
+    std::vector<mve::CameraInfo> trajectory;
+    utp::load_trajectory(args.trajectory, &trajectory);
+
+    mve::TriangleMesh::Ptr mesh;
+    try {
+        mesh = mve::geom::load_ply_mesh(args.proxy_mesh);
+    } catch (std::exception& e) {
+        std::cerr << "Could not load mesh: " << e.what() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    mesh->ensure_normals(false, true);
+
+    std::vector<float> best_gsds, counts;
+    predict(mesh, trajectory, args, &best_gsds, &counts);
+
+    std::vector<float> gsds;
+    std::size_t num_sufficient = 0;
+    for (std::size_t i = 0; i < best_gsds.size(); ++i) {
+        if (best_gsds[i] == std::numeric_limits<float>::infinity()) continue;
+        gsds.push_back(best_gsds[i]);
+        num_sufficient += best_gsds[i] <= args.target_gsd;
+    }
+
+    std::size_t num_verts = best_gsds.size();
+    std::cout << "Observed " << gsds.size() << " of " << num_verts
+        << " vertices" << std::endl;
+    if (!gsds.empty()) {
+        std::vector<float> tmp = gsds;
+        std::nth_element(tmp.begin(), tmp.begin() + tmp.size() / 2, tmp.end());
+        std::cout << "Best GSD median: " << tmp[tmp.size() / 2]
+            << " max: " << *std::max_element(gsds.begin(), gsds.end()) << std::endl;
+    }
+    if (args.target_gsd > 0.0f) {
+        double sum = 0.0;
+        for (float count : counts) sum += count;
+        std::cout << "Target GSD " << args.target_gsd << " reached for "
+            << num_sufficient << " vertices ("
+            << 100.0f * num_sufficient / std::max<std::size_t>(num_verts, 1)
+            << "%), average " << sum / std::max<std::size_t>(num_verts, 1)
+            << " views per vertex" << std::endl;
+    }
+
     save_numpy_file(gsds, args.file);
 
+    if (!args.cloud.empty()) {
+        for (float & gsd : best_gsds) {
+            if (gsd == std::numeric_limits<float>::infinity()) gsd = -1.0f;
+        }
+        save_cloud(mesh, best_gsds, args.cloud);
+    }
+
+    if (!args.count_cloud.empty()) {
+        save_cloud(mesh, counts, args.count_cloud);
+    }
+
     return EXIT_SUCCESS;
 }
@@ -10,4 +10,4 @@ project "evaluate_ground_sampling"
 
     mve.use({ "util" })
 
-    links { "gomp" }
+    links { "gomp", "utp" }
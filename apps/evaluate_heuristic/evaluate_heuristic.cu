@@ -6,25 +6,40 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <array>
+#include <cmath>
+#include <random>
+#include <numeric>
 #include <fstream>
 #include <iostream>
 
 #include "util/system.h"
 #include "util/arguments.h"
+#include "util/tokenizer.h"
 
 #include "util/io.h"
 #include "util/numpy_io.h"
+#include "util/sort.h"
 
 #include "cacc/util.h"
 #include "cacc/math.h"
 
 #include "eval/kernels.h"
 
+#include "geom/projection.h"
+
 #include "stat/correlations.h"
 
 #include "mve/scene.h"
 #include "mve/image.h"
 
+/* Range of a heuristic parameter, steps == 1 denotes a fixed value. */
+struct Range {
+    float min;
+    float max;
+    uint steps;
+};
+
 struct Arguments {
     std::string scene;
     std::string image;
@@ -32,27 +47,66 @@ struct Arguments {
     std::string file;
     std::string recon_cloud;
     std::string obs_cloud;
+    std::string table;
     float max_distance;
     float target_recon;
+    std::array<Range, 4> ranges;
+    uint num_random;
+    std::uint32_t seed;
+    std::size_t num_samples;
 };
 
+typedef std::array<float, 4> HeuristicParams;
+
 typedef unsigned int uint;
 typedef acc::BVHTree<uint, math::Vec3f> BVHTree;
 
+Range parse_range(std::string const & str) {
+    util::Tokenizer tok;
+    tok.split(str, ':');
+    if (tok.size() == 1) {
+        float value = tok.get_as<float>(0);
+        return {value, value, 1u};
+    } else if (tok.size() == 3) {
+        Range range = {tok.get_as<float>(0), tok.get_as<float>(1),
+            tok.get_as<uint>(2)};
+        if (range.steps == 0) throw std::invalid_argument("Invalid range");
+        return range;
+    } else {
+        throw std::invalid_argument("Invalid range " + str);
+    }
+}
+
 Arguments parse_args(int argc, char **argv) {
     util::Arguments args;
     args.set_exit_on_error(true);
     args.set_nonopt_minnum(4);
     args.set_nonopt_maxnum(4);
+    args.set_helptext_indent(24);
     args.set_usage("Usage: " + std::string(argv[0]) +
         " [OPTS] SCENE IMAGE GT_MESH FILE");
     args.set_description("Evaluates Spearman's rank correlation between "
-        "depth error and heuristic for multiple parameter sets.");
+        "depth error and heuristic for multiple parameter sets.\n"
+        "The correlation is reported with its 95% confidence interval. "
+        "Heuristic parameters are either values or ranges MIN:MAX:STEPS, "
+        "ranges span a grid (or a random search with --random) and the "
+        "correlation of each parameter set is emitted as table. "
+        "FILE and the clouds contain the results of the best parameter set.");
     args.add_option('r', "recon-cloud", true,
         "save cloud with predicted reconstructabilities");
     args.add_option('o', "obs-cloud", true,
         "save cloud with number of observations reconstructabilities");
+    args.add_option('t', "table", true, "save sweep table to file [stdout]");
     args.add_option('\0', "max-distance", true, "maximum distance to surface [80.0]");
+    args.add_option('\0', "m-k", true, "matchability steepness [8]");
+    args.add_option('\0', "m-x0", true, "matchability midpoint (pi / x) [4]");
+    args.add_option('\0', "t-k", true, "triangulation steepness [32]");
+    args.add_option('\0', "t-x0", true, "triangulation midpoint (pi / x) [16]");
+    args.add_option('\0', "random", true,
+        "number of random parameter sets drawn from the ranges [0]");
+    args.add_option('\0', "seed", true, "seed for RNG [0]");
+    args.add_option('s', "samples", true, "target number of ground truth "
+        "samples, stratified over image tiles and depth ranges [0 - all pixels]");
     args.parse(argc, argv);
 
     Arguments conf;
@@ -61,6 +115,13 @@ Arguments parse_args(int argc, char **argv) {
     conf.gt_mesh = args.get_nth_nonopt(2);
     conf.file = args.get_nth_nonopt(3);
     conf.max_distance = 80.0f;
+    conf.ranges[0] = {8.0f, 8.0f, 1u};
+    conf.ranges[1] = {4.0f, 4.0f, 1u};
+    conf.ranges[2] = {32.0f, 32.0f, 1u};
+    conf.ranges[3] = {16.0f, 16.0f, 1u};
+    conf.num_random = 0;
+    conf.seed = 0u;
+    conf.num_samples = 0;
 
     for (util::ArgResult const* i = args.next_option();
          i != 0; i = args.next_option()) {
@@ -71,9 +132,27 @@ Arguments parse_args(int argc, char **argv) {
         case 'o':
             conf.obs_cloud = i->arg;
         break;
+        case 't':
+            conf.table = i->arg;
+        break;
+        case 's':
+            conf.num_samples = i->get_arg<std::size_t>();
+        break;
         case '\0':
             if (i->opt->lopt == "max-distance") {
                 conf.max_distance = i->get_arg<float>();
+            } else if (i->opt->lopt == "m-k") {
+                conf.ranges[0] = parse_range(i->arg);
+            } else if (i->opt->lopt == "m-x0") {
+                conf.ranges[1] = parse_range(i->arg);
+            } else if (i->opt->lopt == "t-k") {
+                conf.ranges[2] = parse_range(i->arg);
+            } else if (i->opt->lopt == "t-x0") {
+                conf.ranges[3] = parse_range(i->arg);
+            } else if (i->opt->lopt == "random") {
+                conf.num_random = i->get_arg<uint>();
+            } else if (i->opt->lopt == "seed") {
+                conf.seed = i->get_arg<std::uint32_t>();
             } else {
                 throw std::invalid_argument("Invalid option");
             }
@@ -86,6 +165,224 @@ Arguments parse_args(int argc, char **argv) {
     return conf;
 }
 
+std::vector<HeuristicParams>
+generate_parameter_sets(Arguments const & args) {
+    std::vector<HeuristicParams> ret;
+
+    if (args.num_random > 0) {
+        std::mt19937 gen(args.seed);
+        std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+        ret.resize(args.num_random);
+        for (HeuristicParams & params : ret) {
+            for (int i = 0; i < 4; ++i) {
+                Range const & range = args.ranges[i];
+                params[i] = range.min + dist(gen) * (range.max - range.min);
+            }
+        }
+        return ret;
+    }
+
+    std::size_t num_sets = 1;
+    for (Range const & range : args.ranges) num_sets *= range.steps;
+
+    ret.resize(num_sets);
+    for (std::size_t i = 0; i < num_sets; ++i) {
+        std::size_t idx = i;
+        for (int j = 0; j < 4; ++j) {
+            Range const & range = args.ranges[j];
+            std::size_t step = idx % range.steps;
+            idx /= range.steps;
+
+            float t = (range.steps > 1) ? step / float(range.steps - 1) : 0.0f;
+            ret[i][j] = range.min + t * (range.max - range.min);
+        }
+    }
+
+    return ret;
+}
+
+/* Fractional ranks (ties receive their average rank). */
+std::vector<double>
+fractional_ranks(float const * values, std::size_t n) {
+    std::vector<std::pair<float, std::size_t> > sorted(n);
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < n; ++i) {
+        sorted[i] = std::make_pair(values[i], i);
+    }
+
+    parallel_sort(sorted.begin(), sorted.end());
+
+    std::vector<double> ranks(n);
+    for (std::size_t i = 0; i < n;) {
+        std::size_t j = i + 1;
+        while (j < n && sorted[j].first == sorted[i].first) ++j;
+        double rank = (i + j - 1) / 2.0;
+        for (std::size_t k = i; k < j; ++k) {
+            ranks[sorted[k].second] = rank;
+        }
+        i = j;
+    }
+
+    return ranks;
+}
+
+double
+pearsons_correlation(std::vector<double> const & x, std::vector<double> const & y) {
+    std::size_t const n = x.size();
+
+    double mx = 0.0, my = 0.0;
+    #pragma omp parallel for reduction(+:mx,my)
+    for (std::size_t i = 0; i < n; ++i) {
+        mx += x[i];
+        my += y[i];
+    }
+    mx /= n;
+    my /= n;
+
+    double sxy = 0.0, sxx = 0.0, syy = 0.0;
+    #pragma omp parallel for reduction(+:sxy,sxx,syy)
+    for (std::size_t i = 0; i < n; ++i) {
+        double dx = x[i] - mx;
+        double dy = y[i] - my;
+        sxy += dx * dy;
+        sxx += dx * dx;
+        syy += dy * dy;
+    }
+
+    return sxy / std::sqrt(sxx * syy);
+}
+
+/* Approximate 95% confidence interval of Spearman's rank correlation via the
+ * Fisher transformation (standard error according to Fieller et al.). */
+std::pair<double, double>
+confidence_interval(double rho, std::size_t n) {
+    if (n <= 3) return std::make_pair(-1.0, 1.0);
+    double z = std::atanh(std::max(-0.999999, std::min(rho, 0.999999)));
+    double se = std::sqrt(1.06 / (n - 3));
+    return std::make_pair(std::tanh(z - 1.96 * se), std::tanh(z + 1.96 * se));
+}
+
+/* Selects budget pixels (all if budget == 0) within the border by
+ * proportional stratified sampling - strata are image tiles times depth
+ * ranges of the view (with an additional stratum for missing depths). */
+std::vector<math::Vec2i>
+stratified_pixels(mve::FloatImage::ConstPtr dmap, int border,
+    std::size_t budget, std::mt19937 * gen)
+{
+    constexpr int tiles = 8;
+    constexpr int depth_bins = 4;
+    constexpr int num_strata = tiles * tiles * (depth_bins + 1);
+
+    int const width = dmap->width() - 2 * border;
+    int const height = dmap->height() - 2 * border;
+
+    std::vector<math::Vec2i> pixels;
+    if (width <= 0 || height <= 0) return pixels;
+
+    if (budget == 0 || budget >= std::size_t(width) * height) {
+        pixels.reserve(std::size_t(width) * height);
+        for (int y = border; y < border + height; ++y) {
+            for (int x = border; x < border + width; ++x) {
+                pixels.emplace_back(x, y);
+            }
+        }
+        return pixels;
+    }
+
+    float min_depth = std::numeric_limits<float>::max();
+    float max_depth = 0.0f;
+    for (int y = border; y < border + height; ++y) {
+        for (int x = border; x < border + width; ++x) {
+            float depth = dmap->at(x, y, 0);
+            if (depth <= 0.0f) continue;
+            min_depth = std::min(min_depth, depth);
+            max_depth = std::max(max_depth, depth);
+        }
+    }
+    float depth_range = std::max(max_depth - min_depth,
+        std::numeric_limits<float>::min());
+
+    auto stratum = [&] (int x, int y) -> int {
+        float depth = dmap->at(x, y, 0);
+        int bin = 0;
+        if (depth > 0.0f) {
+            bin = 1 + std::min(int((depth - min_depth) / depth_range
+                * depth_bins), depth_bins - 1);
+        }
+        int tx = ((x - border) * tiles) / width;
+        int ty = ((y - border) * tiles) / height;
+        return (ty * tiles + tx) * (depth_bins + 1) + bin;
+    };
+
+    std::vector<std::size_t> sizes(num_strata, 0);
+    for (int y = border; y < border + height; ++y) {
+        for (int x = border; x < border + width; ++x) {
+            sizes[stratum(x, y)] += 1;
+        }
+    }
+
+    /* Proportional allocation (largest remainder method) - quotas sum up
+     * to budget. */
+    std::size_t const num_pixels = std::size_t(width) * height;
+    std::vector<std::size_t> quotas(num_strata, 0);
+    std::vector<std::size_t> remainders(num_strata, 0);
+    std::size_t remaining = budget;
+    int num_nonempty = 0;
+    for (int i = 0; i < num_strata; ++i) {
+        if (sizes[i] == 0) continue;
+        quotas[i] = (budget * sizes[i]) / num_pixels;
+        remainders[i] = (budget * sizes[i]) % num_pixels;
+        remaining -= quotas[i];
+        num_nonempty += 1;
+    }
+
+    if (budget >= std::size_t(num_nonempty)) {
+        std::vector<int> order(num_strata);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+            [&remainders] (int a, int b) -> bool {
+                return remainders[a] > remainders[b];
+            }
+        );
+        for (std::size_t i = 0; i < remaining; ++i) {
+            quotas[order[i]] += 1;
+        }
+    } else {
+        /* Fewer samples than strata - draw the strata of the remaining
+         * samples with probability proportional to their remainders
+         * (systematic sampling, the remainders sum up to remaining times
+         * num_pixels and each is smaller than num_pixels). */
+        std::uniform_int_distribution<std::size_t> offset(0, num_pixels - 1);
+        std::size_t const u = offset(*gen);
+        auto drawn = [u, num_pixels] (std::size_t x) -> std::size_t {
+            return x > u ? (x - u - 1) / num_pixels + 1 : 0;
+        };
+
+        std::size_t sum = 0;
+        for (int i = 0; i < num_strata; ++i) {
+            std::size_t prev = sum;
+            sum += remainders[i];
+            quotas[i] += drawn(sum) - drawn(prev);
+        }
+    }
+
+    /* Selection sampling (Knuth's algorithm S) within each stratum. */
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    pixels.reserve(budget);
+    for (int y = border; y < border + height; ++y) {
+        for (int x = border; x < border + width; ++x) {
+            int s = stratum(x, y);
+            if (dist(*gen) * sizes[s] < quotas[s]) {
+                pixels.emplace_back(x, y);
+                quotas[s] -= 1;
+            }
+            sizes[s] -= 1;
+        }
+    }
+
+    return pixels;
+}
+
 template <int N> inline void
 patch(mve::FloatImage::Ptr img, int x, int y, float (*ptr)[N][N]) {
     static_assert(N % 2 == 1, "Requires odd patch size");
@@ -127,67 +424,120 @@ int main(int argc, char **argv) {
     BVHTree::Ptr bvh_tree = BVHTree::create(faces, vertices);
     std::cout << "done." << std::endl;
 
-    std::vector<float> errors;
-    std::vector<math::Vec3f> verts;
-    std::vector<math::Vec3f> normals;
-
-    std::vector<mve::View::Ptr> views = scene->get_views();
-    for (mve::View::Ptr & view : views) {
+    std::vector<mve::View::Ptr> views;
+    for (mve::View::Ptr const & view : scene->get_views()) {
         if (view == nullptr) continue;
         if (!view->has_image(args.image, mve::IMAGE_TYPE_FLOAT)) {
             std::cerr << "Warning view " << view->get_name()
                 << " has no image " << args.image << std::endl;
             continue;
         }
+        views.push_back(view);
+    }
+
+    if (views.empty()) {
+        std::cerr << "Scene contains no views with image " << args.image << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+
+    /* Per view buffers - filled in parallel and concatenated in order. */
+    std::vector<std::vector<float> > view_errors(views.size());
+    std::vector<std::vector<math::Vec3f> > view_verts(views.size());
+    std::vector<std::vector<math::Vec3f> > view_normals(views.size());
+
+    #pragma omp parallel for schedule(dynamic)
+    for (std::size_t i = 0; i < views.size(); ++i) {
+        /* Split the samples evenly - views without a share are skipped. */
+        std::size_t budget = 0;
+        if (args.num_samples > 0) {
+            budget = args.num_samples / views.size()
+                + (i < args.num_samples % views.size());
+            if (budget == 0) continue;
+        }
 
+        mve::View::Ptr const & view = views[i];
         mve::FloatImage::Ptr dmap = view->get_float_image(args.image);
 
-        mve::CameraInfo const & camera = view->get_camera();
-        math::Vec3f origin;
-        camera.fill_camera_pos(origin.begin());
-        math::Matrix3f invcalib;
-        camera.fill_inverse_calibration(invcalib.begin(),
+        CameraProjection proj = camera_projection(view->get_camera(),
             dmap->width(), dmap->height());
-        math::Matrix3f c2w_rot;
-        camera.fill_cam_to_world_rot(c2w_rot.begin());
+        math::Vec3f origin(proj.pos);
 
         /* Ignore border - issues with kernel approaches. */
         int border = 0.01f * max(dmap->width(), dmap->height());
-        for (int y = border; y < dmap->height() - border; ++y) {
-            for (int x = border; x < dmap->width() - border; ++x) {
-                float depth = dmap->at(x, y, 0);
-
-                BVHTree::Ray ray;
-                ray.origin = origin;
-                math::Vec3f v = invcalib *
-                    math::Vec3f ((float)x + 0.5f, (float)y + 0.5f, 1.0f);
-                ray.dir = c2w_rot.mult(v.normalized()).normalize();
-                ray.tmin = 0.0f;
-                ray.tmax = std::numeric_limits<float>::infinity();
-
-                /* Ground truth depth? */
-                BVHTree::Hit hit;
-                if (!bvh_tree->intersect(ray, &hit)) continue;
-
-                verts.push_back(origin + (hit.t * ray.dir));
-                math::Vec3f v0 = vertices[faces[hit.idx * 3]];
-                math::Vec3f v1 = vertices[faces[hit.idx * 3 + 1]];
-                math::Vec3f v2 = vertices[faces[hit.idx * 3 + 2]];
-                normals.push_back((v2 - v0).cross(v1 - v0).normalize());
-
-                //float depths[25];
-                //patch(dmap, x, y, (float (*)[5][5])&depths);
-                //if (std::any_of(depths, depths + 25,
-                //        [] (float d) { return d == 0.0f; })) {
-                if (depth == 0) {
-                    errors.push_back(-1.0f);
-                } else {
-                    errors.push_back(std::abs(depth - (hit.t * ray.dir).norm()));
-                }
+
+        std::mt19937 gen(args.seed + i);
+        std::vector<math::Vec2i> pixels;
+        pixels = stratified_pixels(dmap, border, budget, &gen);
+
+        std::vector<float> & errors = view_errors[i];
+        std::vector<math::Vec3f> & verts = view_verts[i];
+        std::vector<math::Vec3f> & normals = view_normals[i];
+        errors.reserve(pixels.size());
+        verts.reserve(pixels.size());
+        normals.reserve(pixels.size());
+
+        /* Rays through the pixel centers. */
+        std::size_t const num_pixels = pixels.size();
+        std::vector<float> px(num_pixels), py(num_pixels);
+        for (std::size_t j = 0; j < num_pixels; ++j) {
+            px[j] = pixels[j][0] + 0.5f;
+            py[j] = pixels[j][1] + 0.5f;
+        }
+        PointBatch dirs;
+        dirs.resize(num_pixels);
+        backproject_pixels(proj, px.data(), py.data(), num_pixels,
+            dirs.x.data(), dirs.y.data(), dirs.z.data());
+
+        for (std::size_t j = 0; j < num_pixels; ++j) {
+            int const x = pixels[j][0];
+            int const y = pixels[j][1];
+            float depth = dmap->at(x, y, 0);
+
+            BVHTree::Ray ray;
+            ray.origin = origin;
+            ray.dir = dirs[j];
+            ray.tmin = 0.0f;
+            ray.tmax = std::numeric_limits<float>::infinity();
+
+            /* Ground truth depth? */
+            BVHTree::Hit hit;
+            if (!bvh_tree->intersect(ray, &hit)) continue;
+
+            verts.push_back(origin + (hit.t * ray.dir));
+            math::Vec3f v0 = vertices[faces[hit.idx * 3]];
+            math::Vec3f v1 = vertices[faces[hit.idx * 3 + 1]];
+            math::Vec3f v2 = vertices[faces[hit.idx * 3 + 2]];
+            normals.push_back((v2 - v0).cross(v1 - v0).normalize());
+
+            //float depths[25];
+            //patch(dmap, x, y, (float (*)[5][5])&depths);
+            //if (std::any_of(depths, depths + 25,
+            //        [] (float d) { return d == 0.0f; })) {
+            if (depth == 0) {
+                errors.push_back(-1.0f);
+            } else {
+                errors.push_back(std::abs(depth - (hit.t * ray.dir).norm()));
             }
         }
+
+        view->cache_cleanup();
+    }
+
+    std::vector<float> errors;
+    std::vector<math::Vec3f> verts;
+    std::vector<math::Vec3f> normals;
+    for (std::size_t i = 0; i < views.size(); ++i) {
+        errors.insert(errors.end(), view_errors[i].begin(), view_errors[i].end());
+        verts.insert(verts.end(), view_verts[i].begin(), view_verts[i].end());
+        normals.insert(normals.end(), view_normals[i].begin(), view_normals[i].end());
+        std::vector<float>().swap(view_errors[i]);
+        std::vector<math::Vec3f>().swap(view_verts[i]);
+        std::vector<math::Vec3f>().swap(view_normals[i]);
     }
 
+    std::cout << "Sampled " << verts.size() << " ground truth points" << std::endl;
+
     /* Construct cloud for heuristic evaluation on GPU. */
     cacc::PointCloud<cacc::HOST>::Ptr cloud;
     cloud = cacc::PointCloud<cacc::HOST>::create(verts.size());
@@ -255,12 +605,21 @@ int main(int argc, char **argv) {
     std::vector<float> heuristics(verts.size());
     std::vector<float> observations(verts.size());
 
-    float m_k = 8;
-    float m_x0 =4;
-    float t_k = 32;
-    float t_x0 = 16;
     {
-        configure_heuristic(m_k, m_x0, t_k, t_x0);
+        cacc::VectorArray<cacc::Vec3f, cacc::HOST> obs_rays(*dobs_rays);
+        cacc::VectorArray<cacc::Vec3f, cacc::HOST>::Data const & data = obs_rays.cdata();
+        CHECK(cudaDeviceSynchronize());
+
+        for (std::size_t k = 0; k < data.num_cols; ++k) {
+            observations[k] = data.num_rows_ptr[k];
+        }
+    }
+
+    std::vector<HeuristicParams> params = generate_parameter_sets(args);
+
+    if (params.size() == 1) {
+        HeuristicParams const & p = params[0];
+        configure_heuristic(p[0], p[1], p[2], p[3]);
         CHECK(cudaDeviceSynchronize());
 
         dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE));
@@ -278,21 +637,96 @@ int main(int argc, char **argv) {
                 heuristics[k] = data.data_ptr[k];
             }
         }
-        std::cout << stat::spearmans_rank_correlation(heuristics, errors) << std::endl;
+        double rho = stat::spearmans_rank_correlation(heuristics, errors);
+        std::pair<double, double> ci = confidence_interval(rho, num_verts);
+        std::cout << rho << ' ' << ci.first << ' ' << ci.second << std::endl;
+    } else {
+        /* Observation rays and errors are reused for all parameter sets. */
+        std::vector<double> error_ranks = fractional_ranks(errors.data(), num_verts);
+        std::vector<double> correlations(params.size());
+
+        /* Evaluate as many parameter sets per launch as fit into ~256MB. */
+        std::size_t batch_size = (std::size_t(1) << 26) / num_verts;
+        batch_size = std::max<std::size_t>(1, std::min<std::size_t>(batch_size, 1024));
+        batch_size = std::min(batch_size, params.size());
+
+        cacc::Array<float, cacc::HOST>::Ptr hparams;
+        hparams = cacc::Array<float, cacc::HOST>::create(4 * batch_size);
+        cacc::Array<float, cacc::DEVICE>::Ptr dparams;
+        dparams = cacc::Array<float, cacc::DEVICE>::create(4 * batch_size);
+        cacc::Image<float, cacc::DEVICE>::Ptr dsweep;
+        dsweep = cacc::Image<float, cacc::DEVICE>::create(num_verts, batch_size);
+        cacc::Image<float, cacc::HOST>::Ptr sweep;
+        sweep = cacc::Image<float, cacc::HOST>::create(num_verts, batch_size);
+
+        std::size_t best = 0;
+        for (std::size_t i = 0; i < params.size(); i += batch_size) {
+            std::size_t num_sets = std::min(batch_size, params.size() - i);
+
+            cacc::Array<float, cacc::HOST>::Data const & pdata = hparams->cdata();
+            for (std::size_t j = 0; j < num_sets; ++j) {
+                std::copy(params[i + j].begin(), params[i + j].end(),
+                    pdata.data_ptr + 4 * j);
+            }
+            *dparams = *hparams;
+
+            {
+                dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE), num_sets);
+                dim3 block(KERNEL_BLOCK_SIZE);
+                evaluate_observation_rays<<<grid, block>>>(dobs_rays->cdata(),
+                    dparams->cdata(), dsweep->cdata());
+                CHECK(cudaDeviceSynchronize());
+            }
 
-        {
-            cacc::VectorArray<cacc::Vec3f, cacc::HOST> obs_rays(*dobs_rays);
-            cacc::VectorArray<cacc::Vec3f, cacc::HOST>::Data const & data = obs_rays.cdata();
+            *sweep = *dsweep;
             CHECK(cudaDeviceSynchronize());
-
-            for (std::size_t k = 0; k < data.num_cols; ++k) {
-                observations[k] = data.num_rows_ptr[k];
+            cacc::Image<float, cacc::HOST>::Data const & data = sweep->cdata();
+            int const stride = data.pitch / sizeof(float);
+
+            for (std::size_t j = 0; j < num_sets; ++j) {
+                float const * row = data.data_ptr + j * stride;
+                std::vector<double> ranks = fractional_ranks(row, num_verts);
+                correlations[i + j] = pearsons_correlation(ranks, error_ranks);
+
+                /* The heuristic should correlate negatively with the error. */
+                if (correlations[i + j] < correlations[best] || i + j == 0) {
+                    best = i + j;
+                    std::copy(row, row + num_verts, heuristics.begin());
+                }
             }
         }
 
-        save_numpy_file(heuristics, errors, observations, args.file);
+        std::vector<std::size_t> order(params.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(),
+            [&correlations] (std::size_t l, std::size_t r) -> bool {
+                return correlations[l] < correlations[r];
+            }
+        );
+
+        std::ofstream out;
+        if (!args.table.empty()) {
+            out.open(args.table.c_str());
+            if (!out.good()) {
+                std::cerr << "Could not open table file" << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        std::ostream & os = args.table.empty() ? std::cout : out;
+
+        os << "m_k m_x0 t_k t_x0 rho rho_lo rho_hi" << std::endl;
+        for (std::size_t idx : order) {
+            HeuristicParams const & p = params[idx];
+            std::pair<double, double> ci;
+            ci = confidence_interval(correlations[idx], num_verts);
+            os << p[0] << ' ' << p[1] << ' ' << p[2] << ' ' << p[3] << ' '
+                << correlations[idx] << ' '
+                << ci.first << ' ' << ci.second << std::endl;
+        }
     }
 
+    save_numpy_file(heuristics, errors, observations, args.file);
+
     if (!args.recon_cloud.empty() || !args.obs_cloud.empty()) {
         mve::TriangleMesh::Ptr mesh = mve::TriangleMesh::create();
 
@@ -17,6 +17,7 @@
 
 #include "util/io.h"
 #include "util/cio.h"
+#include "util/async_load.h"
 
 #include "mve/mesh_io_ply.h"
 #include "mve/scene.h"
@@ -98,27 +99,39 @@ int main(int argc, char * argv[])
 {
     Arguments args = parse_args(argc, argv);
 
-    cacc::select_cuda_device(3, 5);
-
-    std::vector<mve::CameraInfo> trajectory;
-    if (util::fs::dir_exists(args.trajectory.c_str())) {
-        load_scene_as_trajectory(args.trajectory, &trajectory);
-    } else if (util::fs::file_exists(args.trajectory.c_str())) {
-        utp::load_trajectory(args.trajectory, &trajectory);
-    } else {
+    std::string path = args.trajectory;
+    if (!util::fs::dir_exists(path.c_str()) && !util::fs::file_exists(path.c_str())) {
         std::cerr << "Could not load trajectory" << std::endl;
         return EXIT_FAILURE;
     }
 
+    /* Load the inputs and construct the BVH concurrently. */
+    AsyncResult<std::vector<mve::CameraInfo> > trajectory_result
+        = load_async("trajectory " + path, [path] {
+            std::vector<mve::CameraInfo> trajectory;
+            if (util::fs::dir_exists(path.c_str())) {
+                for (SceneView const & view : load_scene_views(path)) {
+                    if (view.id >= 0) trajectory.push_back(view.camera);
+                }
+            } else {
+                utp::load_trajectory(path, &trajectory);
+            }
+            return trajectory;
+        });
+    AsyncResult<acc::BVHTree<uint, math::Vec3f>::Ptr> bvh_tree
+        = load_mesh_as_bvh_tree_async(args.proxy_mesh);
+    AsyncResult<mve::TriangleMesh::Ptr> proxy_cloud
+        = load_mesh_async(args.proxy_cloud);
+
+    cacc::select_cuda_device(3, 5);
+
+    std::vector<mve::CameraInfo> trajectory = trajectory_result.get();
+
     cacc::BVHTree<cacc::DEVICE>::Ptr dbvh_tree;
-    {
-        acc::BVHTree<uint, math::Vec3f>::Ptr bvh_tree;
-        bvh_tree = load_mesh_as_bvh_tree(args.proxy_mesh);
-        dbvh_tree = cacc::BVHTree<cacc::DEVICE>::create<uint, math::Vec3f>(bvh_tree);
-    }
+    dbvh_tree = cacc::BVHTree<cacc::DEVICE>::create<uint, math::Vec3f>(bvh_tree.get());
 
     cacc::PointCloud<cacc::HOST>::Ptr cloud;
-    cloud = load_point_cloud(args.proxy_cloud);
+    cloud = load_point_cloud(proxy_cloud.get());
     cacc::PointCloud<cacc::DEVICE>::Ptr dcloud;
     dcloud = cacc::PointCloud<cacc::DEVICE>::create<cacc::HOST>(cloud);
 
@@ -137,9 +150,6 @@ int main(int argc, char * argv[])
 
     int width = 1920;
     int height = 1080;
-    math::Matrix4f w2c;
-    math::Matrix3f calib;
-    math::Vec3f view_pos(0.0f);
 
     std::chrono::time_point<std::chrono::high_resolution_clock> start, end;
 
@@ -151,14 +161,11 @@ int main(int argc, char * argv[])
         dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE));
         dim3 block(KERNEL_BLOCK_SIZE);
 
-        for (mve::CameraInfo const & cam : trajectory) {
-            cam.fill_calibration(calib.begin(), width, height);
-            cam.fill_world_to_cam(w2c.begin());
-            cam.fill_camera_pos(view_pos.begin());
-
+        /* Co-located views (e.g. oblique rigs) share visibility tests. */
+        std::vector<ViewGroup> groups = group_views(trajectory, width, height);
+        for (ViewGroup const & group : groups) {
             update_observation_rays<<<grid, block, 0, stream>>>(
-                true, cacc::Vec3f(view_pos.begin()), args.max_distance,
-                cacc::Mat4f(w2c.begin()), cacc::Mat3f(calib.begin()), width, height,
+                true, group, args.max_distance, width, height,
                 dbvh_tree->accessor(), dcloud->cdata(), dobs_rays->cdata()
             );
         }
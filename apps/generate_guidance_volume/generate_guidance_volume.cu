@@ -14,6 +14,7 @@
 #include "util/system.h"
 #include "util/arguments.h"
 #include "util/file_system.h"
+#include "util/tokenizer.h"
 
 #include "mve/camera.h"
 #include "mve/mesh_io_ply.h"
@@ -30,16 +31,25 @@
 
 #include "util/io.h"
 #include "util/cio.h"
+#include "util/async_load.h"
 #include "util/progress_counter.h"
 #include "util/itos.h"
 
 #include "geom/sphere.h"
 #include "geom/volume_io.h"
+#include "geom/height_map.h"
+#include "geom/direction_summary.h"
 
 #include "eval/kernels.h"
 
 constexpr float lowest = std::numeric_limits<float>::lowest();
 
+struct Camera {
+    float flen;
+    int width;
+    int height;
+};
+
 struct Arguments {
     std::string proxy_mesh;
     std::string proxy_cloud;
@@ -49,6 +59,11 @@ struct Arguments {
     float max_distance;
     float min_altitude;
     float max_altitude;
+    bool scatter;
+    std::vector<Camera> cameras;
+    HistogramResolution hist_res;
+    uint summary;
+    bool summary_only;
 };
 
 Arguments parse_args(int argc, char **argv) {
@@ -57,11 +72,27 @@ Arguments parse_args(int argc, char **argv) {
     args.set_nonopt_minnum(4);
     args.set_nonopt_maxnum(4);
     args.set_usage("Usage: " + std::string(argv[0]) + " [OPTS] PROXY_MESH PROXY_CLOUD AIRSPACE_MESH OUT_VOLUME");
-    args.set_description("TODO");
+    args.set_description("Generates a guidance volume - the best viewing "
+        "directions for each position of the airspace. The spherical histogram "
+        "of each position is populated once and evaluated for all camera "
+        "models in a single pass, with multiple cameras one volume per camera "
+        "is written (OUT_VOLUME with the camera index as suffix).");
     args.add_option('r', "resolution", true, "guidance volume resolution [1.0]");
     args.add_option('\0', "max-distance", true, "maximum distance to surface [80.0]");
     args.add_option('\0', "min-altitude", true, "minimum altitude [0.0]");
     args.add_option('\0', "max-altitude", true, "maximum altitude [100.0]");
+    args.add_option('\0', "scatter", false, "splat the contributions of each "
+        "cloud vertex into the reachable voxels instead of gathering per voxel "
+        "(height map based occlusion) [false]");
+    args.add_option('c', "camera", true, "camera model FLEN[,WIDTH,HEIGHT] "
+        "(can be given multiple times) [0.86,1920,1080]");
+    args.add_option('\0', "histogram-resolution", true, "direction histogram "
+        "resolution and sphere subdivisions of the spherical histogram "
+        "WxH[xS] [128x45x3]");
+    args.add_option('\0', "summary", true, "store the K best directions of "
+        "each position in a summary layer [0]");
+    args.add_option('\0', "summary-only", false, "store the summary layer "
+        "without the direction histograms (requires --summary) [false]");
     args.parse(argc, argv);
 
     Arguments conf;
@@ -73,6 +104,10 @@ Arguments parse_args(int argc, char **argv) {
     conf.max_distance = 80.0f;
     conf.min_altitude = 0.0f;
     conf.max_altitude = 100.0f;
+    conf.scatter = false;
+    conf.hist_res = default_histogram_resolution();
+    conf.summary = 0;
+    conf.summary_only = false;
 
     for (util::ArgResult const* i = args.next_option();
          i != 0; i = args.next_option()) {
@@ -80,6 +115,21 @@ Arguments parse_args(int argc, char **argv) {
         case 'r':
             conf.resolution = i->get_arg<float>();
         break;
+        case 'c':
+        {
+            util::Tokenizer t;
+            t.split(i->arg, ',');
+            if (t.size() != 1 && t.size() != 3) {
+                throw std::invalid_argument("Invalid camera model");
+            }
+            Camera camera = {t.get_as<float>(0), 1920, 1080};
+            if (t.size() == 3) {
+                camera.width = t.get_as<int>(1);
+                camera.height = t.get_as<int>(2);
+            }
+            conf.cameras.push_back(camera);
+        }
+        break;
         case '\0':
             if (i->opt->lopt == "max-distance") {
                 conf.max_distance = i->get_arg<float>();
@@ -87,6 +137,14 @@ Arguments parse_args(int argc, char **argv) {
                 conf.min_altitude = i->get_arg<float>();
             } else if (i->opt->lopt == "max-altitude") {
                 conf.max_altitude = i->get_arg<float>();
+            } else if (i->opt->lopt == "scatter") {
+                conf.scatter = true;
+            } else if (i->opt->lopt == "histogram-resolution") {
+                conf.hist_res = parse_histogram_resolution(i->arg);
+            } else if (i->opt->lopt == "summary") {
+                conf.summary = i->get_arg<uint>();
+            } else if (i->opt->lopt == "summary-only") {
+                conf.summary_only = true;
             } else {
                 throw std::invalid_argument("Invalid option");
             }
@@ -96,35 +154,305 @@ Arguments parse_args(int argc, char **argv) {
         }
     }
 
+    if (conf.cameras.empty()) {
+        conf.cameras.push_back({0.86f, 1920, 1080});
+    }
+
+    if (conf.cameras.size() > MAX_CAMERA_MODELS) {
+        throw std::invalid_argument("Too many camera models");
+    }
+
+    if (conf.summary_only && conf.summary == 0) {
+        throw std::invalid_argument("Summary only without summary");
+    }
+
     return conf;
 }
 
+std::string
+volume_path(std::string const & path, std::size_t idx, std::size_t num_volumes) {
+    if (num_volumes == 1) return path;
+
+    std::size_t pos = path.rfind('.');
+    std::size_t sep = path.rfind('/');
+    if (pos == std::string::npos || (sep != std::string::npos && pos < sep)) {
+        pos = path.size();
+    }
+    return path.substr(0, pos) + "-" + std::to_string(idx) + path.substr(pos);
+}
+
+/* Vertex-centric generation of the volume - the spherical histograms of
+ * consecutive layers are populated by scattering the contributions of all
+ * cloud vertices and then evaluated in batches. */
+void
+scatter_volume(Arguments const & args, mve::FloatImage::ConstPtr hmap,
+    float ground_level, math::Vec3f const & hmin,
+    cacc::PointCloud<cacc::DEVICE>::Ptr dcloud,
+    cacc::KDTree<3u, cacc::DEVICE>::Ptr dkd_tree, uint num_bins,
+    CameraModels const & models,
+    std::vector<math::Vector<std::uint32_t, 3> > const & sample_positions,
+    std::vector<Volume<std::uint32_t>::Ptr> const & volumes)
+{
+    Volume<std::uint32_t>::Ptr volume = volumes.front();
+    int const width = volume->width();
+    int const height = volume->height();
+    int const depth = volume->depth();
+    std::size_t const layer_size = width * height;
+
+    /* Slots of the sampled voxels in layer major order. */
+    std::vector<int> slots(volume->num_positions(), -1);
+    for (math::Vector<std::uint32_t, 3> const & pos : sample_positions) {
+        slots[volume->index(pos)] = 0;
+    }
+    std::vector<int> layer_slots(depth + 1, 0);
+    std::vector<std::uint32_t> slot_voxels;
+    slot_voxels.reserve(sample_positions.size());
+    for (std::size_t i = 0; i < slots.size(); ++i) {
+        if (i % layer_size == 0) layer_slots[i / layer_size] = slot_voxels.size();
+        if (slots[i] < 0) continue;
+        slots[i] = slot_voxels.size();
+        slot_voxels.push_back(i);
+    }
+    layer_slots[depth] = slot_voxels.size();
+
+    cacc::Array<int, cacc::DEVICE>::Ptr dslots;
+    {
+        cacc::Array<int, cacc::HOST>::Ptr hslots;
+        hslots = cacc::Array<int, cacc::HOST>::create(slots.size());
+        std::copy(slots.begin(), slots.end(), hslots->cdata().data_ptr);
+        dslots = cacc::Array<int, cacc::DEVICE>::create(slots.size());
+        *dslots = *hslots;
+    }
+
+    cacc::Image<float, cacc::DEVICE>::Ptr dhmap;
+    {
+        cacc::Image<float, cacc::HOST>::Ptr hhmap;
+        hhmap = cacc::Image<float, cacc::HOST>::create(hmap->width(), hmap->height());
+        cacc::Image<float, cacc::HOST>::Data data = hhmap->cdata();
+        int const stride = data.pitch / sizeof(float);
+        for (int y = 0; y < hmap->height(); ++y) {
+            float const * row = hmap->get_data_pointer() + y * hmap->width();
+            std::copy(row, row + hmap->width(), data.data_ptr + y * stride);
+        }
+        dhmap = cacc::Image<float, cacc::DEVICE>::create(hmap->width(), hmap->height());
+        *dhmap = *hhmap;
+    }
+
+    /* Limit the spherical histograms to ~1GB (at least one layer). */
+    std::size_t max_slots = (std::size_t(1) << 28) / num_bins;
+    for (int z = 0; z < depth; ++z) {
+        max_slots = std::max<std::size_t>(max_slots, layer_slots[z + 1] - layer_slots[z]);
+    }
+    cacc::Array<float, cacc::DEVICE>::Ptr dsphere_hists;
+    dsphere_hists = cacc::Array<float, cacc::DEVICE>::create(max_slots * num_bins);
+
+    int const hist_width = args.hist_res.width;
+    int const hist_height = args.hist_res.height;
+    uint const num_models = models.num_models;
+    /* ~128 * 45 * 1024 direction bins per batch (gridDim.z <= 65535). */
+    uint const batch_size = std::min<std::size_t>(65535u, std::max<std::size_t>(1u,
+        (128u * 45u * 1024u) / (args.hist_res.num_directions() * num_models)));
+    uint const rows = hist_height * batch_size * num_models;
+    cacc::Image<float, cacc::DEVICE>::Ptr dhists;
+    dhists = cacc::Image<float, cacc::DEVICE>::create(hist_width, rows);
+    cacc::Image<float, cacc::HOST>::Ptr hists;
+    hists = cacc::Image<float, cacc::HOST>::create(hist_width, rows);
+
+    math::Vec3f vmin = volume->position(0u, 0u, 0u);
+    math::Vec3f vres = volume->position(1u, 1u, 1u) - vmin;
+    uint num_verts = dcloud->cdata().num_vertices;
+
+    std::string task = fmt::format("Scattering {} vertices into {} positions",
+        litos(num_verts), litos(slot_voxels.size()));
+    ProgressCounter counter(task, depth);
+
+    for (int z0 = 0, z1 = 0; z0 < depth; z0 = z1) {
+        while (z1 < depth && std::size_t(layer_slots[z1 + 1] - layer_slots[z0]) <= max_slots) {
+            z1 += 1;
+        }
+
+        int first_slot = layer_slots[z0];
+        int num_slots = layer_slots[z1] - first_slot;
+
+        dsphere_hists->null();
+        for (int z = z0; z < z1; ++z) {
+            counter.progress<ETA>();
+
+            if (layer_slots[z + 1] != layer_slots[z]) {
+                cacc::Array<int, cacc::DEVICE>::Data layer = dslots->cdata();
+                layer.data_ptr += z * layer_size;
+
+                dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE));
+                dim3 block(KERNEL_BLOCK_SIZE);
+                scatter_spherical_histograms<<<grid, block>>>(
+                    args.max_distance, cacc::Vec3f(vmin.begin()),
+                    cacc::Vec3f(vres.begin()), width, height, z,
+                    layer, first_slot, dhmap->cdata(),
+                    cacc::Vec2f(hmin[0], hmin[1]), args.resolution, ground_level,
+                    dcloud->cdata(), dkd_tree->accessor(), dsphere_hists->cdata());
+                CHECK(cudaDeviceSynchronize());
+            }
+
+            counter.inc();
+        }
+
+        for (int i = 0; i < num_slots; i += batch_size) {
+            uint n = std::min<uint>(batch_size, num_slots - i);
+
+            cacc::Array<float, cacc::DEVICE>::Data sphere_hists = dsphere_hists->cdata();
+            sphere_hists.data_ptr += i * num_bins;
+
+            dim3 grid(cacc::divup(hist_width, KERNEL_BLOCK_SIZE), hist_height, n);
+            dim3 block(KERNEL_BLOCK_SIZE);
+            evaluate_spherical_histograms<<<grid, block>>>(models,
+                dkd_tree->accessor(), sphere_hists, hist_height, dhists->cdata());
+            CHECK(cudaDeviceSynchronize());
+
+            *hists = *dhists;
+            cacc::Image<float, cacc::HOST>::Data data = hists->cdata();
+            int const stride = data.pitch / sizeof(float);
+
+            for (uint j = 0; j < n; ++j) {
+                for (uint k = 0; k < num_models; ++k) {
+                    mve::FloatImage::Ptr image =
+                        mve::FloatImage::create(hist_width, hist_height, 1);
+                    for (int y = 0; y < hist_height; ++y) {
+                        uint r = (j * num_models + k) * hist_height + y;
+                        float const * row = data.data_ptr + r * stride;
+                        std::copy(row, row + hist_width,
+                            image->get_data_pointer() + y * hist_width);
+                    }
+                    volumes[k]->at(slot_voxels[first_slot + i + j]) = image;
+                }
+            }
+        }
+    }
+}
+
+/* Position-centric generation of the volume - the spherical histogram of
+ * each position is populated by gathering the contributions of all cloud
+ * vertices (ray traced occlusion) and evaluated for all camera models. */
+void
+gather_volume(Arguments const & args, int device,
+    cacc::BVHTree<cacc::DEVICE>::Ptr dbvh_tree,
+    cacc::PointCloud<cacc::DEVICE>::Ptr dcloud,
+    cacc::KDTree<3u, cacc::DEVICE>::Ptr dkd_tree, uint num_verts,
+    CameraModels const & models,
+    std::vector<math::Vector<std::uint32_t, 3> > const & sample_positions,
+    std::vector<Volume<std::uint32_t>::Ptr> const & volumes)
+{
+    int const hist_width = args.hist_res.width;
+    int const hist_height = args.hist_res.height;
+    uint const num_models = models.num_models;
+
+    std::size_t num_samples = sample_positions.size() * args.hist_res.num_directions();
+
+    std::string task = fmt::format("Sampling 5D volume at {} positions", litos(num_samples));
+    ProgressCounter counter(task, sample_positions.size());
+
+    #pragma omp parallel
+    {
+        cacc::set_cuda_device(device);
+
+        cudaStream_t stream;
+        cudaStreamCreate(&stream);
+
+        cacc::Array<float, cacc::DEVICE>::Ptr dobs_hist;
+        dobs_hist = cacc::Array<float, cacc::DEVICE>::create(num_verts, stream);
+
+        cacc::Image<float, cacc::DEVICE>::Ptr dhist;
+        dhist = cacc::Image<float, cacc::DEVICE>::create(hist_width,
+            hist_height * num_models, stream);
+        cacc::Image<float, cacc::HOST>::Ptr hist;
+        hist = cacc::Image<float, cacc::HOST>::create(hist_width,
+            hist_height * num_models, stream);
+
+        #pragma omp for schedule(dynamic)
+        for (std::size_t i = 0; i < sample_positions.size(); ++i) {
+            counter.progress<ETA>();
+
+            dobs_hist->null();
+            {
+                dim3 grid(cacc::divup(dcloud->cdata().num_vertices, KERNEL_BLOCK_SIZE));
+                dim3 block(KERNEL_BLOCK_SIZE);
+                populate_spherical_histogram<<<grid, block, 0, stream>>>(
+                    cacc::Vec3f(volumes.front()->position(sample_positions[i]).begin()),
+                    args.max_distance, dbvh_tree->accessor(), dcloud->cdata(),
+                    dkd_tree->accessor(), dobs_hist->cdata());
+            }
+
+            {
+                dim3 grid(cacc::divup(hist_width, KERNEL_BLOCK_SIZE), hist_height);
+                dim3 block(KERNEL_BLOCK_SIZE);
+                evaluate_spherical_histograms<<<grid, block, 0, stream>>>(
+                    models, dkd_tree->accessor(), dobs_hist->cdata(), hist_height,
+                    dhist->cdata());
+            }
+
+            *hist = *dhist;
+            cacc::Image<float, cacc::HOST>::Data data = hist->cdata();
+
+            hist->sync();
+
+            int const stride = data.pitch / sizeof(float);
+            for (uint j = 0; j < num_models; ++j) {
+                mve::FloatImage::Ptr image =
+                    mve::FloatImage::create(hist_width, hist_height, 1);
+                for (int y = 0; y < hist_height; ++y) {
+                    float const * row = data.data_ptr + (j * hist_height + y) * stride;
+                    std::copy(row, row + hist_width,
+                        image->get_data_pointer() + y * hist_width);
+                }
+                volumes[j]->at(sample_positions[i]) = image;
+            }
+
+            counter.inc();
+        }
+        cudaStreamDestroy(stream);
+    }
+}
+
+/* Best value of each camera model averaged over all positions and the
+ * number of positions at which the model performs best. */
+void
+print_camera_summary(Arguments const & args,
+    std::vector<math::Vector<std::uint32_t, 3> > const & sample_positions,
+    std::vector<Volume<std::uint32_t>::Ptr> const & volumes)
+{
+    std::vector<double> averages;
+    std::vector<std::size_t> wins;
+    compare_volumes<std::uint32_t>(volumes, sample_positions, &averages, &wins);
+
+    for (std::size_t j = 0; j < volumes.size(); ++j) {
+        Camera const & camera = args.cameras[j];
+        std::cout << "Camera " << j << " (" << camera.flen << ", "
+            << camera.width << "x" << camera.height << "): average best value "
+            << averages[j] << ", best at " << wins[j]
+            << " positions" << std::endl;
+    }
+}
+
 int main(int argc, char **argv) {
     util::system::register_segfault_handler();
     util::system::print_build_timestamp(argv[0]);
 
     Arguments args = parse_args(argc, argv);
 
+    /* Load the inputs and construct the BVH concurrently - the height map
+     * is created while the proxy mesh and cloud are pending. */
+    AsyncResult<acc::BVHTree<uint, math::Vec3f>::Ptr> proxy_bvh_tree
+        = load_mesh_as_bvh_tree_async(args.proxy_mesh);
+    AsyncResult<mve::TriangleMesh::Ptr> proxy_cloud
+        = load_mesh_async(args.proxy_cloud);
+    AsyncResult<mve::TriangleMesh::Ptr> airspace
+        = load_mesh_async(args.airspace_mesh);
+
     int device = cacc::select_cuda_device(3, 5);
 
-    cacc::BVHTree<cacc::DEVICE>::Ptr dbvh_tree;
-    {
-        acc::BVHTree<uint, math::Vec3f>::Ptr bvh_tree;
-        bvh_tree = load_mesh_as_bvh_tree(args.proxy_mesh);
-        dbvh_tree = cacc::BVHTree<cacc::DEVICE>::create<uint, math::Vec3f>(bvh_tree);
-    }
-
-    mve::TriangleMesh::Ptr mesh;
-    try {
-        mesh = mve::geom::load_ply_mesh(args.airspace_mesh);
-    } catch (std::exception& e) {
-        std::cerr << "\tCould not load mesh: " << e.what() << std::endl;
-        std::exit(EXIT_FAILURE);
-    }
+    mve::TriangleMesh::Ptr mesh = airspace.get();
 
     std::vector<math::Vec3f> const & verts = mesh->get_vertices();
 
-    //TODO merge with proxy mesh generation code
     acc::AABB<math::Vec3f> aabb = acc::calculate_aabb(verts);
 
     assert(acc::valid(aabb) && acc::volume(aabb) > 0.0f);
@@ -136,40 +464,34 @@ int main(int argc, char **argv) {
     std::cout << width << "x" << height << "x" << depth << std::endl;
 
     /* Create height map. */
-    mve::FloatImage::Ptr hmap = mve::FloatImage::create(width, height, 1);
-    hmap->fill(lowest);
-    for (std::size_t i = 0; i < verts.size(); ++i) {
-        math::Vec3f vertex = verts[i];
-        int x = (vertex[0] - aabb.min[0]) / args.resolution;
-        assert(0 <= x && x < width);
-        int y = (vertex[1] - aabb.min[1]) / args.resolution;
-        assert(0 <= y && y < height);
-        float height = vertex[2];
-        float z = hmap->at(x, y, 0);
-        if (z > height) continue;
-
-        hmap->at(x, y, 0) = height;
-    }
+    mve::FloatImage::Ptr hmap = create_height_map(verts, aabb.min,
+        args.resolution, width, height);
 
     /* Estimate ground level and normalize height map */
-    float ground_level = std::numeric_limits<float>::max();
-    #pragma omp parallel for reduction(min:ground_level)
-    for (int i = 0; i < hmap->get_value_amount(); ++i) {
-        float height = hmap->at(i);
-        if (height != lowest && height < ground_level) {
-            ground_level = height;
-        }
-    }
+    float ground_level = estimate_ground_level(hmap);
 
     #pragma omp parallel for
     for (int i = 0; i < hmap->get_value_amount(); ++i) {
         float height = hmap->at(i);
         hmap->at(i) = (height != lowest) ? height - ground_level : 0.0f;
     }
-    //ODOT merge with proxy mesh generation code
 
-    Volume<std::uint32_t>::Ptr volume;
-    volume = Volume<std::uint32_t>::create(width, height, depth, aabb.min, aabb.max);
+    CameraModels models;
+    models.num_models = 0;
+    for (Camera const & camera : args.cameras) {
+        mve::CameraInfo cam;
+        cam.flen = camera.flen;
+        models.models[models.num_models++] =
+            camera_model(cam, camera.width, camera.height);
+    }
+
+    std::vector<Volume<std::uint32_t>::Ptr> volumes(models.num_models);
+    for (std::size_t i = 0; i < volumes.size(); ++i) {
+        volumes[i] = Volume<std::uint32_t>::create(width, height, depth,
+            aabb.min, aabb.max);
+        store_histogram_resolution(args.hist_res, &volumes[i]->metadata());
+    }
+    Volume<std::uint32_t>::Ptr volume = volumes.front();
     std::vector<math::Vector<std::uint32_t, 3> > sample_positions;
     sample_positions.reserve(volume->num_positions());
 
@@ -194,87 +516,51 @@ int main(int argc, char **argv) {
     uint num_verts;
     cacc::KDTree<3u, cacc::DEVICE>::Ptr dkd_tree;
     {
-        mve::TriangleMesh::Ptr sphere = generate_sphere_mesh(1.0f, 3u);
+        mve::TriangleMesh::Ptr sphere = generate_sphere_mesh(1.0f,
+            args.hist_res.sphere_subdivisions);
         std::vector<math::Vec3f> const & verts = sphere->get_vertices();
         num_verts = verts.size();
         acc::KDTree<3u, uint>::Ptr kd_tree = acc::KDTree<3, uint>::create(verts);
         dkd_tree = cacc::KDTree<3u, cacc::DEVICE>::create<uint>(kd_tree);
     }
 
+    HistogramResolution const & res = args.hist_res;
+    std::cout << "Histograms: " << res.width << "x" << res.height
+        << " directions, " << num_verts << " sphere bins ("
+        << sample_positions.size() * res.num_directions() * sizeof(float) / (1 << 20)
+        << "MB per volume)" << std::endl;
+
+    cacc::BVHTree<cacc::DEVICE>::Ptr dbvh_tree;
+    dbvh_tree = cacc::BVHTree<cacc::DEVICE>::create<uint, math::Vec3f>(
+        proxy_bvh_tree.get());
+
     cacc::PointCloud<cacc::DEVICE>::Ptr dcloud;
     {
         cacc::PointCloud<cacc::HOST>::Ptr cloud;
-        cloud = load_point_cloud(args.proxy_cloud);
+        cloud = load_point_cloud(proxy_cloud.get());
         dcloud = cacc::PointCloud<cacc::DEVICE>::create<cacc::HOST>(cloud);
     }
 
-    mve::CameraInfo cam;
-    cam.flen = 0.86f;
-    math::Matrix3f calib;
-
-    std::size_t num_samples = sample_positions.size() * 128ull * 45ull;
-
-    std::string task = fmt::format("Sampling 5D volume at {} positions", litos(num_samples));
-    ProgressCounter counter(task, sample_positions.size());
-
-    #pragma omp parallel
-    {
-        cacc::set_cuda_device(device);
-
-        cudaStream_t stream;
-        cudaStreamCreate(&stream);
-
-        int width = 1920;
-        int height = 1080;
-        cam.fill_calibration(calib.begin(), width, height);
-
-        cacc::Array<float, cacc::DEVICE>::Ptr dobs_hist;
-        dobs_hist = cacc::Array<float, cacc::DEVICE>::create(num_verts, stream);
-
-        cacc::Image<float, cacc::DEVICE>::Ptr dhist;
-        dhist = cacc::Image<float, cacc::DEVICE>::create(128, 45, stream);
-        cacc::Image<float, cacc::HOST>::Ptr hist;
-        hist = cacc::Image<float, cacc::HOST>::create(128, 45, stream);
-
-        #pragma omp for schedule(dynamic)
-        for (std::size_t i = 0; i < sample_positions.size(); ++i) {
-            counter.progress<ETA>();
-
-            dobs_hist->null();
-            {
-                dim3 grid(cacc::divup(dcloud->cdata().num_vertices, KERNEL_BLOCK_SIZE));
-                dim3 block(KERNEL_BLOCK_SIZE);
-                populate_spherical_histogram<<<grid, block, 0, stream>>>(
-                    cacc::Vec3f(volume->position(sample_positions[i]).begin()),
-                    args.max_distance, dbvh_tree->accessor(), dcloud->cdata(),
-                    dkd_tree->accessor(), dobs_hist->cdata());
-            }
-
-            {
-                dim3 grid(cacc::divup(128, KERNEL_BLOCK_SIZE), 45);
-                dim3 block(KERNEL_BLOCK_SIZE);
-                evaluate_spherical_histogram<<<grid, block, 0, stream>>>(
-                    cacc::Mat3f(calib.begin()), width, height,
-                    dkd_tree->accessor(), dobs_hist->cdata(), dhist->cdata());
-            }
-
-            *hist = *dhist;
-            cacc::Image<float, cacc::HOST>::Data data = hist->cdata();
-
-            hist->sync();
+    if (args.scatter) {
+        scatter_volume(args, hmap, ground_level, aabb.min, dcloud, dkd_tree,
+            num_verts, models, sample_positions, volumes);
+    } else {
+        gather_volume(args, device, dbvh_tree, dcloud, dkd_tree, num_verts,
+            models, sample_positions, volumes);
+    }
 
-            mve::FloatImage::Ptr image = mve::FloatImage::create(128, 45, 1);
-            float const * begin = data.data_ptr;
-            float const * end = data.data_ptr + data.width * data.height;
-            std::copy(begin, end, image->get_data_pointer());
-            volume->at(sample_positions[i]) = image;
+    if (volumes.size() > 1) {
+        print_camera_summary(args, sample_positions, volumes);
+    }
 
-            counter.inc();
+    for (std::size_t i = 0; i < volumes.size(); ++i) {
+        if (args.summary != 0) {
+            summarize_volume<std::uint32_t>(volumes[i], args.summary);
         }
-        cudaStreamDestroy(stream);
+        save_volume<std::uint32_t>(volumes[i],
+            volume_path(args.ovolume, i, volumes.size()), !args.summary_only);
     }
 
-    save_volume<std::uint32_t>(volume, args.ovolume);
-
     return EXIT_SUCCESS;
 }
+
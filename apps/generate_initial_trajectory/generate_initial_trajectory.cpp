@@ -13,6 +13,7 @@
 #include "util/arguments.h"
 
 #include "geom/volume_io.h"
+#include "geom/direction_summary.h"
 
 #include "utp/trajectory_io.h"
 
@@ -67,8 +68,6 @@ Arguments parse_args(int argc, char **argv) {
     return conf;
 }
 
-float const pi = std::acos(-1.0f);
-
 int main(int argc, char **argv) {
     util::system::register_segfault_handler();
     util::system::print_build_timestamp(argv[0]);
@@ -77,7 +76,7 @@ int main(int argc, char **argv) {
 
     Volume<std::uint32_t>::Ptr volume;
     try {
-        volume = load_volume<std::uint32_t>(args.guidance_volume);
+        volume = load_volume<std::uint32_t>(args.guidance_volume, true);
     } catch (std::exception& e) {
         std::cerr << "Could not load volume: " << e.what() << std::endl;
         std::exit(EXIT_FAILURE);
@@ -92,20 +91,12 @@ int main(int argc, char **argv) {
     std::uniform_int_distribution<std::uint32_t> dist(0, volume->num_positions() - 1);
     while (trajectory.size() < args.num_views) {
         std::uint32_t idx = dist(gen);
-        mve::FloatImage::Ptr image = volume->at(idx);
-        if (image == nullptr) continue;
-
         std::uniform_real_distribution<float> rdis(0.0f, 1.0f);
-        std::uniform_int_distribution<int> idis(0, image->get_value_amount() - 1);
-
-        int i = idis(gen);
-        if(image->at(i) < rdis(gen)) continue;
 
-        int x = i % image->width();
-        int y = i / image->width();
-
-        float theta = (0.5f + (y / (float) image->height()) / 2.0f) * pi;
-        float phi = (x / (float) image->width()) * 2.0f * pi;
+        float theta, phi;
+        if (!sample_direction<std::uint32_t>(volume, idx, &gen, &theta, &phi)) {
+            continue;
+        }
 
         math::Matrix3f rot = utp::rotation_from_spherical(theta, phi);
 
@@ -4,8 +4,10 @@ project "generate_initial_trajectory"
     kind "ConsoleApp"
     language "C++"
 
+    buildoptions { "-fopenmp" }
+
     files { "generate_initial_trajectory.cpp" }
 
     mve.use({ "util" })
 
-    links { "utp" }
+    links { "gomp", "utp" }
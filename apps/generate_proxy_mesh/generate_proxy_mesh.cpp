@@ -23,9 +23,11 @@
 #include "fssr/iso_surface.h"
 #include "fssr/mesh_clean.h"
 
-#include "acc/kd_tree.h"
 #include "acc/primitives.h"
 
+#include "geom/point_grid.h"
+#include "geom/height_map.h"
+
 constexpr float lowest = std::numeric_limits<float>::lowest();
 
 struct Arguments {
@@ -35,6 +37,7 @@ struct Arguments {
     std::string scloud;
     float resolution;
     float min_distance;
+    bool direct;
 };
 
 Arguments parse_args(int argc, char **argv) {
@@ -50,6 +53,8 @@ Arguments parse_args(int argc, char **argv) {
     args.add_option('h', "height-map", true, "save height map as pfm file");
     args.add_option('s', "sample-cloud", true, "save sample mesh as ply file");
     args.add_option('m', "min-distance", true, "minimum distance from original samples [0.0]");
+    args.add_option('d', "direct", false, "triangulate height map directly "
+        "instead of surface reconstruction (closed surface with skirt and base)");
     args.parse(argc, argv);
 
     Arguments conf;
@@ -57,6 +62,7 @@ Arguments parse_args(int argc, char **argv) {
     conf.mesh = args.get_nth_nonopt(1);
     conf.resolution = -1.0f;
     conf.min_distance = 0.0f;
+    conf.direct = false;
 
     for (util::ArgResult const* i = args.next_option();
          i != 0; i = args.next_option()) {
@@ -73,6 +79,9 @@ Arguments parse_args(int argc, char **argv) {
         case 's':
             conf.scloud = i->arg;
         break;
+        case 'd':
+            conf.direct = true;
+        break;
         default:
             throw std::invalid_argument("Invalid option");
         }
@@ -96,32 +105,6 @@ patch(mve::FloatImage::Ptr img, int x, int y, float (*ptr)[N][N]) {
     }
 }
 
-template <int N>
-void filter_median(mve::FloatImage::Ptr hmap, float boundary) {
-    constexpr int n = N * N;
-
-    int width = hmap->width();
-    int height = hmap->height();
-    mve::FloatImage::Ptr tmp = mve::FloatImage::create(width, height, 1);
-
-    #pragma omp parallel for
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            if (y < (N / 2) || y >= height - (N / 2) || x < (N / 2) || x >= width - (N / 2)) {
-                tmp->at(x, y, 0) = boundary;
-            } else {
-                float heights[n];
-                patch(hmap, x, y, (float (*)[N][N])&heights);
-                std::nth_element(heights, heights + (n / 2), heights + n);
-                tmp->at(x, y, 0) = heights[n / 2];
-            }
-        }
-    }
-
-    //std::swap(*hmap, *tmp);
-    hmap->swap(*tmp);
-}
-
 template <int N>
 void filter_nth_lowest(mve::FloatImage::Ptr hmap, int idx, float boundary) {
     constexpr int n = N * N;
@@ -151,16 +134,26 @@ void filter_nth_lowest(mve::FloatImage::Ptr hmap, int idx, float boundary) {
 
 float
 median_distance_of_nth_nn(std::vector<math::Vec3f> const & verts,
-    acc::KDTree<3, unsigned> const & kd_tree, std::size_t n)
+    PointGrid<unsigned> const & grid, std::size_t n)
 {
     assert(verts.size() > n);
 
     std::vector<float> dists(verts.size());
-    #pragma omp parallel for
-    for (std::size_t i = 0; i < verts.size(); ++i) {
-        std::vector<std::pair<unsigned, float> > nns;
-        kd_tree.find_nns(verts[i], n, &nns);
-        dists[i] = nns[n - 1].second;
+
+    /* Query in batches to bound the size of the result arrays. */
+    std::size_t const batch_size = 1 << 22;
+    std::vector<math::Vec3f> batch;
+    std::vector<unsigned> nn_ids;
+    std::vector<float> nn_dists;
+    for (std::size_t i = 0; i < verts.size(); i += batch_size) {
+        std::size_t end = std::min(i + batch_size, verts.size());
+        batch.assign(verts.begin() + i, verts.begin() + end);
+        grid.find_nns(batch, n, &nn_ids, &nn_dists);
+
+        #pragma omp parallel for
+        for (std::size_t j = 0; j < batch.size(); ++j) {
+            dists[i + j] = nn_dists[j * n + n - 1];
+        }
     }
 
     //std::ofstream out("/tmp/dists");
@@ -196,7 +189,7 @@ int main(int argc, char **argv) {
 
     assert(acc::valid(aabb) && acc::volume(aabb) > 0.0f);
 
-    acc::KDTree<3, unsigned> kd_tree(verts);
+    PointGrid<unsigned> grid(verts);
     if (args.resolution <= 0.0f) {
         float density;
         if (cloud->has_vertex_values()) {
@@ -207,7 +200,7 @@ int main(int argc, char **argv) {
             density = (*nth / 2.5f);
         } else {
             std::cout << "Estimating point cloud density... " << std::flush;
-            density = median_distance_of_nth_nn(verts, kd_tree, 5);
+            density = median_distance_of_nth_nn(verts, grid, 5);
             std::cout << "done." << std::endl;
         }
         args.resolution = 2.0f * density;
@@ -221,75 +214,19 @@ int main(int argc, char **argv) {
     bool check_confs = cloud->has_vertex_confidences() && args.min_distance == 0.0f;
 
     /* Create height map. */
-    mve::FloatImage::Ptr hmap = mve::FloatImage::create(width, height, 1);
-    hmap->fill(lowest);
-    for (std::size_t i = 0; i < verts.size(); ++i) {
-        if (check_confs && confs[i] == 0.0f) continue;
-
-        math::Vec3f vertex = verts[i];
-        int x = (vertex[0] - aabb.min[0]) / args.resolution;
-        assert(0 <= x && x < width);
-        int y = (vertex[1] - aabb.min[1]) / args.resolution;
-        assert(0 <= y && y < height);
-        float height = vertex[2];
-        float z = hmap->at(x, y, 0);
-        if (z > height) continue;
-
-        hmap->at(x, y, 0) = height;
-    }
+    mve::FloatImage::Ptr hmap = create_height_map(verts, aabb.min,
+        args.resolution, width, height, check_confs ? &confs : nullptr);
 
     if (args.min_distance == 0.0f) {
         /* Use median filter to eliminate outliers. */
-        filter_median<3>(hmap, lowest);
+        median_filter(hmap, lowest);
     }
 
     /* Fill holes within the height map. */
-    bool holes = true;
-    int hole_filling_iters = 20;
-    while (holes && 0 < hole_filling_iters--) {
-        holes = false;
-
-        mve::FloatImage::Ptr tmp = mve::FloatImage::create(width, height, 1);
-
-        #pragma omp parallel for schedule(dynamic)
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                if (y == 0 || y == height - 1 || x == 0 || x == width - 1) {
-                    tmp->at(x, y, 0) = lowest;
-                } else if (hmap->at(x, y, 0) != lowest) {
-                    tmp->at(x, y, 0) = hmap->at(x, y, 0);
-                } else {
-                    float heights[9];
-                    patch(hmap, x, y, (float (*)[3][3])&heights);
-
-                    float * end = std::remove(heights, heights + 9, lowest);
-
-                    int n = std::distance(heights, end);
-
-                    if (n >= 3) {
-                        std::sort(heights, end);
-                        tmp->at(x, y, 0) = heights[n / 2];
-                    } else {
-                        tmp->at(x, y, 0) = lowest;
-                        holes = true;
-                    }
-                }
-            }
-        }
-
-        //std::swap(*hmap, *tmp);
-        hmap->swap(*tmp);
-    }
+    fill_holes(hmap, 20);
 
     /* Estimate ground level and normalize height map */
-    float ground_level = std::numeric_limits<float>::max();
-    #pragma omp parallel for reduction(min:ground_level)
-    for (int i = 0; i < hmap->get_value_amount(); ++i) {
-        float height = hmap->at(i);
-        if (height != lowest && height < ground_level) {
-            ground_level = height;
-        }
-    }
+    float ground_level = estimate_ground_level(hmap);
 
     std::size_t num_valid = 0;
     #pragma omp parallel for reduction(+:num_valid)
@@ -357,6 +294,48 @@ int main(int argc, char **argv) {
         mve::image::save_pfm_file(hmap, args.hmap);
     }
 
+    if (args.direct) {
+        /* Same discontinuity threshold as for the artificial wall samples. */
+        mve::TriangleMesh::Ptr mesh = triangulate_height_map(hmap, aabb.min,
+            args.resolution, ground_level, 1.5f * args.resolution,
+            0.1f * args.resolution);
+
+        std::vector<math::Vec3f> const & mverts = mesh->get_vertices();
+        std::vector<math::Vec4f> & mcolors = mesh->get_vertex_colors();
+        mcolors.resize(mverts.size());
+
+        std::vector<unsigned> nn_ids;
+        std::vector<float> nn_dists;
+        std::vector<std::uint32_t> nn_counts;
+        grid.find_nns(mverts, 3, &nn_ids, &nn_dists, &nn_counts, args.resolution);
+
+        #pragma omp parallel for
+        for (std::size_t i = 0; i < mverts.size(); ++i) {
+            mcolors[i] = math::Vec4f(0.415f, 0.353f, 0.80f, 1.0f);
+            if (nn_counts[i] == 0 || colors.empty()) continue;
+
+            math::Vec4f color(0.0f);
+            float norm = 0.0f;
+            for (std::size_t n = 0; n < nn_counts[i]; ++n) {
+                float weight = 1.0f - nn_dists[i * 3 + n] / args.resolution;
+                color += weight * colors[nn_ids[i * 3 + n]];
+                norm += weight;
+            }
+            if (norm > 0.0f) mcolors[i] = color / norm;
+        }
+
+        mesh->recalc_normals(false, true);
+
+        std::cout << fmt::format("Triangulated height map ({} vertices, {} faces)",
+            mverts.size(), mesh->get_faces().size() / 3) << std::endl;
+
+        mve::geom::SavePLYOptions opts;
+        opts.write_vertex_normals = true;
+        mve::geom::save_ply_mesh(mesh, args.mesh, opts);
+
+        return EXIT_SUCCESS;
+    }
+
     fssr::IsoOctree octree;
 
     mve::TriangleMesh::Ptr scloud = mve::TriangleMesh::create();
@@ -438,6 +417,12 @@ int main(int argc, char **argv) {
         mve::geom::save_ply_mesh(scloud, args.scloud, opts);
     }
 
+    /* Transfer colors of the three nearest original samples. */
+    std::vector<unsigned> nn_ids;
+    std::vector<float> nn_dists;
+    std::vector<std::uint32_t> nn_counts;
+    grid.find_nns(sverts, 3, &nn_ids, &nn_dists, &nn_counts, args.resolution);
+
     for (std::size_t i = 0; i < sverts.size(); ++i) {
         fssr::Sample sample;
         sample.pos = sverts[i];
@@ -445,14 +430,12 @@ int main(int argc, char **argv) {
         /* Set scale according to fssr scale (radius of patch). */
         sample.scale = args.resolution * 1.25f;
         sample.confidence = 1.0f;
-        std::vector<std::pair<uint, float> > nns;
-        kd_tree.find_nns(sverts[i], 3, &nns, args.resolution);
-        if (!nns.empty()) {
+        if (nn_counts[i] != 0) {
             math::Vec3f color(0.0f);
             float norm = 0.0f;
-            for (std::size_t n = 0; n < nns.size(); ++n) {
-                float weight = 1.0f - nns[n].second / args.resolution;
-                color += weight * math::Vec3f(colors[nns[n].first].begin());
+            for (std::size_t n = 0; n < nn_counts[i]; ++n) {
+                float weight = 1.0f - nn_dists[i * 3 + n] / args.resolution;
+                color += weight * math::Vec3f(colors[nn_ids[i * 3 + n]].begin());
                 norm += weight;
             }
             sample.color = color / norm;
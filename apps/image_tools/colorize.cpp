@@ -14,6 +14,7 @@
 #include "col/mpl_viridis.h"
 #include "col/dcm_coolwarm.h"
 #include "util/choices.h"
+#include "util/colormap.h"
 
 enum ColorMap {
     VIRIDIS = 0,
@@ -108,19 +109,8 @@ int main(int argc, char **argv) {
         float value = in_image->at(i);
 
         math::Vec3f color(args.ccolor);
-        if (0.0f <= value && value <= 1.0f) {
-            std::uint8_t lidx = std::floor(value * 255.0f);
-            float t = value * 255.0f - lidx;
-            std::uint8_t hidx = lidx == 255 ? 255 : lidx + 1;
-
-            math::Vec3f lc(colormap[lidx]);
-            math::Vec3f hc(colormap[hidx]);
-            for (int j = 0; j < 3; ++j) {
-                out_image->at(i, j) = (1.0f - t) * lc[j] + t * hc[j];
-            }
-        } else {
-            std::copy(color.begin(), color.end(), &out_image->at(i, 0));
-        }
+        colormap_lookup(colormap, value, &color);
+        std::copy(color.begin(), color.end(), &out_image->at(i, 0));
     }
 
     mve::image::save_pfm_file(out_image, args.out_image);
@@ -6,19 +6,41 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <cmath>
 #include <iostream>
 #include <vector>
 #include <unordered_map>
 #include <algorithm>
 
+#include "math/vector.h"
+
 #include "mve/image_io.h"
 
 #include "util/arguments.h"
 #include "util/file_system.h"
 #include "util/tokenizer.h"
+#include "util/choices.h"
+#include "util/batch_normalize.h"
+#include "util/colormap.h"
+
+#include "col/mpl_viridis.h"
+#include "col/dcm_coolwarm.h"
+
+enum ColorMap {
+    NONE = 0,
+    VIRIDIS = 1,
+    COOLWARM = 2
+};
+
+template <> inline
+const std::vector<std::string> choice_strings<ColorMap>() {
+    return {"none", "viridis", "coolwarm"};
+}
 
 struct Arguments {
     bool clamp;
+    bool batch;
+    ColorMap colormap;
     std::string in_image;
     std::string out_image;
     float min;
@@ -34,7 +56,14 @@ Arguments parse_args(int argc, char **argv) {
     args.set_nonopt_maxnum(2);
     args.set_nonopt_minnum(2);
     args.set_usage("Usage: " + std::string(argv[0]) + " [OPTS] IN_IMAGE OUT_IMAGE");
-    args.set_description("Normalizes the pixel values.");
+    args.set_description("Normalizes the pixel values. In batch mode IN_IMAGE "
+        "is a list of images (comma separated, @FILE with one path per line or "
+        "a glob pattern) and OUT_IMAGE a directory - the range is estimated "
+        "once over all images (approximate quantiles) and all images are "
+        "normalized in parallel.");
+    args.add_option('b', "batch", false, "batch mode");
+    args.add_option('m', "colormap", true, "colorize normalized images (batch mode) "
+        + choices<ColorMap>(NONE));
     args.add_option('c', "clamp", false, "clamp (instead of remove) outliers");
     args.add_option('e', "epsilon", true, "remove outliers in percent [0.0]");
     args.add_option('i', "ignore", true, "set value to ignore [-1.0]");
@@ -51,6 +80,8 @@ Arguments parse_args(int argc, char **argv) {
     conf.max = std::numeric_limits<float>::max();
     conf.eps = 0.0f;
     conf.clamp = false;
+    conf.batch = false;
+    conf.colormap = NONE;
     conf.no_value = -1.0f;
 
     for (util::ArgResult const* i = args.next_option();
@@ -62,6 +93,12 @@ Arguments parse_args(int argc, char **argv) {
         case 'c':
             conf.clamp = true;
         break;
+        case 'b':
+            conf.batch = true;
+        break;
+        case 'm':
+            conf.colormap = parse_choice<ColorMap>(i->arg);
+        break;
         case 'i':
             conf.no_value = i->get_arg<float>();
         break;
@@ -91,16 +128,99 @@ Arguments parse_args(int argc, char **argv) {
         throw std::invalid_argument("minimum has to be smaller that maximum");
     }
 
-    if (conf.images.empty()) {
+    if (conf.images.empty() && !conf.batch) {
         conf.images.push_back(conf.in_image);
     }
 
     return conf;
 }
 
+int
+normalize(mve::FloatImage::Ptr image, float min, float max, Arguments const & args) {
+    float delta = max - min;
+    int num_outliers = 0;
+    for (int i = 0; i < image->get_value_amount(); ++i) {
+        float value = image->at(i);
+
+        if (value == args.no_value) continue;
+
+        if (value >= min) {
+            if(value <= max) {
+                image->at(i) = ((value - min) / delta);
+            } else {
+                image->at(i) = args.clamp ? 1.0f : args.no_value;
+                num_outliers++;
+            }
+        } else {
+            image->at(i) = args.clamp ? 0.0f : args.no_value;
+            num_outliers++;
+        }
+    }
+    return num_outliers;
+}
+
+/* Out of range values are magenta (see colorize.cpp). */
+mve::FloatImage::Ptr
+colorize(mve::FloatImage::ConstPtr image, ColorMap cmap) {
+    float (*colormap)[3];
+    switch(cmap) {
+        case COOLWARM: colormap = col::maps::coolwarm; break;
+        default: colormap = col::maps::srgb::viridis;
+    }
+
+    mve::FloatImage::Ptr ret = mve::FloatImage::create(image->width(),
+        image->height(), 3);
+    for (int i = 0; i < image->get_value_amount(); i++){
+        float value = image->at(i);
+
+        math::Vec3f color(1.0f, 0.0f, 1.0f);
+        colormap_lookup(colormap, value, &color);
+        std::copy(color.begin(), color.end(), &ret->at(i, 0));
+    }
+    return ret;
+}
+
+void
+batch_normalize(Arguments const & args) {
+    auto insert = [&args] (std::string const & path, QuantileSketch * sketch) {
+        mve::FloatImage::Ptr image = mve::image::load_pfm_file(path);
+        for (int j = 0; j < image->get_value_amount(); ++j) {
+            float value = image->at(j);
+
+            if (value == args.no_value) continue;
+
+            sketch->insert(value);
+        }
+    };
+
+    auto normalize_image = [&args] (std::string const & path,
+        std::string const & out, float min, float max) -> int
+    {
+        mve::FloatImage::Ptr image = mve::image::load_pfm_file(path);
+        int num_outliers = normalize(image, min, max, args);
+        if (args.colormap != NONE) {
+            mve::image::save_pfm_file(colorize(image, args.colormap), out);
+        } else {
+            mve::image::save_pfm_file(image, out);
+        }
+        return num_outliers;
+    };
+
+    int num_outliers = ::batch_normalize(args.in_image, args.images,
+        args.out_image, args.min, args.max, args.eps, insert, normalize_image);
+
+    std::cout << (args.clamp ? "Clamped " : "Removed ")
+        << num_outliers << " outliers" << std::endl;
+}
+
 int main(int argc, char **argv) {
     Arguments args = parse_args(argc, argv);
 
+    if (args.batch) {
+        batch_normalize(args);
+        return EXIT_SUCCESS;
+    }
+
     mve::FloatImage::Ptr image_to_normalize;
 
     std::unordered_map<std::string, mve::FloatImage::Ptr> images_to_load;
@@ -168,30 +288,11 @@ int main(int argc, char **argv) {
         max = *nth;
     }
 
-    float delta = max - min;
     std::cout << "Minimal value: " << real_min << std::endl;
     std::cout << "Maximal value: " << real_max << std::endl;
     std::cout << "Normalizing range " << min << " - " << max << std::endl;
 
-    int num_outliers = 0;
-    mve::FloatImage::Ptr image = image_to_normalize;
-    for (int i = 0; i < image->get_value_amount(); ++i) {
-        float value = image->at(i);
-
-        if (value == args.no_value) continue;
-
-        if (value >= min) {
-            if(value <= max) {
-                image->at(i) = ((value - min) / delta);
-            } else {
-                image->at(i) = args.clamp ? 1.0f : args.no_value;
-                num_outliers++;
-            }
-        } else {
-            image->at(i) = args.clamp ? 0.0f : args.no_value;
-            num_outliers++;
-        }
-    }
+    int num_outliers = normalize(image_to_normalize, min, max, args);
 
     if (args.clamp) {
         std::cout << "Clamped ";
@@ -12,10 +12,14 @@ project "normalize-image"
     kind "ConsoleApp"
     language "C++"
 
+    buildoptions { "-fopenmp" }
+
     files { "normalize.cpp" }
 
     mve.use({ "util" })
 
+    links { "gomp" }
+
 project "colorize-image"
     kind "ConsoleApp"
     language "C++"
@@ -14,6 +14,7 @@
 #include "col/mpl_viridis.h"
 #include "col/dcm_coolwarm.h"
 #include "util/choices.h"
+#include "util/colormap.h"
 
 enum ColorMap {
     VIRIDIS = 0,
@@ -111,16 +112,9 @@ int main(int argc, char **argv) {
         float value = values[i];
 
         math::Vec4f color(args.ccolor);
-        if (0.0f <= value && value <= 1.0f) {
-            std::uint8_t lidx = std::floor(value * 255.0f);
-            float t = value * 255.0f - lidx;
-            std::uint8_t hidx = lidx == 255 ? 255 : lidx + 1;
-
-            math::Vec3f lc(colormap[lidx]);
-            math::Vec3f hc(colormap[hidx]);
-            for (int j = 0; j < 3; ++j) {
-                color[j] = (1.0f - t) * lc[j] + t * hc[j];
-            }
+        math::Vec3f rgb;
+        if (colormap_lookup(colormap, value, &rgb)) {
+            std::copy(rgb.begin(), rgb.end(), color.begin());
         }
         colors[i] = color;
     }
@@ -6,19 +6,42 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <array>
+#include <cmath>
+#include <numeric>
 #include <iostream>
 #include <vector>
 #include <unordered_map>
 #include <algorithm>
+#include <stdexcept>
 
 #include "mve/mesh_io_ply.h"
 
 #include "util/arguments.h"
 #include "util/file_system.h"
 #include "util/tokenizer.h"
+#include "util/choices.h"
+#include "util/batch_normalize.h"
+#include "util/colormap.h"
+
+#include "col/mpl_viridis.h"
+#include "col/dcm_coolwarm.h"
+
+enum ColorMap {
+    NONE = 0,
+    VIRIDIS = 1,
+    COOLWARM = 2
+};
+
+template <> inline
+const std::vector<std::string> choice_strings<ColorMap>() {
+    return {"none", "viridis", "coolwarm"};
+}
 
 struct Arguments {
     bool clamp;
+    bool batch;
+    ColorMap colormap;
     std::string in_mesh;
     std::string out_mesh;
     float min;
@@ -34,7 +57,14 @@ Arguments parse_args(int argc, char **argv) {
     args.set_nonopt_maxnum(2);
     args.set_nonopt_minnum(2);
     args.set_usage("Usage: " + std::string(argv[0]) + " [OPTS] IN_MESH OUT_MESH");
-    args.set_description("Normalizes the vertex values.");
+    args.set_description("Normalizes the vertex values. In batch mode IN_MESH "
+        "is a list of meshes (comma separated, @FILE with one path per line or "
+        "a glob pattern) and OUT_MESH a directory - the range is estimated "
+        "once over all meshes (approximate quantiles) and all meshes are "
+        "normalized in parallel.");
+    args.add_option('b', "batch", false, "batch mode");
+    args.add_option('m', "colormap", true, "colorize normalized meshes (batch mode) "
+        + choices<ColorMap>(NONE));
     args.add_option('c', "clamp", false, "clamp (instead of remove) outliers");
     args.add_option('e', "epsilon", true, "remove outliers in percent [0.0]");
     args.add_option('i', "ignore", true, "set value to ignore [-1.0]");
@@ -51,6 +81,8 @@ Arguments parse_args(int argc, char **argv) {
     conf.max = std::numeric_limits<float>::max();
     conf.eps = 0.0f;
     conf.clamp = false;
+    conf.batch = false;
+    conf.colormap = NONE;
     conf.no_value = -1.0f;
 
     for (util::ArgResult const* i = args.next_option();
@@ -62,6 +94,12 @@ Arguments parse_args(int argc, char **argv) {
         case 'c':
             conf.clamp = true;
         break;
+        case 'b':
+            conf.batch = true;
+        break;
+        case 'm':
+            conf.colormap = parse_choice<ColorMap>(i->arg);
+        break;
         case 'i':
             conf.no_value = i->get_arg<float>();
         break;
@@ -91,16 +129,131 @@ Arguments parse_args(int argc, char **argv) {
         throw std::invalid_argument("minimum has to be smaller that maximum");
     }
 
-    if (conf.meshes.empty()) {
+    if (conf.meshes.empty() && !conf.batch) {
         conf.meshes.push_back(conf.in_mesh);
     }
 
     return conf;
 }
 
+int
+normalize(mve::TriangleMesh::Ptr mesh, float min, float max,
+    Arguments const & args, std::array<uint, 11> * hist)
+{
+    float delta = max - min;
+    int num_outliers = 0;
+    mve::TriangleMesh::ValueList & vertex_values = mesh->get_vertex_values();
+    for (std::size_t i = 0; i < vertex_values.size(); ++i) {
+        float & value = vertex_values[i];
+        if (value == args.no_value) continue;
+
+        if (value >= min) {
+            if(value <= max) {
+                value = ((value - min) / delta);
+            } else {
+                value = args.clamp ? 1.0f : args.no_value;
+                num_outliers++;
+            }
+        } else {
+            value = args.clamp ? 0.0f : args.no_value;
+            num_outliers++;
+        }
+
+        if (value != args.no_value) {
+            (*hist)[value * 10.0f] += 1;
+        }
+    }
+    return num_outliers;
+}
+
+/* Out of range values are magenta (see colorize.cpp). */
+void
+colorize(mve::TriangleMesh::Ptr mesh, ColorMap cmap) {
+    float (*colormap)[3];
+    switch(cmap) {
+        case COOLWARM: colormap = col::maps::coolwarm; break;
+        default: colormap = col::maps::srgb::viridis;
+    }
+
+    mve::TriangleMesh::ValueList const & values = mesh->get_vertex_values();
+    mve::TriangleMesh::ColorList & colors = mesh->get_vertex_colors();
+    colors.resize(values.size());
+    for (std::size_t i = 0; i < values.size(); i++){
+        float value = values[i];
+
+        math::Vec4f color(1.0f, 0.0f, 1.0f, 1.0f);
+        math::Vec3f rgb;
+        if (colormap_lookup(colormap, value, &rgb)) {
+            std::copy(rgb.begin(), rgb.end(), color.begin());
+        }
+        colors[i] = color;
+    }
+}
+
+void
+print_histogram(std::array<uint, 11> const & hist) {
+    float sum = std::accumulate(hist.begin(), hist.end(), 0u);
+    for (int i = 0; i < 11; ++i) {
+        std::size_t width = std::ceil((hist[i] / sum) * 100.0f);
+        std::string bar = width ? std::string(width, '#') : " ";
+        std::cout << i / 10.0f << '\t' << bar << std::endl;
+    }
+}
+
+void
+batch_normalize(Arguments const & args) {
+    auto insert = [&args] (std::string const & path, QuantileSketch * sketch) {
+        mve::TriangleMesh::Ptr mesh = mve::geom::load_ply_mesh(path);
+        for (float value : mesh->get_vertex_values()) {
+            if (value == args.no_value) continue;
+
+            sketch->insert(value);
+        }
+    };
+
+    std::array<uint, 11> hist = {};
+    auto normalize_mesh = [&args, &hist] (std::string const & path,
+        std::string const & out, float min, float max) -> int
+    {
+        mve::TriangleMesh::Ptr mesh = mve::geom::load_ply_mesh(path);
+        if (!mesh->has_vertex_values()) {
+            throw std::runtime_error("Mesh has no vertex values");
+        }
+
+        std::array<uint, 11> mhist = {};
+        int num_outliers = normalize(mesh, min, max, args, &mhist);
+        if (args.colormap != NONE) colorize(mesh, args.colormap);
+
+        mve::geom::SavePLYOptions opts;
+        opts.format_binary = true;
+        opts.write_vertex_normals = true;
+        opts.write_vertex_colors = args.colormap != NONE;
+        opts.write_vertex_values = true;
+        mve::geom::save_ply_mesh(mesh, out, opts);
+
+        #pragma omp critical
+        for (int j = 0; j < 11; ++j) hist[j] += mhist[j];
+
+        return num_outliers;
+    };
+
+    int num_outliers = ::batch_normalize(args.in_mesh, args.meshes,
+        args.out_mesh, args.min, args.max, args.eps, insert, normalize_mesh);
+
+    print_histogram(hist);
+
+    std::cout << (args.clamp ? "Clamped " : "Removed ")
+        << num_outliers << " outliers" << std::endl;
+}
+
 int main(int argc, char **argv) {
     Arguments args = parse_args(argc, argv);
 
+    if (args.batch) {
+        batch_normalize(args);
+        return EXIT_SUCCESS;
+    }
+
     mve::TriangleMesh::Ptr mesh_to_normalize;
 
     std::unordered_map<std::string, mve::TriangleMesh::Ptr> meshes_to_load;
@@ -175,42 +328,13 @@ int main(int argc, char **argv) {
         max = *nth;
     }
 
-    float delta = max - min;
     std::cout << "Minimal value: " << real_min << std::endl;
     std::cout << "Maximal value: " << real_max << std::endl;
     std::cout << "Normalizing range " << min << " - " << max << std::endl;
 
     std::array<uint, 11> hist = {};
-
-    int num_outliers = 0;
-    mve::TriangleMesh::ValueList & vertex_values = mesh_to_normalize->get_vertex_values();
-    for (std::size_t i = 0; i < vertex_values.size(); ++i) {
-        float & value = vertex_values[i];
-        if (value == args.no_value) continue;
-
-        if (value >= min) {
-            if(value <= max) {
-                value = ((value - min) / delta);
-            } else {
-                value = args.clamp ? 1.0f : args.no_value;
-                num_outliers++;
-            }
-        } else {
-            value = args.clamp ? 0.0f : args.no_value;
-            num_outliers++;
-        }
-
-        if (value != args.no_value) {
-            hist[value * 10.0f] += 1;
-        }
-    }
-
-    float sum = std::accumulate(hist.begin(), hist.end(), 0u);
-    for (int i = 0; i < 11; ++i) {
-        std::size_t width = std::ceil((hist[i] / sum) * 100.0f);
-        std::string bar = width ? std::string(width, '#') : " ";
-        std::cout << i / 10.0f << '\t' << bar << std::endl;
-    }
+    int num_outliers = normalize(mesh_to_normalize, min, max, args, &hist);
+    print_histogram(hist);
 
     if (args.clamp) {
         std::cout << "Clamped ";
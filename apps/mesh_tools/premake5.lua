@@ -12,10 +12,14 @@ project "normalize-mesh"
     kind "ConsoleApp"
     language "C++"
 
+    buildoptions { "-fopenmp" }
+
     files { "normalize.cpp" }
 
     mve.use({ "util" })
 
+    links { "gomp" }
+
 project "colorize-mesh"
     kind "ConsoleApp"
     language "C++"
@@ -6,11 +6,15 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <deque>
+#include <mutex>
+#include <atomic>
 #include <random>
 #include <csignal>
 #include <iostream>
 #include <algorithm>
 
+#include "util/timer.h"
 #include "util/system.h"
 #include "util/arguments.h"
 #include "util/file_system.h"
@@ -29,6 +33,8 @@
 
 #include "util/io.h"
 #include "util/cio.h"
+#include "util/task_scheduler.h"
+#include "util/async_load.h"
 
 #include "geom/sphere.h"
 #include "geom/volume_io.h"
@@ -53,6 +59,8 @@ struct Arguments {
     float focal_length;
     float target_recon;
     float independence;
+    uint pipeline_depth;
+    HistogramResolution hist_res;
 };
 
 Arguments parse_args(int argc, char **argv) {
@@ -68,6 +76,13 @@ Arguments parse_args(int argc, char **argv) {
     args.add_option('\0', "max-distance", true, "maximum distance to surface [50.0]");
     args.add_option('\0', "focal-length", true, "camera focal length [0.86]");
     args.add_option('\0', "independence", true, "reduce independence constraint [1.0]");
+    args.add_option('\0', "pipeline-depth", true, "number of view batches "
+        "optimized concurrently - each additional batch evaluates a copy of "
+        "the observation rays and the result depends on the timing (is not "
+        "reproducible with the seed) [1]");
+    args.add_option('\0', "histogram-resolution", true, "direction histogram "
+        "resolution and sphere subdivisions of the spherical histogram "
+        "WxH[xS] [128x45x3]");
     args.add_option('m', "max-iters", true, "maximum iterations [100]");
     args.parse(argc, argv);
 
@@ -84,6 +99,8 @@ Arguments parse_args(int argc, char **argv) {
     conf.focal_length = 0.86f;
     conf.target_recon = 3.0f;
     conf.independence = 1.0f;
+    conf.pipeline_depth = 1;
+    conf.hist_res = default_histogram_resolution();
 
     for (util::ArgResult const* i = args.next_option();
          i != 0; i = args.next_option()) {
@@ -102,6 +119,10 @@ Arguments parse_args(int argc, char **argv) {
                 conf.max_distance = i->get_arg<float>();
             } else if (i->opt->lopt == "independence") {
                 conf.independence = i->get_arg<float>();
+            } else if (i->opt->lopt == "pipeline-depth") {
+                conf.pipeline_depth = std::max(1u, i->get_arg<uint>());
+            } else if (i->opt->lopt == "histogram-resolution") {
+                conf.hist_res = parse_histogram_resolution(i->arg);
             } else {
                 throw std::invalid_argument("Invalid option");
             }
@@ -118,7 +139,55 @@ Arguments parse_args(int argc, char **argv) {
 
 float const pi = std::acos(-1.0f);
 
-bool terminate = false;
+std::atomic<bool> terminate(false);
+
+/* Thread local CUDA stream and buffers for evaluations of the objective. */
+struct StreamContext {
+    cudaStream_t stream;
+    cudaEvent_t event;
+
+    /* Spherical histogram. */
+    cacc::Array<float, cacc::DEVICE>::Ptr dcon_hist;
+
+    /* Convoluted spherical histograms. */
+    cacc::Image<float, cacc::DEVICE>::Ptr dhist;
+    cacc::Image<float, cacc::HOST>::Ptr hist;
+
+    StreamContext(int device, uint num_sverts, HistogramResolution const & res) {
+        cacc::set_cuda_device(device);
+
+        CHECK(cudaStreamCreate(&stream));
+        CHECK(cudaEventCreateWithFlags(&event, cudaEventDefault | cudaEventDisableTiming));
+
+        dcon_hist = cacc::Array<float, cacc::DEVICE>::create(num_sverts, stream);
+        dhist = cacc::Image<float, cacc::DEVICE>::create(res.width, res.height, stream);
+        hist = cacc::Image<float, cacc::HOST>::create(res.width, res.height, stream);
+    }
+
+    ~StreamContext() {
+        cudaEventDestroy(event);
+        cudaStreamDestroy(stream);
+    }
+};
+
+StreamContext & stream_context(int device, uint num_sverts,
+    HistogramResolution const & res)
+{
+    static thread_local std::unique_ptr<StreamContext> context;
+    if (context == nullptr) context.reset(new StreamContext(device, num_sverts, res));
+    return *context;
+}
+
+/* Independent views optimized together. */
+struct Batch {
+    std::vector<std::size_t> indices;
+    std::vector<math::Vec3f> positions;
+    /* Reconstructabilities and observation rays without the rays of the
+     * batch (the rays are shared without pipelining). */
+    cacc::Array<float, cacc::DEVICE>::Ptr drecons;
+    cacc::VectorArray<cacc::Vec3f, cacc::DEVICE>::Ptr dobs_rays;
+    TaskScheduler::TaskHandle done;
+};
 
 void initialize(Simplex<3> * simplex, math::Vec3f pos, float scale, float theta, float phi) {
     static float tmp = 1.0f / std::sqrt(2.0f);
@@ -143,38 +212,51 @@ int main(int argc, char **argv) {
 
     Arguments args = parse_args(argc, argv);
 
+    /* Issue all loads and BVH constructions at once - each input is
+     * consumed as soon as it is ready. */
+    AsyncResult<acc::BVHTree<uint, math::Vec3f>::Ptr> proxy_bvh_tree
+        = load_mesh_as_bvh_tree_async(args.proxy_mesh);
+    AsyncResult<mve::TriangleMesh::Ptr> proxy_cloud
+        = load_mesh_async(args.proxy_cloud);
+    AsyncResult<acc::BVHTree<uint, math::Vec3f>::Ptr> airspace_bvh_tree
+        = load_mesh_as_bvh_tree_async(args.airspace);
+    std::string in_trajectory = args.in_trajectory;
+    AsyncResult<std::vector<mve::CameraInfo> > in_trajectory_result
+        = load_async("trajectory " + in_trajectory, [in_trajectory] {
+            std::vector<mve::CameraInfo> trajectory;
+            utp::load_trajectory(in_trajectory, &trajectory);
+            return trajectory;
+        });
+
     int device = cacc::select_cuda_device(3, 5);
 
-    /* Load proxy mesh and construct BVH for visibility calculations. */
+    /* Upload proxy mesh BVH for visibility calculations. */
     cacc::BVHTree<cacc::DEVICE>::Ptr dbvh_tree;
-    {
-        acc::BVHTree<uint, math::Vec3f>::Ptr bvh_tree;
-        bvh_tree = load_mesh_as_bvh_tree(args.proxy_mesh);
-        dbvh_tree = cacc::BVHTree<cacc::DEVICE>::create<uint, math::Vec3f>(bvh_tree);
-    }
+    dbvh_tree = cacc::BVHTree<cacc::DEVICE>::create<uint, math::Vec3f>(
+        proxy_bvh_tree.get());
 
     /* Generate sphere and construct KDTree for histogram binning. */
     uint num_sverts;
     cacc::KDTree<3u, cacc::DEVICE>::Ptr dkd_tree;
     {
-        mve::TriangleMesh::Ptr sphere = generate_sphere_mesh(1.0f, 3u);
+        mve::TriangleMesh::Ptr sphere = generate_sphere_mesh(1.0f,
+            args.hist_res.sphere_subdivisions);
         std::vector<math::Vec3f> const & verts = sphere->get_vertices();
         num_sverts = verts.size();
         acc::KDTree<3u, uint>::Ptr kd_tree = acc::KDTree<3, uint>::create(verts);
         dkd_tree = cacc::KDTree<3u, cacc::DEVICE>::create<uint>(kd_tree);
     }
 
-    /* Load proxy cloud to evaluate heuristic */
+    /* Upload proxy cloud to evaluate heuristic */
     cacc::PointCloud<cacc::DEVICE>::Ptr dcloud;
     {
         cacc::PointCloud<cacc::HOST>::Ptr cloud;
-        cloud = load_point_cloud(args.proxy_cloud);
+        cloud = load_point_cloud(proxy_cloud.get());
         dcloud = cacc::PointCloud<cacc::DEVICE>::create<cacc::HOST>(cloud);
     }
     int num_verts = dcloud->cdata().num_vertices;
 
-    acc::BVHTree<uint, math::Vec3f>::Ptr bvh_tree;
-    bvh_tree = load_mesh_as_bvh_tree(args.airspace);
+    acc::BVHTree<uint, math::Vec3f>::Ptr bvh_tree = airspace_bvh_tree.get();
 
     /* Allocate shared GPU data structures. */
     uint max_cameras = 32;
@@ -195,9 +277,9 @@ int main(int argc, char **argv) {
     int width = 1920;
     int height = 1080;
     cam.fill_calibration(calib.begin(), width, height);
+    CameraModel model = camera_model(cam, width, height);
 
-    std::vector<mve::CameraInfo> trajectory;
-    utp::load_trajectory(args.in_trajectory, &trajectory);
+    std::vector<mve::CameraInfo> trajectory = in_trajectory_result.get();
 
     /* Initialize data structure for view selection distribution. */
     std::vector<std::size_t> iters(trajectory.size(), args.max_iters);
@@ -230,133 +312,162 @@ int main(int argc, char **argv) {
 
 
     float volume = 0.0f;
-    std::vector<std::size_t> oindices;
+    std::vector<float> volumes(simplices.size());
+    for (std::size_t j = 0; j < simplices.size(); ++j) {
+        std::array<math::Vector<float, 3>, 4> & v = simplices[j].verts;
+        volumes[j] = std::abs(math::geom::tetrahedron_volume(v[0], v[1], v[2], v[3]));
+        volume += volumes[j];
+    }
     std::vector<float> ovalues;
     ovalues.reserve(args.max_iters);
-    #pragma omp parallel
-    {
-        /* Allocate thread local data structures. */
-        cacc::set_cuda_device(device);
-
-        cudaStream_t stream;
-        CHECK(cudaStreamCreate(&stream));
-
-        cudaEvent_t event;
-        CHECK(cudaEventCreateWithFlags(&event, cudaEventDefault | cudaEventDisableTiming));
-
-        /* Spherical histogram. */
-        cacc::Array<float, cacc::DEVICE>::Ptr dcon_hist;
-        dcon_hist = cacc::Array<float, cacc::DEVICE>::create(num_sverts, stream);
 
-        /* Convoluted spherical histograms. */
-        cacc::Image<float, cacc::DEVICE>::Ptr dhist;
-        dhist = cacc::Image<float, cacc::DEVICE>::create(128, 45, stream);
-        cacc::Image<float, cacc::HOST>::Ptr hist;
-        hist = cacc::Image<float, cacc::HOST>::create(128, 45, stream);
+    TaskScheduler & scheduler = TaskScheduler::global();
 
-        /* Initialize direction histograms. */
-        #pragma omp for schedule(dynamic)
-        for (std::size_t j = 0; j < trajectory.size(); ++j) {
-            mve::CameraInfo const & cam = trajectory[j];
+    auto update_rays = [&] (bool populate, mve::CameraInfo const & cam,
+        cudaStream_t stream)
+    {
+        math::Vec3f pos;
+        cam.fill_camera_pos(pos.begin());
+        math::Matrix4f w2c;
+        cam.fill_world_to_cam(w2c.begin());
+
+        dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE));
+        dim3 block(KERNEL_BLOCK_SIZE);
+        update_observation_rays<<<grid, block, 0, stream>>>(
+            populate, cacc::Vec3f(pos.begin()), args.max_distance,
+            cacc::Mat4f(w2c.begin()), cacc::Mat3f(calib.begin()),
+            width, height,
+            dbvh_tree->accessor(),
+            dcloud->cdata(), dobs_rays->cdata()
+        );
+    };
 
-            math::Vec3f pos;
-            cam.fill_camera_pos(pos.begin());
-            math::Matrix4f w2c;
-            cam.fill_world_to_cam(w2c.begin());
+    /* Sorts the rays and computes the reconstructabilities. */
+    auto evaluate_rays = [&] (cudaStream_t stream) {
+        {
+            dim3 grid(cacc::divup(num_verts, 2));
+            dim3 block(32, 2);
+            process_observation_rays<<<grid, block, 0, stream>>>(
+                dobs_rays->cdata());
+        }
 
+        {
             dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE));
             dim3 block(KERNEL_BLOCK_SIZE);
-            update_observation_rays<<<grid, block, 0, stream>>>(
-                true, cacc::Vec3f(pos.begin()), args.max_distance,
-                cacc::Mat4f(w2c.begin()), cacc::Mat3f(calib.begin()),
-                width, height,
-                dbvh_tree->accessor(),
-                dcloud->cdata(), dobs_rays->cdata()
-            );
-
-            cacc::sync(stream, event, std::chrono::microseconds(100));
+            evaluate_observation_rays<<<grid, block, 0, stream>>>(
+                dobs_rays->cdata(), drecons->cdata());
         }
+    };
 
-        for (uint i = 0; i < args.max_iters && !terminate; ++i) {
-            /* Select views to optimize by a single thread. */
-            #pragma omp single
-            {
-                volume = 0.0f;
-                oindices.clear();
-
-                /* Create view selection distribution. */
-                std::discrete_distribution<> d(iters.begin(), iters.end());
-                {
-                    /* Select multiple independent views for optimization. */
-                    std::vector<math::Vec3f> poss;
-                    for (std::size_t j = 0; j < trajectory.size(); ++j) {
-                        std::size_t idx = d(gen);
-
-                        math::Vec3f pos;
-                        trajectory[idx].fill_camera_pos(pos.begin());
-
-                        bool too_close = std::any_of(poss.begin(), poss.end(),
-                            [&pos, &min_sq_distance](math::Vec3f const & opos) -> bool {
-                                return (pos - opos).square_norm() < min_sq_distance;
-                        });
-
-                        if (!too_close) {
-                            oindices.push_back(idx);
-                            poss.push_back(pos);
-                            iters[idx] -= 1;
-                        }
-                    }
-                }
+    /* Initialize direction histograms. */
+    scheduler.parallel_for(std::size_t(0), trajectory.size(), [&] (std::size_t j) {
+        StreamContext & ctx = stream_context(device, num_sverts, args.hist_res);
+        update_rays(true, trajectory[j], ctx.stream);
+        cacc::sync(ctx.stream, ctx.event, std::chrono::microseconds(100));
+    }, std::size_t(1));
+
+    /* Batches of independent views are optimized as a pipeline - while the
+     * simplex-downhill steps of one batch are evaluated, the rays of the
+     * previous batch are added and the rays of the next batch are removed.
+     * Batches in flight are mutually independent, i.e. they (mostly) touch
+     * disjoint vertices. The ray kernels add, remove and sort the rays in
+     * place and are serialized by the mutex (as are the modifications of the
+     * reconstructabilities). The objective function of a batch reads
+     * snapshots of the reconstructabilities and rays taken after its rays
+     * were removed - the evaluations never wait for ray updates. */
+    std::mutex rays_mutex;
+    /* Ray snapshots of retired batches for reuse. */
+    std::vector<cacc::VectorArray<cacc::Vec3f, cacc::DEVICE>::Ptr> snapshots;
+
+    std::deque<std::shared_ptr<Batch> > batches;
+    std::size_t num_optimized = 0;
+    util::WallTimer timer;
+
+    for (uint i = 0; i < args.max_iters && !terminate; ++i) {
+        /* Retire finished batches, wait for the oldest if the pipeline is full. */
+        while (!batches.empty()
+            && (batches.front()->done->done() || batches.size() >= args.pipeline_depth)) {
+            scheduler.wait(batches.front()->done);
+            if (batches.front()->dobs_rays != dobs_rays) {
+                snapshots.push_back(batches.front()->dobs_rays);
+            }
+            batches.pop_front();
+        }
+        if (terminate) break;
+
+        std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+
+        /* Select multiple independent views for optimization - also
+         * independent of the views in flight. */
+        {
+            std::vector<math::Vec3f> poss;
+            std::vector<bool> in_flight(trajectory.size(), false);
+            for (std::shared_ptr<Batch> const & other : batches) {
+                poss.insert(poss.end(), other->positions.begin(), other->positions.end());
+                for (std::size_t idx : other->indices) in_flight[idx] = true;
             }
 
-            /* Remove view directions of selected views. */
-            #pragma omp for schedule(dynamic)
-            for (std::size_t j = 0; j < oindices.size(); ++j) {
-                mve::CameraInfo const & cam = trajectory[oindices[j]];
+            std::discrete_distribution<> d(iters.begin(), iters.end());
+            for (std::size_t j = 0; j < trajectory.size(); ++j) {
+                std::size_t idx = d(gen);
+                if (in_flight[idx]) continue;
 
                 math::Vec3f pos;
-                cam.fill_camera_pos(pos.begin());
-                math::Matrix4f w2c;
-                cam.fill_world_to_cam(w2c.begin());
-
-                dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE));
-                dim3 block(KERNEL_BLOCK_SIZE);
-                update_observation_rays<<<grid, block, 0, stream>>>(
-                    false, cacc::Vec3f(pos.begin()), args.max_distance,
-                    cacc::Mat4f(w2c.begin()), cacc::Mat3f(calib.begin()),
-                    width, height,
-                    dbvh_tree->accessor(),
-                    dcloud->cdata(), dobs_rays->cdata()
-                );
-
-                cacc::sync(stream, event, std::chrono::microseconds(100));
-            }
-            ((void)0); //For unknown reasons a statement is required here
-
-            /* Compute new reconstructabilities. */
-            #pragma omp single
-            {
-                {
-                    dim3 grid(cacc::divup(num_verts, 2));
-                    dim3 block(32, 2);
-                    process_observation_rays<<<grid, block, 0, stream>>>(
-                        dobs_rays->cdata());
+                trajectory[idx].fill_camera_pos(pos.begin());
+
+                bool too_close = std::any_of(poss.begin(), poss.end(),
+                    [&pos, &min_sq_distance](math::Vec3f const & opos) -> bool {
+                        return (pos - opos).square_norm() < min_sq_distance;
+                });
+
+                if (!too_close) {
+                    batch->indices.push_back(idx);
+                    batch->positions.push_back(pos);
+                    poss.push_back(pos);
+                    in_flight[idx] = true;
+                    iters[idx] -= 1;
                 }
+            }
+        }
+        if (batch->indices.empty()) continue;
+
+        batch->drecons = cacc::Array<float, cacc::DEVICE>::create(num_verts);
+        if (args.pipeline_depth == 1) {
+            batch->dobs_rays = dobs_rays;
+        } else if (!snapshots.empty()) {
+            batch->dobs_rays = snapshots.back();
+            snapshots.pop_back();
+        } else {
+            batch->dobs_rays = cacc::VectorArray<cacc::Vec3f, cacc::DEVICE>::create(
+                num_verts, max_cameras);
+        }
 
-                {
-                    dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE));
-                    dim3 block(KERNEL_BLOCK_SIZE);
-                    evaluate_observation_rays<<<grid, block, 0, stream>>>(
-                        dobs_rays->cdata(), drecons->cdata());
-                }
+        /* Remove view directions of selected views and compute new
+         * reconstructabilities. */
+        TaskScheduler::TaskHandle removed = scheduler.submit([&, batch] {
+            StreamContext & ctx = stream_context(device, num_sverts, args.hist_res);
+            std::lock_guard<std::mutex> lock(rays_mutex);
 
-                cacc::sync(stream, event, std::chrono::microseconds(100));
+            for (std::size_t idx : batch->indices) {
+                update_rays(false, trajectory[idx], ctx.stream);
             }
+            evaluate_rays(ctx.stream);
+            cacc::sync(ctx.stream, ctx.event, std::chrono::microseconds(100));
+
+            *batch->drecons = *drecons;
+            if (batch->dobs_rays != dobs_rays) *batch->dobs_rays = *dobs_rays;
+        });
+
+        /* Execute a iteration of simplex-downhill for selected views. */
+        std::vector<TaskScheduler::TaskHandle> optimized;
+        for (std::size_t idx : batch->indices) {
+            optimized.push_back(scheduler.submit([&, batch, idx] {
+                StreamContext & ctx = stream_context(device, num_sverts, args.hist_res);
+                cudaStream_t stream = ctx.stream;
+                cacc::Array<float, cacc::DEVICE>::Ptr dcon_hist = ctx.dcon_hist;
+                cacc::Image<float, cacc::DEVICE>::Ptr dhist = ctx.dhist;
+                cacc::Image<float, cacc::HOST>::Ptr hist = ctx.hist;
 
-            /* Execute a iteration of simplex-downhill for selected views. */
-            #pragma omp for schedule(dynamic)
-            for (std::size_t j = 0; j < oindices.size(); ++j) {
-                std::size_t idx = oindices[j];
                 mve::CameraInfo & cam = trajectory[idx];
 
                 /* Will be set by simplex-downhill. */
@@ -394,22 +505,23 @@ int main(int argc, char **argv) {
                         populate_spherical_histogram<<<grid, block, 0, stream>>>(
                             cacc::Vec3f(pos.begin()), args.max_distance, args.target_recon,
                             dbvh_tree->accessor(), dcloud->cdata(), dkd_tree->accessor(),
-                            dobs_rays->cdata(), drecons->cdata(), dcon_hist->cdata());
+                            batch->dobs_rays->cdata(), batch->drecons->cdata(),
+                            dcon_hist->cdata());
                     }
 
                     /* Convolve spherical histogram. */
                     {
-                        dim3 grid(cacc::divup(128, KERNEL_BLOCK_SIZE), 45);
+                        dim3 grid(cacc::divup(args.hist_res.width, KERNEL_BLOCK_SIZE),
+                            args.hist_res.height);
                         dim3 block(KERNEL_BLOCK_SIZE);
-                        evaluate_spherical_histogram<<<grid, block, 0, stream>>>(
-                            cacc::Mat3f(calib.begin()), width, height,
+                        evaluate_spherical_histogram<<<grid, block, 0, stream>>>(model,
                             dkd_tree->accessor(), dcon_hist->cdata(), dhist->cdata());
                     }
 
                     *hist = *dhist;
                     cacc::Image<float, cacc::HOST>::Data data = hist->cdata();
 
-                    cacc::sync(stream, event, std::chrono::microseconds(100));
+                    cacc::sync(stream, ctx.event, std::chrono::microseconds(100));
 
                     /* Select optimal direction based on spherical histogram. */
                     float min = 0.0f; //all values are negative;
@@ -467,87 +579,66 @@ int main(int argc, char **argv) {
 
                 std::copy(trans.begin(), trans.end(), cam.trans);
                 std::copy(rot.begin(), rot.end(), cam.rot);
-            }
-
-            /* Add view directions of optimized views. */
-            #pragma omp for schedule(dynamic)
-            for (std::size_t j = 0; j < oindices.size(); ++j) {
-                mve::CameraInfo const & cam = trajectory[oindices[j]];
+            }, {removed}));
+        }
 
-                math::Vec3f pos;
-                cam.fill_camera_pos(pos.begin());
-                math::Matrix4f w2c;
-                cam.fill_world_to_cam(w2c.begin());
+        /* Add view directions of optimized views and evaluate the objective. */
+        batch->done = scheduler.submit([&, batch, i] {
+            StreamContext & ctx = stream_context(device, num_sverts, args.hist_res);
+            std::lock_guard<std::mutex> lock(rays_mutex);
 
-                {
-                    dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE));
-                    dim3 block(KERNEL_BLOCK_SIZE);
-                    update_observation_rays<<<grid, block, 0, stream>>>(
-                        true, cacc::Vec3f(pos.begin()), args.max_distance,
-                        cacc::Mat4f(w2c.begin()), cacc::Mat3f(calib.begin()),
-                        width, height,
-                        dbvh_tree->accessor(), dcloud->cdata(),
-                        dobs_rays->cdata()
-                    );
-                }
+            for (std::size_t idx : batch->indices) {
+                update_rays(true, trajectory[idx], ctx.stream);
 
-                cacc::sync(stream, event, std::chrono::microseconds(100));
+                /* Update total simplex volume - step size. */
+                std::array<math::Vector<float, 3>, 4> & v = simplices[idx].verts;
+                float nvolume = std::abs(math::geom::tetrahedron_volume(v[0], v[1], v[2], v[3]));
+                volume += nvolume - volumes[idx];
+                volumes[idx] = nvolume;
             }
+            num_optimized += batch->indices.size();
 
-            /* Calculate total simplex volume - step size. */
-            #pragma omp for reduction(+:volume)
-            for (std::size_t j = 0; j < simplices.size(); ++j) {
-                std::array<math::Vector<float, 3>, 4> & v = simplices[j].verts;
-                volume += std::abs(math::geom::tetrahedron_volume(v[0], v[1], v[2], v[3]));
-            }
-
-            #pragma omp single
+            evaluate_rays(ctx.stream);
             {
-                {
-                    dim3 grid(cacc::divup(num_verts, 2));
-                    dim3 block(32, 2);
-                    process_observation_rays<<<grid, block, 0, stream>>>(
-                        dobs_rays->cdata());
-                }
-
-                /* Evaluate new reconstructabilities. */
-                {
-                    dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE));
-                    dim3 block(KERNEL_BLOCK_SIZE);
-                    evaluate_observation_rays<<<grid, block, 0, stream>>>(
-                        dobs_rays->cdata(), drecons->cdata());
-
-                    calculate_func_recons<<<grid, block, 0, stream>>>(
-                        drecons->cdata(), args.target_recon, dwrecons->cdata());
+                dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE));
+                dim3 block(KERNEL_BLOCK_SIZE);
+                calculate_func_recons<<<grid, block, 0, ctx.stream>>>(
+                    drecons->cdata(), args.target_recon, dwrecons->cdata());
+            }
+            cacc::sync(ctx.stream, ctx.event, std::chrono::microseconds(100));
+
+            /* Calculate value of objective function. */
+            float avg_wrecon = cacc::reduction::sum(dwrecons) / num_verts;
+            ovalues.push_back(avg_wrecon);
+
+            /* Terminate if improvement to small. */
+            std::size_t n = ovalues.size();
+            if (n > 1) {
+                float improvement = ovalues[n - 1 - std::min<std::size_t>(n - 1, 100)] - avg_wrecon;
+                if (improvement < args.target_recon * 1e-4f) {
+                    terminate = true;
                 }
+            }
 
-                cacc::sync(stream, event, std::chrono::microseconds(100));
-
-                //float length = utp::length(trajectory);
-
-                /* Calculate value of objective function. */
-                float avg_wrecon = cacc::reduction::sum(dwrecons) / num_verts;
-                ovalues.push_back(avg_wrecon);
+            std::cout << i << " "
+                << batch->indices.size() << " "
+                << avg_wrecon << " "
+                << volume << std::endl;
+        }, optimized);
 
-                /* Terminate if improvement to small. */
-                if (i > 0) {
-                    float improvement = ovalues[std::max((int)i - 100, 0)] - avg_wrecon;
-                    if (improvement < args.target_recon * 1e-4f) {
-                        terminate = true;
-                    }
-                }
+        batches.push_back(batch);
+    }
 
-                float max_recon = cacc::reduction::max(drecons);
-                std::cout << i << " "
-                    << oindices.size() << " "
-                    << avg_wrecon << " "
-                    << volume << std::endl;
-            }
-        }
-        cudaEventDestroy(event);
-        cudaStreamDestroy(stream);
+    while (!batches.empty()) {
+        scheduler.wait(batches.front()->done);
+        batches.pop_front();
     }
 
+    std::cout << "Optimized " << num_optimized << " views in "
+        << timer.get_elapsed_sec() << "s ("
+        << num_optimized / std::max(timer.get_elapsed_sec(), 1e-3f)
+        << " views/s)" << std::endl;
+
     utp::save_trajectory(trajectory, args.out_trajectory);
 
     return EXIT_SUCCESS;
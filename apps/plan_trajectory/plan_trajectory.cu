@@ -6,7 +6,9 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#include <chrono>
 #include <random>
+#include <cstdint>
 #include <iostream>
 
 #include "util/system.h"
@@ -23,14 +25,17 @@
 
 #include "util/io.h"
 #include "util/cio.h"
+#include "util/async_load.h"
 
 #include "geom/sphere.h"
 #include "geom/volume_io.h"
 
 #include "utp/trajectory.h"
 #include "utp/trajectory_io.h"
+#include "utp/receding_horizon.h"
 
 #include "eval/kernels.h"
+#include "eval/observation_rays.h"
 
 struct Arguments {
     std::string proxy_mesh;
@@ -43,6 +48,12 @@ struct Arguments {
     float max_altitude;
     float max_velocity;
     float focal_length;
+    HistogramResolution hist_res;
+    uint horizon;
+    float budget;
+    std::size_t max_evaluations;
+    float target_recon;
+    bool cpu;
 };
 
 Arguments parse_args(int argc, char **argv) {
@@ -59,6 +70,20 @@ Arguments parse_args(int argc, char **argv) {
     args.add_option('\0', "max-altitude", true, "maximum altitude [100.0]");
     args.add_option('\0', "max-velocity", true, "maximum velocity [5.0]");
     args.add_option('\0', "focal-length", true, "camera focal length [0.86]");
+    args.add_option('\0', "histogram-resolution", true, "direction histogram "
+        "resolution and sphere subdivisions of the spherical histogram "
+        "WxH[xS] [128x45x3]");
+    args.add_option('\0', "horizon", true, "receding horizon mode - number "
+        "of waypoints planned from the vehicle state [0]");
+    args.add_option('\0', "budget", true, "receding horizon mode - planning "
+        "time per waypoint in ms, 0 disables the limit [100.0]");
+    args.add_option('\0', "max-evaluations", true, "receding horizon mode - "
+        "maximum number of evaluated views per waypoint, 0 disables the "
+        "limit [0]");
+    args.add_option('\0', "target-recon", true, "receding horizon mode - "
+        "desired reconstructability [3.0]");
+    args.add_option('\0', "cpu", false, "receding horizon mode - "
+        "deterministic evaluation on the host");
     args.add_option('n', "num-views", true, "number of views [500]");
     args.parse(argc, argv);
 
@@ -73,6 +98,12 @@ Arguments parse_args(int argc, char **argv) {
     conf.max_velocity = 5.0f;
     conf.num_views = 500;
     conf.focal_length = 0.86f;
+    conf.hist_res = default_histogram_resolution();
+    conf.horizon = 0;
+    conf.budget = 100.0f;
+    conf.max_evaluations = 0;
+    conf.target_recon = 3.0f;
+    conf.cpu = false;
 
     for (util::ArgResult const* i = args.next_option();
          i != 0; i = args.next_option()) {
@@ -93,6 +124,18 @@ Arguments parse_args(int argc, char **argv) {
                 conf.max_altitude = i->get_arg<float>();
             } else if (i->opt->lopt == "max-velocity") {
                 conf.max_velocity = i->get_arg<float>();
+            } else if (i->opt->lopt == "histogram-resolution") {
+                conf.hist_res = parse_histogram_resolution(i->arg);
+            } else if (i->opt->lopt == "horizon") {
+                conf.horizon = i->get_arg<uint>();
+            } else if (i->opt->lopt == "budget") {
+                conf.budget = i->get_arg<float>();
+            } else if (i->opt->lopt == "max-evaluations") {
+                conf.max_evaluations = i->get_arg<std::size_t>();
+            } else if (i->opt->lopt == "target-recon") {
+                conf.target_recon = i->get_arg<float>();
+            } else if (i->opt->lopt == "cpu") {
+                conf.cpu = true;
             } else {
                 throw std::invalid_argument("Invalid option");
             }
@@ -102,6 +145,10 @@ Arguments parse_args(int argc, char **argv) {
         }
     }
 
+    if (conf.horizon > 0 && conf.budget <= 0.0f && conf.max_evaluations == 0) {
+        throw std::invalid_argument("Requires a budget or maximum evaluations");
+    }
+
     return conf;
 }
 
@@ -113,34 +160,46 @@ int main(int argc, char **argv) {
 
     Arguments args = parse_args(argc, argv);
 
+    /* Load the inputs and construct the BVH and point grid concurrently. */
+    AsyncResult<acc::BVHTree<uint, math::Vec3f>::Ptr> proxy_bvh_tree
+        = load_mesh_as_bvh_tree_async(args.proxy_mesh);
+    AsyncResult<mve::TriangleMesh::Ptr> proxy_cloud
+        = load_mesh_async(args.proxy_cloud);
+    float const cell_size = args.min_distance;
+    AsyncResult<PointGrid<uint>::Ptr> proxy_grid = then(proxy_cloud,
+        [cell_size] (mve::TriangleMesh::Ptr mesh) {
+            return build_point_grid(mesh, cell_size);
+        });
+
     int device = cacc::select_cuda_device(3, 5);
 
+    acc::BVHTree<uint, math::Vec3f>::Ptr bvh_tree = proxy_bvh_tree.get();
     cacc::BVHTree<cacc::DEVICE>::Ptr dbvh_tree;
-    {
-        acc::BVHTree<uint, math::Vec3f>::Ptr bvh_tree;
-        bvh_tree = load_mesh_as_bvh_tree(args.proxy_mesh);
-        dbvh_tree = cacc::BVHTree<cacc::DEVICE>::create<uint, math::Vec3f>(bvh_tree);
-    }
+    dbvh_tree = cacc::BVHTree<cacc::DEVICE>::create<uint, math::Vec3f>(bvh_tree);
 
     uint num_sverts;
+    std::vector<math::Vec3f> sverts;
+    acc::KDTree<3u, uint>::Ptr kd_tree;
     cacc::KDTree<3u, cacc::DEVICE>::Ptr dkd_tree;
     {
-        mve::TriangleMesh::Ptr sphere = generate_sphere_mesh(1.0f, 3u);
-        std::vector<math::Vec3f> const & verts = sphere->get_vertices();
-        num_sverts = verts.size();
-        acc::KDTree<3u, uint>::Ptr kd_tree = acc::KDTree<3, uint>::create(verts);
+        mve::TriangleMesh::Ptr sphere = generate_sphere_mesh(1.0f,
+            args.hist_res.sphere_subdivisions);
+        sverts = sphere->get_vertices();
+        num_sverts = sverts.size();
+        kd_tree = acc::KDTree<3, uint>::create(sverts);
         dkd_tree = cacc::KDTree<3u, cacc::DEVICE>::create<uint>(kd_tree);
     }
 
     cacc::PointCloud<cacc::DEVICE>::Ptr dcloud;
     {
         cacc::PointCloud<cacc::HOST>::Ptr cloud;
-        cloud = load_point_cloud(args.proxy_cloud);
+        cloud = load_point_cloud(proxy_cloud.get());
         dcloud = cacc::PointCloud<cacc::DEVICE>::create<cacc::HOST>(cloud);
     }
     uint num_verts = dcloud->cdata().num_vertices;
 
-    acc::KDTree<3, uint>::Ptr kd_tree(load_mesh_as_kd_tree(args.proxy_cloud));
+    /* Point grid of the proxy cloud for clearance checks. */
+    PointGrid<uint>::Ptr grid = proxy_grid.get();
 
     uint max_cameras = 20;
 
@@ -156,6 +215,7 @@ int main(int argc, char **argv) {
     int width = 1920;
     int height = 1080;
     cam.fill_calibration(calib.begin(), width, height);
+    CameraModel model = camera_model(cam, width, height);
 
     struct State {
         math::Vec3f pos;
@@ -166,6 +226,184 @@ int main(int argc, char **argv) {
     state.vel = math::Vec3f(1.0f, 0.0f, 0.0f) * 0.1f;
 
     std::vector<mve::CameraInfo> trajectory;
+
+    /* Receding horizon mode - after each waypoint the next waypoints are
+     * planned from the vehicle state within the budget (warm started with
+     * the remainder of the previous plan). The views of a plan are
+     * evaluated on the current reconstructabilities. */
+    if (args.horizon > 0) {
+        cudaStream_t stream;
+        cudaStreamCreate(&stream);
+
+        cacc::Array<float, cacc::DEVICE>::Ptr dcon_hist;
+        dcon_hist = cacc::Array<float, cacc::DEVICE>::create(num_sverts, stream);
+        cacc::Image<float, cacc::DEVICE>::Ptr dhist;
+        dhist = cacc::Image<float, cacc::DEVICE>::create(args.hist_res.width,
+            args.hist_res.height, stream);
+        cacc::Image<float, cacc::HOST>::Ptr hist;
+        hist = cacc::Image<float, cacc::HOST>::create(args.hist_res.width,
+            args.hist_res.height, stream);
+
+        /* Host copies for the CPU path - independent of the thread count. */
+        std::vector<math::Vec3f> verts;
+        std::vector<math::Vec3f> normals;
+        ObservationRays obs_rays;
+        std::vector<float> recons;
+        CameraModels models;
+        models.num_models = 1;
+        models.models[0] = model;
+        if (args.cpu) {
+            /* Normals have been computed by load_point_cloud. */
+            mve::TriangleMesh::ConstPtr mesh = proxy_cloud.get();
+            verts = mesh->get_vertices();
+            normals = mesh->get_vertex_normals();
+            obs_rays.resize(verts.size());
+            recons.assign(verts.size(), 0.0f);
+        }
+
+        /* Best (lowest) direction of the view's direction histogram. */
+        auto evaluate = [&] (math::Vec3f const & pos) -> HistogramDirection {
+            if (args.cpu) {
+                std::vector<float> sphere_hist(num_sverts, 0.0f);
+                populate_spherical_histogram(pos, args.max_distance,
+                    args.target_recon, *bvh_tree, verts, normals, *kd_tree,
+                    obs_rays, max_cameras, recons, &sphere_hist);
+                return best_direction(evaluate_camera_models(models, sverts,
+                    sphere_hist.data(), args.hist_res)[0]);
+            }
+
+            dcon_hist->null();
+            {
+                dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE));
+                dim3 block(KERNEL_BLOCK_SIZE);
+                populate_spherical_histogram<<<grid, block, 0, stream>>>(
+                    cacc::Vec3f(pos.begin()), args.max_distance, args.target_recon,
+                    dbvh_tree->accessor(), dcloud->cdata(), dkd_tree->accessor(),
+                    ddir_hist->cdata(), drecons->cdata(), dcon_hist->cdata());
+            }
+            {
+                dim3 grid(cacc::divup(args.hist_res.width, KERNEL_BLOCK_SIZE),
+                    args.hist_res.height);
+                dim3 block(KERNEL_BLOCK_SIZE);
+                evaluate_spherical_histogram<<<grid, block, 0, stream>>>(model,
+                    dkd_tree->accessor(), dcon_hist->cdata(), dhist->cdata());
+            }
+            *hist = *dhist;
+            hist->sync();
+
+            /* Same selection as the CPU path. */
+            cacc::Image<float, cacc::HOST>::Data data = hist->cdata();
+            mve::FloatImage::Ptr image = mve::FloatImage::create(data.width,
+                data.height, 1);
+            for (int y = 0; y < data.height; ++y) {
+                for (int x = 0; x < data.width; ++x) {
+                    image->at(x, y, 0) =
+                        data.data_ptr[y * data.pitch / sizeof(float) + x];
+                }
+            }
+            return best_direction(image);
+        };
+
+        /* Reduction of the reconstructability deficit, views violating the
+         * velocity, altitude or clearance constraints are infeasible. */
+        utp::RecedingHorizonPlanner::ScoreFunction score =
+            [&] (utp::State const & from, math::Vec3f const & pos,
+                math::Matrix3f * rot) -> float
+        {
+            if ((pos - from.pos).norm() > args.max_velocity) return 0.0f;
+            if (pos[2] < args.min_altitude || args.max_altitude < pos[2]) return 0.0f;
+
+            float penalty = 0.0f;
+            std::pair<uint, float> nn;
+            if (args.min_distance > 0.0f
+                && grid->find_nn(pos, &nn, 2.0f * args.min_distance)) {
+                if (nn.second < args.min_distance) return 0.0f;
+                penalty = 1.0f - (nn.second - args.min_distance) / args.min_distance;
+            }
+
+            HistogramDirection dir = evaluate(pos);
+            *rot = utp::rotation_from_spherical(dir.theta, dir.phi);
+            return -dir.value * (1.0f - penalty);
+        };
+
+        utp::RecedingHorizonPlanner::Options opts;
+        opts.horizon = args.horizon;
+        opts.max_evaluations = args.max_evaluations;
+        utp::RecedingHorizonPlanner planner(opts, score);
+
+        std::chrono::microseconds budget(
+            static_cast<std::int64_t>(args.budget * 1000.0f));
+
+        utp::State vstate;
+        vstate.pos = state.pos;
+        vstate.vel = state.vel;
+
+        std::size_t num_late = 0;
+        std::chrono::microseconds total_latency(0);
+        std::chrono::microseconds max_latency(0);
+        for (uint i = 0; i < args.num_views; ++i) {
+            utp::RecedingHorizonPlanner::Plan plan = planner.plan(vstate, budget);
+            total_latency += plan.latency;
+            max_latency = std::max(max_latency, plan.latency);
+            if (budget.count() > 0 && plan.latency > budget) num_late += 1;
+
+            if (plan.waypoints.empty() || plan.waypoints[0].score < 0.1f) break;
+
+            utp::Waypoint const & waypoint = plan.waypoints[0];
+            vstate.vel = waypoint.pos - vstate.pos;
+            vstate.pos = waypoint.pos;
+
+            math::Vec3f trans = -waypoint.rot * waypoint.pos;
+            std::copy(trans.begin(), trans.end(), cam.trans);
+            std::copy(waypoint.rot.begin(), waypoint.rot.end(), cam.rot);
+
+            float avg_recon;
+            if (args.cpu) {
+                std::vector<mve::CameraInfo> cams(1, cam);
+                update_observation_rays(true, group_views(cams, width, height)[0],
+                    args.max_distance, width, height, *bvh_tree, verts, normals,
+                    max_cameras, &obs_rays);
+                evaluate_observation_rays(obs_rays, &recons);
+
+                double sum = 0.0;
+                for (float recon : recons) sum += recon;
+                avg_recon = sum / recons.size();
+            } else {
+                math::Matrix4f w2c;
+                cam.fill_world_to_cam(w2c.begin());
+                dim3 grid(cacc::divup(num_verts, KERNEL_BLOCK_SIZE));
+                dim3 block(KERNEL_BLOCK_SIZE);
+                update_observation_rays<<<grid, block, 0, stream>>>(
+                    true, cacc::Vec3f(vstate.pos.begin()), args.max_distance,
+                    cacc::Mat4f(w2c.begin()), cacc::Mat3f(calib.begin()), width, height,
+                    dbvh_tree->accessor(), dcloud->cdata(), ddir_hist->cdata());
+                evaluate_observation_rays<<<grid, block, 0, stream>>>(
+                    ddir_hist->cdata(), drecons->cdata());
+                cudaStreamSynchronize(stream);
+
+                avg_recon = cacc::reduction::sum(drecons) / num_verts;
+            }
+
+            std::cout << i << " " << avg_recon << " " << plan.evaluations
+                << " " << plan.latency.count() / 1000.0f << "ms" << std::endl;
+
+            trajectory.push_back(cam);
+        }
+
+        if (!trajectory.empty()) {
+            std::cout << "Planning latency: "
+                << total_latency.count() / 1000.0f / trajectory.size() << "ms avg, "
+                << max_latency.count() / 1000.0f << "ms max, "
+                << num_late << " plans over budget" << std::endl;
+        }
+
+        cudaStreamDestroy(stream);
+
+        utp::save_trajectory(trajectory, args.out_trajectory);
+
+        return EXIT_SUCCESS;
+    }
+
     struct ViewCandidate {
         math::Vec3f pos;
         math::Matrix3f rot;
@@ -174,24 +412,9 @@ int main(int argc, char **argv) {
     std::array<float, 27> view_scores;
     std::mt19937 gen(12345);
 
-    std::array<math::Vec3f, 27> offsets;
-    std::array<float, 27> oweights;
-    for (int z = 0; z < 3; ++z) {
-        for (int y = 0; y < 3; ++y) {
-            for (int x = 0; x < 3; ++x) {
-                float r = 1.0f + (z - 1) * 0.25f;
-                float phi = (y - 1) * (pi / 8.0f);
-                float theta = pi / 2 + (x - 1) * (pi / 8.0f);
-
-                int idx = (z * 3 + y) * 3 + x;
-                offsets[idx][0] = r * std::sin(theta) * std::cos(phi);
-                offsets[idx][1] = r * std::sin(theta) * std::sin(phi);
-                offsets[idx][2] = r * std::cos(theta);
-
-                oweights[idx] = 1.0f - (math::Vec3f(1.0f, 0.0f, 0.0f) - offsets[idx]).norm() / 10.0f;
-            }
-        }
-    }
+    utp::MotionPrimitives prims = utp::motion_primitives();
+    std::array<math::Vec3f, 27> const & offsets = prims.offsets;
+    std::array<float, 27> const & oweights = prims.weights;
 
 #if 0
     mve::TriangleMesh::Ptr mesh = mve::TriangleMesh::create();
@@ -215,9 +438,11 @@ int main(int argc, char **argv) {
         dcon_hist = cacc::Array<float, cacc::DEVICE>::create(num_sverts, stream);
 
         cacc::Image<float, cacc::DEVICE>::Ptr dhist;
-        dhist = cacc::Image<float, cacc::DEVICE>::create(128, 45, stream);
+        dhist = cacc::Image<float, cacc::DEVICE>::create(args.hist_res.width,
+            args.hist_res.height, stream);
         cacc::Image<float, cacc::HOST>::Ptr hist;
-        hist = cacc::Image<float, cacc::HOST>::create(128, 45, stream);
+        hist = cacc::Image<float, cacc::HOST>::create(args.hist_res.width,
+            args.hist_res.height, stream);
 
         float avg_recon = 1.0f;
 
@@ -257,7 +482,7 @@ int main(int argc, char **argv) {
                 if ((pos - state.pos).norm() > args.max_velocity) continue;
                 if (pos[2] < args.min_altitude || args.max_altitude < pos[2]) continue;
                 std::pair<uint, float> nn;
-                if (kd_tree->find_nn(pos, &nn, 2.0f * args.min_distance)) {
+                if (grid->find_nn(pos, &nn, 2.0f * args.min_distance)) {
                     if (nn.second < args.min_distance) continue;
                     penalties += 1.0f - (nn.second - args.min_distance) / args.min_distance;
                 }
@@ -275,10 +500,10 @@ int main(int argc, char **argv) {
                 }
 
                 {
-                    dim3 grid(cacc::divup(128, KERNEL_BLOCK_SIZE), 45);
+                    dim3 grid(cacc::divup(args.hist_res.width, KERNEL_BLOCK_SIZE),
+                        args.hist_res.height);
                     dim3 block(KERNEL_BLOCK_SIZE);
-                    evaluate_spherical_histogram<<<grid, block, 0, stream>>>(
-                        cacc::Mat3f(calib.begin()), width, height,
+                    evaluate_spherical_histogram<<<grid, block, 0, stream>>>(model,
                         dkd_tree->accessor(), dcon_hist->cdata(), dhist->cdata());
                 }
 
@@ -0,0 +1,13 @@
+local mve = require "mve"
+
+project "query_viewpoints"
+    kind "ConsoleApp"
+    language "C++"
+
+    buildoptions { "-fopenmp" }
+
+    files { "query_viewpoints.cpp" }
+
+    mve.use({ "util" })
+
+    links { "gomp" }
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <sstream>
+#include <iostream>
+
+#include "util/timer.h"
+#include "util/system.h"
+#include "util/arguments.h"
+
+#include "mve/mesh_io_ply.h"
+
+#include "geom/volume_io.h"
+#include "geom/viewpoint_index.h"
+
+struct Arguments {
+    std::string recon_cloud;
+    std::string obs_cloud;
+    std::string guidance_volume;
+    std::vector<std::string> queries;
+    float target_recon;
+    float cell_size;
+};
+
+Arguments parse_args(int argc, char **argv) {
+    util::Arguments args;
+    args.set_exit_on_error(true);
+    args.set_nonopt_minnum(1);
+    args.set_nonopt_maxnum(1);
+    args.set_usage("Usage: " + std::string(argv[0]) + " [OPTS] RECON_CLOUD");
+    args.set_description("Answers region queries on the per vertex "
+        "reconstructability (see evaluate_trajectory -r) and the best "
+        "viewpoints of a guidance volume. Queries are read from stdin "
+        "(one per line) unless given as options:\n"
+        "  box K X0 Y0 Z0 X1 Y1 Z1\n"
+        "  sphere K X Y Z R\n"
+        "  polygon K ZMIN ZMAX X0 Y0 X1 Y1 X2 Y2 ...\n"
+        "  reload (updates the indices incrementally from the files)\n"
+        "K is the number of reported viewpoints and vertices.");
+    args.add_option('o', "observations", true,
+        "observation count cloud (see evaluate_trajectory -o)");
+    args.add_option('g', "guidance-volume", true, "guidance volume");
+    args.add_option('q', "query", true, "query (can be given multiple times)");
+    args.add_option('\0', "target-recon", true, "desired reconstructability [3.0]");
+    args.add_option('\0', "cell-size", true, "index cell size [estimated]");
+    args.parse(argc, argv);
+
+    Arguments conf;
+    conf.recon_cloud = args.get_nth_nonopt(0);
+    conf.target_recon = 3.0f;
+    conf.cell_size = 0.0f;
+
+    for (util::ArgResult const* i = args.next_option();
+         i != 0; i = args.next_option()) {
+        switch (i->opt->sopt) {
+        case 'o':
+            conf.obs_cloud = i->arg;
+        break;
+        case 'g':
+            conf.guidance_volume = i->arg;
+        break;
+        case 'q':
+            conf.queries.push_back(i->arg);
+        break;
+        case '\0':
+            if (i->opt->lopt == "target-recon") {
+                conf.target_recon = i->get_arg<float>();
+            } else if (i->opt->lopt == "cell-size") {
+                conf.cell_size = i->get_arg<float>();
+            } else {
+                throw std::invalid_argument("Invalid option");
+            }
+        break;
+        default:
+            throw std::invalid_argument("Invalid option");
+        }
+    }
+
+    return conf;
+}
+
+float const pi = std::acos(-1.0f);
+
+mve::TriangleMesh::Ptr
+load_cloud(std::string const & path) {
+    mve::TriangleMesh::Ptr cloud;
+    try {
+        cloud = mve::geom::load_ply_mesh(path);
+    } catch (std::exception& e) {
+        std::cerr << "Could not load cloud: " << e.what() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (!cloud->has_vertex_values()) {
+        std::cerr << "Cloud " << path << " has no vertex values" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    return cloud;
+}
+
+Volume<std::uint32_t>::Ptr
+load_guidance_volume(std::string const & path) {
+    Volume<std::uint32_t>::Ptr volume;
+    try {
+        volume = load_volume<std::uint32_t>(path, true);
+    } catch (std::exception& e) {
+        std::cerr << "Could not load volume: " << e.what() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    return volume;
+}
+
+std::vector<float>
+load_observations(Arguments const & args) {
+    if (args.obs_cloud.empty()) return std::vector<float>();
+    return load_cloud(args.obs_cloud)->get_vertex_values();
+}
+
+bool
+parse_region(std::string const & type, std::istream & in, QueryRegion * region) {
+    if (type == "box") {
+        math::Vec3f min, max;
+        in >> min[0] >> min[1] >> min[2] >> max[0] >> max[1] >> max[2];
+        *region = QueryRegion::box(min, max);
+    } else if (type == "sphere") {
+        math::Vec3f center;
+        float radius;
+        in >> center[0] >> center[1] >> center[2] >> radius;
+        *region = QueryRegion::sphere(center, radius);
+    } else if (type == "polygon") {
+        float zmin, zmax;
+        in >> zmin >> zmax;
+        std::vector<math::Vec2f> polygon;
+        math::Vec2f v;
+        while (in >> v[0] >> v[1]) polygon.push_back(v);
+        if (polygon.size() < 3) return false;
+        in.clear();
+        *region = QueryRegion::prism(polygon, zmin, zmax);
+    } else {
+        return false;
+    }
+    return !in.fail();
+}
+
+int main(int argc, char **argv) {
+    util::system::register_segfault_handler();
+    util::system::print_build_timestamp(argv[0]);
+
+    Arguments args = parse_args(argc, argv);
+
+    util::WallTimer timer;
+
+    mve::TriangleMesh::Ptr cloud = load_cloud(args.recon_cloud);
+    ReconstructabilityIndex::Ptr recon_index;
+    try {
+        recon_index = ReconstructabilityIndex::create(cloud->get_vertices(),
+            cloud->get_vertex_values(), load_observations(args),
+            args.target_recon, args.cell_size);
+    } catch (std::exception& e) {
+        std::cerr << "Could not create index: " << e.what() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    ViewpointIndex::Ptr viewpoint_index;
+    if (!args.guidance_volume.empty()) {
+        Volume<std::uint32_t>::Ptr volume = load_guidance_volume(args.guidance_volume);
+        viewpoint_index = ViewpointIndex::create(volume, args.cell_size);
+    }
+
+    std::cout << "Indexed " << recon_index->num_points() << " vertices ("
+        << recon_index->num_cells() << " cells)";
+    if (viewpoint_index != nullptr) {
+        std::cout << " and " << viewpoint_index->num_points() << " viewpoints ("
+            << viewpoint_index->num_cells() << " cells)";
+    }
+    std::cout << " in " << timer.get_elapsed() << "ms" << std::endl;
+
+    auto execute = [&] (std::string const & query) {
+        std::stringstream in(query);
+        std::string type;
+        if (!(in >> type)) return;
+
+        timer.reset();
+
+        if (type == "reload") {
+            std::size_t num_changed = recon_index->update(
+                load_cloud(args.recon_cloud)->get_vertex_values(),
+                load_observations(args));
+            std::cout << "Updated " << num_changed << " vertices";
+            if (viewpoint_index != nullptr) {
+                num_changed = viewpoint_index->update(
+                    load_guidance_volume(args.guidance_volume));
+                std::cout << " and " << num_changed << " viewpoints";
+            }
+            std::cout << " in " << timer.get_elapsed() << "ms" << std::endl;
+            return;
+        }
+
+        std::size_t k;
+        QueryRegion region;
+        if (!(in >> k) || !parse_region(type, in, &region)) {
+            std::cerr << "Invalid query: " << query << std::endl;
+            return;
+        }
+
+        ReconstructabilityStats stats = recon_index->stats(region);
+        std::vector<std::uint32_t> worst = recon_index->worst(region, k);
+
+        std::pair<std::size_t, float> vstats(0, 0.0f);
+        std::vector<Viewpoint> best;
+        if (viewpoint_index != nullptr) {
+            vstats = viewpoint_index->stats(region);
+            best = viewpoint_index->best(region, k);
+        }
+
+        std::size_t elapsed = timer.get_elapsed();
+
+        std::vector<math::Vec3f> const & verts = cloud->get_vertices();
+        std::cout << "Vertices: " << stats.num_vertices << '\n';
+        if (stats.num_vertices != 0) {
+            std::cout << "  insufficient: " << stats.num_insufficient
+                << " (" << 100.0f * stats.num_insufficient / stats.num_vertices << "%)\n"
+                << "  unobserved: " << stats.num_unobserved << '\n'
+                << "  reconstructability: " << stats.avg_recon()
+                << " [" << stats.min_recon << ", " << stats.max_recon << "]\n"
+                << "  observations: " << stats.avg_observations() << '\n';
+        }
+        for (std::uint32_t id : worst) {
+            std::cout << "  " << id << ' ' << verts[id] << ' '
+                << recon_index->reconstructability(id) << '\n';
+        }
+
+        if (viewpoint_index != nullptr) {
+            std::cout << "Viewpoints: " << vstats.first << '\n';
+            for (Viewpoint const & viewpoint : best) {
+                std::cout << "  " << viewpoint.pos << ' ' << viewpoint.value << ' '
+                    << viewpoint.theta * 180.0f / pi << ' '
+                    << viewpoint.phi * 180.0f / pi << '\n';
+            }
+        }
+        std::cout << "Took " << elapsed << "ms" << std::endl;
+    };
+
+    if (!args.queries.empty()) {
+        for (std::string const & query : args.queries) execute(query);
+    } else {
+        std::string line;
+        while (std::getline(std::cin, line)) execute(line);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,601 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef RUN_PIPELINE_PIPELINE_HEADER
+#define RUN_PIPELINE_PIPELINE_HEADER
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+#include <condition_variable>
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "util/file_system.h"
+#include "util/tokenizer.h"
+
+#include "util/hash.h"
+
+enum Status {
+    PENDING = 0,
+    CACHED = 1,
+    RUNNING = 2,
+    DONE = 3,
+    FAILED = 4,
+    SKIPPED = 5
+};
+
+struct Stage {
+    std::string name;
+    std::string command;
+    uint threads;
+    std::size_t memory;
+    bool gpu;
+    std::vector<std::size_t> deps;
+    std::vector<std::string> outputs;
+    std::string key;
+    Status status;
+};
+
+struct Pipeline {
+    std::string dir;
+    std::map<std::string, std::string> params;
+    std::vector<Stage> stages;
+};
+
+/* Directories of the cache - completed stages are stored in objects under
+ * their key, stages are executed in tmp and logs of failed stages are kept
+ * in logs. */
+struct Cache {
+    std::string dir;
+    std::string objects_dir;
+    std::string tmp_dir;
+    std::string logs_dir;
+};
+
+struct Limits {
+    uint max_threads;
+    std::size_t max_memory;
+    uint max_gpu_jobs;
+};
+
+typedef std::function<std::string(std::string const &, std::string const &)>
+    Resolver;
+
+/* Replaces all ${KIND:NAME} references of the command. */
+inline std::string
+substitute(std::string const & command, Resolver const & resolve) {
+    std::string ret;
+    std::size_t pos = 0;
+    while (true) {
+        std::size_t beg = command.find("${", pos);
+        if (beg == std::string::npos) break;
+        std::size_t end = command.find('}', beg);
+        std::size_t sep = command.find(':', beg);
+        if (end == std::string::npos || sep == std::string::npos || sep > end) {
+            throw std::runtime_error("Malformed reference in: " + command);
+        }
+        ret.append(command, pos, beg - pos);
+        ret.append(resolve(command.substr(beg + 2, sep - beg - 2),
+            command.substr(sep + 1, end - sep - 1)));
+        pos = end + 1;
+    }
+    ret.append(command, pos, std::string::npos);
+    return ret;
+}
+
+inline Pipeline
+load_pipeline(std::string const & path) {
+    std::ifstream in(path.c_str());
+    if (!in.good()) {
+        throw std::runtime_error("Could not open pipeline " + path);
+    }
+
+    Pipeline pipeline;
+    pipeline.dir = util::fs::dirname(util::fs::abspath(path.c_str()));
+
+    std::string line;
+    for (std::size_t lineno = 1; std::getline(in, line); ++lineno) {
+        std::string location = path + ":" + std::to_string(lineno) + ": ";
+
+        std::size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+
+        if (first != 0) {
+            if (pipeline.stages.empty()) {
+                throw std::runtime_error(location + "Command without stage");
+            }
+            std::string & command = pipeline.stages.back().command;
+            std::size_t last = line.find_last_not_of(" \t\r");
+            if (!command.empty()) command += ' ';
+            command += line.substr(first, last - first + 1);
+            continue;
+        }
+
+        util::Tokenizer tok;
+        tok.split(line);
+        std::vector<std::string> tokens;
+        for (std::string const & token : tok) {
+            if (!token.empty()) tokens.push_back(token);
+        }
+
+        if (tokens[0] == "param") {
+            if (tokens.size() < 3) {
+                throw std::runtime_error(location + "Expected param NAME VALUE");
+            }
+            std::string value = tokens[2];
+            for (std::size_t i = 3; i < tokens.size(); ++i) {
+                value += ' ' + tokens[i];
+            }
+            pipeline.params[tokens[1]] = value;
+        } else if (tokens[0] == "stage") {
+            if (tokens.size() < 2) {
+                throw std::runtime_error(location + "Expected stage NAME");
+            }
+
+            Stage stage;
+            stage.name = tokens[1];
+            stage.threads = 0;
+            stage.memory = 0;
+            stage.gpu = false;
+            stage.status = PENDING;
+            for (std::size_t i = 2; i < tokens.size(); ++i) {
+                if (tokens[i] == "gpu") {
+                    stage.gpu = true;
+                } else if (tokens[i].compare(0, 8, "threads=") == 0) {
+                    stage.threads = std::stoul(tokens[i].substr(8));
+                } else if (tokens[i].compare(0, 7, "memory=") == 0) {
+                    stage.memory = std::stoull(tokens[i].substr(7));
+                } else {
+                    throw std::runtime_error(location
+                        + "Invalid stage attribute " + tokens[i]);
+                }
+            }
+
+            for (Stage const & other : pipeline.stages) {
+                if (other.name != stage.name) continue;
+                throw std::runtime_error(location
+                    + "Duplicate stage " + stage.name);
+            }
+            pipeline.stages.push_back(stage);
+        } else {
+            throw std::runtime_error(location + "Unknown keyword " + tokens[0]);
+        }
+    }
+
+    /* Dependencies and outputs - stages may only reference stages defined
+     * before them, the definition order is thus a topological order. */
+    for (std::size_t i = 0; i < pipeline.stages.size(); ++i) {
+        Stage & stage = pipeline.stages[i];
+        if (stage.command.empty()) {
+            throw std::runtime_error("Stage " + stage.name + " has no command");
+        }
+
+        substitute(stage.command, [&] (std::string const & kind,
+                std::string const & name) -> std::string {
+            if (kind == "output") {
+                stage.outputs.push_back(name);
+            } else if (kind != "input" && kind != "param") {
+                auto it = std::find_if(pipeline.stages.begin(),
+                    pipeline.stages.begin() + i,
+                    [&kind] (Stage const & other) { return other.name == kind; });
+                if (it == pipeline.stages.begin() + i) {
+                    throw std::runtime_error("Stage " + stage.name
+                        + " references unknown or later stage " + kind);
+                }
+                stage.deps.push_back(it - pipeline.stages.begin());
+            }
+            return std::string();
+        });
+
+        std::sort(stage.deps.begin(), stage.deps.end());
+        stage.deps.erase(std::unique(stage.deps.begin(), stage.deps.end()),
+            stage.deps.end());
+    }
+
+    /* Verify referenced outputs. */
+    for (Stage const & stage : pipeline.stages) {
+        substitute(stage.command, [&] (std::string const & kind,
+                std::string const & name) -> std::string {
+            if (kind == "output" || kind == "input" || kind == "param") {
+                return std::string();
+            }
+            for (Stage const & other : pipeline.stages) {
+                if (other.name != kind) continue;
+                if (std::find(other.outputs.begin(), other.outputs.end(), name)
+                    == other.outputs.end()) {
+                    throw std::runtime_error("Stage " + stage.name
+                        + " references undeclared output " + kind + ":" + name);
+                }
+            }
+            return std::string();
+        });
+    }
+
+    return pipeline;
+}
+
+/* Content hashes of input files, reused as long as size and modification
+ * time (nanoseconds) of the file do not change. */
+class InputIndex {
+private:
+    struct Entry {
+        std::string hash;
+        long long size;
+        long long mtime;
+    };
+    std::string path;
+    std::map<std::string, Entry> entries;
+
+    std::string hash_file(std::string const & filename) {
+        std::ifstream in(filename.c_str(), std::ios::binary);
+        if (!in.good()) {
+            throw std::runtime_error("Could not open input " + filename);
+        }
+
+        Hash hash;
+        std::vector<char> buffer(1 << 20);
+        while (in.good()) {
+            in.read(buffer.data(), buffer.size());
+            hash.update(buffer.data(), in.gcount());
+        }
+        return hash.hex();
+    }
+
+public:
+    InputIndex(std::string const & path) : path(path) {
+        std::ifstream in(path.c_str());
+        std::string hash, filename;
+        long long size, mtime;
+        while (in >> hash >> size >> mtime && std::getline(in >> std::ws, filename)) {
+            entries[filename] = {hash, size, mtime};
+        }
+    }
+
+    void save(void) const {
+        std::ofstream out(path.c_str());
+        for (auto const & entry : entries) {
+            out << entry.second.hash << ' ' << entry.second.size << ' '
+                << entry.second.mtime << ' ' << entry.first << '\n';
+        }
+        if (!out.good()) {
+            throw std::runtime_error("Could not write input index " + path);
+        }
+    }
+
+    /* Directories (e.g. scenes) are hashed recursively. */
+    std::string hash(std::string const & filename) {
+        struct stat st;
+        if (::stat(filename.c_str(), &st) != 0) {
+            throw std::runtime_error("Input " + filename + " does not exist");
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            util::fs::Directory dir(filename);
+            std::sort(dir.begin(), dir.end());
+
+            Hash hash;
+            for (util::fs::File const & file : dir) {
+                hash.update(file.name);
+                hash.update(this->hash(file.get_absolute_name()));
+            }
+            return hash.hex();
+        }
+
+        long long mtime = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+        auto it = entries.find(filename);
+        if (it != entries.end() && it->second.size == st.st_size
+            && it->second.mtime == mtime) {
+            return it->second.hash;
+        }
+
+        Entry entry = {hash_file(filename), st.st_size, mtime};
+        entries[filename] = entry;
+        return entry.hash;
+    }
+};
+
+inline std::string
+input_path(Pipeline const & pipeline, std::string const & path) {
+    if (!path.empty() && path[0] == '/') return path;
+    return util::fs::join_path(pipeline.dir, path);
+}
+
+inline std::string
+param_value(Pipeline const & pipeline, Stage const & stage,
+    std::string const & name)
+{
+    auto it = pipeline.params.find(name);
+    if (it == pipeline.params.end()) {
+        throw std::runtime_error("Stage " + stage.name
+            + " references undefined parameter " + name);
+    }
+    return it->second;
+}
+
+/* Resolves the executable (first word) of the command like the shell -
+ * returns an empty string if it cannot be found. */
+inline std::string
+find_executable(std::string const & command, std::string const & search_path) {
+    std::size_t beg = command.find_first_not_of(" \t");
+    if (beg == std::string::npos) return std::string();
+    std::size_t end = command.find_first_of(" \t", beg);
+    std::string name = command.substr(beg, end - beg);
+
+    if (name.find('/') != std::string::npos) {
+        return ::access(name.c_str(), X_OK) == 0 ? name : std::string();
+    }
+
+    util::Tokenizer dirs;
+    dirs.split(search_path, ':');
+    for (std::string const & dir : dirs) {
+        if (dir.empty()) continue;
+        std::string filename = util::fs::join_path(dir, name);
+        struct stat st;
+        if (::stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (::access(filename.c_str(), X_OK) == 0) return filename;
+    }
+    return std::string();
+}
+
+/* The key covers everything that determines the outputs of a stage - its
+ * command, the executable (rebuilds invalidate the outputs), parameters,
+ * inputs and the keys of upstream stages. Executables are searched in
+ * search_path. */
+inline void
+compute_keys(Pipeline * pipeline, InputIndex * index,
+    std::string const & search_path)
+{
+    for (Stage & stage : pipeline->stages) {
+        std::string command = substitute(stage.command, [&] (
+                std::string const & kind, std::string const & name) -> std::string {
+            if (kind == "input") {
+                return "${input:" + index->hash(input_path(*pipeline, name)) + "}";
+            } else if (kind == "output") {
+                return "${output:" + name + "}";
+            } else if (kind == "param") {
+                return param_value(*pipeline, stage, name);
+            } else {
+                for (Stage const & other : pipeline->stages) {
+                    if (other.name != kind) continue;
+                    return "${" + other.key + ":" + name + "}";
+                }
+                return std::string();
+            }
+        });
+
+        Hash hash;
+        hash.update(command);
+        std::string executable = find_executable(command, search_path);
+        if (!executable.empty()) hash.update(index->hash(executable));
+        stage.key = hash.hex();
+    }
+}
+
+inline std::string
+stage_command(Pipeline const & pipeline, Stage const & stage,
+    std::string const & objects_dir, std::string const & out_dir)
+{
+    return substitute(stage.command, [&] (
+            std::string const & kind, std::string const & name) -> std::string {
+        if (kind == "input") {
+            return input_path(pipeline, name);
+        } else if (kind == "output") {
+            return util::fs::join_path(out_dir, name);
+        } else if (kind == "param") {
+            return param_value(pipeline, stage, name);
+        } else {
+            for (Stage const & other : pipeline.stages) {
+                if (other.name != kind) continue;
+                std::string dir = util::fs::join_path(objects_dir, other.key);
+                return util::fs::join_path(dir, name);
+            }
+            return std::string();
+        }
+    });
+}
+
+/* Removes the directory and its contents. */
+inline bool
+remove_directory(std::string const & path) {
+    bool success = true;
+    util::fs::Directory dir(path);
+    for (util::fs::File const & file : dir) {
+        std::string filename = file.get_absolute_name();
+        if (file.is_dir) {
+            success = remove_directory(filename) && success;
+        } else {
+            success = util::fs::unlink(filename.c_str()) && success;
+        }
+    }
+    return util::fs::rmdir(path.c_str()) && success;
+}
+
+inline Cache
+open_cache(std::string const & path) {
+    Cache cache;
+    cache.dir = util::fs::abspath(path.c_str());
+    cache.objects_dir = util::fs::join_path(cache.dir, "objects");
+    cache.tmp_dir = util::fs::join_path(cache.dir, "tmp");
+    cache.logs_dir = util::fs::join_path(cache.dir, "logs");
+    for (std::string const & dir : {cache.dir, cache.objects_dir,
+            cache.tmp_dir, cache.logs_dir}) {
+        if (util::fs::dir_exists(dir.c_str())) continue;
+        if (!util::fs::mkdir(dir.c_str())) {
+            throw std::runtime_error("Could not create directory " + dir);
+        }
+    }
+    return cache;
+}
+
+/* Marks the stages whose outputs are present in the cache. */
+inline void
+lookup_stages(Pipeline * pipeline, Cache const & cache) {
+    for (Stage & stage : pipeline->stages) {
+        std::string dir = util::fs::join_path(cache.objects_dir, stage.key);
+        stage.status = util::fs::dir_exists(dir.c_str()) ? CACHED : PENDING;
+    }
+}
+
+/* Executes a stage in a temporary directory, which is moved into the cache
+ * on success and removed otherwise (the log is kept in the logs directory).
+ * Returns whether the stage succeeded, log holds the log file. */
+inline bool
+execute_stage(Pipeline const & pipeline, Stage const & stage,
+    Cache const & cache, uint threads, std::string * log)
+{
+    std::string out_dir = util::fs::join_path(cache.tmp_dir,
+        stage.key + "." + std::to_string(getpid()));
+    *log = util::fs::join_path(out_dir, "log.txt");
+
+    bool success = util::fs::mkdir(out_dir.c_str());
+    if (!success) {
+        *log = out_dir;
+        return false;
+    }
+
+    std::string command = stage_command(pipeline, stage,
+        cache.objects_dir, out_dir);
+    std::ofstream out(util::fs::join_path(out_dir, "command.txt").c_str());
+    out << command << std::endl;
+    out.close();
+
+    command = "OMP_NUM_THREADS=" + std::to_string(threads) + " "
+        + command + " > " + *log + " 2>&1";
+    int ret = std::system(command.c_str());
+    success = ret != -1 && WIFEXITED(ret) && WEXITSTATUS(ret) == 0;
+
+    for (std::string const & output : stage.outputs) {
+        if (!success) break;
+        std::string filename = util::fs::join_path(out_dir, output);
+        success = util::fs::exists(filename.c_str());
+    }
+
+    std::string dir = util::fs::join_path(cache.objects_dir, stage.key);
+    if (success && !util::fs::dir_exists(dir.c_str())) {
+        success = util::fs::rename(out_dir.c_str(), dir.c_str());
+        if (success) {
+            *log = util::fs::join_path(dir, "log.txt");
+            return true;
+        }
+    }
+
+    if (success) {
+        /* Another run finished the same stage. */
+        *log = util::fs::join_path(dir, "log.txt");
+    } else {
+        std::string failed_log = util::fs::join_path(cache.logs_dir,
+            stage.name + "." + stage.key + ".txt");
+        if (util::fs::rename(log->c_str(), failed_log.c_str())) {
+            *log = failed_log;
+        }
+    }
+    remove_directory(out_dir);
+
+    return success;
+}
+
+/* Executes the pending stages once their dependencies are available -
+ * independent stages run concurrently within the limits. Stages of failed
+ * dependencies are skipped. */
+inline void
+run_pipeline(Pipeline * pipeline, Cache const & cache, Limits const & limits) {
+    std::vector<Stage> & stages = pipeline->stages;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint used_threads = 0;
+    std::size_t used_memory = 0;
+    uint used_gpus = 0;
+    uint running = 0;
+
+    auto stage_threads = [&limits] (Stage const & stage) -> uint {
+        return stage.threads ? std::min(stage.threads, limits.max_threads)
+            : limits.max_threads;
+    };
+
+    auto execute = [&] (std::size_t idx) {
+        Stage const & stage = stages[idx];
+        uint threads = stage_threads(stage);
+
+        std::string log;
+        bool success = execute_stage(*pipeline, stage, cache, threads, &log);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::cout << stage.name << ' ' << (success ? "done" : "failed");
+        if (!success) std::cout << " (see " << log << ")";
+        std::cout << std::endl;
+
+        stages[idx].status = success ? DONE : FAILED;
+        used_threads -= threads;
+        used_memory -= stage.memory;
+        used_gpus -= stage.gpu;
+        running -= 1;
+        cv.notify_one();
+    };
+
+    std::vector<std::thread> workers;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            bool pending = false;
+            for (std::size_t i = 0; i < stages.size(); ++i) {
+                Stage & stage = stages[i];
+                if (stage.status != PENDING) continue;
+
+                bool ready = true;
+                bool broken = false;
+                for (std::size_t dep : stage.deps) {
+                    Status status = stages[dep].status;
+                    broken = broken || status == FAILED || status == SKIPPED;
+                    ready = ready && (status == CACHED || status == DONE);
+                }
+                if (broken) {
+                    stage.status = SKIPPED;
+                    std::cout << stage.name << " skipped" << std::endl;
+                    continue;
+                }
+                pending = true;
+                if (!ready) continue;
+
+                uint threads = stage_threads(stage);
+                /* Stages exceeding the limits are executed exclusively. */
+                bool fits = running == 0 || (
+                    used_threads + threads <= limits.max_threads
+                    && used_memory + stage.memory <= limits.max_memory
+                    && (!stage.gpu || used_gpus < limits.max_gpu_jobs));
+                if (!fits) continue;
+
+                used_threads += threads;
+                used_memory += stage.memory;
+                used_gpus += stage.gpu;
+                running += 1;
+                stage.status = RUNNING;
+                std::cout << stage.name << " running" << std::endl;
+                workers.emplace_back(execute, i);
+            }
+
+            if (!pending && running == 0) break;
+            cv.wait(lock);
+        }
+    }
+
+    for (std::thread & worker : workers) worker.join();
+}
+
+#endif /* RUN_PIPELINE_PIPELINE_HEADER */
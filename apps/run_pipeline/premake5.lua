@@ -0,0 +1,9 @@
+local mve = require "mve"
+
+project "run_pipeline"
+    kind "ConsoleApp"
+    language "C++"
+
+    files { "run_pipeline.cpp" }
+
+    mve.use({ "util" })
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <map>
+#include <thread>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+#include <unistd.h>
+
+#include "util/system.h"
+#include "util/arguments.h"
+#include "util/file_system.h"
+
+#include "pipeline.h"
+
+static char const * status_strings[] = {
+    "pending", "cached", "running", "done", "failed", "skipped"
+};
+
+struct Arguments {
+    std::string pipeline;
+    std::string cache;
+    std::string input_dir;
+    std::string link_dir;
+    std::string bin_dir;
+    std::map<std::string, std::string> params;
+    uint max_threads;
+    std::size_t max_memory;
+    uint max_gpu_jobs;
+    bool dry_run;
+    bool force;
+};
+
+Arguments parse_args(int argc, char **argv) {
+    util::Arguments args;
+    args.set_exit_on_error(true);
+    args.set_nonopt_minnum(2);
+    args.set_nonopt_maxnum(2);
+    args.set_usage("Usage: " + std::string(argv[0]) + " [OPTS] PIPELINE CACHE_DIR");
+    args.set_description("Runs the stages of the pipeline description that are "
+        "not up to date. Stage outputs are stored in the cache directory under "
+        "a key derived from the stage's command, its executable, parameters, "
+        "the contents of its inputs and the keys of the stages it depends on. "
+        "See res/pipelines/uavmvs.pipeline for the capture planning pipeline.\n\n"
+        "Pipeline descriptions consist of parameter defaults\n"
+        "  param NAME VALUE\n"
+        "and stages\n"
+        "  stage NAME [threads=N] [memory=MB] [gpu]\n"
+        "      COMMAND (indented, may span multiple lines)\n"
+        "Commands may reference ${input:PATH} (relative to the input directory), "
+        "${output:NAME}, ${param:NAME} and ${STAGE:NAME} (output NAME of a "
+        "previously defined stage). Lines starting with # are ignored.");
+    args.set_helptext_indent(24);
+    args.add_option('D', "define", true, "set parameter NAME=VALUE");
+    args.add_option('i', "input-dir", true, "directory of the inputs "
+        "[directory of the pipeline]");
+    args.add_option('l', "link-dir", true, "link stage outputs into directory");
+    args.add_option('b', "bin-dir", true, "directory of the executables "
+        "[" __ROOT__ "/build/release]");
+    args.add_option('j', "max-threads", true, "maximum number of threads "
+        "used by concurrent stages [hardware concurrency]");
+    args.add_option('m', "max-memory", true, "maximum memory (MB) "
+        "used by concurrent stages [physical memory]");
+    args.add_option('\0', "max-gpu-jobs", true, "maximum number of "
+        "concurrent gpu stages [1]");
+    args.add_option('n', "dry-run", false, "only print the stage status");
+    args.add_option('f', "force", false, "ignore cached outputs");
+    args.parse(argc, argv);
+
+    Arguments conf;
+    conf.pipeline = args.get_nth_nonopt(0);
+    conf.cache = args.get_nth_nonopt(1);
+    conf.bin_dir = util::fs::join_path(__ROOT__, "build/release");
+    conf.max_threads = std::max(1u, std::thread::hardware_concurrency());
+    conf.max_memory = (std::size_t(sysconf(_SC_PHYS_PAGES))
+        * sysconf(_SC_PAGE_SIZE)) >> 20;
+    conf.max_gpu_jobs = 1;
+    conf.dry_run = false;
+    conf.force = false;
+
+    for (util::ArgResult const* i = args.next_option();
+         i != 0; i = args.next_option()) {
+        switch (i->opt->sopt) {
+        case 'D':
+        {
+            std::size_t pos = i->arg.find('=');
+            if (pos == std::string::npos) {
+                throw std::invalid_argument("Invalid parameter " + i->arg);
+            }
+            conf.params[i->arg.substr(0, pos)] = i->arg.substr(pos + 1);
+        }
+        break;
+        case 'i':
+            conf.input_dir = i->arg;
+        break;
+        case 'l':
+            conf.link_dir = i->arg;
+        break;
+        case 'b':
+            conf.bin_dir = i->arg;
+        break;
+        case 'j':
+            conf.max_threads = std::max(1u, i->get_arg<uint>());
+        break;
+        case 'm':
+            conf.max_memory = i->get_arg<std::size_t>();
+        break;
+        case 'n':
+            conf.dry_run = true;
+        break;
+        case 'f':
+            conf.force = true;
+        break;
+        case '\0':
+            if (i->opt->lopt == "max-gpu-jobs") {
+                conf.max_gpu_jobs = std::max(1u, i->get_arg<uint>());
+            } else {
+                throw std::invalid_argument("Invalid option");
+            }
+        break;
+        default:
+            throw std::invalid_argument("Invalid option");
+        }
+    }
+
+    return conf;
+}
+
+int main(int argc, char **argv) {
+    util::system::register_segfault_handler();
+    util::system::print_build_timestamp(argv[0]);
+
+    Arguments args = parse_args(argc, argv);
+
+    Pipeline pipeline;
+    Cache cache;
+    try {
+        cache = open_cache(args.cache);
+        pipeline = load_pipeline(args.pipeline);
+        if (!args.input_dir.empty()) {
+            pipeline.dir = util::fs::abspath(args.input_dir.c_str());
+        }
+        for (auto const & param : args.params) {
+            pipeline.params[param.first] = param.second;
+        }
+
+        std::string path = args.bin_dir;
+        if (char const * env = std::getenv("PATH")) path += std::string(":") + env;
+        setenv("PATH", path.c_str(), 1);
+
+        InputIndex index(util::fs::join_path(cache.dir, "inputs.idx"));
+        compute_keys(&pipeline, &index, path);
+        index.save();
+    } catch (std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<Stage> & stages = pipeline.stages;
+    if (!args.force) lookup_stages(&pipeline, cache);
+    for (Stage const & stage : stages) {
+        std::cout << stage.name << ' ' << stage.key << ' '
+            << status_strings[stage.status] << std::endl;
+    }
+
+    if (args.dry_run) return EXIT_SUCCESS;
+
+    Limits limits;
+    limits.max_threads = args.max_threads;
+    limits.max_memory = args.max_memory;
+    limits.max_gpu_jobs = args.max_gpu_jobs;
+    run_pipeline(&pipeline, cache, limits);
+
+    if (!args.link_dir.empty()) {
+        if (!util::fs::dir_exists(args.link_dir.c_str())) {
+            util::fs::mkdir(args.link_dir.c_str());
+        }
+        for (Stage const & stage : stages) {
+            if (stage.status != CACHED && stage.status != DONE) continue;
+            std::string link = util::fs::join_path(args.link_dir, stage.name);
+            std::string target = util::fs::join_path(cache.objects_dir, stage.key);
+            ::unlink(link.c_str());
+            if (::symlink(target.c_str(), link.c_str()) != 0) {
+                std::cerr << "Could not create link " << link << std::endl;
+            }
+        }
+    }
+
+    bool failed = std::any_of(stages.begin(), stages.end(),
+        [] (Stage const & stage) { return stage.status == FAILED
+            || stage.status == SKIPPED; });
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
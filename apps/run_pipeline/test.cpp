@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include <sys/stat.h>
+
+#include "pipeline.h"
+
+#define TEST(cond) if (!(cond)) { \
+    std::cerr << __FILE__ << ":" << __LINE__ << ": " #cond " failed" << std::endl; \
+    std::exit(EXIT_FAILURE); }
+
+void
+write_file(std::string const & filename, std::string const & content,
+    bool executable = false)
+{
+    std::ofstream out(filename.c_str());
+    out << content;
+    out.close();
+    TEST(out.good());
+    if (executable) ::chmod(filename.c_str(), 0755);
+}
+
+std::string
+read_file(std::string const & filename) {
+    std::ifstream in(filename.c_str());
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+/* Working directory with a pipeline of two stages, the executable (append)
+ * in bin and the input in data. */
+struct Fixture {
+    std::string dir;
+    std::string bin_dir;
+    Cache cache;
+
+    Fixture(void) {
+        char tmpl[] = "/tmp/run_pipeline_test.XXXXXX";
+        TEST(::mkdtemp(tmpl) != nullptr);
+        dir = tmpl;
+        bin_dir = util::fs::join_path(dir, "bin");
+        TEST(util::fs::mkdir(bin_dir.c_str()));
+        TEST(util::fs::mkdir(util::fs::join_path(dir, "data").c_str()));
+
+        write_file(util::fs::join_path(bin_dir, "append"),
+            "#!/bin/sh\ncat \"$1\" > \"$2\" && echo \"$3\" >> \"$2\"\n", true);
+        write_file(util::fs::join_path(bin_dir, "fail"),
+            "#!/bin/sh\necho partial > \"$1\"\nexit 1\n", true);
+        write_file(util::fs::join_path(dir, "data/in.txt"), "in\n");
+        write_file(util::fs::join_path(dir, "data/test.pipeline"),
+            "param first_suffix a\n"
+            "param second_suffix b\n"
+            "stage first\n"
+            "    append ${input:in.txt} ${output:out.txt}\n"
+            "        ${param:first_suffix}\n"
+            "stage second\n"
+            "    append ${first:out.txt} ${output:out.txt} ${param:second_suffix}\n");
+
+        cache = open_cache(util::fs::join_path(dir, "cache"));
+    }
+
+    ~Fixture(void) {
+        remove_directory(dir);
+    }
+
+    Pipeline load(std::map<std::string, std::string> const & params = {}) {
+        Pipeline pipeline = load_pipeline(
+            util::fs::join_path(dir, "data/test.pipeline"));
+        for (auto const & param : params) {
+            pipeline.params[param.first] = param.second;
+        }
+        InputIndex index(util::fs::join_path(cache.dir, "inputs.idx"));
+        compute_keys(&pipeline, &index, bin_dir);
+        index.save();
+        lookup_stages(&pipeline, cache);
+        return pipeline;
+    }
+
+    void run(Pipeline * pipeline) {
+        std::string path = bin_dir + ":" + std::getenv("PATH");
+        setenv("PATH", path.c_str(), 1);
+        Limits limits = {2, 1024, 1};
+        run_pipeline(pipeline, cache, limits);
+    }
+
+    std::string output(Pipeline const & pipeline, std::size_t stage) {
+        std::string dir = util::fs::join_path(cache.objects_dir,
+            pipeline.stages[stage].key);
+        return read_file(util::fs::join_path(dir, "out.txt"));
+    }
+};
+
+/* Stages are only executed if their key changes - i.e. if their inputs,
+ * parameters, executable or upstream stages change. */
+void test_cache(void) {
+    Fixture fixture;
+
+    Pipeline pipeline = fixture.load();
+    TEST(pipeline.stages[0].status == PENDING);
+    TEST(pipeline.stages[1].status == PENDING);
+    fixture.run(&pipeline);
+    TEST(pipeline.stages[0].status == DONE);
+    TEST(pipeline.stages[1].status == DONE);
+    TEST(fixture.output(pipeline, 1) == "in\na\nb\n");
+
+    /* Unchanged pipeline. */
+    Pipeline cached = fixture.load();
+    TEST(cached.stages[0].status == CACHED);
+    TEST(cached.stages[1].status == CACHED);
+    TEST(cached.stages[1].key == pipeline.stages[1].key);
+
+    /* Sweep over a parameter of the last stage. */
+    Pipeline sweep = fixture.load({{"second_suffix", "c"}});
+    TEST(sweep.stages[0].status == CACHED);
+    TEST(sweep.stages[1].status == PENDING);
+    fixture.run(&sweep);
+    TEST(fixture.output(sweep, 1) == "in\na\nc\n");
+
+    /* Parameters of upstream stages invalidate downstream stages. */
+    Pipeline upstream = fixture.load({{"first_suffix", "x"}});
+    TEST(upstream.stages[0].status == PENDING);
+    TEST(upstream.stages[1].status == PENDING);
+
+    /* Input with the same size rewritten within the same second. */
+    write_file(util::fs::join_path(fixture.dir, "data/in.txt"), "IN\n");
+    Pipeline input = fixture.load();
+    TEST(input.stages[0].status == PENDING);
+    TEST(input.stages[1].status == PENDING);
+    fixture.run(&input);
+    TEST(fixture.output(input, 1) == "IN\na\nb\n");
+
+    /* Rebuilt executable. */
+    write_file(util::fs::join_path(fixture.bin_dir, "append"),
+        "#!/bin/sh\ncat \"$1\" > \"$2\"; echo \"$3\" >> \"$2\"\n", true);
+    Pipeline rebuilt = fixture.load();
+    TEST(rebuilt.stages[0].status == PENDING);
+    TEST(rebuilt.stages[1].status == PENDING);
+    TEST(rebuilt.stages[0].key != input.stages[0].key);
+
+    std::cout << "Passed (cache)" << std::endl;
+}
+
+/* Failed stages leave no temporary directories behind and their dependent
+ * stages are skipped - the log is kept. */
+void test_failure(void) {
+    Fixture fixture;
+    write_file(util::fs::join_path(fixture.dir, "data/test.pipeline"),
+        "stage broken\n"
+        "    fail ${output:out.txt}\n"
+        "stage missing\n"
+        "    append ${input:in.txt} ${output:other.txt} a ${output:out.txt}\n"
+        "stage dependent\n"
+        "    append ${broken:out.txt} ${output:out.txt} b\n"
+        "stage independent\n"
+        "    append ${input:in.txt} ${output:out.txt} c\n");
+
+    Pipeline pipeline = fixture.load();
+    fixture.run(&pipeline);
+    TEST(pipeline.stages[0].status == FAILED);
+    TEST(pipeline.stages[1].status == FAILED);
+    TEST(pipeline.stages[2].status == SKIPPED);
+    TEST(pipeline.stages[3].status == DONE);
+
+    TEST(util::fs::Directory(fixture.cache.tmp_dir).empty());
+    TEST(util::fs::Directory(fixture.cache.objects_dir).size() == 1);
+    TEST(util::fs::Directory(fixture.cache.logs_dir).size() == 2);
+
+    /* Failed stages are executed again. */
+    Pipeline again = fixture.load();
+    TEST(again.stages[0].status == PENDING);
+    TEST(again.stages[3].status == CACHED);
+
+    std::cout << "Passed (failure)" << std::endl;
+}
+
+int main(void) {
+    test_cache();
+    test_failure();
+
+    return EXIT_SUCCESS;
+}
@@ -18,6 +18,8 @@
 
 #include "acc/bvh_tree.h"
 
+#include "geom/projection.h"
+
 struct Arguments {
     std::string scene;
     std::string out_file;
@@ -76,6 +78,8 @@ int main(int argc, char **argv) {
         {21.8781, -110.377, -4.49192}
     };
 
+    PointBatch batch(points);
+
     std::vector<std::tuple<int, int, math::Vec2f> > observations;
     std::vector<mve::View::Ptr> const & views = scene->get_views();
     for (std::size_t i = 0; i < views.size(); ++i) {
@@ -92,30 +96,22 @@ int main(int argc, char **argv) {
         int height = 1500;
         float fnorm = std::max(width, height);
 
-        math::Vec3f cam_pos;
-        math::Vec3f view_dir;
-        math::Matrix3f calib;
-        math::Matrix4f w2c;
-        cam.fill_camera_pos(cam_pos.begin());
-        cam.fill_viewing_direction(view_dir.begin());
-        cam.fill_calibration(calib.begin(), width, height);
-        cam.fill_world_to_cam(w2c.begin());
+        CameraProjection proj = camera_projection(cam, width, height);
+        math::Vec3f cam_pos(proj.pos);
+
+        ProjectedPoints projected;
+        project_points(proj, batch, 0, batch.size(), FrustumBounds(10.0f), &projected);
 
         for (std::size_t j = 0; j < points.size(); ++j) {
-            math::Vec3f const& point = points[j];
-            math::Vec3f pt = calib * w2c.mult(point, 1.0f);
-            math::Vec2f pos(pt[0] / pt[2], pt[1] / pt[2]);
+            if (!projected.inside[j]) continue;
 
-            if (pos[0] < 10 || width - 10 <= pos[0]) continue;
-            if (pos[1] < 10 || height - 10 <= pos[1]) continue;
+            math::Vec3f const& point = points[j];
+            math::Vec2f pos(projected.x[j], projected.y[j]);
 
             math::Vec3f dir = (point - cam_pos);
             float dist = dir.norm();
             dir /= dist;
 
-            if (view_dir.dot(dir) < 0.0f)
-                continue;
-
             acc::Ray<math::Vec3f> ray;
             ray.origin = cam_pos;
             ray.dir = dir;
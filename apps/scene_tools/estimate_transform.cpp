@@ -7,19 +7,21 @@
  */
 
 #include <iostream>
+#include <algorithm>
 
 #include "util/system.h"
 #include "util/arguments.h"
 
 #include "util/matrix_io.h"
+#include "util/flat_bundle.h"
 
 #include "mve/scene.h"
-#include "mve/bundle_io.h"
 #include "mve/mesh_io_ply.h"
 
 #include "acc/bvh_tree.h"
 
 #include "geom/icp.h"
+#include "geom/projection.h"
 
 struct Arguments {
     std::string bundle;
@@ -92,15 +94,15 @@ int main(int argc, char **argv) {
         std::exit(EXIT_FAILURE);
     }
 
-    mve::Bundle::Ptr bundle;
+    FlatBundle::Ptr bundle;
     try {
-        bundle = mve::load_mve_bundle(args.bundle);
+        bundle = FlatBundle::load(args.bundle);
     } catch (std::exception& e) {
         std::cerr << "\tCould not load bundle: "<< e.what() << std::endl;
         std::exit(EXIT_FAILURE);
     }
 
-    if (scene->get_views().size() != bundle->get_cameras().size()) {
+    if (scene->get_views().size() != bundle->num_cameras()) {
         std::cerr << "\tScene views and bundle cameras do not match" << std::endl;
         std::exit(EXIT_FAILURE);
     }
@@ -122,76 +124,128 @@ int main(int argc, char **argv) {
     int width = 1920;
     int height = 1080;
 
-    mve::Bundle::Features & features = bundle->get_features();
-    mve::Bundle::Cameras & bundle_cameras = bundle->get_cameras();
-
-    #pragma omp parallel for
-    for (std::size_t i = 0; i < features.size(); ++i) {
-        math::Vec3f feature = math::Vec3f(features[i].pos);
-        std::vector<mve::Bundle::Feature2D> & refs = features[i].refs;
-        for (mve::Bundle::Feature2D & feature2d : refs) {
-            mve::CameraInfo const & cam = bundle_cameras[feature2d.view_id];
-
-            math::Vec3f cam_pos;
-            math::Matrix4f w2c;
-            math::Matrix3f calib;
-            cam.fill_camera_pos(cam_pos.begin());
-            cam.fill_calibration(calib.begin(), width, height);
-            cam.fill_world_to_cam(w2c.begin());
-            math::Vec3f pt = calib * w2c.mult(feature, 1.0f);
-            math::Vec2f pos(pt[0] / pt[2], pt[1] / pt[2]);
-
-            std::copy(pos.begin(), pos.end(), feature2d.pos);
+    std::size_t const num_features = bundle->num_features();
+    float const * positions = bundle->positions();
+    mve::CameraInfo const * bundle_cameras = bundle->cameras();
+
+    /* Projections of the bundle cameras (features) and the scene cameras
+     * (rays) of each view. */
+    std::vector<CameraProjection> bundle_projs(views.size());
+    std::vector<CameraProjection> scene_projs(views.size());
+    for (std::size_t i = 0; i < views.size(); ++i) {
+        bundle_projs[i] = camera_projection(bundle_cameras[i], width, height);
+        scene_projs[i] = camera_projection(cameras[i], width, height);
+    }
+
+    /* Group observations (bundle references) by view - the observations
+     * of feature i are [obs_offsets[i], obs_offsets[i + 1]). */
+    std::uint64_t const * obs_offsets = bundle->ref_offsets();
+    std::int32_t const * obs_views = bundle->ref_views();
+    std::size_t num_obs = bundle->num_refs();
+
+    std::vector<std::size_t> view_offsets(views.size() + 1, 0);
+    for (std::size_t obs = 0; obs < num_obs; ++obs) {
+        view_offsets[obs_views[obs] + 1] += 1;
+    }
+    for (std::size_t i = 0; i < views.size(); ++i) {
+        view_offsets[i + 1] += view_offsets[i];
+    }
+    std::vector<std::size_t> view_obs(num_obs);
+    {
+        std::vector<std::size_t> fill(view_offsets.begin(), view_offsets.end() - 1);
+        for (std::size_t obs = 0; obs < num_obs; ++obs) {
+            view_obs[fill[obs_views[obs]]++] = obs;
         }
     }
+    std::vector<std::size_t> obs_features(num_obs);
+    for (std::size_t i = 0; i < num_features; ++i) {
+        std::fill(obs_features.begin() + obs_offsets[i],
+            obs_features.begin() + obs_offsets[i + 1], i);
+    }
 
-    std::vector<Correspondence> correspondences(features.size());
-    std::vector<std::uint8_t> valid(features.size(), 0);
+    /* Mesh intersections of the rays through the reprojected features. */
+    std::vector<math::Vec3f> hits(num_obs);
+    std::vector<std::uint8_t> hit_valid(num_obs, 0);
+
+    /* Reproject and cast rays view by view, ordered by image tiles for
+     * coherent traversals. */
+    #pragma omp parallel for schedule(dynamic)
+    for (std::size_t v = 0; v < views.size(); ++v) {
+        if (views[v] == nullptr) continue;
+
+        std::size_t beg = view_offsets[v];
+        std::size_t n = view_offsets[v + 1] - beg;
+
+        PointBatch features;
+        features.resize(n);
+        for (std::size_t k = 0; k < n; ++k) {
+            float const * feature = positions + 3 * obs_features[view_obs[beg + k]];
+            features.x[k] = feature[0];
+            features.y[k] = feature[1];
+            features.z[k] = feature[2];
+        }
 
-    #pragma omp parallel for
-    for (std::size_t i = 0; i < features.size(); ++i) {
-        math::Vec3f feature = math::Vec3f(features[i].pos);
-        std::vector<math::Vec3f> projections;
+        ProjectedPoints projected;
+        project_points(bundle_projs[v], features, 0, n, FrustumBounds(), &projected);
 
-        std::vector<mve::Bundle::Feature2D> const & refs = features[i].refs;
-        for (mve::Bundle::Feature2D const & feature2d : refs) {
-            mve::CameraInfo const & cam = cameras[feature2d.view_id];
-            math::Vec2f pos(feature2d.pos);
+        PointBatch dirs;
+        dirs.resize(n);
+        backproject_pixels(scene_projs[v], projected.x.data(), projected.y.data(),
+            n, dirs.x.data(), dirs.y.data(), dirs.z.data());
 
-            math::Vec3f cam_pos;
-            math::Matrix3f invcalib;
-            math::Matrix3f c2w_rot;
-            cam.fill_camera_pos(cam_pos.begin());
-            cam.fill_inverse_calibration(invcalib.begin(), width, height);
-            cam.fill_cam_to_world_rot(c2w_rot.begin());
+        std::vector<std::pair<std::uint64_t, std::size_t> > order;
+        order.reserve(n);
+        for (std::size_t k = 0; k < n; ++k) {
+            std::uint64_t tx = std::min(std::max(projected.x[k], 0.0f), 65535.0f) / 16;
+            std::uint64_t ty = std::min(std::max(projected.y[k], 0.0f), 65535.0f) / 16;
+            order.emplace_back((ty << 32) | tx, k);
+        }
+        std::sort(order.begin(), order.end());
 
-            math::Vec3f v = invcalib * math::Vec3f(pos[0], pos[1], 1.0f);
+        for (std::pair<std::uint64_t, std::size_t> const & entry : order) {
+            std::size_t k = entry.second;
+            std::size_t obs = view_obs[beg + k];
 
             acc::Ray<math::Vec3f> ray;
-            ray.origin = cam_pos;
-            ray.dir = c2w_rot.mult(v.normalized()).normalize();
+            ray.origin = math::Vec3f(scene_projs[v].pos);
+            ray.dir = dirs[k];
             ray.tmin = 0.0f;
             ray.tmax = std::numeric_limits<float>::infinity();
 
             acc::BVHTree<uint, math::Vec3f>::Hit hit;
             if (!bvh_tree.intersect(ray, &hit)) continue;
 
-            projections.push_back(cam_pos + hit.t * ray.dir);
+            hits[obs] = ray.origin + hit.t * ray.dir;
+            hit_valid[obs] = 255;
         }
+    }
+
+    std::vector<Correspondence> correspondences(num_features);
+    std::vector<std::uint8_t> valid(num_features, 0);
 
-        if (projections.size() < 3) continue;
+    #pragma omp parallel
+    {
+        std::vector<float> values;
 
-        for (int j = 0; j < 3; ++j) {
-            std::stable_sort(projections.begin(), projections.end(),
-                [j] (math::Vec3f const & r, math::Vec3f const & l) {
-                    return r[j] > l[j];
+        #pragma omp for schedule(dynamic, 1024)
+        for (std::size_t i = 0; i < num_features; ++i) {
+            math::Vec3f projection;
+            for (int j = 0; j < 3; ++j) {
+                values.clear();
+                for (std::size_t obs = obs_offsets[i]; obs < obs_offsets[i + 1]; ++obs) {
+                    if (hit_valid[obs]) values.push_back(hits[obs][j]);
                 }
-            );
-        }
-        math::Vec3f projection = projections[projections.size() / 2];
+                if (values.size() < 3) break;
+
+                std::vector<float>::iterator nth = values.begin() + values.size() / 2;
+                std::nth_element(values.begin(), nth, values.end());
+                projection[j] = *nth;
+            }
+            if (values.size() < 3) continue;
 
-        correspondences[i] = std::make_pair(feature, projection);
-        valid[i] = 255;
+            correspondences[i] = std::make_pair(math::Vec3f(positions + 3 * i), projection);
+            valid[i] = 255;
+        }
     }
 
     math::Matrix4f T;
@@ -200,12 +254,12 @@ int main(int argc, char **argv) {
 
     remove_invalid(&correspondences, valid);
     T = estimate_transform(correspondences, 0.01f);
-    correspondences.resize(features.size());
+    correspondences.resize(num_features);
 
     double avg_dist = 0.0;
     #pragma omp parallel for reduction(+:avg_dist)
-    for (std::size_t i = 0; i < features.size(); ++i) {
-        math::Vec3f feature = math::Vec3f(features[i].pos);
+    for (std::size_t i = 0; i < num_features; ++i) {
+        math::Vec3f feature = math::Vec3f(positions + 3 * i);
         math::Vec3f vertex = T.mult(feature, 1.0f);
 
         math::Vec3f cp = bvh_tree.closest_point(vertex);
@@ -215,7 +269,7 @@ int main(int argc, char **argv) {
 
         avg_dist += dist;
     }
-    avg_dist /= features.size();
+    avg_dist /= num_features;
 
     std::cout << "  Average distance to surface: " << avg_dist  << std::endl;
 
@@ -228,8 +282,8 @@ int main(int argc, char **argv) {
         avg_dist = 0.0;
 
         #pragma omp parallel for reduction(+:avg_dist)
-        for (std::size_t i = 0; i < features.size(); ++i) {
-            math::Vec3f feature = math::Vec3f(features[i].pos);
+        for (std::size_t i = 0; i < num_features; ++i) {
+            math::Vec3f feature = math::Vec3f(positions + 3 * i);
             math::Vec3f vertex = T.mult(feature, 1.0f);
 
             math::Vec3f cp = bvh_tree.closest_point(vertex);
@@ -239,7 +293,7 @@ int main(int argc, char **argv) {
 
             avg_dist += dist;
         }
-        avg_dist /= features.size();
+        avg_dist /= num_features;
 
         double improvement = prev_avg_dist - avg_dist;
         if (improvement < 1e-5) break;
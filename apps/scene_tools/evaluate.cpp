@@ -12,7 +12,7 @@
 #include "util/system.h"
 #include "util/arguments.h"
 
-#include "mve/scene.h"
+#include "util/scene_index.h"
 
 struct Arguments {
     std::string in_scene;
@@ -49,25 +49,22 @@ int main(int argc, char **argv) {
 
     Arguments args = parse_args(argc, argv);
 
-    mve::Scene::Ptr in_scene;
+    std::vector<SceneView> in_views;
     try {
-        in_scene = mve::Scene::create(args.in_scene);
+        in_views = load_scene_views(args.in_scene);
     } catch (std::exception& e) {
         std::cerr << "Could not open scene: " << e.what() << std::endl;
         std::exit(EXIT_FAILURE);
     }
 
-    mve::Scene::Ptr gt_scene;
+    std::vector<SceneView> gt_views;
     try {
-        gt_scene = mve::Scene::create(args.gt_scene);
+        gt_views = load_scene_views(args.gt_scene);
     } catch (std::exception& e) {
         std::cerr << "Could not open scene: " << e.what() << std::endl;
         std::exit(EXIT_FAILURE);
     }
 
-    std::vector<mve::View::Ptr> const & in_views = in_scene->get_views();
-    std::vector<mve::View::Ptr> const & gt_views = gt_scene->get_views();
-
     if (in_views.size() != gt_views.size()) {
         std::cerr << "Incompatible scenes" << std::endl;
         std::exit(EXIT_FAILURE);
@@ -78,10 +75,12 @@ int main(int argc, char **argv) {
     std::vector<float> errors;
     errors.reserve(num_views);
     for (std::size_t i = 0; i < num_views; ++i) {
-        mve::CameraInfo in_cam = in_views[i]->get_camera();
+        if (in_views[i].id < 0 || gt_views[i].id < 0) continue;
+
+        mve::CameraInfo in_cam = in_views[i].camera;
         if (in_cam.flen == 0.0f) continue;
 
-        mve::CameraInfo gt_cam = gt_views[i]->get_camera();
+        mve::CameraInfo gt_cam = gt_views[i].camera;
         math::Vec3f in_pos;
         in_cam.fill_camera_pos(in_pos.begin());
         math::Vec3f gt_pos;
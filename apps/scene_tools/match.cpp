@@ -15,9 +15,9 @@
 
 #include "math/transform.h"
 
-#include "mve/scene.h"
+#include "util/scene_index.h"
 
-#include "acc/kd_tree.h"
+#include "geom/point_grid.h"
 
 struct Arguments {
     std::string in_scene;
@@ -49,7 +49,7 @@ Arguments parse_args(int argc, char **argv) {
 }
 
 void
-fill(std::vector<mve::View::Ptr> const & views,
+fill(std::vector<SceneView> const & views,
     std::vector<math::Vec3f> * cam_poss, std::vector<math::Vec3f> * view_dirs)
 {
     cam_poss->resize(views.size());
@@ -57,10 +57,10 @@ fill(std::vector<mve::View::Ptr> const & views,
 
     std::size_t num_valid = 0;
     for (std::size_t i = 0; i < views.size(); ++i) {
-        mve::View::Ptr const & view = views[i];
-        if (view == nullptr) continue;
+        SceneView const & view = views[i];
+        if (view.id < 0) continue;
 
-        mve::CameraInfo const& cam = view->get_camera();
+        mve::CameraInfo const& cam = view.camera;
         if (cam.flen == 0.0f) continue;
 
         num_valid += 1;
@@ -74,17 +74,17 @@ fill(std::vector<mve::View::Ptr> const & views,
 int main(int argc, char **argv) {
     Arguments args = parse_args(argc, argv);
 
-    mve::Scene::Ptr in_scene;
+    std::vector<SceneView> in_views;
     try {
-        in_scene = mve::Scene::create(args.in_scene);
+        in_views = load_scene_views(args.in_scene);
     } catch (std::exception& e) {
         std::cerr << "Could not open scene: " << e.what() << std::endl;
         std::exit(EXIT_FAILURE);
     }
 
-    mve::Scene::Ptr gt_scene;
+    std::vector<SceneView> gt_views;
     try {
-        gt_scene = mve::Scene::create(args.gt_scene);
+        gt_views = load_scene_views(args.gt_scene);
     } catch (std::exception& e) {
         std::cerr << "Could not open scene: " << e.what() << std::endl;
         std::exit(EXIT_FAILURE);
@@ -95,24 +95,28 @@ int main(int argc, char **argv) {
     std::vector<math::Vec3f> in_view_dirs;
     std::vector<math::Vec3f> gt_view_dirs;
 
-    fill(in_scene->get_views(), &in_cam_poss, &in_view_dirs);
-    fill(gt_scene->get_views(), &gt_cam_poss, &gt_view_dirs);
+    fill(in_views, &in_cam_poss, &in_view_dirs);
+    fill(gt_views, &gt_cam_poss, &gt_view_dirs);
 
 
     std::vector<math::Vec3f> v0, v1;
 
-    acc::KDTree<3, uint> kd_tree(in_cam_poss);
+    /* Five nearest input cameras for each ground truth camera. */
+    std::vector<uint> nn_ids;
+    std::vector<float> nn_dists;
+    std::vector<std::uint32_t> nn_counts;
+    PointGrid<uint> grid(in_cam_poss);
+    grid.find_nns(gt_cam_poss, 5, &nn_ids, &nn_dists, &nn_counts);
+
     for (std::size_t i = 0; i < gt_cam_poss.size(); ++i) {
         math::Vec3f gt_cam_pos = gt_cam_poss[i];
         //math::Vec3f gt_view_dir = gt_view_dirs[i];
         math::Vec3f gt_p = gt_cam_pos + gt_view_dirs[i] * 50.0f;
 
-        std::vector<std::pair<uint, float> > nns;
-        kd_tree.find_nns(gt_cam_pos, 5, &nns);
         float lowest = 1.0f/0.0f;
         uint best = -1;
-        for (std::size_t j = 0; j < nns.size(); ++j) {
-            uint id = nns[j].first;
+        for (std::size_t j = 0; j < nn_counts[i]; ++j) {
+            uint id = nn_ids[i * 5 + j];
             //float dist = nns[j].second;
             math::Vec3f in_cam_pos = in_cam_poss[id];
             math::Vec3f in_p = in_cam_pos + in_view_dirs[id] * 50.0f;
@@ -145,12 +149,10 @@ int main(int argc, char **argv) {
         //math::Vec3f gt_p = gt_cam_pos + (R * gt_view_dirs[i]) * 50.0f;
         math::Vec3f gt_p = gt_cam_pos + gt_view_dirs[i] * 50.0f;
 
-        std::vector<std::pair<uint, float> > nns;
-        kd_tree.find_nns(gt_cam_pos, 5, &nns);
         float lowest = 1.0f/0.0f;
         uint best = -1;
-        for (std::size_t j = 0; j < nns.size(); ++j) {
-            uint id = nns[j].first;
+        for (std::size_t j = 0; j < nn_counts[i]; ++j) {
+            uint id = nn_ids[i * 5 + j];
             //float dist = nns[j].second;
             math::Vec3f in_cam_pos = in_cam_poss[id];
             math::Vec3f in_p = in_cam_pos + in_view_dirs[id] * 50.0f;
@@ -169,7 +171,7 @@ int main(int argc, char **argv) {
         }
 
         std::cout << i << ' ' << best << ' ' << lowest << ' '
-            << in_scene->get_view_by_id(best)->get_name() << std::endl;
+            << in_views[best].name << std::endl;
     }
 
     return EXIT_SUCCESS;
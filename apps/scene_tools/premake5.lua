@@ -20,10 +20,14 @@ project "annotate-scene"
     kind "ConsoleApp"
     language "C++"
 
+    buildoptions { "-fopenmp" }
+
     files { "annotate.cpp" }
 
     mve.use({ "util" })
 
+    links { "gomp" }
+
 project "estimate_transform-scene"
     kind "ConsoleApp"
     language "C++"
@@ -60,6 +64,10 @@ project "match-scene"
     kind "ConsoleApp"
     language "C++"
 
+    buildoptions { "-fopenmp" }
+
     files { "match.cpp" }
 
     mve.use({ "util" })
+
+    links { "gomp" }
@@ -14,10 +14,10 @@
 #include "util/file_system.h"
 
 #include "util/matrix_io.h"
+#include "util/flat_bundle.h"
 
 #include "math/matrix_tools.h"
 
-#include "mve/bundle_io.h"
 #include "mve/mesh_io_ply.h"
 
 #include "ogl/events.h"
@@ -28,6 +28,7 @@
 #include "sim/window.h"
 #include "sim/shader.h"
 #include "sim/shader_type.h"
+#include "sim/point_octree_renderer.h"
 
 #include "acc/primitives.h"
 
@@ -54,7 +55,8 @@ Arguments parse_args(int argc, char **argv) {
     args.set_description("Visual selector for target areas based on bundle "
             "files. Writes out the selection as axis-aligned bounding box and "
             "according transformation.");
-    args.add_option('d', "dense-cloud", true, "dense cloud to display");
+    args.add_option('d', "dense-cloud", true, "dense cloud to display "
+        "(ply file or point octree directory, see build_octree-cloud)");
     args.parse(argc, argv);
 
     Arguments conf;
@@ -92,41 +94,47 @@ int main(int argc, char **argv) {
 
     Arguments args = parse_args(argc, argv);
 
+    bool stream_dense = !args.dense_cloud.empty()
+        && util::fs::dir_exists(args.dense_cloud.c_str());
+
     mve::TriangleMesh::Ptr dense_cloud;
-    if (!args.dense_cloud.empty()) {
+    if (!args.dense_cloud.empty() && !stream_dense) {
         try {
             dense_cloud = mve::geom::load_ply_mesh(args.dense_cloud);
         } catch (std::exception& e) {
             std::cerr << "\tCould not load dense cloud: "<< e.what() << std::endl;
             std::exit(EXIT_FAILURE);
         }
-        std::for_each(dense_cloud->get_vertex_colors().begin(),
-            dense_cloud->get_vertex_colors().end(),
-            [] (math::Vec4f & color) { col::gamma_decode_srgb(color.begin());}
-        );
+        std::vector<math::Vec4f> & colors = dense_cloud->get_vertex_colors();
+        #pragma omp parallel for
+        for (std::size_t i = 0; i < colors.size(); ++i) {
+            col::gamma_decode_srgb(colors[i].begin());
+        }
     }
 
     mve::TriangleMesh::Ptr cloud = mve::TriangleMesh::create();
     std::vector<math::Vec3f> & verts = cloud->get_vertices();
     std::vector<math::Vec4f> & colors = cloud->get_vertex_colors();
     {
-        mve::Bundle::Ptr bundle;
+        FlatBundle::Ptr bundle;
         try {
-            bundle = mve::load_mve_bundle(args.bundle);
+            bundle = FlatBundle::load(args.bundle);
         } catch (std::exception& e) {
             std::cerr << "\tCould not load bundle: "<< e.what() << std::endl;
             std::exit(EXIT_FAILURE);
         }
 
-        std::vector<mve::Bundle::Feature3D> const & features = bundle->get_features();
-        verts.reserve(features.size());
-        colors.reserve(features.size());
-        for (mve::Bundle::Feature3D const & feature : features) {
-            if (feature.refs.size() < 5) continue;
-            verts.emplace_back();
-            std::copy(feature.pos, feature.pos + 3, verts.back().begin());
+        std::size_t const num_features = bundle->num_features();
+        float const * positions = bundle->positions();
+        float const * feature_colors = bundle->colors();
+        verts.reserve(num_features);
+        colors.reserve(num_features);
+        for (std::size_t i = 0; i < num_features; ++i) {
+            if (bundle->num_refs(i) < 5) continue;
+            verts.emplace_back(positions + 3 * i);
             colors.emplace_back(1.0f);
-            std::copy(feature.color, feature.color + 3, colors.back().begin());
+            std::copy(feature_colors + 3 * i, feature_colors + 3 * i + 3,
+                colors.back().begin());
         }
     }
 
@@ -147,12 +155,14 @@ int main(int argc, char **argv) {
         std::cout << "done." << std::endl;
     }
 
+    #pragma omp parallel for
     for (std::size_t i = 0; i < verts.size(); ++i) {
         verts[i] = T.mult(verts[i], 1.0f);
     }
 
     if (dense_cloud != nullptr) {
         std::vector<math::Vec3f> & verts = dense_cloud->get_vertices();
+        #pragma omp parallel for
         for (std::size_t i = 0; i < verts.size(); ++i) {
             verts[i] = T.mult(verts[i], 1.0f);
         }
@@ -197,6 +207,23 @@ int main(int argc, char **argv) {
         dcr->set_primitive(GL_POINTS);
     }
 
+    /* Large dense clouds are streamed - transformed per node on load. */
+    PointOctreeRenderer::Ptr dor;
+    if (stream_dense) {
+        try {
+            dor = PointOctreeRenderer::Ptr(
+                new PointOctreeRenderer(args.dense_cloud, shaders[0], T));
+        } catch (std::exception& e) {
+            std::cerr << "\tCould not load dense cloud: "<< e.what() << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        dor->set_node_callback([] (mve::TriangleMesh::Ptr mesh) {
+            for (math::Vec4f & color : mesh->get_vertex_colors()) {
+                col::gamma_decode_srgb(color.begin());
+            }
+        });
+    }
+
     ogl::MeshRenderer::Ptr mr = ogl::MeshRenderer::create();
     mr->set_mesh(generate_aabb_mesh(aabb.min, aabb.max));
     mr->set_shader(shaders[1]->get_shader_program());
@@ -331,6 +358,8 @@ int main(int argc, char **argv) {
             camera.up_vec = trackball.get_upvec();
             camera.update_matrices();
 
+            if (dor && render_dense) dor->update(camera);
+
             math::Vec3f zaxis(0.0f, 0.0f, 1.0f);
             math::Matrix3f R = matrix_rotation_from_axis_angle(zaxis, angle);
             math::Matrix3f S = matrix_from_diagonal(scales);
@@ -349,6 +378,7 @@ int main(int argc, char **argv) {
 
             cr->draw();
             if (dcr && render_dense) dcr->draw();
+            if (dor && render_dense) dor->render();
             glEnable(GL_BLEND);
             mr->draw();
             glDisable(GL_BLEND);
@@ -356,6 +386,8 @@ int main(int argc, char **argv) {
             glFlush();
 
             update = false;
+        } else if (dor && render_dense && dor->update(camera)) {
+            update = true;
         } else {
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
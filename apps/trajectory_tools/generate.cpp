@@ -20,6 +20,8 @@
 
 #include "acc/primitives.h"
 
+#include "geom/height_map.h"
+
 #include "utp/trajectory_io.h"
 
 struct Arguments {
@@ -34,6 +36,9 @@ struct Arguments {
     float elevation;
     float focal_length;
     float aspect_ratio;
+    bool footprint;
+    bool terrain_following;
+    std::vector<math::Vec2f> polygon;
 };
 
 Arguments parse_args(int argc, char **argv) {
@@ -48,11 +53,18 @@ Arguments parse_args(int argc, char **argv) {
     args.add_option('a', "altitude", true, "flying altitude [60.0]");
     args.add_option('e', "elevation", true, "elevation for overlap planning [0.0]");
     args.add_option('r', "rotation", true, "rotation (deg) [0]");
+    args.add_option('t', "terrain-following", false, "adapt the altitude of "
+        "each view to the local terrain (altitude and elevation are relative "
+        "to the terrain)");
 
     args.add_option('\0', "angles", true, "comma separate list of angles (nadir 0 deg) [0]");
     args.add_option('\0', "focal-length", true, "camera focal length [0.86]");
     args.add_option('\0', "aspect-ratio", true, "camera sensor aspect ratio [0.66]");
     args.add_option('\0', "airspace-mesh", true, "use mesh to consider flyable airspace");
+    args.add_option('\0', "footprint", false, "clip lines to the occupied "
+        "footprint of the proxy mesh");
+    args.add_option('\0', "polygon", true, "clip lines to the polygon "
+        "(comma separated list of x,y coordinates)");
     args.parse(argc, argv);
 
     Arguments conf;
@@ -65,8 +77,12 @@ Arguments parse_args(int argc, char **argv) {
     conf.altitude = 60.0f;
     conf.focal_length = 0.86f;
     conf.aspect_ratio = 2.0f / 3.0f;
+    conf.elevation = 0.0f;
+    conf.footprint = false;
+    conf.terrain_following = false;
 
     std::string angles;
+    std::string polygon;
     for (util::ArgResult const* i = args.next_option();
          i != 0; i = args.next_option()) {
         switch (i->opt->sopt) {
@@ -85,6 +101,9 @@ Arguments parse_args(int argc, char **argv) {
         case 'e':
             conf.elevation = i->get_arg<float>();
         break;
+        case 't':
+            conf.terrain_following = true;
+        break;
         case '\0':
             if (i->opt->lopt == "angles") {
                 angles = i->arg;
@@ -94,6 +113,10 @@ Arguments parse_args(int argc, char **argv) {
                 conf.aspect_ratio = i->get_arg<float>();
             } else if (i->opt->lopt == "airspace-mesh") {
                 conf.airspace_mesh = i->arg;
+            } else if (i->opt->lopt == "footprint") {
+                conf.footprint = true;
+            } else if (i->opt->lopt == "polygon") {
+                polygon = i->arg;
             } else {
                 throw std::invalid_argument("Invalid option");
             }
@@ -117,9 +140,155 @@ Arguments parse_args(int argc, char **argv) {
         }
     }
 
+    if (!polygon.empty()) {
+        util::Tokenizer tok;
+        tok.split(polygon, ',');
+        if (tok.size() % 2 != 0 || tok.size() < 6) {
+            throw std::invalid_argument("Polygon requires at least three vertices");
+        }
+
+        for (std::size_t i = 0; i < tok.size(); i += 2) {
+            conf.polygon.emplace_back(tok.get_as<float>(i), tok.get_as<float>(i + 1));
+        }
+    }
+
     return conf;
 }
 
+/* Raster of the survey area - the cells covered by the footprint of the
+ * proxy mesh (and/or the polygon) and the terrain height. Without clipping
+ * occupied is empty, without terrain following terrain is null. */
+struct SurveyGrid {
+    math::Vec2f min;
+    float resolution;
+    int width;
+    int height;
+    std::vector<bool> occupied;
+    mve::FloatImage::Ptr terrain;
+    float ground_level;
+
+    /* Whether an occupied cell lies within the rectangle with center and
+     * half extents hu, hv along the orthonormal axes u and v. */
+    bool covers(math::Vec2f const & center, math::Vec2f const & u,
+        math::Vec2f const & v, float hu, float hv) const;
+
+    float terrain_height(math::Vec2f const & pos) const;
+};
+
+bool
+SurveyGrid::covers(math::Vec2f const & center, math::Vec2f const & u,
+    math::Vec2f const & v, float hu, float hv) const
+{
+    if (occupied.empty()) return true;
+
+    float ex = std::abs(u[0]) * hu + std::abs(v[0]) * hv;
+    float ey = std::abs(u[1]) * hu + std::abs(v[1]) * hv;
+    int x0 = std::max(0, int(std::floor((center[0] - ex - min[0]) / resolution)));
+    int x1 = std::min(width - 1, int(std::ceil((center[0] + ex - min[0]) / resolution)));
+    int y0 = std::max(0, int(std::floor((center[1] - ey - min[1]) / resolution)));
+    int y1 = std::min(height - 1, int(std::ceil((center[1] + ey - min[1]) / resolution)));
+
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            if (!occupied[y * width + x]) continue;
+            math::Vec2f cell(min[0] + (x + 0.5f) * resolution,
+                min[1] + (y + 0.5f) * resolution);
+            math::Vec2f d = cell - center;
+            if (std::abs(d.dot(u)) <= hu && std::abs(d.dot(v)) <= hv) return true;
+        }
+    }
+    return false;
+}
+
+float
+SurveyGrid::terrain_height(math::Vec2f const & pos) const {
+    int x = (pos[0] - min[0]) / resolution;
+    int y = (pos[1] - min[1]) / resolution;
+    x = std::max(0, std::min(width - 1, x));
+    y = std::max(0, std::min(height - 1, y));
+    float height = terrain->at(x, y, 0);
+    return (height != std::numeric_limits<float>::lowest()) ? height : ground_level;
+}
+
+/* Even-odd test of the point against the polygon. */
+bool
+inside(std::vector<math::Vec2f> const & polygon, math::Vec2f const & point) {
+    bool ret = false;
+    for (std::size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+        math::Vec2f const & a = polygon[i];
+        math::Vec2f const & b = polygon[j];
+        if ((a[1] > point[1]) == (b[1] > point[1])) continue;
+        float x = (b[0] - a[0]) * (point[1] - a[1]) / (b[1] - a[1]) + a[0];
+        if (point[0] < x) ret = !ret;
+    }
+    return ret;
+}
+
+/* Rasterizes the proxy mesh with a margin of two cells (fill_holes
+ * invalidates the boundary). Structures smaller than the image footprint
+ * are removed from the terrain (opening) and the terrain is raised to its
+ * maximum within the image footprint - the overlaps are kept for the
+ * highest terrain within each image. */
+SurveyGrid
+create_survey_grid(mve::TriangleMesh::ConstPtr mesh, Arguments const & args,
+    float resolution, float footprint)
+{
+    std::vector<math::Vec3f> const & verts = mesh->get_vertices();
+    acc::AABB<math::Vec3f> aabb = acc::calculate_aabb(verts);
+    for (math::Vec2f const & v : args.polygon) {
+        for (int i = 0; i < 2; ++i) {
+            aabb.min[i] = std::min(aabb.min[i], v[i]);
+            aabb.max[i] = std::max(aabb.max[i], v[i]);
+        }
+    }
+
+    SurveyGrid grid;
+    grid.resolution = resolution;
+    grid.ground_level = 0.0f;
+    grid.min = math::Vec2f(aabb.min[0] - 2.0f * resolution,
+        aabb.min[1] - 2.0f * resolution);
+    grid.width = (aabb.max[0] - grid.min[0]) / resolution + 3.0f;
+    grid.height = (aabb.max[1] - grid.min[1]) / resolution + 3.0f;
+
+    /* The height map is only required for the footprint and the terrain. */
+    bool const clip = args.footprint || !args.polygon.empty();
+    if (!clip && !args.terrain_following) return grid;
+
+    float const lowest = std::numeric_limits<float>::lowest();
+    mve::FloatImage::Ptr hmap;
+    if (args.footprint || args.terrain_following) {
+        hmap = create_height_map(verts,
+            math::Vec3f(grid.min[0], grid.min[1], 0.0f), resolution,
+            grid.width, grid.height);
+        fill_holes(hmap, 2);
+        grid.ground_level = estimate_ground_level(hmap);
+    }
+
+    if (clip) {
+        grid.occupied.resize(grid.width * grid.height);
+        for (int y = 0; y < grid.height; ++y) {
+            for (int x = 0; x < grid.width; ++x) {
+                bool occupied = !args.footprint || hmap->at(x, y, 0) != lowest;
+                if (occupied && !args.polygon.empty()) {
+                    occupied = inside(args.polygon, math::Vec2f(
+                        grid.min[0] + (x + 0.5f) * resolution,
+                        grid.min[1] + (y + 0.5f) * resolution));
+                }
+                grid.occupied[y * grid.width + x] = occupied;
+            }
+        }
+    }
+
+    if (args.terrain_following) {
+        int radius = std::ceil(footprint / resolution);
+        min_filter(hmap, radius);
+        max_filter(hmap, 2 * radius);
+        grid.terrain = hmap;
+    }
+
+    return grid;
+}
+
 int main(int argc, char **argv) {
     util::system::register_segfault_handler();
     util::system::print_build_timestamp(argv[0]);
@@ -142,21 +311,26 @@ int main(int argc, char **argv) {
     math::Matrix3f rot = math::matrix_rotation_from_axis_angle(
         math::Vec3f(0.0f, 0.0f, 1.0f), args.rotation);
 
-    acc::AABB<math::Vec3f> aabb;
-    if (args.rotation == 0.0f) {
-        aabb = acc::calculate_aabb(mesh->get_vertices());
+    /* Extent of the survey area within the (rotated) frame of the lines. */
+    std::vector<math::Vec3f> verts;
+    if (args.polygon.empty()) {
+        verts = mesh->get_vertices();
     } else {
-        std::vector<math::Vec3f> verts = mesh->get_vertices();
-        aabb = acc::calculate_aabb(verts);
-        math::Vec3f center = aabb.min + (aabb.max - aabb.min) / 2.0f;
+        for (math::Vec2f const & v : args.polygon) {
+            verts.emplace_back(v[0], v[1], 0.0f);
+        }
+    }
+    acc::AABB<math::Vec3f> aabb = acc::calculate_aabb(verts);
+    math::Vec3f center = aabb.min + (aabb.max - aabb.min) / 2.0f;
+    if (args.rotation != 0.0f) {
+        math::Matrix3f irot = rot.transposed();
         for (std::size_t i = 0; i < verts.size(); ++i) {
-            verts[i] = rot * (verts[i] - center) + center;
+            verts[i] = irot * (verts[i] - center);
         }
         aabb = acc::calculate_aabb(verts);
-        center = aabb.min + (aabb.max - aabb.min) / 2.0f;
+        center += rot * (aabb.min + (aabb.max - aabb.min) / 2.0f);
     }
 
-
     float hfov = 2.0f * std::atan2(1.0f, 2.0f * args.focal_length);
     float vfov = 2.0f * std::atan2(args.aspect_ratio, 2.0f * args.focal_length);
 
@@ -167,8 +341,11 @@ int main(int argc, char **argv) {
     float velocity = height * (1.0f - args.forward_overlap / 100.0f);
     float spacing = width * (1.0f - args.side_overlap / 100.0f);
 
+    SurveyGrid grid = create_survey_grid(mesh, args,
+        std::min(velocity, spacing) / 4.0f, std::max(width, height) / 2.0f);
+
     math::Vec3f dim = aabb.max - aabb.min;
-    math::Vec3f off(aabb.min[0] + dim[0] / 2.0f, aabb.min[1] + dim[1] / 2.0f, args.altitude);
+    math::Vec3f off(center[0], center[1], args.altitude);
 
     /* Set camera intrinsics. */
     mve::CameraInfo cam;
@@ -182,6 +359,16 @@ int main(int argc, char **argv) {
 
     std::vector<mve::CameraInfo> trajectory;
     math::Vec3f rel(0.0f);
+    auto add_view = [&] (math::Matrix3f const & rrot) {
+        math::Vec3f pos = off + rot * rel;
+        if (args.terrain_following) {
+            pos[2] += grid.terrain_height(math::Vec2f(pos[0], pos[1]));
+        }
+        math::Vec3f trans = -rrot * pos;
+        std::copy(trans.begin(), trans.end(), cam.trans);
+        trajectory.push_back(cam);
+    };
+
     for (std::size_t d = 0; d < args.angles.size(); ++d) {
         /* Sideways dimension */
         int sw = d % 2;
@@ -200,44 +387,84 @@ int main(int argc, char **argv) {
         float ss = (0.0f < rel[sw]) ? -1.0f : 1.0f;
         float fs = (0.0f < rel[fw]) ? -1.0f : 1.0f;
 
+        auto line_pos = [&] (int i) -> float {
+            return ss * spacing * (i - (lines - 1) / 2.0f);
+        };
+        auto image_pos = [&] (int k) -> float {
+            return velocity * (k - (images - 1) / 2.0f);
+        };
+
+        /* Range of images of each line whose footprint covers the area. */
+        math::Vec3f u3 = rot * math::Vec3f(sw == 0, sw == 1, 0.0f);
+        math::Vec3f v3 = rot * math::Vec3f(fw == 0, fw == 1, 0.0f);
+        math::Vec2f u(u3[0], u3[1]), v(v3[0], v3[1]);
+        std::vector<int> kept;
+        std::vector<std::pair<int, int> > ranges(lines, std::make_pair(images, -1));
         for (int i = 0; i < lines; ++i) {
-            rel = math::Vec3f(0.0f);
-            rel[sw] = ss * spacing * (i - (lines - 1) / 2.0f);
+            for (int k = 0; k < images; ++k) {
+                math::Vec3f r(0.0f);
+                r[sw] = line_pos(i);
+                r[fw] = image_pos(k);
+                math::Vec3f pos = off + rot * r;
+                if (!grid.covers(math::Vec2f(pos[0], pos[1]), u, v,
+                        width / 2.0f, height / 2.0f)) continue;
+                ranges[i].first = std::min(ranges[i].first, k);
+                ranges[i].second = std::max(ranges[i].second, k);
+            }
+            if (ranges[i].first <= ranges[i].second) kept.push_back(i);
+        }
+
+        for (std::size_t l = 0; l < kept.size(); ++l) {
+            int i = kept[l];
 
             /* Determine flight direction for this line. */
-            float lfs = fs * ((i % 2 == 0) ? 1.0f : -1.0f);
-            for (int j = 0; j < images - 1; ++j) {
-                rel[fw] = lfs * velocity * (j - ((images - 1) / 2.0f));
-
-                math::Vec3f pos = off + rot * rel;
-                math::Vec3f trans = -rrot * pos;
-                std::copy(trans.begin(), trans.end(), cam.trans);
-                trajectory.push_back(cam);
+            float lfs = fs * ((l % 2 == 0) ? 1.0f : -1.0f);
+            int first = (lfs > 0.0f) ? ranges[i].first : ranges[i].second;
+            int last = (lfs > 0.0f) ? ranges[i].second : ranges[i].first;
+            int step = (lfs > 0.0f) ? 1 : -1;
+
+            rel = math::Vec3f(0.0f);
+            rel[sw] = line_pos(i);
+            for (int k = first; k != last; k += step) {
+                rel[fw] = image_pos(k);
+                add_view(rrot);
             }
 
-            float radius = spacing / 2.0f;
+            /* Turn beyond the end of this and the start of the next line. */
+            int turn = last;
+            if (l + 1 != kept.size()) {
+                int next = kept[l + 1];
+                turn = (lfs > 0.0f)
+                    ? std::max(last, ranges[next].second)
+                    : std::min(last, ranges[next].first);
+            }
 
-            int n = 1;
-            /* If not last line, determine number of connecting images. */
-            if (i != (lines - 1)) {
-                n = std::floor((M_PI * radius) / velocity);
+            if (turn != last || l + 1 == kept.size()) {
+                rel[fw] = image_pos(last);
+                add_view(rrot);
             }
 
+            if (l + 1 == kept.size()) continue;
+
+            float radius = std::abs(line_pos(kept[l + 1]) - line_pos(i)) / 2.0f;
+
+            /* Determine number of connecting images. */
+            int n = std::max<int>(std::floor((M_PI * radius) / velocity), 1);
+
             /* Connect lines via half circle. */
             float angle = std::acos(-1.0f) / n;
             for (int j = 0; j < n; j++) {
+                if (turn != last && j == 0) continue;
+
                 math::Vec2f r;
                 r[sw] = std::cos(angle * j) * radius;
                 r[fw] = std::sin(angle * j) * radius;
 
                 rel = math::Vec3f(0.0f);
-                rel[sw] = ss * ((i - (lines - 1) / 2.0f) * spacing + radius - r[sw]);
-                rel[fw] = lfs * (((images - 1) / 2.0f) * velocity + r[fw]);
+                rel[sw] = line_pos(i) + ss * (radius - r[sw]);
+                rel[fw] = image_pos(turn) + lfs * r[fw];
 
-                math::Vec3f pos = off + rot * rel;
-                math::Vec3f trans = -rrot * pos;
-                std::copy(trans.begin(), trans.end(), cam.trans);
-                trajectory.push_back(cam);
+                add_view(rrot);
             }
         }
     }
@@ -4,10 +4,12 @@ project "generate-trajectory"
     kind "ConsoleApp"
     language "C++"
 
+    buildoptions { "-fopenmp" }
     files { "generate.cpp" }
 
     mve.use({ "util" })
-    links { "utp" }
+
+    links { "gomp", "utp" }
 
 project "shorten-trajectory"
     kind "ConsoleApp"
@@ -19,11 +19,16 @@
 #include "utp/trajectory_io.h"
 
 #include "tsp/optimize.h"
+#include "tsp/partition.h"
 
 struct Arguments {
     std::string in_trajectory;
     std::string mesh;
     std::string out_trajectory;
+    std::size_t tours;
+    float max_length;
+    std::size_t max_views;
+    int iterations;
 };
 
 Arguments parse_args(int argc, char **argv) {
@@ -33,24 +38,69 @@ Arguments parse_args(int argc, char **argv) {
     args.set_nonopt_maxnum(2);
     args.set_usage("Usage: " + std::string(argv[0]) + " [OPTS] IN_TRAJECTORY OUT_TRAJECTORY");
     args.set_description("Searches for a short path trough the input trajectories "
-        "view positions by solving the corresponding TSP.");
+        "view positions by solving the corresponding TSP. With multiple tours "
+        "(or budgets) the views are split into spatially compact tours of "
+        "balanced length which are optimized concurrently, tour i is written to "
+        "OUT_TRAJECTORY with suffix -i.");
+    args.add_option('k', "tours", true, "number of tours (vehicles or "
+        "battery cycles) [1]");
+    args.add_option('\0', "max-length", true, "maximal length of a tour - "
+        "increases the number of tours if required [inf]");
+    args.add_option('\0', "max-views", true, "maximal number of views of a "
+        "tour - increases the number of tours if required [inf]");
+    args.add_option('\0', "iterations", true, "number of random restarts "
+        "per tour (tours of up to 1024 views) [64]");
     args.parse(argc, argv);
 
     Arguments conf;
     conf.in_trajectory = args.get_nth_nonopt(0);
     conf.out_trajectory = args.get_nth_nonopt(1);
+    conf.tours = 1;
+    conf.max_length = std::numeric_limits<float>::infinity();
+    conf.max_views = 0;
+    conf.iterations = 64;
 
     for (util::ArgResult const* i = args.next_option();
          i != 0; i = args.next_option()) {
         switch (i->opt->sopt) {
+        case 'k':
+            conf.tours = i->get_arg<std::size_t>();
+        break;
+        case '\0':
+            if (i->opt->lopt == "max-length") {
+                conf.max_length = i->get_arg<float>();
+            } else if (i->opt->lopt == "max-views") {
+                conf.max_views = i->get_arg<std::size_t>();
+            } else if (i->opt->lopt == "iterations") {
+                conf.iterations = i->get_arg<int>();
+            } else {
+                throw std::invalid_argument("Invalid option");
+            }
+        break;
         default:
             throw std::invalid_argument("Invalid option");
         }
     }
 
+    if (conf.tours == 0) {
+        throw std::invalid_argument("Requires at least one tour");
+    }
+
     return conf;
 }
 
+std::string
+tour_path(std::string const & path, std::size_t idx, std::size_t num_tours) {
+    if (num_tours == 1) return path;
+
+    std::size_t pos = path.rfind('.');
+    std::size_t sep = path.rfind('/');
+    if (pos == std::string::npos || (sep != std::string::npos && pos < sep)) {
+        pos = path.size();
+    }
+    return path.substr(0, pos) + "-" + std::to_string(idx) + path.substr(pos);
+}
+
 int main(int argc, char **argv) {
     util::system::register_segfault_handler();
     util::system::print_build_timestamp(argv[0]);
@@ -65,22 +115,45 @@ int main(int argc, char **argv) {
         trajectory[i].fill_camera_pos(pos[i].begin());
     }
 
-    std::vector<uint> ids(trajectory.size());
-    std::iota(ids.begin(), ids.end(), 0);
+    bool split = args.tours > 1 || args.max_views != 0
+        || args.max_length < std::numeric_limits<float>::infinity();
 
-    std::cout << "Optimizing TSP... " << std::flush;
-    tsp::optimize(&ids, pos, 64);
-    std::cout << "done. " << std::endl;
+    if (!split) {
+        std::vector<uint> ids(trajectory.size());
+        std::iota(ids.begin(), ids.end(), 0);
+
+        std::cout << "Optimizing TSP... " << std::flush;
+        tsp::optimize(&ids, pos, args.iterations);
+        std::cout << "done. " << std::endl;
 
-    {
         std::vector<mve::CameraInfo> tmp(trajectory.size());
         for (std::size_t i = 0; i < trajectory.size(); ++i) {
             tmp[i] = trajectory[ids[i]];
         }
-        std::swap(tmp, trajectory);
+        utp::save_trajectory(tmp, args.out_trajectory);
+
+        return EXIT_SUCCESS;
     }
 
-    utp::save_trajectory(trajectory, args.out_trajectory);
+    std::cout << "Splitting and optimizing tours... " << std::flush;
+    std::vector<std::vector<uint> > tours = tsp::split(pos, args.tours,
+        args.max_length, args.max_views, args.iterations);
+    std::cout << "done. " << std::endl;
+
+    float max_length = 0.0f;
+    for (std::size_t i = 0; i < tours.size(); ++i) {
+        float length = tsp::tour_length(tours[i], pos);
+        max_length = std::max(max_length, length);
+        std::cout << "Tour " << i << ": " << tours[i].size() << " views, length "
+            << length << std::endl;
+
+        std::vector<mve::CameraInfo> tmp(tours[i].size());
+        for (std::size_t j = 0; j < tours[i].size(); ++j) {
+            tmp[j] = trajectory[tours[i][j]];
+        }
+        utp::save_trajectory(tmp, tour_path(args.out_trajectory, i, tours.size()));
+    }
+    std::cout << "Longest tour: " << max_length << std::endl;
 
     return EXIT_SUCCESS;
 }
@@ -32,6 +32,7 @@
 #include "sim/shader_type.h"
 #include "sim/entities/trajectory_renderer.h"
 #include "sim/model_renderer.h"
+#include "sim/point_octree_renderer.h"
 
 #include "col/mpl_viridis.h"
 
@@ -40,6 +41,8 @@
 #include "geom/sphere.h"
 #include "geom/volume_io.h"
 
+#include "eval/spherical_histogram.h"
+
 #include "utp/trajectory_io.h"
 
 //TODOs
@@ -57,7 +60,8 @@ Arguments parse_args(int argc, char **argv) {
     args.set_nonopt_minnum(0);
     args.set_nonopt_maxnum(0);
     args.set_usage("Usage: " + std::string(argv[0]) + " [OPTS]");
-    args.add_option('m', "mesh", true, "");
+    args.add_option('m', "mesh", true, "mesh or point octree directory "
+        "(see build_octree-cloud)");
     args.add_option('v', "volume", true, "");
     args.add_option('t', "trajectory", true, "");
     args.set_description("Visualizer for meshes, volumes and trajectories.");
@@ -124,11 +128,28 @@ int main(int argc, char **argv) {
     init_opengl();
 
     Engine::Ptr engine(new Engine());
-    if (!args.mesh.empty()) {
+    std::vector<Shader::Ptr> shaders;
+
+    PointOctreeRenderer::Ptr por;
+    if (util::fs::dir_exists(args.mesh.c_str())) {
+        Shader::Ptr shader(new Shader());
+        std::string path = util::fs::join_path(__ROOT__, "res/shaders");
+        shader->load_shader_program(path + "/" + shader_names[VCOLOR]);
+        math::Matrix4f eye;
+        math::matrix_set_identity(&eye);
+        shader->set_model_matrix(eye);
+        shaders.push_back(shader);
+
+        try {
+            por = PointOctreeRenderer::Ptr(new PointOctreeRenderer(args.mesh, shader, eye));
+        } catch (std::exception& e) {
+            std::cerr << "Could not load point octree: " << e.what() << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    } else if (!args.mesh.empty()) {
         engine->create_static_model(args.mesh);
     }
 
-    std::vector<Shader::Ptr> shaders;
     if (!args.trajectory.empty()) {
         Shader::Ptr shader(new Shader());
         std::string path = util::fs::join_path(__ROOT__, "res/shaders");
@@ -219,7 +240,7 @@ int main(int argc, char **argv) {
     std::vector<float> samples;
     Volume<std::uint32_t>::Ptr volume;
     Pose::Ptr poses[3][3];
-    mve::ByteImage::Ptr hist = mve::ByteImage::create(128, 90, 3);
+    mve::ByteImage::Ptr hist;
     ogl::Texture::Ptr textures[3][3];
     if (!args.volume.empty()) {
         Shader::Ptr shader(new Shader());
@@ -237,6 +258,10 @@ int main(int argc, char **argv) {
             std::exit(EXIT_FAILURE);
         }
 
+        /* Lower hemisphere histogram, upper half stays black. */
+        HistogramResolution res = load_histogram_resolution(volume->metadata());
+        hist = mve::ByteImage::create(res.width, 2 * res.height, 3);
+
         mve::TriangleMesh::Ptr sphere = generate_sphere_mesh(0.1f, 5u);
         parameterize_spherical(sphere);
 
@@ -437,6 +462,8 @@ int main(int argc, char **argv) {
         camera.up_vec = trackball.get_upvec();
         camera.update_matrices();
 
+        if (por) por->update(camera);
+
         for (std::size_t i = 0; i < shaders.size(); ++i) {
             shaders[i]->set_view_matrix(camera.view);
             shaders[i]->set_proj_matrix(camera.proj);
@@ -447,6 +474,7 @@ int main(int argc, char **argv) {
 
         glViewport(0, 0, 1920, 1080);
         engine->render(camera);
+        if (por) por->render();
 
         glFlush();
 
@@ -10,19 +10,25 @@
 #include <vector>
 #include <unordered_map>
 #include <algorithm>
+#include <limits>
+#include <cmath>
 
 #include "geom/volume_io.h"
 
 #include "util/arguments.h"
 #include "util/file_system.h"
 #include "util/tokenizer.h"
+#include "util/batch_normalize.h"
 
 struct Arguments {
     bool clamp;
+    bool batch;
     std::string in_volume;
     std::string out_volume;
     float eps;
     float no_value;
+    float min;
+    float max;
     std::vector<std::string> volumes;
 };
 
@@ -32,12 +38,19 @@ Arguments parse_args(int argc, char **argv) {
     args.set_nonopt_maxnum(2);
     args.set_nonopt_minnum(2);
     args.set_usage("Usage: " + std::string(argv[0]) + " [OPTS] IN_VOLUME OUT_VOLUME");
-    args.set_description("Normalizes the volume values.");
+    args.set_description("Normalizes the volume values. In batch mode IN_VOLUME "
+        "is a list of volumes (comma separated, @FILE with one path per line or "
+        "a glob pattern) and OUT_VOLUME a directory - the range is estimated "
+        "once over all volumes (approximate quantiles) and all volumes are "
+        "normalized in parallel.");
+    args.add_option('b', "batch", false, "batch mode");
     args.add_option('c', "clamp", false, "clamp (instead of remove) outliers");
     args.add_option('e', "epsilon", true, "remove outliers in percent [0.0]");
     args.add_option('i', "ignore", true, "set value to ignore [-1.0]");
-    args.add_option('\0', "meshes", true, "calculate normalization based on these volumes (comma seperated list)."
-        "If no mesh is given the normalization is calculate from IN_VOLUME");
+    args.add_option('\0', "min", true, "minimum value (batch mode) [estimated]");
+    args.add_option('\0', "max", true, "maximum value (batch mode) [estimated]");
+    args.add_option('\0', "volumes", true, "calculate normalization based on these volumes (comma seperated list)."
+        "If no volume is given the normalization is calculate from IN_VOLUME");
     args.parse(argc, argv);
 
     Arguments conf;
@@ -45,7 +58,10 @@ Arguments parse_args(int argc, char **argv) {
     conf.out_volume = args.get_nth_nonopt(1);
     conf.eps = 0.0f;
     conf.clamp = false;
+    conf.batch = false;
     conf.no_value = -1.0f;
+    conf.min = std::numeric_limits<float>::lowest();
+    conf.max = std::numeric_limits<float>::max();
 
     for (util::ArgResult const* i = args.next_option();
          i != 0; i = args.next_option()) {
@@ -56,6 +72,9 @@ Arguments parse_args(int argc, char **argv) {
         case 'c':
             conf.clamp = true;
         break;
+        case 'b':
+            conf.batch = true;
+        break;
         case 'i':
             conf.no_value = i->get_arg<float>();
         break;
@@ -64,6 +83,10 @@ Arguments parse_args(int argc, char **argv) {
                 util::Tokenizer t;
                 t.split(i->arg, ',');
                 conf.volumes = t;
+            } else if (i->opt->lopt == "min") {
+                conf.min = i->get_arg<float>();
+            } else if (i->opt->lopt == "max") {
+                conf.max = i->get_arg<float>();
             } else {
                 throw std::invalid_argument("Invalid option");
             }
@@ -77,16 +100,107 @@ Arguments parse_args(int argc, char **argv) {
         throw std::invalid_argument("epsilon is supposed to be in the intervall [0.0, 1.0]");
     }
 
-    if (conf.volumes.empty()) {
+    if (conf.volumes.empty() && !conf.batch) {
         conf.volumes.push_back(conf.in_volume);
     }
 
     return conf;
 }
 
+/* Calls func for each value of the histograms and the summary layer
+ * entries of positions without histogram (summary only volumes). */
+template <typename Func> void
+for_each_value(Volume<std::uint32_t>::Ptr volume, Func func) {
+    for (std::uint32_t i = 0; i < volume->num_positions(); ++i) {
+        mve::FloatImage::Ptr image = volume->at(i);
+        if (image != nullptr) {
+            for (int j = 0; j < image->get_value_amount(); ++j) {
+                func(image->at(j));
+            }
+        } else if (volume->has_summary(i)) {
+            VolumeDirection * directions = volume->summary(i);
+            for (std::size_t j = 0; j < volume->summary_size(); ++j) {
+                if (std::isinf(directions[j].value)) break;
+                func(directions[j].value);
+            }
+        }
+    }
+}
+
+int
+normalize(Volume<std::uint32_t>::Ptr volume, float min, float max,
+    Arguments const & args)
+{
+    float delta = max - min;
+    /* Returns true for outliers. */
+    auto normalize_value = [&] (float & value) -> bool {
+        if (value == args.no_value) return false;
+
+        if (value >= min) {
+            if(value <= max) {
+                value = ((value - min) / delta);
+                return false;
+            } else {
+                value = args.clamp ? 1.0f : args.no_value;
+                return true;
+            }
+        } else {
+            value = args.clamp ? 0.0f : args.no_value;
+            return true;
+        }
+    };
+
+    int num_outliers = 0;
+    for_each_value(volume, [&] (float & value) {
+        if (normalize_value(value)) num_outliers++;
+    });
+
+    /* Keep the summary layer of positions with histogram consistent. */
+    for (std::uint32_t i = 0; i < volume->num_positions(); ++i) {
+        if (volume->at(i) == nullptr || !volume->has_summary(i)) continue;
+        VolumeDirection * directions = volume->summary(i);
+        for (std::size_t j = 0; j < volume->summary_size(); ++j) {
+            if (std::isinf(directions[j].value)) break;
+            normalize_value(directions[j].value);
+        }
+    }
+
+    return num_outliers;
+}
+
+void
+batch_normalize(Arguments const & args) {
+    auto insert = [&args] (std::string const & path, QuantileSketch * sketch) {
+        Volume<std::uint32_t>::Ptr volume = load_volume<std::uint32_t>(path);
+        for_each_value(volume, [&] (float value) {
+            if (value != args.no_value) sketch->insert(value);
+        });
+    };
+
+    auto normalize_volume = [&args] (std::string const & path,
+        std::string const & out, float min, float max) -> int
+    {
+        Volume<std::uint32_t>::Ptr volume = load_volume<std::uint32_t>(path);
+        int num_outliers = normalize(volume, min, max, args);
+        save_volume<std::uint32_t>(volume, out);
+        return num_outliers;
+    };
+
+    int num_outliers = ::batch_normalize(args.in_volume, args.volumes,
+        args.out_volume, args.min, args.max, args.eps, insert, normalize_volume);
+
+    std::cout << (args.clamp ? "Clamped " : "Removed ")
+        << num_outliers << " outliers" << std::endl;
+}
+
 int main(int argc, char **argv) {
     Arguments args = parse_args(argc, argv);
 
+    if (args.batch) {
+        batch_normalize(args);
+        return EXIT_SUCCESS;
+    }
+
     Volume<std::uint32_t>::Ptr volume_to_normalize;
 
     std::unordered_map<std::string, Volume<std::uint32_t>::Ptr> volumes_to_load;
@@ -108,12 +222,7 @@ int main(int argc, char **argv) {
             std::exit(EXIT_FAILURE);
         }
 
-        for (std::uint32_t i = 0; i < volume->num_positions(); ++i) {
-            mve::FloatImage::Ptr image = volume->at(i);
-            if (image != nullptr) {
-                num_values += image->get_value_amount();
-            }
-        }
+        for_each_value(volume, [&num_values] (float) { num_values += 1; });
 
         it->second = volume;
     }
@@ -124,18 +233,9 @@ int main(int argc, char **argv) {
 
     for (std::size_t i = 0; i < args.volumes.size(); ++i) {
         Volume<std::uint32_t>::Ptr volume = volumes_to_load[args.volumes[i]];
-        for (std::uint32_t j = 0; j < volume->num_positions(); ++j) {
-            mve::FloatImage::Ptr image = volume->at(j);
-            if (image == nullptr) continue;
-
-            for (int k = 0; k < image->get_value_amount(); ++k) {
-                float value = image->at(k);
-
-                if (value == args.no_value) continue;
-
-                values.push_back(value);
-            }
-        }
+        for_each_value(volume, [&] (float value) {
+            if (value != args.no_value) values.push_back(value);
+        });
     }
 
     std::cout << values.size() << " valid values" << std::endl;
@@ -158,33 +258,11 @@ int main(int argc, char **argv) {
     std::nth_element(values.begin(), nth, values.end(), std::greater<float>());
     float max = *nth;
 
-    float delta = max - min;
     std::cout << "Minimal value: " << real_min << std::endl;
     std::cout << "Maximal value: " << real_max << std::endl;
     std::cout << "Normalizing range " << min << " - " << max << std::endl;
 
-    int num_outliers = 0;
-    for (std::uint32_t i = 0; i < volume_to_normalize->num_positions(); ++i) {
-        mve::FloatImage::Ptr image = volume_to_normalize->at(i);
-        if (image == nullptr) continue;
-
-        for (int j = 0; j < image->get_value_amount(); ++j) {
-            float value = image->at(j);
-            if (value == args.no_value) continue;
-
-            if (value >= min) {
-                if(value <= max) {
-                    image->at(j) = ((value - min) / delta);
-                } else {
-                    image->at(j) = args.clamp ? 1.0f : args.no_value;
-                    num_outliers++;
-                }
-            } else {
-                image->at(j) = args.clamp ? 0.0f : args.no_value;
-                num_outliers++;
-            }
-        }
-    }
+    int num_outliers = normalize(volume_to_normalize, min, max, args);
 
     if (args.clamp) {
         std::cout << "Clamped ";
@@ -15,6 +15,10 @@ project "normalize-volume"
     kind "ConsoleApp"
     language "C++"
 
+    buildoptions { "-fopenmp" }
+
     files { "normalize.cpp" }
 
     mve.use({ "util" })
+
+    links { "gomp" }
@@ -110,7 +110,8 @@ rad2deg(float rad) {
 
 __forceinline__ __device__
 float
-heuristic(cacc::Vec3f const * rel_rays, uint stride, uint n, cacc::Vec3f new_rel_ray)
+heuristic(cacc::Vec3f const * rel_rays, uint stride, uint n, cacc::Vec3f new_rel_ray,
+    float m_k, float m_x0, float t_k, float t_x0)
 {
     float sum = 0.0f;
     for (uint i = 0; i < n; ++i) {
@@ -122,8 +123,8 @@ heuristic(cacc::Vec3f const * rel_rays, uint stride, uint n, cacc::Vec3f new_rel
         float scale = min(rel_ray[3], new_rel_ray[3]);
         float ctheta = min(rel_ray[2], new_rel_ray[2]);
 #if 1
-        float matchability = (1.0f - logistic(alpha, sym_m_k, pi / sym_m_x0)) * ctheta;
-        float triangulation = logistic(alpha, sym_t_k, pi / sym_t_x0) * scale;
+        float matchability = (1.0f - logistic(alpha, m_k, pi / m_x0)) * ctheta;
+        float triangulation = logistic(alpha, t_k, pi / t_x0) * scale;
         sum += matchability * triangulation;
 #else
         float deg = rad2deg(alpha);
@@ -135,6 +136,14 @@ heuristic(cacc::Vec3f const * rel_rays, uint stride, uint n, cacc::Vec3f new_rel
     return sum;
 }
 
+__forceinline__ __device__
+float
+heuristic(cacc::Vec3f const * rel_rays, uint stride, uint n, cacc::Vec3f new_rel_ray)
+{
+    return heuristic(rel_rays, stride, n, new_rel_ray,
+        sym_m_k, sym_m_x0, sym_t_k, sym_t_x0);
+}
+
 __global__
 void
 update_observation_rays(bool populate,
@@ -201,6 +210,65 @@ update_observation_rays(bool populate,
     }
 }
 
+__global__
+void
+update_observation_rays(bool populate,
+    ViewGroup const group, float max_distance, int width, int height,
+    cacc::BVHTree<cacc::DEVICE>::Accessor const bvh_tree,
+    cacc::PointCloud<cacc::DEVICE>::Data cloud,
+    cacc::VectorArray<cacc::Vec3f, cacc::DEVICE>::Data obs_rays)
+{
+    int const bx = blockIdx.x;
+    int const tx = threadIdx.x;
+
+    uint id = bx * blockDim.x + tx;
+    int const stride = obs_rays.pitch / sizeof(cacc::Vec3f);
+
+    if (id >= cloud.num_vertices) return;
+    cacc::Vec3f v = cloud.vertices_ptr[id];
+    cacc::Vec3f n = cloud.normals_ptr[id];
+
+    float l;
+    cacc::Vec3f v2cn;
+    if (!observable(group.pos, &v[0], &n[0], max_distance, &v2cn[0], &l)) return;
+
+    uint count = count_in_frustum(group, &v[0], width, height);
+    if (count == 0) return;
+
+    if (!visible(v, v2cn, l, bvh_tree)) return;
+
+    cacc::Vec3f rel_ray;
+    relative_direction(&v2cn[0], &n[0], &rel_ray[0]);
+    rel_ray[3] = 1.0f - (l / max_distance);
+
+    cacc::Vec3f * rel_rays = obs_rays.data_ptr + id;
+    if (populate) {
+        uint num_rows = atomicAdd(obs_rays.num_rows_ptr + id, count);
+
+        for (uint i = num_rows; i < min(num_rows + count, obs_rays.max_rows); ++i) {
+            rel_rays[i * stride] = rel_ray; //TODO handle overflow
+        }
+    } else {
+        uint num_rows = min(obs_rays.num_rows_ptr[id], obs_rays.max_rows);
+
+        for (int i = 0; i < num_rows && count > 0; ++i) {
+            cacc::Vec3f orel_ray = rel_rays[i * stride];
+
+            bool equal = true;
+            #pragma unroll
+            for (int j = 0; j < 4; ++j) {
+                equal = equal && abs(rel_ray[j] - orel_ray[j]) < 1e-5f;
+            }
+
+            if (equal) {
+                //Mark invalid
+                rel_rays[i * stride][3] = -1.0f;
+                count -= 1;
+            }
+        }
+    }
+}
+
 __global__
 void
 process_observation_rays(
@@ -290,6 +358,114 @@ evaluate_observation_rays(
     recons.data_ptr[id] = recon;
 }
 
+__global__
+void
+evaluate_observation_rays(
+    cacc::VectorArray<cacc::Vec3f, cacc::DEVICE>::Data obs_rays,
+    cacc::Array<float, cacc::DEVICE>::Data const params,
+    cacc::Image<float, cacc::DEVICE>::Data recons)
+{
+    int const bx = blockIdx.x;
+    int const tx = threadIdx.x;
+    int const by = blockIdx.y;
+
+    uint id = bx * blockDim.x + tx;
+
+    if (id >= obs_rays.num_cols || by >= recons.height) return;
+
+    int const stride = obs_rays.pitch / sizeof(cacc::Vec3f);
+    uint num_rows = min(obs_rays.num_rows_ptr[id], obs_rays.max_rows);
+
+    cacc::Vec3f * rel_rays = obs_rays.data_ptr + id;
+
+    float const * p = params.data_ptr + 4 * by;
+    float const m_k = p[0];
+    float const m_x0 = p[1];
+    float const t_k = p[2];
+    float const t_x0 = p[3];
+
+    float recon = num_rows >= 1 ? 0.0f : -1.0f;
+    for (int i = 1; i < num_rows; ++i) {
+        cacc::Vec3f rel_ray = rel_rays[i * stride];
+        recon += heuristic(rel_rays, stride, i, rel_ray, m_k, m_x0, t_k, t_x0);
+    }
+
+    int const rstride = recons.pitch / sizeof(float);
+    recons.data_ptr[by * rstride + id] = recon;
+}
+
+/* Contribution of observing sample id under the angle (cos) ctheta
+ * with the distance scale. */
+__forceinline__ __device__
+float
+observation_score(cacc::PointCloud<cacc::DEVICE>::Data const & cloud, uint id,
+    float ctheta, float scale)
+{
+    float capture_difficulty = max(cloud.qualities_ptr[id], 0.0f);
+
+    // 1.484f ~ 85.0f / 180.0f * pi
+    float min_theta = min(cloud.values_ptr[id], 1.484f);
+
+    float scaling = (pi / 2.0f) / ((pi / 2.0f) - min_theta);
+
+    float theta = acosf(__saturatef(ctheta));
+    float rel_theta = max(theta - min_theta, 0.0f) * scaling;
+    return capture_difficulty * cosf(rel_theta) * scale;
+}
+
+/* Conservative visibility of the segment from v to p within a height field
+ * (heights relative to ground_level, cells of size res starting at origin)
+ * traversed with a 2D DDA. The cell containing v is skipped and a cell only
+ * occludes if the segment stays below its height while crossing it. */
+__forceinline__ __device__
+bool
+visible(cacc::Vec3f const & v, cacc::Vec3f const & p,
+    cacc::Image<float, cacc::DEVICE>::Data const & hmap,
+    cacc::Vec2f const & origin, float res, float ground_level)
+{
+    float const inf = __int_as_float(0x7f800000);
+
+    float x0 = (v[0] - origin[0]) / res;
+    float y0 = (v[1] - origin[1]) / res;
+    float dx = (p[0] - origin[0]) / res - x0;
+    float dy = (p[1] - origin[1]) / res - y0;
+    float dz = p[2] - v[2];
+
+    int cx = floorf(x0);
+    int cy = floorf(y0);
+    int const sx = dx > 0.0f ? 1 : -1;
+    int const sy = dy > 0.0f ? 1 : -1;
+
+    float const tdx = dx != 0.0f ? abs(1.0f / dx) : inf;
+    float const tdy = dy != 0.0f ? abs(1.0f / dy) : inf;
+    float tmx = dx != 0.0f ? ((dx > 0.0f) ? (cx + 1 - x0) : (x0 - cx)) * tdx : inf;
+    float tmy = dy != 0.0f ? ((dy > 0.0f) ? (cy + 1 - y0) : (y0 - cy)) * tdy : inf;
+
+    int const stride = hmap.pitch / sizeof(float);
+
+    while (true) {
+        float t;
+        if (tmx < tmy) {
+            t = tmx;
+            cx += sx;
+            tmx += tdx;
+        } else {
+            t = tmy;
+            cy += sy;
+            tmy += tdy;
+        }
+        if (t >= 1.0f) return true;
+
+        if (cx < 0 || hmap.width <= cx || cy < 0 || hmap.height <= cy) {
+            return true;
+        }
+
+        float tn = min(min(tmx, tmy), 1.0f);
+        float z = v[2] + max(t * dz, tn * dz);
+        if (z - ground_level < hmap.data_ptr[cy * stride + cx]) return false;
+    }
+}
+
 __global__
 void populate_spherical_histogram(cacc::Vec3f view_pos, float max_distance,
     cacc::BVHTree<cacc::DEVICE>::Accessor const bvh_tree,
@@ -319,16 +495,7 @@ void populate_spherical_histogram(cacc::Vec3f view_pos, float max_distance,
 
     if (!visible(v, v2cn, l, bvh_tree)) return;
 
-    float capture_difficulty = max(cloud.qualities_ptr[id], 0.0f);
-
-    // 1.484f ~ 85.0f / 180.0f * pi
-    float min_theta = min(cloud.values_ptr[id], 1.484f);
-
-    float scaling = (pi / 2.0f) / ((pi / 2.0f) - min_theta);
-
-    float theta = acosf(__saturatef(ctheta));
-    float rel_theta = max(theta - min_theta, 0.0f) * scaling;
-    float score = capture_difficulty * cosf(rel_theta) * scale;
+    float score = observation_score(cloud, id, ctheta, scale);
 
     uint idx;
     cacc::nnsearch::find_nn<3u>(kd_tree, -v2cn, &idx, nullptr);
@@ -391,7 +558,7 @@ void populate_spherical_histogram(cacc::Vec3f view_pos,
 
 __global__
 void
-evaluate_spherical_histogram(cacc::Mat3f calib, int width, int height,
+evaluate_spherical_histogram(CameraModel const model,
     cacc::KDTree<3, cacc::DEVICE>::Accessor const kd_tree,
     cacc::Array<float, cacc::DEVICE>::Data const sphere_hist,
     cacc::Image<float, cacc::DEVICE>::Data hist)
@@ -406,43 +573,111 @@ evaluate_spherical_histogram(cacc::Mat3f calib, int width, int height,
 
     if (x >= hist.width || y >= hist.height) return;
 
-    float phi = (x / (float) hist.width) * 2.0f * pi;
-    //float theta = (y / (float) hist.height) * pi;
-    float theta = (0.5f + (y / (float) hist.height) / 2.0f) * pi;
-    float stheta = sinf(theta);
-    cacc::Vec3f view_dir(stheta * cosf(phi), stheta * sinf(phi), cosf(theta));
-    view_dir.normalize();
+    CameraModels models;
+    models.num_models = 1;
+    models.models[0] = model;
+
+    float sum;
+    convolve_spherical_histogram(models, kd_tree.verts_ptr, kd_tree.num_verts,
+        sphere_hist.data_ptr, x, y, hist.width, hist.height, &sum);
+
+    int const stride = hist.pitch / sizeof(float);
+    hist.data_ptr[y * stride + x] = sum;
+}
+
+__global__
+void
+scatter_spherical_histograms(float max_distance,
+    cacc::Vec3f vmin, cacc::Vec3f vres, int vwidth, int vheight, int z,
+    cacc::Array<int, cacc::DEVICE>::Data const slots, int first_slot,
+    cacc::Image<float, cacc::DEVICE>::Data const hmap,
+    cacc::Vec2f hmin, float hres, float ground_level,
+    cacc::PointCloud<cacc::DEVICE>::Data const cloud,
+    cacc::KDTree<3, cacc::DEVICE>::Accessor const kd_tree,
+    cacc::Array<float, cacc::DEVICE>::Data sphere_hists)
+{
+    int const bx = blockIdx.x;
+    int const tx = threadIdx.x;
+
+    uint id = bx * blockDim.x + tx;
+
+    if (id >= cloud.num_vertices) return;
 
-    /* Determine stable rotation matrix
-     * (local coordinate system with z == viewing direction). */
-    cacc::Vec3f rz = -view_dir;
+    cacc::Vec3f v = cloud.vertices_ptr[id];
+    cacc::Vec3f n = cloud.normals_ptr[id];
 
-    cacc::Vec3f up = cacc::Vec3f(0.0f, 0.0f, 1.0f);
-    bool stable = abs(dot(up, rz)) < 0.99f;
-    up = stable ? up : cacc::Vec3f(cosf(phi), sinf(phi), 0.0f);
+    float pz = vmin[2] + z * vres[2];
+    float dz = pz - v[2];
+    float r2 = max_distance * max_distance - dz * dz;
+    if (r2 <= 0.0f) return;
 
-    cacc::Vec3f rx = cross(up, rz).normalize();
-    cacc::Vec3f ry = cross(rz, rx).normalize();
+    /* Voxels of the layer outside of the visible hemisphere. */
+    float r = sqrtf(r2);
+    int x0 = max(0, (int) ceilf((v[0] - r - vmin[0]) / vres[0]));
+    int x1 = min(vwidth - 1, (int) floorf((v[0] + r - vmin[0]) / vres[0]));
+    int y0 = max(0, (int) ceilf((v[1] - r - vmin[1]) / vres[1]));
+    int y1 = min(vheight - 1, (int) floorf((v[1] + r - vmin[1]) / vres[1]));
 
-    float sum = 0.0f;
+    uint const num_bins = kd_tree.num_verts;
 
-    for (uint i = 0; i < kd_tree.num_verts; ++i) {
-        cacc::Vec3f dir = kd_tree.verts_ptr[i].normalize();
-        if (dot(view_dir, dir) < 0.0f) continue;
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = x0; x <= x1; ++x) {
+            int slot = slots.data_ptr[y * vwidth + x];
+            if (slot < 0) continue;
+
+            cacc::Vec3f p(vmin[0] + x * vres[0], vmin[1] + y * vres[1], pz);
+            cacc::Vec3f v2c = p - v;
+            float l = norm(v2c);
+
+            float scale = 1.0f - (l / max_distance);
+            if (scale <= 0.0f) continue;
 
-        cacc::Vec3f v;
-        v[0] = dot(rx, dir);
-        v[1] = dot(ry, dir);
-        v[2] = dot(rz, dir);
+            cacc::Vec3f v2cn = v2c / l;
+            float ctheta = dot(v2cn, n);
+            // 0.087f ~ cos(85.0f / 180.0f * pi)
+            if (ctheta < 0.087f) continue;
 
-        cacc::Vec2f p = project(v, calib);
-        if (p[0] < 0.0f || width <= p[0] || p[1] < 0.0f || height <= p[1]) continue;
+            if (!visible(v, p, hmap, hmin, hres, ground_level)) continue;
 
-        sum += sphere_hist.data_ptr[i];
+            float score = observation_score(cloud, id, ctheta, scale);
+
+            uint idx;
+            cacc::nnsearch::find_nn<3u>(kd_tree, -v2cn, &idx, nullptr);
+            uint offset = (slot - first_slot) * num_bins;
+            atomicAdd(sphere_hists.data_ptr + offset + idx, score);
+        }
     }
+}
 
-    int const stride = hist.pitch / sizeof(float);
-    hist.data_ptr[y * stride + x] = sum;
+__global__
+void
+evaluate_spherical_histograms(CameraModels const models,
+    cacc::KDTree<3, cacc::DEVICE>::Accessor const kd_tree,
+    cacc::Array<float, cacc::DEVICE>::Data const sphere_hists,
+    uint hist_height, cacc::Image<float, cacc::DEVICE>::Data hists)
+{
+    int const bx = blockIdx.x;
+    int const tx = threadIdx.x;
+    int const by = blockIdx.y;
+    int const ty = threadIdx.y;
+    int const bz = blockIdx.z;
+
+    uint x = bx * blockDim.x + tx;
+    uint y = by * blockDim.y + ty;
+
+    if (x >= hists.width || y >= hist_height) return;
+
+    float const * sphere_hist = sphere_hists.data_ptr + bz * kd_tree.num_verts;
+
+    float sums[MAX_CAMERA_MODELS];
+    convolve_spherical_histogram(models, kd_tree.verts_ptr, kd_tree.num_verts,
+        sphere_hist, x, y, hists.width, hist_height, sums);
+
+    int const stride = hists.pitch / sizeof(float);
+    for (uint i = 0; i < models.num_models; ++i) {
+        uint row = (bz * models.num_models + i) * hist_height + y;
+        hists.data_ptr[row * stride + x] = sums[i];
+    }
 }
 
 __global__ void
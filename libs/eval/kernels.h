@@ -17,6 +17,9 @@
 #include "cacc/point_cloud.h"
 #include "cacc/vector_array.h"
 
+#include "view_group.h"
+#include "spherical_histogram.h"
+
 #define KERNEL_BLOCK_SIZE 128
 
 /* Add (populate) observation rays for each sample visible in the view.
@@ -30,6 +33,15 @@ __global__ void update_observation_rays(bool populate,
     cacc::PointCloud<cacc::DEVICE>::Data const cloud,
     cacc::VectorArray<cacc::Vec3f, cacc::DEVICE>::Data obs_rays);
 
+/* Same as above for a group of views sharing their position - distance and
+ * occlusion are determined once, each view containing the sample in its
+ * frustum adds (removes) one observation ray. */
+__global__ void update_observation_rays(bool populate,
+    ViewGroup const group, float max_distance, int width, int height,
+    cacc::BVHTree<cacc::DEVICE>::Accessor const bvh_tree,
+    cacc::PointCloud<cacc::DEVICE>::Data const cloud,
+    cacc::VectorArray<cacc::Vec3f, cacc::DEVICE>::Data obs_rays);
+
 /* Sort and remove invalid observation rays. */
 __global__ void process_observation_rays(
     cacc::VectorArray<cacc::Vec3f, cacc::DEVICE>::Data obs_rays);
@@ -39,6 +51,14 @@ __global__ void evaluate_observation_rays(
     cacc::VectorArray<cacc::Vec3f, cacc::DEVICE>::Data obs_rays,
     cacc::Array<float, cacc::DEVICE>::Data recons);
 
+/* Evaluate per sample reconstructabilities for multiple heuristic parameter
+ * sets (m_k, m_x0, t_k, t_x0 - four values per set in params).
+ * Row y of recons holds the reconstructabilities for parameter set y. */
+__global__ void evaluate_observation_rays(
+    cacc::VectorArray<cacc::Vec3f, cacc::DEVICE>::Data obs_rays,
+    cacc::Array<float, cacc::DEVICE>::Data const params,
+    cacc::Image<float, cacc::DEVICE>::Data recons);
+
 __global__ void populate_spherical_histogram(cacc::Vec3f view_pos, float max_distance,
     cacc::BVHTree<cacc::DEVICE>::Accessor const bvh_tree,
     cacc::PointCloud<cacc::DEVICE>::Data const cloud,
@@ -65,13 +85,41 @@ __global__ void populate_spherical_histogram(cacc::Vec3f view_pos,
  * hemisphere by "convolving" it with a "frustum kernel".
  * Each x of hist is phi [0, width] -> [0, 2pi] and
  * y of hist is phi [0, height] -> [pi/2, pi].
+ * Single model variant of evaluate_spherical_histograms (shares
+ * convolve_spherical_histogram with evaluate_camera_models).
  * kd_tree - vertices are 3D location of sphere_hist bins */
 __global__
-void evaluate_spherical_histogram(cacc::Mat3f calib, int width, int height,
+void evaluate_spherical_histogram(CameraModel const model,
     cacc::KDTree<3, cacc::DEVICE>::Accessor const kd_tree,
     cacc::Array<float, cacc::DEVICE>::Data const sphere_hist,
     cacc::Image<float, cacc::DEVICE>::Data hist);
 
+/* Scatter formulation of populate_spherical_histogram - each cloud vertex
+ * splats its contribution into the spherical histograms of all voxels
+ * of layer z within max_distance in its visible hemisphere.
+ * Occlusion is determined (conservatively) within the height map.
+ * slots - per voxel (x, y) of the layer its slot or -1 (unoccupied)
+ * sphere_hists - kd_tree.num_verts bins per slot starting at first_slot */
+__global__
+void scatter_spherical_histograms(float max_distance,
+    cacc::Vec3f vmin, cacc::Vec3f vres, int vwidth, int vheight, int z,
+    cacc::Array<int, cacc::DEVICE>::Data const slots, int first_slot,
+    cacc::Image<float, cacc::DEVICE>::Data const hmap,
+    cacc::Vec2f hmin, float hres, float ground_level,
+    cacc::PointCloud<cacc::DEVICE>::Data const cloud,
+    cacc::KDTree<3, cacc::DEVICE>::Accessor const kd_tree,
+    cacc::Array<float, cacc::DEVICE>::Data sphere_hists);
+
+/* Evaluates the spherical histograms for all camera models in a single pass
+ * over their bins - blockIdx.z selects the spherical histogram, the result
+ * for model i is stored in rows [j * hist_height, (j + 1) * hist_height)
+ * of hists with j = z * num_models + i. */
+__global__
+void evaluate_spherical_histograms(CameraModels const models,
+    cacc::KDTree<3, cacc::DEVICE>::Accessor const kd_tree,
+    cacc::Array<float, cacc::DEVICE>::Data const sphere_hists,
+    uint hist_height, cacc::Image<float, cacc::DEVICE>::Data hists);
+
 /* Estimate the capture difficulty of each cloud vertex by sampling which parts
  * of the hemisphere around the samples normal are observable.
  * bvh_tree - contains both proxy and airspace mesh, the face IDs of the
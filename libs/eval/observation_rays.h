@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef EVAL_OBSERVATION_RAYS_HEADER
+#define EVAL_OBSERVATION_RAYS_HEADER
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#include "math/vector.h"
+
+#include "acc/kd_tree.h"
+#include "acc/bvh_tree.h"
+
+#include "view_group.h"
+
+/* Per sample observation rays - relative direction (xyz) and distance
+ * scale (w), a negative scale marks removed rays. */
+typedef std::vector<std::vector<math::Vec4f> > ObservationRays;
+
+/* Host implementation of the grouped update_observation_rays kernel. */
+inline void
+update_observation_rays(bool populate, ViewGroup const & group,
+    float max_distance, int width, int height,
+    acc::BVHTree<uint, math::Vec3f> const & bvh_tree,
+    std::vector<math::Vec3f> const & verts,
+    std::vector<math::Vec3f> const & normals,
+    std::size_t max_rows, ObservationRays * obs_rays)
+{
+    obs_rays->resize(verts.size());
+
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (std::size_t i = 0; i < verts.size(); ++i) {
+        math::Vec3f const & v = verts[i];
+        math::Vec3f const & n = normals[i];
+
+        float l;
+        math::Vec3f v2cn;
+        if (!observable(group.pos, v.begin(), n.begin(), max_distance,
+                v2cn.begin(), &l)) continue;
+
+        unsigned int count = count_in_frustum(group, v.begin(), width, height);
+        if (count == 0) continue;
+
+        acc::Ray<math::Vec3f> ray;
+        ray.origin = v;
+        ray.dir = v2cn;
+        ray.tmin = l * 0.001f;
+        ray.tmax = l;
+        if (bvh_tree.intersect(ray)) continue;
+
+        math::Vec4f rel_ray;
+        relative_direction(v2cn.begin(), n.begin(), rel_ray.begin());
+        rel_ray[3] = 1.0f - (l / max_distance);
+
+        std::vector<math::Vec4f> & rel_rays = (*obs_rays)[i];
+        if (populate) {
+            std::size_t num_rows = std::min(rel_rays.size() + count, max_rows);
+            rel_rays.resize(std::max(num_rows, rel_rays.size()), rel_ray);
+        } else {
+            for (std::size_t j = 0; j < rel_rays.size() && count > 0; ++j) {
+                bool equal = true;
+                for (int k = 0; k < 4; ++k) {
+                    equal = equal && std::abs(rel_ray[k] - rel_rays[j][k]) < 1e-5f;
+                }
+                if (!equal) continue;
+
+                rel_rays[j][3] = -1.0f;
+                count -= 1;
+            }
+        }
+    }
+}
+
+/* Host implementation of the reconstructability heuristic (kernels.cu) -
+ * contribution of new_rel_ray given the first n rel_rays. */
+inline float
+heuristic(std::vector<math::Vec4f> const & rel_rays, std::size_t n,
+    math::Vec4f const & new_rel_ray, float m_k = 8.0f, float m_x0 = 4.0f,
+    float t_k = 32.0f, float t_x0 = 16.0f)
+{
+    float const pi = 3.14159265f;
+    auto logistic = [] (float x, float k, float x0) -> float {
+        return 1.0f / (1.0f + std::exp(-k * (x - x0)));
+    };
+
+    float sum = 0.0f;
+    for (std::size_t i = 0; i < n; ++i) {
+        math::Vec4f const & rel_ray = rel_rays[i];
+
+        float calpha = rel_ray[0] * new_rel_ray[0] + rel_ray[1] * new_rel_ray[1]
+            + rel_ray[2] * new_rel_ray[2];
+        float alpha = std::acos(std::max(-1.0f, std::min(calpha, 1.0f)));
+
+        float scale = std::min(rel_ray[3], new_rel_ray[3]);
+        float ctheta = std::min(rel_ray[2], new_rel_ray[2]);
+        float matchability = (1.0f - logistic(alpha, m_k, pi / m_x0)) * ctheta;
+        float triangulation = logistic(alpha, t_k, pi / t_x0) * scale;
+        sum += matchability * triangulation;
+    }
+    return sum;
+}
+
+/* Host implementation of the evaluate_observation_rays kernel. */
+inline void
+evaluate_observation_rays(ObservationRays const & obs_rays,
+    std::vector<float> * recons)
+{
+    recons->resize(obs_rays.size());
+
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (std::size_t i = 0; i < obs_rays.size(); ++i) {
+        std::vector<math::Vec4f> const & rel_rays = obs_rays[i];
+
+        float recon = rel_rays.size() >= 1 ? 0.0f : -1.0f;
+        for (std::size_t j = 1; j < rel_rays.size(); ++j) {
+            recon += heuristic(rel_rays, j, rel_rays[j]);
+        }
+        (*recons)[i] = recon;
+    }
+}
+
+/* Host implementation of the populate_spherical_histogram kernel -
+ * adds the change of the reconstructability deficit of each sample
+ * observed from view_pos to the bin of its direction (sphere_hist has to
+ * be cleared). The samples are processed in a fixed number of blocks
+ * whose histograms are summed in order, the result does not depend on the
+ * number of threads. */
+inline void
+populate_spherical_histogram(math::Vec3f const & view_pos,
+    float max_distance, float target_recon,
+    acc::BVHTree<uint, math::Vec3f> const & bvh_tree,
+    std::vector<math::Vec3f> const & verts,
+    std::vector<math::Vec3f> const & normals,
+    acc::KDTree<3, uint> const & kd_tree,
+    ObservationRays const & obs_rays, std::size_t max_rows,
+    std::vector<float> const & recons, std::vector<float> * sphere_hist)
+{
+    auto deficit = [target_recon] (float recon) -> float {
+        float diff = std::min(recon - target_recon, 0.0f);
+        return diff * diff;
+    };
+
+    std::size_t const num_blocks = 64;
+    std::size_t const num_bins = sphere_hist->size();
+    std::vector<float> block_hists(num_blocks * num_bins, 0.0f);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (std::size_t b = 0; b < num_blocks; ++b) {
+        float * hist = block_hists.data() + b * num_bins;
+        std::size_t begin = b * verts.size() / num_blocks;
+        std::size_t end = (b + 1) * verts.size() / num_blocks;
+        for (std::size_t i = begin; i < end; ++i) {
+            math::Vec3f const & v = verts[i];
+            math::Vec3f const & n = normals[i];
+
+            float l;
+            math::Vec3f v2cn;
+            if (!observable(view_pos.begin(), v.begin(), n.begin(),
+                    max_distance, v2cn.begin(), &l)) continue;
+
+            std::vector<math::Vec4f> const & rel_rays = obs_rays[i];
+            if (rel_rays.size() >= max_rows) continue;
+
+            acc::Ray<math::Vec3f> ray;
+            ray.origin = v;
+            ray.dir = v2cn;
+            ray.tmin = l * 0.001f;
+            ray.tmax = l;
+            if (bvh_tree.intersect(ray)) continue;
+
+            float recon = recons[i];
+            float new_recon = 0.0f;
+            if (rel_rays.size() >= 1) {
+                math::Vec4f rel_ray;
+                relative_direction(v2cn.begin(), n.begin(), rel_ray.begin());
+                rel_ray[3] = 1.0f - (l / max_distance);
+                new_recon = recon + heuristic(rel_rays, rel_rays.size(), rel_ray);
+            }
+
+            std::pair<uint, float> nn;
+            if (!kd_tree.find_nn(-v2cn, &nn)) continue;
+            hist[nn.first] += deficit(new_recon) - deficit(recon);
+        }
+    }
+
+    for (std::size_t b = 0; b < num_blocks; ++b) {
+        float const * hist = block_hists.data() + b * num_bins;
+        for (std::size_t j = 0; j < num_bins; ++j) (*sphere_hist)[j] += hist[j];
+    }
+}
+
+/* Removes rays marked invalid (equivalent to process_observation_rays). */
+inline void
+process_observation_rays(ObservationRays * obs_rays) {
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (std::size_t i = 0; i < obs_rays->size(); ++i) {
+        std::vector<math::Vec4f> & rel_rays = (*obs_rays)[i];
+        rel_rays.erase(std::remove_if(rel_rays.begin(), rel_rays.end(),
+            [] (math::Vec4f const & rel_ray) { return rel_ray[3] < 0.0f; }),
+            rel_rays.end());
+    }
+}
+
+#endif /* EVAL_OBSERVATION_RAYS_HEADER */
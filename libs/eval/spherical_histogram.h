@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef EVAL_SPHERICAL_HISTOGRAM_HEADER
+#define EVAL_SPHERICAL_HISTOGRAM_HEADER
+
+#include <map>
+#include <cmath>
+#include <string>
+#include <limits>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+#include "math/vector.h"
+#include "math/matrix.h"
+
+#include "util/tokenizer.h"
+
+#include "mve/camera.h"
+#include "mve/image.h"
+
+#ifndef EVAL_HOST_DEVICE
+#ifdef __CUDACC__
+#define EVAL_HOST_DEVICE __host__ __device__
+#else
+#define EVAL_HOST_DEVICE
+#endif
+#endif
+
+#define MAX_CAMERA_MODELS 10
+
+/* Resolution of the direction histograms (width x height bins of the lower
+ * hemisphere) and of the spherical histograms (one bin per vertex of an
+ * icosahedron subdivided sphere_subdivisions times, see
+ * generate_sphere_mesh). Memory and compute of
+ * the evaluation grow with the product of both. */
+struct HistogramResolution {
+    int width;
+    int height;
+    int sphere_subdivisions;
+
+    std::size_t num_directions(void) const {
+        return std::size_t(width) * height;
+    }
+};
+
+inline HistogramResolution
+default_histogram_resolution(void) {
+    HistogramResolution res = {128, 45, 3};
+    return res;
+}
+
+/* Parses WxH[xS] - the sphere subdivisions default to 3. */
+inline HistogramResolution
+parse_histogram_resolution(std::string const & str) {
+    util::Tokenizer tok;
+    tok.split(str, 'x');
+    if (tok.size() != 2 && tok.size() != 3) {
+        throw std::invalid_argument("Invalid histogram resolution " + str);
+    }
+
+    HistogramResolution res = default_histogram_resolution();
+    res.width = tok.get_as<int>(0);
+    res.height = tok.get_as<int>(1);
+    if (tok.size() == 3) res.sphere_subdivisions = tok.get_as<int>(2);
+
+    if (res.width <= 0 || res.height <= 0
+        || res.sphere_subdivisions < 0 || res.sphere_subdivisions > 8) {
+        throw std::invalid_argument("Invalid histogram resolution " + str);
+    }
+    return res;
+}
+
+inline void
+store_histogram_resolution(HistogramResolution const & res,
+    std::map<std::string, std::string> * metadata)
+{
+    (*metadata)["histogram_width"] = std::to_string(res.width);
+    (*metadata)["histogram_height"] = std::to_string(res.height);
+    (*metadata)["sphere_subdivisions"] = std::to_string(res.sphere_subdivisions);
+}
+
+/* Missing entries (e.g. volumes of version 0.1) yield the defaults. */
+inline HistogramResolution
+load_histogram_resolution(std::map<std::string, std::string> const & metadata) {
+    HistogramResolution res = default_histogram_resolution();
+    auto load = [&metadata] (std::string const & key, int * value) {
+        auto it = metadata.find(key);
+        if (it != metadata.end()) *value = std::atoi(it->second.c_str());
+    };
+    load("histogram_width", &res.width);
+    load("histogram_height", &res.height);
+    load("sphere_subdivisions", &res.sphere_subdivisions);
+    return res;
+}
+
+/* Intrinsics of a candidate camera - the spherical histogram of a position
+ * does not depend on them, only its "convolution" with the frustum does.
+ * Plain arrays to be usable on host and device alike. */
+struct CameraModel {
+    float calib[9];
+    int width;
+    int height;
+};
+
+struct CameraModels {
+    unsigned int num_models;
+    CameraModel models[MAX_CAMERA_MODELS];
+};
+
+inline CameraModel
+camera_model(mve::CameraInfo const & cam, int width, int height)
+{
+    math::Matrix3f calib;
+    cam.fill_calibration(calib.begin(), width, height);
+
+    CameraModel model;
+    std::copy(calib.begin(), calib.end(), model.calib);
+    model.width = width;
+    model.height = height;
+    return model;
+}
+
+/* Viewing direction of pixel (x, y) of a hist_width x hist_height direction
+ * histogram (x is phi [0, width] -> [0, 2pi] and y is theta
+ * [0, height] -> [pi/2, pi]) and a stable local frame with rz == -view_dir. */
+EVAL_HOST_DEVICE inline void
+histogram_frame(unsigned int x, unsigned int y,
+    unsigned int hist_width, unsigned int hist_height,
+    float * view_dir, float * rx, float * ry, float * rz)
+{
+    float const pi = 3.14159265f;
+    float phi = (x / (float) hist_width) * 2.0f * pi;
+    float theta = (0.5f + (y / (float) hist_height) / 2.0f) * pi;
+    float stheta = sinf(theta);
+    view_dir[0] = stheta * cosf(phi);
+    view_dir[1] = stheta * sinf(phi);
+    view_dir[2] = cosf(theta);
+    float l = sqrtf(view_dir[0] * view_dir[0] + view_dir[1] * view_dir[1]
+        + view_dir[2] * view_dir[2]);
+    for (int i = 0; i < 3; ++i) {
+        view_dir[i] /= l;
+        rz[i] = -view_dir[i];
+    }
+
+    float up[3] = {0.0f, 0.0f, 1.0f};
+    if (fabsf(rz[2]) >= 0.99f) {
+        up[0] = cosf(phi);
+        up[1] = sinf(phi);
+        up[2] = 0.0f;
+    }
+
+    rx[0] = up[1] * rz[2] - up[2] * rz[1];
+    rx[1] = up[2] * rz[0] - up[0] * rz[2];
+    rx[2] = up[0] * rz[1] - up[1] * rz[0];
+    float lx = sqrtf(rx[0] * rx[0] + rx[1] * rx[1] + rx[2] * rx[2]);
+    for (int i = 0; i < 3; ++i) rx[i] /= lx;
+
+    ry[0] = rz[1] * rx[2] - rz[2] * rx[1];
+    ry[1] = rz[2] * rx[0] - rz[0] * rx[2];
+    ry[2] = rz[0] * rx[1] - rz[1] * rx[0];
+    float ly = sqrtf(ry[0] * ry[0] + ry[1] * ry[1] + ry[2] * ry[2]);
+    for (int i = 0; i < 3; ++i) ry[i] /= ly;
+}
+
+/* Projects the direction v (local frame) with the model's calibration. */
+EVAL_HOST_DEVICE inline bool
+in_image(CameraModel const & model, float const * v)
+{
+    float p[3];
+    for (int i = 0; i < 3; ++i) {
+        float const * row = model.calib + i * 3;
+        p[i] = row[0] * v[0] + row[1] * v[1] + row[2] * v[2];
+    }
+    float x = p[0] / p[2] - 0.5f;
+    float y = p[1] / p[2] - 0.5f;
+
+    return 0.0f <= x && x < model.width && 0.0f <= y && y < model.height;
+}
+
+/* Sum of the spherical histogram bins within the frustum of each camera
+ * model looking into the direction of pixel (x, y) of the direction
+ * histogram - one pass over the bins for all models.
+ * dirs - directions of the sphere_hist bins (dirs[i][0..2]) */
+template <typename Directions>
+EVAL_HOST_DEVICE inline void
+convolve_spherical_histogram(CameraModels const & models,
+    Directions const & dirs, unsigned int num_dirs, float const * sphere_hist,
+    unsigned int x, unsigned int y,
+    unsigned int hist_width, unsigned int hist_height, float * sums)
+{
+    float view_dir[3], rx[3], ry[3], rz[3];
+    histogram_frame(x, y, hist_width, hist_height, view_dir, rx, ry, rz);
+
+    for (unsigned int j = 0; j < models.num_models; ++j) sums[j] = 0.0f;
+
+    for (unsigned int i = 0; i < num_dirs; ++i) {
+        /* Empty bins do not contribute to any model. */
+        float value = sphere_hist[i];
+        if (value == 0.0f) continue;
+
+        float dir[3] = {dirs[i][0], dirs[i][1], dirs[i][2]};
+        float l = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+        for (int k = 0; k < 3; ++k) dir[k] /= l;
+
+        if (view_dir[0] * dir[0] + view_dir[1] * dir[1]
+            + view_dir[2] * dir[2] < 0.0f) continue;
+
+        float v[3] = {
+            rx[0] * dir[0] + rx[1] * dir[1] + rx[2] * dir[2],
+            ry[0] * dir[0] + ry[1] * dir[1] + ry[2] * dir[2],
+            rz[0] * dir[0] + rz[1] * dir[1] + rz[2] * dir[2]
+        };
+
+        for (unsigned int j = 0; j < models.num_models; ++j) {
+            if (in_image(models.models[j], v)) sums[j] += value;
+        }
+    }
+}
+
+/* Host implementation of the batched evaluation (see
+ * evaluate_spherical_histograms kernel) - returns one
+ * hist_width x hist_height direction histogram per camera model. */
+inline std::vector<mve::FloatImage::Ptr>
+evaluate_camera_models(CameraModels const & models,
+    std::vector<math::Vec3f> const & dirs, float const * sphere_hist,
+    int hist_width, int hist_height)
+{
+    std::vector<mve::FloatImage::Ptr> hists(models.num_models);
+    for (unsigned int j = 0; j < models.num_models; ++j) {
+        hists[j] = mve::FloatImage::create(hist_width, hist_height, 1);
+    }
+
+    float sums[MAX_CAMERA_MODELS];
+    for (int y = 0; y < hist_height; ++y) {
+        for (int x = 0; x < hist_width; ++x) {
+            convolve_spherical_histogram(models, dirs.data(), dirs.size(),
+                sphere_hist, x, y, hist_width, hist_height, sums);
+            for (unsigned int j = 0; j < models.num_models; ++j) {
+                hists[j]->at(x, y, 0) = sums[j];
+            }
+        }
+    }
+
+    return hists;
+}
+
+inline std::vector<mve::FloatImage::Ptr>
+evaluate_camera_models(CameraModels const & models,
+    std::vector<math::Vec3f> const & dirs, float const * sphere_hist,
+    HistogramResolution const & res = default_histogram_resolution())
+{
+    return evaluate_camera_models(models, dirs, sphere_hist, res.width, res.height);
+}
+
+struct HistogramDirection {
+    float value;
+    float theta;
+    float phi;
+};
+
+/* Best (lowest) value of a direction histogram and its direction. */
+inline HistogramDirection
+best_direction(mve::FloatImage::ConstPtr hist)
+{
+    HistogramDirection best;
+    best.value = std::numeric_limits<float>::max();
+    best.theta = 0.0f;
+    best.phi = 0.0f;
+
+    float const pi = std::acos(-1.0f);
+    int const width = hist->width();
+    int const height = hist->height();
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float value = hist->at(x, y, 0);
+            if (value >= best.value) continue;
+            best.value = value;
+            best.theta = (0.5f + (y / (float) height) / 2.0f) * pi;
+            best.phi = (x / (float) width) * 2.0f * pi;
+        }
+    }
+    return best;
+}
+
+#endif /* EVAL_SPHERICAL_HISTOGRAM_HEADER */
@@ -0,0 +1,745 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "math/matrix_tools.h"
+
+#include "geom/sphere.h"
+#include "geom/volume_io.h"
+#include "geom/direction_summary.h"
+#include "geom/projection.h"
+
+#include "observation_rays.h"
+#include "spherical_histogram.h"
+
+#define TEST(cond) if (!(cond)) { \
+    std::cerr << __FILE__ << ":" << __LINE__ << ": " #cond " failed" << std::endl; \
+    std::exit(EXIT_FAILURE); }
+
+/* Camera at pos looking down, tilted by the angles around x and y. */
+mve::CameraInfo
+create_camera(math::Vec3f const & pos, float xangle, float yangle) {
+    math::Matrix3f nadir(0.0f);
+    nadir(0, 0) = 1.0f;
+    nadir(1, 1) = -1.0f;
+    nadir(2, 2) = -1.0f;
+    math::Matrix3f rx = math::matrix_rotation_from_axis_angle(
+        math::Vec3f(1.0f, 0.0f, 0.0f), xangle);
+    math::Matrix3f ry = math::matrix_rotation_from_axis_angle(
+        math::Vec3f(0.0f, 1.0f, 0.0f), yangle);
+    math::Matrix3f rot = nadir * rx * ry;
+
+    mve::CameraInfo cam;
+    cam.flen = 0.8f;
+    std::copy(rot.begin(), rot.end(), cam.rot);
+    math::Vec3f trans = -(rot * pos);
+    std::copy(trans.begin(), trans.end(), cam.trans);
+    return cam;
+}
+
+/* Grouped evaluation of co-located views has to yield the same observation
+ * rays as evaluating each view on its own. */
+void test_view_groups(void) {
+    /* Ground plane [-50, 50]^2 and an occluder at height 5. */
+    std::vector<math::Vec3f> vertices = {
+        {-50.0f, -50.0f, 0.0f}, {50.0f, -50.0f, 0.0f},
+        {50.0f, 50.0f, 0.0f}, {-50.0f, 50.0f, 0.0f},
+        {-5.0f, -5.0f, 5.0f}, {5.0f, -5.0f, 5.0f},
+        {5.0f, 5.0f, 5.0f}, {-5.0f, 5.0f, 5.0f}
+    };
+    std::vector<uint> faces = {0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7};
+    acc::BVHTree<uint, math::Vec3f> bvh_tree(faces, vertices);
+
+    std::vector<math::Vec3f> verts;
+    std::vector<math::Vec3f> normals;
+    for (int y = -40; y <= 40; ++y) {
+        for (int x = -40; x <= 40; ++x) {
+            verts.emplace_back(x + 0.25f, y + 0.25f, 0.01f);
+            normals.emplace_back(0.0f, 0.0f, 1.0f);
+        }
+    }
+
+    float const angle = 30.0f * std::acos(-1.0f) / 180.0f;
+    std::vector<mve::CameraInfo> cams;
+    for (math::Vec3f pos : {math::Vec3f(0.0f, 0.0f, 20.0f),
+            math::Vec3f(20.0f, 10.0f, 25.0f)}) {
+        cams.push_back(create_camera(pos, 0.0f, 0.0f));
+        cams.push_back(create_camera(pos, angle, 0.0f));
+        cams.push_back(create_camera(pos, -angle, 0.0f));
+        cams.push_back(create_camera(pos, 0.0f, angle));
+        cams.push_back(create_camera(pos, 0.0f, -angle));
+    }
+
+    int const width = 1920;
+    int const height = 1080;
+    float const max_distance = 80.0f;
+    std::size_t const max_rows = 32;
+
+    std::vector<ViewGroup> groups = group_views(cams, width, height);
+    TEST(groups.size() == 2);
+    TEST(groups[0].num_views == 5 && groups[1].num_views == 5);
+
+    ObservationRays grouped, single;
+    for (ViewGroup const & group : groups) {
+        update_observation_rays(true, group, max_distance, width, height,
+            bvh_tree, verts, normals, max_rows, &grouped);
+    }
+    for (mve::CameraInfo const & cam : cams) {
+        std::vector<ViewGroup> group = group_views({cam}, width, height);
+        TEST(group.size() == 1 && group[0].num_views == 1);
+        update_observation_rays(true, group[0], max_distance, width, height,
+            bvh_tree, verts, normals, max_rows, &single);
+    }
+
+    auto less = [] (math::Vec4f const & a, math::Vec4f const & b) {
+        return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+    };
+
+    /* Positions of co-located views only agree up to numerical noise. */
+    auto equal = [] (std::vector<math::Vec4f> const & a,
+        std::vector<math::Vec4f> const & b) -> bool
+    {
+        if (a.size() != b.size()) return false;
+        for (std::size_t i = 0; i < a.size(); ++i) {
+            for (int j = 0; j < 4; ++j) {
+                if (std::abs(a[i][j] - b[i][j]) > 1e-4f) return false;
+            }
+        }
+        return true;
+    };
+
+    std::size_t num_rays = 0;
+    for (std::size_t i = 0; i < verts.size(); ++i) {
+        std::sort(grouped[i].begin(), grouped[i].end(), less);
+        std::sort(single[i].begin(), single[i].end(), less);
+        TEST(equal(grouped[i], single[i]));
+        num_rays += grouped[i].size();
+
+        /* Directly below the occluder nothing is visible. */
+        if (std::abs(verts[i][0]) < 2.0f && std::abs(verts[i][1]) < 2.0f) {
+            TEST(grouped[i].empty());
+        }
+    }
+    TEST(num_rays > 0);
+
+    /* Removing the views of a group removes exactly their rays. */
+    update_observation_rays(false, groups[1], max_distance, width, height,
+        bvh_tree, verts, normals, max_rows, &grouped);
+    process_observation_rays(&grouped);
+
+    ObservationRays first;
+    update_observation_rays(true, groups[0], max_distance, width, height,
+        bvh_tree, verts, normals, max_rows, &first);
+    for (std::size_t i = 0; i < verts.size(); ++i) {
+        std::sort(grouped[i].begin(), grouped[i].end(), less);
+        std::sort(first[i].begin(), first[i].end(), less);
+        TEST(equal(grouped[i], first[i]));
+    }
+
+    std::cout << "Passed (" << num_rays << " observation rays)" << std::endl;
+}
+
+/* Grouping through the hashed cells has to match comparing each view with
+ * all groups - co-located views (also more than MAX_GROUP_VIEWS and across
+ * cell borders) and isolated views. */
+void test_view_grouping(void) {
+    std::mt19937 gen(5);
+    std::uniform_real_distribution<float> dist(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> noise(-2e-4f, 2e-4f);
+    std::uniform_int_distribution<int> count(1, 20);
+
+    /* The last view is within tolerance of both groups. */
+    std::vector<mve::CameraInfo> cams;
+    for (float x : {0.0f, 1.5e-3f, 0.8e-3f}) {
+        cams.push_back(create_camera(math::Vec3f(1000.0f + x, 0.0f, 60.0f), 0.0f, 0.0f));
+    }
+    while (cams.size() < 20000) {
+        math::Vec3f pos(dist(gen), dist(gen), dist(gen) / 10.0f + 60.0f);
+        /* Exactly on a cell border of the default tolerance. */
+        if (cams.size() % 7 == 0) pos[0] = std::round(pos[0]);
+        for (int j = count(gen); j > 0; --j) {
+            math::Vec3f offset(noise(gen), noise(gen), noise(gen));
+            cams.push_back(create_camera(pos + offset, j * 0.01f, 0.0f));
+        }
+    }
+
+    int const width = 1920;
+    int const height = 1080;
+    std::vector<ViewGroup> groups = group_views(cams, width, height);
+
+    std::vector<math::Vec3f> positions;
+    std::vector<unsigned int> sizes;
+    for (mve::CameraInfo const & cam : cams) {
+        math::Vec3f pos;
+        cam.fill_camera_pos(pos.begin());
+        std::size_t gid = positions.size();
+        for (std::size_t i = 0; i < positions.size() && gid == positions.size(); ++i) {
+            if (sizes[i] < MAX_GROUP_VIEWS && (positions[i] - pos).norm() <= 1e-3f) {
+                gid = i;
+            }
+        }
+        if (gid == positions.size()) {
+            positions.push_back(pos);
+            sizes.push_back(0);
+        }
+        sizes[gid] += 1;
+    }
+
+    TEST(groups.size() == positions.size());
+    TEST(groups[0].num_views == 2 && groups[1].num_views == 1);
+    TEST(groups.size() < cams.size() / 4);
+    for (std::size_t i = 0; i < groups.size(); ++i) {
+        TEST(groups[i].num_views == sizes[i]);
+        TEST(math::Vec3f(groups[i].pos) == positions[i]);
+    }
+
+    std::cout << "Passed (view grouping)" << std::endl;
+}
+
+/* Evaluating several camera models in one pass has to yield the same
+ * direction histograms as evaluating each model on its own. */
+void test_camera_models(void) {
+    mve::TriangleMesh::Ptr sphere = generate_sphere_mesh(1.0f, 3u);
+    std::vector<math::Vec3f> const & dirs = sphere->get_vertices();
+
+    std::mt19937 gen(1337);
+    std::uniform_real_distribution<float> dist(-1.0f, 0.0f);
+    std::vector<float> sphere_hist(dirs.size());
+    for (float & value : sphere_hist) value = dist(gen);
+
+    CameraModels models;
+    models.num_models = 0;
+    for (float flen : {0.5f, 0.86f, 1.5f}) {
+        mve::CameraInfo cam;
+        cam.flen = flen;
+        models.models[models.num_models++] = camera_model(cam, 1920, 1080);
+    }
+    {
+        mve::CameraInfo cam;
+        cam.flen = 0.86f;
+        models.models[models.num_models++] = camera_model(cam, 1000, 1000);
+    }
+
+    std::vector<mve::FloatImage::Ptr> hists = evaluate_camera_models(models,
+        dirs, sphere_hist.data());
+    TEST(hists.size() == models.num_models);
+
+    for (unsigned int i = 0; i < models.num_models; ++i) {
+        CameraModels model;
+        model.num_models = 1;
+        model.models[0] = models.models[i];
+        mve::FloatImage::Ptr hist = evaluate_camera_models(model,
+            dirs, sphere_hist.data())[0];
+        for (int j = 0; j < hist->get_value_amount(); ++j) {
+            TEST(hist->at(j) == hists[i]->at(j));
+        }
+    }
+
+    /* The frustum of a longer focal length is contained in the frustum of
+     * a shorter one, with negative bins the sums can only increase. */
+    for (unsigned int i = 1; i < 3; ++i) {
+        for (int j = 0; j < hists[i]->get_value_amount(); ++j) {
+            TEST(hists[i - 1]->at(j) <= hists[i]->at(j) + 1e-4f);
+        }
+        TEST(best_direction(hists[i - 1]).value < best_direction(hists[i]).value);
+    }
+
+    /* A single bin is seen best from its own direction. */
+    std::fill(sphere_hist.begin(), sphere_hist.end(), 0.0f);
+    math::Vec3f dir(0.3f, -0.4f, -0.8f);
+    dir.normalize();
+    std::size_t idx = 0;
+    for (std::size_t i = 1; i < dirs.size(); ++i) {
+        if (dirs[i].dot(dir) > dirs[idx].dot(dir)) idx = i;
+    }
+    sphere_hist[idx] = -1.0f;
+
+    hists = evaluate_camera_models(models, dirs, sphere_hist.data());
+    float const pi = std::acos(-1.0f);
+    for (unsigned int i = 0; i < models.num_models; ++i) {
+        HistogramDirection best = best_direction(hists[i]);
+        TEST(best.value == -1.0f);
+
+        /* The best direction is close to the bin, the opposite horizontal
+         * direction does not see it. */
+        math::Vec3f view_dir(std::sin(best.theta) * std::cos(best.phi),
+            std::sin(best.theta) * std::sin(best.phi), std::cos(best.theta));
+        TEST(view_dir.dot(dirs[idx].normalized()) > std::cos(pi / 4.0f));
+
+        int x = std::atan2(dirs[idx][1], dirs[idx][0]) / (2.0f * pi) * 128.0f + 64.0f;
+        TEST(hists[i]->at(x % 128, 0, 0) == 0.0f);
+    }
+
+    std::cout << "Passed (" << models.num_models << " camera models)" << std::endl;
+}
+
+/* Direction histograms follow the configured resolution and volumes keep
+ * it in their metadata. */
+void test_histogram_resolutions(void) {
+    CameraModels models;
+    models.num_models = 1;
+    {
+        mve::CameraInfo cam;
+        cam.flen = 0.86f;
+        models.models[0] = camera_model(cam, 1920, 1080);
+    }
+
+    math::Vec3f dir(-0.5f, 0.2f, -0.7f);
+    dir.normalize();
+    float const pi = std::acos(-1.0f);
+
+    for (char const * str : {"32x12x1", "128x45", "256x90x4"}) {
+        HistogramResolution res = parse_histogram_resolution(str);
+        mve::TriangleMesh::Ptr sphere = generate_sphere_mesh(1.0f,
+            res.sphere_subdivisions);
+        std::vector<math::Vec3f> const & dirs = sphere->get_vertices();
+
+        std::size_t idx = 0;
+        for (std::size_t i = 1; i < dirs.size(); ++i) {
+            if (dirs[i].dot(dir) > dirs[idx].dot(dir)) idx = i;
+        }
+        std::vector<float> sphere_hist(dirs.size(), 0.0f);
+        sphere_hist[idx] = -1.0f;
+
+        mve::FloatImage::Ptr hist = evaluate_camera_models(models, dirs,
+            sphere_hist.data(), res)[0];
+        TEST(hist->width() == res.width && hist->height() == res.height);
+        TEST(std::size_t(hist->get_value_amount()) == res.num_directions());
+
+        HistogramDirection best = best_direction(hist);
+        TEST(best.value == -1.0f);
+        math::Vec3f view_dir(std::sin(best.theta) * std::cos(best.phi),
+            std::sin(best.theta) * std::sin(best.phi), std::cos(best.theta));
+        TEST(view_dir.dot(dirs[idx].normalized()) > std::cos(pi / 4.0f));
+    }
+
+    HistogramResolution res = parse_histogram_resolution("64x20x2");
+    TEST(res.width == 64 && res.height == 20 && res.sphere_subdivisions == 2);
+    for (char const * str : {"64", "0x20", "64x-1", "64x20x9", "64x20x2x1"}) {
+        bool thrown = false;
+        try {
+            parse_histogram_resolution(str);
+        } catch (std::invalid_argument &) {
+            thrown = true;
+        }
+        TEST(thrown);
+    }
+
+    HistogramResolution def = load_histogram_resolution(
+        std::map<std::string, std::string>());
+    TEST(def.width == 128 && def.height == 45 && def.sphere_subdivisions == 3);
+
+    Volume<std::uint32_t>::Ptr volume = Volume<std::uint32_t>::create(2, 2, 2,
+        math::Vec3f(0.0f), math::Vec3f(1.0f));
+    store_histogram_resolution(res, &volume->metadata());
+    mve::FloatImage::Ptr image = mve::FloatImage::create(res.width, res.height, 1);
+    image->fill(0.5f);
+    volume->at(1, 0, 1) = image;
+
+    std::string filename = "/tmp/eval_test_volume.vol";
+    save_volume<std::uint32_t>(volume, filename);
+    Volume<std::uint32_t>::Ptr loaded = load_volume<std::uint32_t>(filename);
+    std::remove(filename.c_str());
+
+    HistogramResolution lres = load_histogram_resolution(loaded->metadata());
+    TEST(lres.width == 64 && lres.height == 20 && lres.sphere_subdivisions == 2);
+    TEST(loaded->at(1, 0, 1) != nullptr);
+    TEST(loaded->at(1, 0, 1)->width() == 64);
+    TEST(loaded->at(0, 0, 0) == nullptr);
+
+    std::cout << "Passed (histogram resolutions)" << std::endl;
+}
+
+/* Host evaluation of a view position (CPU path of plan_trajectory) - new
+ * observations can only reduce the reconstructability deficit and the
+ * result does not depend on the number of threads. */
+void test_view_evaluation(void) {
+    std::vector<math::Vec3f> vertices = {
+        {-50.0f, -50.0f, 0.0f}, {50.0f, -50.0f, 0.0f},
+        {50.0f, 50.0f, 0.0f}, {-50.0f, 50.0f, 0.0f}
+    };
+    std::vector<uint> faces = {0, 1, 2, 0, 2, 3};
+    acc::BVHTree<uint, math::Vec3f> bvh_tree(faces, vertices);
+
+    std::vector<math::Vec3f> verts;
+    std::vector<math::Vec3f> normals;
+    for (int y = -20; y <= 20; ++y) {
+        for (int x = -20; x <= 20; ++x) {
+            verts.emplace_back(x + 0.25f, y + 0.25f, 0.01f);
+            normals.emplace_back(0.0f, 0.0f, 1.0f);
+        }
+    }
+
+    int const width = 1920;
+    int const height = 1080;
+    float const max_distance = 80.0f;
+    float const target_recon = 3.0f;
+    std::size_t const max_rows = 32;
+
+    /* Two views observe the samples with x > 0. */
+    float const angle = 20.0f * std::acos(-1.0f) / 180.0f;
+    std::vector<mve::CameraInfo> cams = {
+        create_camera(math::Vec3f(10.0f, 0.0f, 10.0f), 0.0f, 0.0f),
+        create_camera(math::Vec3f(14.0f, 0.0f, 10.0f), 0.0f, angle)
+    };
+    ObservationRays obs_rays(verts.size());
+    for (ViewGroup const & group : group_views(cams, width, height)) {
+        update_observation_rays(true, group, max_distance, width, height,
+            bvh_tree, verts, normals, max_rows, &obs_rays);
+    }
+
+    std::vector<float> recons;
+    evaluate_observation_rays(obs_rays, &recons);
+    TEST(recons.size() == verts.size());
+    std::size_t num_observed = 0;
+    for (std::size_t i = 0; i < verts.size(); ++i) {
+        if (obs_rays[i].size() == 0) TEST(recons[i] == -1.0f);
+        if (obs_rays[i].size() == 1) TEST(recons[i] == 0.0f);
+        if (obs_rays[i].size() >= 2) TEST(recons[i] > 0.0f);
+        num_observed += !obs_rays[i].empty();
+    }
+    TEST(num_observed > 0 && num_observed < verts.size());
+
+    mve::TriangleMesh::Ptr sphere = generate_sphere_mesh(1.0f, 3u);
+    std::vector<math::Vec3f> const & dirs = sphere->get_vertices();
+    acc::KDTree<3, uint> kd_tree(dirs);
+
+    std::vector<float> sphere_hist(dirs.size(), 0.0f);
+    math::Vec3f pos(0.0f, 0.0f, 15.0f);
+    populate_spherical_histogram(pos, max_distance, target_recon, bvh_tree,
+        verts, normals, kd_tree, obs_rays, max_rows, recons, &sphere_hist);
+
+    float sum = 0.0f;
+    for (float value : sphere_hist) {
+        TEST(value <= 0.0f);
+        sum += value;
+    }
+    TEST(sum < 0.0f);
+
+#ifdef _OPENMP
+    int num_threads = omp_get_max_threads();
+    for (int threads : {1, 3, 8}) {
+        omp_set_num_threads(threads);
+        std::vector<float> other(dirs.size(), 0.0f);
+        populate_spherical_histogram(pos, max_distance, target_recon, bvh_tree,
+            verts, normals, kd_tree, obs_rays, max_rows, recons, &other);
+        TEST(other == sphere_hist);
+    }
+    omp_set_num_threads(num_threads);
+#endif
+
+    CameraModels models;
+    models.num_models = 1;
+    {
+        mve::CameraInfo cam;
+        cam.flen = 0.86f;
+        models.models[0] = camera_model(cam, width, height);
+    }
+    HistogramDirection best = best_direction(evaluate_camera_models(models,
+        dirs, sphere_hist.data())[0]);
+    TEST(best.value < 0.0f);
+
+    std::cout << "Passed (view evaluation)" << std::endl;
+}
+
+/* The summary layer holds distinct local maxima sorted by descending value,
+ * it is saved alongside or instead of the histograms and can be loaded
+ * without the histograms. */
+void test_direction_summary(void) {
+    int const width = 128;
+    int const height = 45;
+    mve::FloatImage::Ptr image = mve::FloatImage::create(width, height, 1);
+    image->fill(0.0f);
+    /* Plateau across the phi seam - one direction only. */
+    image->at(0, 10, 0) = 0.7f;
+    image->at(width - 1, 10, 0) = 0.7f;
+    image->at(40, 20, 0) = 0.9f;
+    image->at(41, 20, 0) = 0.8f;
+    image->at(90, 30, 0) = 0.8f;
+
+    std::vector<VolumeDirection> directions(5);
+    summarize_directions(image, directions.size(), directions.data());
+    float const pi = std::acos(-1.0f);
+    TEST(directions[0].value == 0.9f);
+    TEST(std::abs(directions[0].phi - 40.0f / width * 2.0f * pi) < 1e-5f);
+    TEST(std::abs(directions[0].theta - (0.5f + 20.0f / height / 2.0f) * pi) < 1e-5f);
+    TEST(directions[1].value == 0.8f);
+    TEST(std::abs(directions[1].phi - 90.0f / width * 2.0f * pi) < 1e-5f);
+    TEST(directions[2].value == 0.7f && directions[2].phi == 0.0f);
+    /* The background plateau counts as one direction. */
+    TEST(directions[3].value == 0.0f);
+    TEST(std::isinf(directions[4].value));
+
+    Volume<std::uint32_t>::Ptr volume = Volume<std::uint32_t>::create(8, 8, 8,
+        math::Vec3f(0.0f), math::Vec3f(1.0f));
+    for (std::uint32_t idx = 0; idx < volume->num_positions(); idx += 3) {
+        mve::FloatImage::Ptr hist = image->duplicate();
+        hist->at(idx % width, 5, 0) = 1.0f + idx;
+        volume->at(idx) = hist;
+    }
+    summarize_volume<std::uint32_t>(volume, 4);
+    TEST(volume->summary_size() == 4);
+    TEST(!volume->has_summary(1));
+    TEST(volume->has_summary(3) && volume->summary(3)[0].value == 4.0f);
+
+    std::string filename = "/tmp/eval_test_summary.vol";
+    std::string summary_filename = "/tmp/eval_test_summary_only.vol";
+    save_volume<std::uint32_t>(volume, filename);
+    save_volume<std::uint32_t>(volume, summary_filename, false);
+
+    auto file_size = [] (std::string const & fn) {
+        std::ifstream in(fn.c_str(), std::ios::binary | std::ios::ate);
+        return std::size_t(in.tellg());
+    };
+    TEST(file_size(summary_filename) * 100 < file_size(filename));
+
+    Volume<std::uint32_t>::Ptr full = load_volume<std::uint32_t>(filename);
+    Volume<std::uint32_t>::Ptr summary = load_volume<std::uint32_t>(filename, true);
+    Volume<std::uint32_t>::Ptr summary_only = load_volume<std::uint32_t>(summary_filename);
+    std::remove(filename.c_str());
+    std::remove(summary_filename.c_str());
+
+    TEST(full->at(3) != nullptr && summary->at(3) == nullptr);
+    TEST(summary_only->at(3) == nullptr);
+    for (Volume<std::uint32_t>::Ptr loaded : {full, summary, summary_only}) {
+        TEST(loaded->summary_size() == 4);
+        for (std::uint32_t idx = 0; idx < volume->num_positions(); ++idx) {
+            TEST(loaded->has_summary(idx) == volume->has_summary(idx));
+            if (!volume->has_summary(idx)) continue;
+            for (std::size_t i = 0; i < 4; ++i) {
+                VolumeDirection const & a = loaded->summary(idx)[i];
+                VolumeDirection const & b = volume->summary(idx)[i];
+                TEST(a.value == b.value && a.theta == b.theta && a.phi == b.phi);
+            }
+        }
+    }
+
+    std::cout << "Passed (direction summary)" << std::endl;
+}
+
+/* Sampling the summary layer (see generate_initial_trajectory) has to
+ * reproduce the direction distribution of sampling the histogram - for
+ * bumps of equal shape the mass of each bump is proportional to its peak. */
+void test_direction_sampling(void) {
+    int const width = 64;
+    int const height = 16;
+    int const peaks[3][2] = {{0, 4}, {20, 8}, {45, 12}};
+    float const amplitudes[3] = {0.9f, 0.6f, 0.3f};
+
+    mve::FloatImage::Ptr image = mve::FloatImage::create(width, height, 1);
+    image->fill(0.0f);
+    for (int i = 0; i < 3; ++i) {
+        for (int ry = -1; ry <= 1; ++ry) {
+            for (int rx = -1; rx <= 1; ++rx) {
+                int x = (peaks[i][0] + rx + width) % width;
+                int y = peaks[i][1] + ry;
+                image->at(x, y, 0) = (rx == 0 && ry == 0) ?
+                    amplitudes[i] : amplitudes[i] / 2.0f;
+            }
+        }
+    }
+
+    Volume<std::uint32_t>::Ptr hist_volume = Volume<std::uint32_t>::create(
+        1, 1, 1, math::Vec3f(0.0f), math::Vec3f(1.0f));
+    hist_volume->at(0) = image;
+    Volume<std::uint32_t>::Ptr summary_volume = Volume<std::uint32_t>::create(
+        1, 1, 1, math::Vec3f(0.0f), math::Vec3f(1.0f));
+    summary_volume->at(0) = image;
+    summarize_volume<std::uint32_t>(summary_volume, 8);
+    summary_volume->at(0) = nullptr;
+
+    float const pi = std::acos(-1.0f);
+    /* Fraction of the accepted samples per bump. */
+    auto sample = [&] (Volume<std::uint32_t>::Ptr volume, bool exact) {
+        std::mt19937 gen(11);
+        std::vector<float> fractions(3, 0.0f);
+        std::size_t num_samples = 0;
+        for (int j = 0; j < 2000000; ++j) {
+            float theta, phi;
+            if (!sample_direction<std::uint32_t>(volume, 0u, &gen, &theta, &phi)) {
+                continue;
+            }
+            int x = int(std::round(phi / (2.0f * pi) * width)) % width;
+            int y = int(std::round((theta / pi - 0.5f) * 2.0f * height));
+            int bump = -1;
+            for (int i = 0; i < 3; ++i) {
+                int dx = std::abs(x - peaks[i][0]);
+                int dy = std::abs(y - peaks[i][1]);
+                int d = exact ? 0 : 1;
+                if (std::min(dx, width - dx) <= d && dy <= d) bump = i;
+            }
+            TEST(bump != -1);
+            fractions[bump] += 1.0f;
+            num_samples += 1;
+        }
+        TEST(num_samples > 10000);
+        for (float & fraction : fractions) fraction /= num_samples;
+        return fractions;
+    };
+
+    std::vector<float> hist_fractions = sample(hist_volume, false);
+    std::vector<float> summary_fractions = sample(summary_volume, true);
+    for (int i = 0; i < 3; ++i) {
+        float expected = amplitudes[i] / 1.8f;
+        TEST(std::abs(hist_fractions[i] - expected) < 0.02f);
+        TEST(std::abs(summary_fractions[i] - expected) < 0.02f);
+    }
+
+    std::cout << "Passed (direction sampling)" << std::endl;
+}
+
+/* The camera model comparison credits the volume with the highest value
+ * at each position and averages the highest values. */
+void test_compare_volumes(void) {
+    std::vector<Volume<std::uint32_t>::Ptr> volumes;
+    for (int j = 0; j < 2; ++j) {
+        volumes.push_back(Volume<std::uint32_t>::create(2, 1, 1,
+            math::Vec3f(0.0f), math::Vec3f(1.0f)));
+    }
+    /* The first volume has the better peak at position 0 and the worse
+     * lowest value everywhere, the second one the better peak at 1. */
+    float const values[2][2][2] = {{{0.1f, 0.9f}, {0.1f, 0.4f}},
+        {{0.3f, 0.5f}, {0.3f, 0.8f}}};
+    std::vector<math::Vector<std::uint32_t, 3> > positions;
+    for (std::uint32_t x = 0; x < 2; ++x) {
+        positions.push_back(math::Vector<std::uint32_t, 3>(x, 0u, 0u));
+        for (int j = 0; j < 2; ++j) {
+            mve::FloatImage::Ptr image = mve::FloatImage::create(4, 2, 1);
+            image->fill(values[j][x][0]);
+            image->at(3, 1, 0) = values[j][x][1];
+            volumes[j]->at(positions.back()) = image;
+        }
+    }
+    positions.push_back(positions.front());
+
+    std::vector<double> averages;
+    std::vector<std::size_t> wins;
+    compare_volumes<std::uint32_t>(volumes, positions, &averages, &wins);
+    TEST(wins.size() == 2 && wins[0] == 2 && wins[1] == 1);
+    TEST(std::abs(averages[0] - (0.9 + 0.4 + 0.9) / 3.0) < 1e-6);
+    TEST(std::abs(averages[1] - (0.5 + 0.8 + 0.5) / 3.0) < 1e-6);
+
+    std::cout << "Passed (compare volumes)" << std::endl;
+}
+
+/* Batched projections match the per point projections through the camera
+ * matrices - back-projection inverts them. */
+void test_batch_projection(void) {
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> dist(-20.0f, 20.0f);
+
+    std::vector<math::Vec3f> verts(3000);
+    for (math::Vec3f & v : verts) v = math::Vec3f(dist(gen), dist(gen), dist(gen));
+    PointBatch points(verts);
+    TEST(points.size() == verts.size() && points[17] == verts[17]);
+
+    int const width = 640;
+    int const height = 480;
+    std::vector<CameraProjection> projs;
+    for (int i = 0; i < 4; ++i) {
+        mve::CameraInfo cam;
+        cam.flen = 0.6f + 0.2f * i;
+        float view_dir[3];
+        math::Matrix3f rot;
+        histogram_frame(7 * i, 5 + 8 * i, 32, 45, view_dir,
+            rot.begin(), rot.begin() + 3, rot.begin() + 6);
+        math::Vec3f pos(5.0f * i, -3.0f, 25.0f - 10.0f * i);
+        math::Vec3f trans = -rot * pos;
+        std::copy(rot.begin(), rot.end(), cam.rot);
+        std::copy(trans.begin(), trans.end(), cam.trans);
+        projs.push_back(camera_projection(cam, width, height));
+
+        math::Matrix3f calib;
+        math::Matrix4f w2c;
+        cam.fill_calibration(calib.begin(), width, height);
+        cam.fill_world_to_cam(w2c.begin());
+
+        FrustumBounds bounds(8.0f, 1.0f, 30.0f);
+        ProjectedPoints projected;
+        std::size_t num_inside = project_points(projs.back(), points, 0,
+            points.size(), bounds, &projected);
+
+        std::size_t expected = 0;
+        for (std::size_t j = 0; j < verts.size(); ++j) {
+            math::Vec3f c = w2c.mult(verts[j], 1.0f);
+            math::Vec3f p = calib * c;
+            float x = p[0] / p[2];
+            float y = p[1] / p[2];
+            TEST(std::abs(projected.depth[j] - c[2]) < 1e-4f);
+            bool inside = 1.0f < c[2] && c[2] <= 30.0f
+                && 8.0f <= x && x < width - 8.0f && 8.0f <= y && y < height - 8.0f;
+            if (c[2] > 1e-3f) {
+                TEST(std::abs(projected.x[j] - x) < 1e-4f * (1.0f + std::abs(x)));
+                TEST(std::abs(projected.y[j] - y) < 1e-4f * (1.0f + std::abs(y)));
+            }
+            /* Ignore points on the border within rounding errors. */
+            bool on_border = std::abs(x - 8.0f) < 1e-3f || std::abs(y - 8.0f) < 1e-3f
+                || std::abs(x - (width - 8.0f)) < 1e-3f
+                || std::abs(y - (height - 8.0f)) < 1e-3f;
+            if (!on_border) TEST(bool(projected.inside[j]) == inside);
+            expected += projected.inside[j];
+        }
+        TEST(num_inside == expected);
+
+        PointBatch back;
+        back.resize(points.size());
+        backproject_pixels(projs.back(), projected.x.data(), projected.y.data(),
+            projected.depth.data(), points.size(),
+            back.x.data(), back.y.data(), back.z.data());
+        PointBatch dirs;
+        dirs.resize(points.size());
+        backproject_pixels(projs.back(), projected.x.data(), projected.y.data(),
+            points.size(), dirs.x.data(), dirs.y.data(), dirs.z.data());
+        for (std::size_t j = 0; j < verts.size(); ++j) {
+            if (!projected.inside[j]) continue;
+            TEST((back[j] - verts[j]).norm() < 1e-3f);
+            math::Vec3f dir = (verts[j] - math::Vec3f(projs.back().pos)).normalized();
+            TEST((dirs[j] - dir).norm() < 1e-4f);
+        }
+    }
+
+    std::vector<std::vector<std::uint32_t> > ids;
+    points_in_frusta(projs, points, FrustumBounds(), &ids);
+    TEST(ids.size() == projs.size());
+    for (std::size_t i = 0; i < projs.size(); ++i) {
+        ProjectedPoints projected;
+        project_points(projs[i], points, 0, points.size(), FrustumBounds(), &projected);
+        std::vector<std::uint32_t> expected;
+        for (std::size_t j = 0; j < verts.size(); ++j) {
+            if (projected.inside[j]) expected.push_back(j);
+        }
+        TEST(!expected.empty());
+        TEST(ids[i] == expected);
+    }
+
+    std::cout << "Passed (batch projection)" << std::endl;
+}
+
+int main(void) {
+    test_view_groups();
+    test_view_grouping();
+    test_camera_models();
+    test_histogram_resolutions();
+    test_view_evaluation();
+    test_direction_summary();
+    test_direction_sampling();
+    test_compare_volumes();
+    test_batch_projection();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef EVAL_VIEW_GROUP_HEADER
+#define EVAL_VIEW_GROUP_HEADER
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+
+#include "math/vector.h"
+#include "math/matrix.h"
+
+#include "mve/camera.h"
+
+#ifndef EVAL_HOST_DEVICE
+#ifdef __CUDACC__
+#define EVAL_HOST_DEVICE __host__ __device__
+#else
+#define EVAL_HOST_DEVICE
+#endif
+#endif
+
+#define MAX_GROUP_VIEWS 8
+
+/* Views sharing a position - distance and occlusion of a sample only have
+ * to be determined once per group, only the frustum test is per view.
+ * Plain arrays to be usable on host and device alike. */
+struct ViewOrientation {
+    float w2c[12]; /* Upper 3x4 of the world to camera matrix (row major). */
+    float calib[9];
+};
+
+struct ViewGroup {
+    float pos[3];
+    unsigned int num_views;
+    ViewOrientation views[MAX_GROUP_VIEWS];
+};
+
+/* Checks distance and angle between sample and view position,
+ * returns the normalized direction from v to pos and the distance. */
+EVAL_HOST_DEVICE inline bool
+observable(float const * pos, float const * v, float const * n,
+    float max_distance, float * v2cn, float * l)
+{
+    float v2c[3] = {pos[0] - v[0], pos[1] - v[1], pos[2] - v[2]};
+    *l = sqrtf(v2c[0] * v2c[0] + v2c[1] * v2c[1] + v2c[2] * v2c[2]);
+    for (int i = 0; i < 3; ++i) v2cn[i] = v2c[i] / *l;
+
+    float ctheta = v2cn[0] * n[0] + v2cn[1] * n[1] + v2cn[2] * n[2];
+    // 0.087f ~ cos(85.0f / 180.0f * pi)
+    if (ctheta < 0.087f) return false;
+
+    return *l < max_distance;
+}
+
+/* Projects v into the view (pixel centers at integer coordinates). */
+EVAL_HOST_DEVICE inline bool
+in_frustum(ViewOrientation const & view, float const * v, int width, int height)
+{
+    float c[3];
+    for (int i = 0; i < 3; ++i) {
+        float const * row = view.w2c + i * 4;
+        c[i] = row[0] * v[0] + row[1] * v[1] + row[2] * v[2] + row[3];
+    }
+    float p[3];
+    for (int i = 0; i < 3; ++i) {
+        float const * row = view.calib + i * 3;
+        p[i] = row[0] * c[0] + row[1] * c[1] + row[2] * c[2];
+    }
+    float x = p[0] / p[2] - 0.5f;
+    float y = p[1] / p[2] - 0.5f;
+
+    return 0.0f <= x && x < width && 0.0f <= y && y < height;
+}
+
+/* Number of views of the group which contain v in their frustum. */
+EVAL_HOST_DEVICE inline unsigned int
+count_in_frustum(ViewGroup const & group, float const * v, int width, int height)
+{
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < group.num_views; ++i) {
+        count += in_frustum(group.views[i], v, width, height);
+    }
+    return count;
+}
+
+/* Direction v2cn relative to the local frame of the normal n. */
+EVAL_HOST_DEVICE inline void
+relative_direction(float const * v2cn, float const * n, float * rel_dir)
+{
+    /* Orthogonal vector to n (cross with the less parallel axis). */
+    float rx[3];
+    if (fabsf(n[0]) < fabsf(n[1])) {
+        rx[0] = 0.0f; rx[1] = -n[2]; rx[2] = n[1];
+    } else {
+        rx[0] = n[2]; rx[1] = 0.0f; rx[2] = -n[0];
+    }
+    float lx = sqrtf(rx[0] * rx[0] + rx[1] * rx[1] + rx[2] * rx[2]);
+    for (int i = 0; i < 3; ++i) rx[i] /= lx;
+
+    float ry[3] = {
+        n[1] * rx[2] - n[2] * rx[1],
+        n[2] * rx[0] - n[0] * rx[2],
+        n[0] * rx[1] - n[1] * rx[0]
+    };
+    float ly = sqrtf(ry[0] * ry[0] + ry[1] * ry[1] + ry[2] * ry[2]);
+    for (int i = 0; i < 3; ++i) ry[i] /= ly;
+
+    rel_dir[0] = rx[0] * v2cn[0] + rx[1] * v2cn[1] + rx[2] * v2cn[2];
+    rel_dir[1] = ry[0] * v2cn[0] + ry[1] * v2cn[1] + ry[2] * v2cn[2];
+    rel_dir[2] = n[0] * v2cn[0] + n[1] * v2cn[1] + n[2] * v2cn[2];
+    float l = sqrtf(rel_dir[0] * rel_dir[0] + rel_dir[1] * rel_dir[1]
+        + rel_dir[2] * rel_dir[2]);
+    for (int i = 0; i < 3; ++i) rel_dir[i] /= l;
+}
+
+/* Groups views whose positions are within tolerance of the first view of a
+ * group (at most MAX_GROUP_VIEWS per group), the group position is the
+ * position of that first view. The default tolerance only absorbs the
+ * numerical noise of positions recovered from rotation and translation.
+ * Group positions are hashed into cells of the tolerance - each view only
+ * checks the groups of the neighbouring cells (the earliest group within
+ * tolerance wins). */
+inline std::vector<ViewGroup>
+group_views(std::vector<mve::CameraInfo> const & cams, int width, int height,
+    float tolerance = 1e-3f)
+{
+    /* Hash of the cell of pos offset by (rx, ry, rz) cells. */
+    auto cell = [tolerance] (float const * pos, int rx, int ry, int rz) {
+        std::int64_t x = std::int64_t(std::floor(pos[0] / tolerance)) + rx;
+        std::int64_t y = std::int64_t(std::floor(pos[1] / tolerance)) + ry;
+        std::int64_t z = std::int64_t(std::floor(pos[2] / tolerance)) + rz;
+        return std::uint64_t(x * 73856093) ^ std::uint64_t(y * 19349663)
+            ^ std::uint64_t(z * 83492791);
+    };
+    std::unordered_map<std::uint64_t, std::vector<std::size_t> > cells;
+
+    std::vector<ViewGroup> groups;
+    for (mve::CameraInfo const & cam : cams) {
+        math::Vec3f pos;
+        cam.fill_camera_pos(pos.begin());
+
+        std::size_t gid = groups.size();
+        for (int rz = -1; rz <= 1; ++rz) {
+            for (int ry = -1; ry <= 1; ++ry) {
+                for (int rx = -1; rx <= 1; ++rx) {
+                    auto it = cells.find(cell(pos.begin(), rx, ry, rz));
+                    if (it == cells.end()) continue;
+                    for (std::size_t i : it->second) {
+                        if (i >= gid) continue;
+                        math::Vec3f gpos(groups[i].pos);
+                        if ((gpos - pos).norm() <= tolerance) gid = i;
+                    }
+                }
+            }
+        }
+        if (gid == groups.size()) {
+            groups.emplace_back();
+            std::copy(pos.begin(), pos.end(), groups.back().pos);
+            groups.back().num_views = 0;
+            cells[cell(pos.begin(), 0, 0, 0)].push_back(gid);
+        }
+        ViewGroup * group = &groups[gid];
+
+        math::Matrix4f w2c;
+        math::Matrix3f calib;
+        cam.fill_world_to_cam(w2c.begin());
+        cam.fill_calibration(calib.begin(), width, height);
+
+        ViewOrientation & view = group->views[group->num_views++];
+        std::copy(w2c.begin(), w2c.begin() + 12, view.w2c);
+        std::copy(calib.begin(), calib.end(), view.calib);
+
+        /* Full groups are not checked anymore. */
+        if (group->num_views == MAX_GROUP_VIEWS) {
+            std::vector<std::size_t> & ids = cells[cell(group->pos, 0, 0, 0)];
+            ids.erase(std::find(ids.begin(), ids.end(), gid));
+        }
+    }
+    return groups;
+}
+
+#endif /* EVAL_VIEW_GROUP_HEADER */
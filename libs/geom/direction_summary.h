@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef GEOM_DIRECTION_SUMMARY_HEADER
+#define GEOM_DIRECTION_SUMMARY_HEADER
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+#include "volume.h"
+
+/* Writes the (at most) k best (highest) local maxima of the direction
+ * histogram sorted by descending value to directions, remaining entries are
+ * cleared. Neighbouring bins with equal values are resolved by their index
+ * and phi wraps around - each entry is a distinct direction. */
+inline void
+summarize_directions(mve::FloatImage::ConstPtr hist, std::size_t k,
+    VolumeDirection * directions)
+{
+    int const width = hist->width();
+    int const height = hist->height();
+
+    auto before = [hist, width] (int x0, int y0, int x1, int y1) {
+        float v0 = hist->at(x0, y0, 0);
+        float v1 = hist->at(x1, y1, 0);
+        return v0 > v1 || (v0 == v1 && y0 * width + x0 < y1 * width + x1);
+    };
+
+    std::vector<std::pair<float, int> > maxima;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            bool maximum = true;
+            for (int ry = -1; ry <= 1 && maximum; ++ry) {
+                int ny = y + ry;
+                if (ny < 0 || ny >= height) continue;
+                for (int rx = -1; rx <= 1 && maximum; ++rx) {
+                    int nx = (x + rx + width) % width;
+                    if (nx == x && ny == y) continue;
+                    maximum = before(x, y, nx, ny);
+                }
+            }
+            if (maximum) maxima.emplace_back(hist->at(x, y, 0), y * width + x);
+        }
+    }
+
+    std::size_t n = std::min(k, maxima.size());
+    std::partial_sort(maxima.begin(), maxima.begin() + n, maxima.end(),
+        [] (std::pair<float, int> const & a, std::pair<float, int> const & b) {
+            return a.first > b.first || (a.first == b.first && a.second < b.second);
+        });
+
+    float const pi = std::acos(-1.0f);
+    for (std::size_t i = 0; i < k; ++i) {
+        VolumeDirection & direction = directions[i];
+        if (i >= n) {
+            direction.value = std::numeric_limits<float>::infinity();
+            direction.theta = 0.0f;
+            direction.phi = 0.0f;
+            continue;
+        }
+        int x = maxima[i].second % width;
+        int y = maxima[i].second / width;
+        direction.value = maxima[i].first;
+        direction.theta = (0.5f + (y / (float) height) / 2.0f) * pi;
+        direction.phi = (x / (float) width) * 2.0f * pi;
+    }
+}
+
+/* Computes the summary layer of all positions with a histogram. */
+template <typename IdxType> void
+summarize_volume(typename Volume<IdxType>::Ptr volume, std::size_t k) {
+    volume->resize_summary(k);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (std::int64_t i = 0; i < std::int64_t(volume->num_positions()); ++i) {
+        mve::FloatImage::ConstPtr hist = volume->at(IdxType(i));
+        if (hist == nullptr) continue;
+        summarize_directions(hist, k, volume->summary(IdxType(i)));
+    }
+}
+
+/* Draws a direction of the position - a uniformly chosen summary entry (or
+ * histogram bin for positions without summary) is accepted with probability
+ * equal to its value. Returns false if the sample is rejected or the position
+ * has no directions. */
+template <typename IdxType, typename Generator> bool
+sample_direction(typename Volume<IdxType>::ConstPtr volume, IdxType idx,
+    Generator * gen, float * theta, float * phi)
+{
+    std::uniform_real_distribution<float> rdis(0.0f, 1.0f);
+
+    if (volume->has_summary(idx)) {
+        VolumeDirection const * directions = volume->summary(idx);
+        std::size_t n = 1;
+        while (n < volume->summary_size()
+            && std::isfinite(directions[n].value)) ++n;
+        std::uniform_int_distribution<std::size_t> sdis(0, n - 1);
+
+        VolumeDirection const & direction = directions[sdis(*gen)];
+        if (direction.value < rdis(*gen)) return false;
+
+        *theta = direction.theta;
+        *phi = direction.phi;
+        return true;
+    }
+
+    mve::FloatImage::ConstPtr image = volume->at(idx);
+    if (image == nullptr) return false;
+
+    std::uniform_int_distribution<int> idis(0, image->get_value_amount() - 1);
+
+    int i = idis(*gen);
+    if (image->at(i) < rdis(*gen)) return false;
+
+    int x = i % image->width();
+    int y = i / image->width();
+
+    float const pi = std::acos(-1.0f);
+    *theta = (0.5f + (y / (float) image->height()) / 2.0f) * pi;
+    *phi = (x / (float) image->width()) * 2.0f * pi;
+    return true;
+}
+
+/* Highest value of each volume averaged over the positions and the number
+ * of positions at which each volume has the highest value (the first one on
+ * ties) - compares the volumes of multiple camera models. */
+template <typename IdxType> void
+compare_volumes(std::vector<typename Volume<IdxType>::Ptr> const & volumes,
+    std::vector<math::Vector<IdxType, 3> > const & positions,
+    std::vector<double> * averages, std::vector<std::size_t> * wins)
+{
+    averages->assign(volumes.size(), 0.0);
+    wins->assign(volumes.size(), 0);
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        float best = std::numeric_limits<float>::lowest();
+        std::size_t winner = 0;
+        for (std::size_t j = 0; j < volumes.size(); ++j) {
+            mve::FloatImage::ConstPtr image = volumes[j]->at(positions[i]);
+            float value = std::numeric_limits<float>::lowest();
+            for (int k = 0; k < image->get_value_amount(); ++k) {
+                value = std::max(value, image->at(k));
+            }
+            averages->at(j) += value;
+            if (value > best) {
+                best = value;
+                winner = j;
+            }
+        }
+        wins->at(winner) += 1;
+    }
+
+    std::size_t num_positions = std::max<std::size_t>(1, positions.size());
+    for (double & average : *averages) average /= num_positions;
+}
+
+#endif /* GEOM_DIRECTION_SUMMARY_HEADER */
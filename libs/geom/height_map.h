@@ -0,0 +1,788 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef GEOM_HEIGHT_MAP_HEADER
+#define GEOM_HEIGHT_MAP_HEADER
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+#include "math/vector.h"
+
+#include "mve/image.h"
+#include "mve/mesh.h"
+
+/* Invalid (unobserved) height map pixels have the value
+ * std::numeric_limits<float>::lowest(). */
+
+/* Rasterizes the maximal height of the vertices into a width x height map
+ * with the given resolution starting at min.
+ * Vertices with zero confidence are skipped if confs is given. */
+inline mve::FloatImage::Ptr
+create_height_map(std::vector<math::Vec3f> const & verts,
+    math::Vec3f const & min, float resolution, int width, int height,
+    std::vector<float> const * confs = nullptr)
+{
+    float const lowest = std::numeric_limits<float>::lowest();
+
+    mve::FloatImage::Ptr hmap = mve::FloatImage::create(width, height, 1);
+    hmap->fill(lowest);
+    for (std::size_t i = 0; i < verts.size(); ++i) {
+        if (confs != nullptr && (*confs)[i] == 0.0f) continue;
+
+        math::Vec3f const & vertex = verts[i];
+        int x = (vertex[0] - min[0]) / resolution;
+        assert(0 <= x && x < width);
+        int y = (vertex[1] - min[1]) / resolution;
+        assert(0 <= y && y < height);
+
+        float & z = hmap->at(x, y, 0);
+        z = std::max(z, vertex[2]);
+    }
+
+    return hmap;
+}
+
+/* Lowest valid height. */
+inline float
+estimate_ground_level(mve::FloatImage::ConstPtr hmap) {
+    float const lowest = std::numeric_limits<float>::lowest();
+
+    float ground_level = std::numeric_limits<float>::max();
+    #pragma omp parallel for reduction(min:ground_level)
+    for (int i = 0; i < hmap->get_value_amount(); ++i) {
+        float height = hmap->at(i);
+        if (height != lowest && height < ground_level) {
+            ground_level = height;
+        }
+    }
+    return ground_level;
+}
+
+/* 3x3 median filter, pixels at the image boundary are set to boundary.
+ * The columns of each row are sorted once and the median is selected from
+ * the sorted columns of the 3x3 neighborhood (median of the maximal minimum,
+ * the median of medians and the minimal maximum) - branch free and
+ * vectorizable along the rows. */
+inline void
+median_filter(mve::FloatImage::Ptr hmap, float boundary) {
+    int const width = hmap->width();
+    int const height = hmap->height();
+
+    mve::FloatImage::Ptr tmp = mve::FloatImage::create(width, height, 1);
+    float const * src = hmap->get_data_pointer();
+    float * dst = tmp->get_data_pointer();
+
+    #pragma omp parallel
+    {
+        std::vector<float> los(width), mids(width), his(width);
+        float * lo = los.data();
+        float * mid = mids.data();
+        float * hi = his.data();
+
+        #pragma omp for schedule(static)
+        for (int y = 0; y < height; ++y) {
+            float * row = dst + std::size_t(y) * width;
+            if (y == 0 || y == height - 1 || width < 3) {
+                std::fill(row, row + width, boundary);
+                continue;
+            }
+
+            float const * r0 = src + std::size_t(y - 1) * width;
+            float const * r1 = src + std::size_t(y) * width;
+            float const * r2 = src + std::size_t(y + 1) * width;
+
+            #pragma omp simd
+            for (int x = 0; x < width; ++x) {
+                float l = std::min(r0[x], r1[x]);
+                float h = std::max(r0[x], r1[x]);
+                lo[x] = std::min(l, r2[x]);
+                hi[x] = std::max(h, r2[x]);
+                mid[x] = std::max(l, std::min(h, r2[x]));
+            }
+
+            #pragma omp simd
+            for (int x = 1; x < width - 1; ++x) {
+                float max_lo = std::max(std::max(lo[x - 1], lo[x]), lo[x + 1]);
+                float min_hi = std::min(std::min(hi[x - 1], hi[x]), hi[x + 1]);
+                float a = mid[x - 1];
+                float b = mid[x];
+                float c = mid[x + 1];
+                float med_mid = std::max(std::min(a, b), std::min(std::max(a, b), c));
+                row[x] = std::max(std::min(max_lo, med_mid),
+                    std::min(std::max(max_lo, med_mid), min_hi));
+            }
+
+            row[0] = boundary;
+            row[width - 1] = boundary;
+        }
+    }
+
+    hmap->swap(*tmp);
+}
+
+/* Fills invalid pixels within max_distance (chessboard distance) of valid
+ * pixels by push-pull interpolation over an image pyramid, pixels at the
+ * image boundary are invalidated. Linear in the number of pixels. */
+inline void
+fill_holes(mve::FloatImage::Ptr hmap, int max_distance) {
+    float const lowest = std::numeric_limits<float>::lowest();
+
+    int const width = hmap->width();
+    int const height = hmap->height();
+    float * data = hmap->get_data_pointer();
+
+    /* Chessboard distance to the closest valid pixel (two passes),
+     * capped to max_distance + 1. */
+    std::uint16_t const far = std::min(max_distance + 1, 65535);
+    std::vector<std::uint16_t> dists(std::size_t(width) * height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            std::size_t idx = std::size_t(y) * width + x;
+            if (data[idx] != lowest) {
+                dists[idx] = 0;
+                continue;
+            }
+            int d = far;
+            if (x > 0) d = std::min(d, dists[idx - 1] + 1);
+            if (y > 0) {
+                std::size_t up = idx - width;
+                d = std::min(d, dists[up] + 1);
+                if (x > 0) d = std::min(d, dists[up - 1] + 1);
+                if (x < width - 1) d = std::min(d, dists[up + 1] + 1);
+            }
+            dists[idx] = std::min<int>(d, far);
+        }
+    }
+    for (int y = height - 1; y >= 0; --y) {
+        for (int x = width - 1; x >= 0; --x) {
+            std::size_t idx = std::size_t(y) * width + x;
+            int d = dists[idx];
+            if (d == 0) continue;
+            if (x < width - 1) d = std::min(d, dists[idx + 1] + 1);
+            if (y < height - 1) {
+                std::size_t down = idx + width;
+                d = std::min(d, dists[down] + 1);
+                if (x > 0) d = std::min(d, dists[down - 1] + 1);
+                if (x < width - 1) d = std::min(d, dists[down + 1] + 1);
+            }
+            dists[idx] = std::min<int>(d, far);
+        }
+    }
+
+    struct Level {
+        int width;
+        int height;
+        std::vector<float> values;
+        std::vector<float> weights;
+    };
+
+    std::vector<Level> levels(1);
+    levels[0].width = width;
+    levels[0].height = height;
+    levels[0].values.resize(std::size_t(width) * height);
+    levels[0].weights.resize(std::size_t(width) * height);
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < levels[0].values.size(); ++i) {
+        bool valid = data[i] != lowest;
+        levels[0].values[i] = valid ? data[i] : 0.0f;
+        levels[0].weights[i] = valid ? 1.0f : 0.0f;
+    }
+
+    /* Pull - weighted averages of 2x2 blocks. */
+    while (levels.back().width > 1 || levels.back().height > 1) {
+        Level const & fine = levels.back();
+        Level coarse;
+        coarse.width = (fine.width + 1) / 2;
+        coarse.height = (fine.height + 1) / 2;
+        coarse.values.resize(std::size_t(coarse.width) * coarse.height);
+        coarse.weights.resize(std::size_t(coarse.width) * coarse.height);
+
+        #pragma omp parallel for
+        for (int y = 0; y < coarse.height; ++y) {
+            for (int x = 0; x < coarse.width; ++x) {
+                float sum = 0.0f;
+                float weight = 0.0f;
+                for (int ty = 2 * y; ty < std::min(2 * y + 2, fine.height); ++ty) {
+                    for (int tx = 2 * x; tx < std::min(2 * x + 2, fine.width); ++tx) {
+                        std::size_t idx = std::size_t(ty) * fine.width + tx;
+                        sum += fine.weights[idx] * fine.values[idx];
+                        weight += fine.weights[idx];
+                    }
+                }
+                std::size_t idx = std::size_t(y) * coarse.width + x;
+                coarse.values[idx] = (weight > 0.0f) ? sum / weight : 0.0f;
+                coarse.weights[idx] = std::min(weight, 1.0f);
+            }
+        }
+
+        levels.push_back(std::move(coarse));
+    }
+
+    /* Push - blend partially covered pixels with the coarser level. */
+    for (std::size_t l = levels.size() - 1; l-- > 0;) {
+        Level const & coarse = levels[l + 1];
+        Level & fine = levels[l];
+
+        #pragma omp parallel for
+        for (int y = 0; y < fine.height; ++y) {
+            for (int x = 0; x < fine.width; ++x) {
+                std::size_t idx = std::size_t(y) * fine.width + x;
+                float weight = fine.weights[idx];
+                if (weight >= 1.0f) continue;
+
+                std::size_t cidx = std::size_t(y / 2) * coarse.width + x / 2;
+                if (coarse.weights[cidx] <= 0.0f) continue;
+
+                fine.values[idx] = weight * fine.values[idx]
+                    + (1.0f - weight) * coarse.values[cidx];
+                fine.weights[idx] = 1.0f;
+            }
+        }
+    }
+
+    Level const & filled = levels[0];
+    #pragma omp parallel for
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            std::size_t idx = std::size_t(y) * width + x;
+            if (y == 0 || y == height - 1 || x == 0 || x == width - 1) {
+                data[idx] = lowest;
+            } else if (data[idx] == lowest && dists[idx] <= max_distance
+                && filled.weights[idx] > 0.0f) {
+                data[idx] = filled.values[idx];
+            }
+        }
+    }
+}
+
+/* Minimum (max == false) or maximum of the valid pixels within the
+ * (2 * radius + 1)^2 window around each pixel - separable, pixels without
+ * valid pixels in their window stay invalid. */
+inline void
+extremum_filter(mve::FloatImage::Ptr hmap, int radius, bool max) {
+    float const lowest = std::numeric_limits<float>::lowest();
+
+    int const width = hmap->width();
+    int const height = hmap->height();
+
+    auto filter = [&] (float const * src, float * dst, int n, int stride) {
+        for (int i = 0; i < n; ++i) {
+            float value = lowest;
+            int const first = std::max(0, i - radius);
+            int const last = std::min(n - 1, i + radius);
+            for (int j = first; j <= last; ++j) {
+                float v = src[j * stride];
+                if (v == lowest) continue;
+                if (value == lowest || (max ? v > value : v < value)) value = v;
+            }
+            dst[i * stride] = value;
+        }
+    };
+
+    mve::FloatImage::Ptr tmp = mve::FloatImage::create(width, height, 1);
+    float * data = hmap->get_data_pointer();
+    float * tdata = tmp->get_data_pointer();
+
+    #pragma omp parallel for
+    for (int y = 0; y < height; ++y) {
+        filter(data + y * width, tdata + y * width, width, 1);
+    }
+    #pragma omp parallel for
+    for (int x = 0; x < width; ++x) {
+        filter(tdata + x, data + x, height, width);
+    }
+}
+
+inline void
+min_filter(mve::FloatImage::Ptr hmap, int radius) {
+    extremum_filter(hmap, radius, false);
+}
+
+inline void
+max_filter(mve::FloatImage::Ptr hmap, int radius) {
+    extremum_filter(hmap, radius, true);
+}
+
+/* Triangulates the height map directly (pixel centers at
+ * min + (x + 0.5, y + 0.5) * resolution, heights offset by z_offset) into a
+ * closed surface. At each cell corner, neighboring valid cells whose heights
+ * differ by less than discontinuity share a vertex (averaged heights),
+ * vertical walls connect the remaining ones. The boundary of the valid
+ * region is closed by a skirt down to a flat base one resolution below the
+ * lowest height. Tiles of tile_size^2 cells with shared corners that deviate
+ * from their least squares plane by at most tolerance are replaced by a fan
+ * over their boundary vertices (the base of fully valid tiles likewise). */
+inline mve::TriangleMesh::Ptr
+triangulate_height_map(mve::FloatImage::ConstPtr hmap, math::Vec3f const & min,
+    float resolution, float z_offset, float discontinuity, float tolerance,
+    int tile_size = 16)
+{
+    float const lowest = std::numeric_limits<float>::lowest();
+
+    int const width = hmap->width();
+    int const height = hmap->height();
+    int const cwidth = width + 1;
+    int const cheight = height + 1;
+    std::size_t const num_corners = std::size_t(cwidth) * cheight;
+
+    auto valid = [&] (int x, int y) -> bool {
+        return 0 <= x && x < width && 0 <= y && y < height
+            && hmap->at(x, y, 0) != lowest;
+    };
+
+    /* Slot i of corner (cx, cy) is cell (cx - 1 + (i & 1), cy - 1 + (i >> 1)),
+     * ccw lists the slots counter clockwise. */
+    static int const ccw[4] = {0, 1, 3, 2};
+
+    /* Connected components of the valid cells around a corner - cells that
+     * share an edge are connected (their tops only if the height difference
+     * is below the discontinuity). Returns 2 bit labels per slot, numbered
+     * in slot order. */
+    auto components = [&] (int cx, int cy, bool tops, int * num) -> std::uint8_t {
+        bool v[4];
+        float h[4];
+        int parent[4];
+        for (int i = 0; i < 4; ++i) {
+            int x = cx - 1 + (i & 1);
+            int y = cy - 1 + (i >> 1);
+            v[i] = valid(x, y);
+            h[i] = v[i] ? hmap->at(x, y, 0) : 0.0f;
+            parent[i] = i;
+        }
+        auto find = [&parent] (int i) -> int {
+            while (parent[i] != i) i = parent[i];
+            return i;
+        };
+        for (int k = 0; k < 4; ++k) {
+            int a = ccw[k];
+            int b = ccw[(k + 1) % 4];
+            if (!v[a] || !v[b]) continue;
+            if (tops && !(std::abs(h[a] - h[b]) < discontinuity)) continue;
+            int ra = find(a);
+            int rb = find(b);
+            parent[std::max(ra, rb)] = std::min(ra, rb);
+        }
+        /* Roots are the smallest slots of their components. */
+        std::uint8_t labels = 0;
+        int component[4];
+        *num = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (!v[i]) continue;
+            int r = find(i);
+            if (r == i) component[i] = (*num)++;
+            labels |= component[r] << (2 * i);
+        }
+        return labels;
+    };
+
+    /* Corners: number of top vertices (0 - unused, 1 - shared, otherwise
+     * split) and base vertices (one per component of valid cells). */
+    std::vector<std::uint8_t> types(num_corners, 0);
+    std::vector<std::uint8_t> top_labels(num_corners, 0);
+    std::vector<std::uint8_t> bases(num_corners, 0);
+    std::vector<std::uint8_t> base_labels(num_corners, 0);
+    std::vector<float> heights(num_corners, 0.0f);
+    float hmin = std::numeric_limits<float>::max();
+
+    #pragma omp parallel for reduction(min:hmin)
+    for (int cy = 0; cy < cheight; ++cy) {
+        for (int cx = 0; cx < cwidth; ++cx) {
+            std::size_t idx = std::size_t(cy) * cwidth + cx;
+            int num;
+            top_labels[idx] = components(cx, cy, true, &num);
+            types[idx] = num;
+            base_labels[idx] = components(cx, cy, false, &num);
+            bases[idx] = num;
+
+            float sum = 0.0f;
+            int n = 0;
+            for (int i = 0; i < 4; ++i) {
+                int x = cx - 1 + (i & 1);
+                int y = cy - 1 + (i >> 1);
+                if (!valid(x, y)) continue;
+                float h = hmap->at(x, y, 0);
+                hmin = std::min(hmin, h);
+                sum += h;
+                n += 1;
+            }
+            if (n != 0) heights[idx] = sum / n;
+        }
+    }
+    float const base = hmin - resolution + z_offset;
+
+    /* Planar and fully valid tiles. */
+    int const twidth = (width + tile_size - 1) / tile_size;
+    int const theight = (height + tile_size - 1) / tile_size;
+    std::vector<std::uint8_t> planar(std::size_t(twidth) * theight, 0);
+    std::vector<std::uint8_t> full(planar.size(), 0);
+    std::vector<float> centers(planar.size());
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int ty = 0; ty < theight; ++ty) {
+        for (int tx = 0; tx < twidth; ++tx) {
+            int x0 = tx * tile_size;
+            int y0 = ty * tile_size;
+            int x1 = std::min(x0 + tile_size, width);
+            int y1 = std::min(y0 + tile_size, height);
+            if (x1 - x0 < 2 || y1 - y0 < 2) continue;
+
+            bool complete = true;
+            for (int y = y0; y < y1 && complete; ++y) {
+                for (int x = x0; x < x1 && complete; ++x) {
+                    complete = valid(x, y);
+                }
+            }
+            if (!complete) continue;
+            full[ty * twidth + tx] = 1;
+
+            /* Least squares plane z = a x + b y + c (centered coordinates). */
+            double sxx = 0.0, sxy = 0.0, syy = 0.0, sxz = 0.0, syz = 0.0, sz = 0.0;
+            double mx = (x0 + x1) / 2.0;
+            double my = (y0 + y1) / 2.0;
+            bool candidate = true;
+            std::size_t n = 0;
+            for (int cy = y0; cy <= y1 && candidate; ++cy) {
+                for (int cx = x0; cx <= x1; ++cx) {
+                    std::size_t idx = std::size_t(cy) * cwidth + cx;
+                    if (types[idx] != 1) {
+                        candidate = false;
+                        break;
+                    }
+                    double x = cx - mx;
+                    double y = cy - my;
+                    double z = heights[idx];
+                    sxx += x * x; sxy += x * y; syy += y * y;
+                    sxz += x * z; syz += y * z; sz += z;
+                    n += 1;
+                }
+            }
+            if (!candidate) continue;
+
+            double det = sxx * syy - sxy * sxy;
+            double a = (sxz * syy - syz * sxy) / det;
+            double b = (syz * sxx - sxz * sxy) / det;
+            double c = sz / n;
+
+            for (int cy = y0; cy <= y1 && candidate; ++cy) {
+                for (int cx = x0; cx <= x1; ++cx) {
+                    std::size_t idx = std::size_t(cy) * cwidth + cx;
+                    double z = a * (cx - mx) + b * (cy - my) + c;
+                    if (std::abs(z - heights[idx]) > tolerance) {
+                        candidate = false;
+                        break;
+                    }
+                }
+            }
+            if (!candidate) continue;
+
+            planar[ty * twidth + tx] = 1;
+            centers[ty * twidth + tx] = c;
+        }
+    }
+
+    /* Interior corners of planar (fully valid) tiles are not needed. */
+    #pragma omp parallel for schedule(dynamic)
+    for (int ty = 0; ty < theight; ++ty) {
+        for (int tx = 0; tx < twidth; ++tx) {
+            std::size_t t = ty * twidth + tx;
+            if (!full[t]) continue;
+            int x1 = std::min((tx + 1) * tile_size, width);
+            int y1 = std::min((ty + 1) * tile_size, height);
+            for (int cy = ty * tile_size + 1; cy < y1; ++cy) {
+                for (int cx = tx * tile_size + 1; cx < x1; ++cx) {
+                    std::size_t idx = std::size_t(cy) * cwidth + cx;
+                    if (planar[t]) types[idx] = 0;
+                    bases[idx] = 0;
+                }
+            }
+        }
+    }
+
+    /* Vertex ids - tops and bases of the corners followed by the tile
+     * centers of the tops and bases. */
+    std::vector<std::uint32_t> ids(num_corners);
+    std::vector<std::uint32_t> base_ids(num_corners);
+    std::uint32_t num_verts = 0;
+    for (std::size_t idx = 0; idx < num_corners; ++idx) {
+        ids[idx] = num_verts;
+        num_verts += types[idx];
+        base_ids[idx] = num_verts;
+        num_verts += bases[idx];
+    }
+    std::vector<std::uint32_t> center_ids(planar.size());
+    std::vector<std::uint32_t> base_center_ids(planar.size());
+    for (std::size_t i = 0; i < planar.size(); ++i) {
+        center_ids[i] = num_verts;
+        num_verts += planar[i];
+        base_center_ids[i] = num_verts;
+        num_verts += full[i];
+    }
+
+    mve::TriangleMesh::Ptr mesh = mve::TriangleMesh::create();
+    std::vector<math::Vec3f> & verts = mesh->get_vertices();
+    verts.resize(num_verts);
+
+    #pragma omp parallel for
+    for (int cy = 0; cy < cheight; ++cy) {
+        for (int cx = 0; cx < cwidth; ++cx) {
+            std::size_t idx = std::size_t(cy) * cwidth + cx;
+            float px = min[0] + cx * resolution;
+            float py = min[1] + cy * resolution;
+            if (types[idx] == 1) {
+                verts[ids[idx]] = math::Vec3f(px, py, heights[idx] + z_offset);
+            } else if (types[idx] > 1) {
+                /* Averaged heights of the components. */
+                float sums[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                int counts[4] = {0, 0, 0, 0};
+                for (int i = 0; i < 4; ++i) {
+                    int x = cx - 1 + (i & 1);
+                    int y = cy - 1 + (i >> 1);
+                    if (!valid(x, y)) continue;
+                    int label = (top_labels[idx] >> (2 * i)) & 3;
+                    sums[label] += hmap->at(x, y, 0);
+                    counts[label] += 1;
+                }
+                for (int j = 0; j < types[idx]; ++j) {
+                    verts[ids[idx] + j] = math::Vec3f(px, py,
+                        sums[j] / counts[j] + z_offset);
+                }
+            }
+            for (int j = 0; j < bases[idx]; ++j) {
+                verts[base_ids[idx] + j] = math::Vec3f(px, py, base);
+            }
+        }
+    }
+    for (int ty = 0; ty < theight; ++ty) {
+        for (int tx = 0; tx < twidth; ++tx) {
+            std::size_t t = ty * twidth + tx;
+            if (!full[t]) continue;
+            float cx = (tx * tile_size + std::min((tx + 1) * tile_size, width)) / 2.0f;
+            float cy = (ty * tile_size + std::min((ty + 1) * tile_size, height)) / 2.0f;
+            float px = min[0] + cx * resolution;
+            float py = min[1] + cy * resolution;
+            if (planar[t]) {
+                verts[center_ids[t]] = math::Vec3f(px, py, centers[t] + z_offset);
+            }
+            verts[base_center_ids[t]] = math::Vec3f(px, py, base);
+        }
+    }
+
+    /* Top and base vertices of (valid) cell (x, y) at corner (cx, cy). */
+    auto vertex = [&] (int x, int y, int cx, int cy) -> std::uint32_t {
+        std::size_t idx = std::size_t(cy) * cwidth + cx;
+        int slot = (x - cx + 1) + 2 * (y - cy + 1);
+        return ids[idx] + ((top_labels[idx] >> (2 * slot)) & 3);
+    };
+    auto base_vertex = [&] (int x, int y, int cx, int cy) -> std::uint32_t {
+        std::size_t idx = std::size_t(cy) * cwidth + cx;
+        int slot = (x - cx + 1) + 2 * (y - cy + 1);
+        return base_ids[idx] + ((base_labels[idx] >> (2 * slot)) & 3);
+    };
+
+    typedef std::vector<unsigned int> Faces;
+    auto triangle = [] (Faces * faces, std::uint32_t a, std::uint32_t b, std::uint32_t c) {
+        if (a == b || b == c || c == a) return;
+        faces->push_back(a);
+        faces->push_back(b);
+        faces->push_back(c);
+    };
+
+    /* Wall below the top edge p -> q (counter clockwise w.r.t. the cell)
+     * down to the edge op -> oq of the neighbor or the base - the winding
+     * follows the top, the sign of the height difference orients the normal. */
+    auto wall = [&triangle] (Faces * faces, std::uint32_t p, std::uint32_t q,
+        std::uint32_t op, std::uint32_t oq) {
+        triangle(faces, p, op, oq);
+        triangle(faces, p, oq, q);
+    };
+
+    std::vector<Faces> tile_faces(planar.size());
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int ty = 0; ty < theight; ++ty) {
+        for (int tx = 0; tx < twidth; ++tx) {
+            std::size_t t = ty * twidth + tx;
+            Faces * faces = &tile_faces[t];
+
+            int x0 = tx * tile_size;
+            int y0 = ty * tile_size;
+            int x1 = std::min(x0 + tile_size, width);
+            int y1 = std::min(y0 + tile_size, height);
+
+            if (full[t]) {
+                /* Fans over the boundary (counter clockwise, clockwise for
+                 * the base) - the corners of the boundary cells. */
+                std::vector<std::pair<int, int> > cells, corners;
+                for (int x = x0; x < x1; ++x) {
+                    cells.emplace_back(x, y0);
+                    corners.emplace_back(x, y0);
+                }
+                for (int y = y0; y < y1; ++y) {
+                    cells.emplace_back(x1 - 1, y);
+                    corners.emplace_back(x1, y);
+                }
+                for (int x = x1; x > x0; --x) {
+                    cells.emplace_back(x - 1, y1 - 1);
+                    corners.emplace_back(x, y1);
+                }
+                for (int y = y1; y > y0; --y) {
+                    cells.emplace_back(x0, y - 1);
+                    corners.emplace_back(x0, y);
+                }
+                std::size_t n = corners.size();
+                for (std::size_t i = 0; i < n; ++i) {
+                    std::pair<int, int> c0 = corners[i];
+                    std::pair<int, int> c1 = corners[(i + 1) % n];
+                    std::pair<int, int> a = cells[i];
+                    std::pair<int, int> b = cells[(i + 1) % n];
+                    if (planar[t]) {
+                        triangle(faces, center_ids[t],
+                            vertex(a.first, a.second, c0.first, c0.second),
+                            vertex(b.first, b.second, c1.first, c1.second));
+                    }
+                    triangle(faces, base_center_ids[t],
+                        base_vertex(b.first, b.second, c1.first, c1.second),
+                        base_vertex(a.first, a.second, c0.first, c0.second));
+                }
+            }
+
+            for (int y = y0; y < y1; ++y) {
+                for (int x = x0; x < x1; ++x) {
+                    if (!valid(x, y)) continue;
+
+                    std::uint32_t v00 = vertex(x, y, x, y);
+                    std::uint32_t v10 = vertex(x, y, x + 1, y);
+                    std::uint32_t v01 = vertex(x, y, x, y + 1);
+                    std::uint32_t v11 = vertex(x, y, x + 1, y + 1);
+                    if (!planar[t]) {
+                        triangle(faces, v00, v10, v11);
+                        triangle(faces, v00, v11, v01);
+                    }
+
+                    std::uint32_t b00 = 0, b10 = 0, b01 = 0, b11 = 0;
+                    bool border = !valid(x + 1, y) || !valid(x, y + 1)
+                        || !valid(x - 1, y) || !valid(x, y - 1);
+                    if (!full[t] || border) {
+                        b00 = base_vertex(x, y, x, y);
+                        b10 = base_vertex(x, y, x + 1, y);
+                        b01 = base_vertex(x, y, x, y + 1);
+                        b11 = base_vertex(x, y, x + 1, y + 1);
+                    }
+                    if (!full[t]) {
+                        triangle(faces, b00, b11, b10);
+                        triangle(faces, b00, b01, b11);
+                    }
+
+                    /* Walls towards the right and upper neighbors (none
+                     * within planar tiles, their corners are shared) and
+                     * skirts towards invalid neighbors. */
+                    bool inner_x = planar[t] && x + 1 < x1;
+                    bool inner_y = planar[t] && y + 1 < y1;
+                    if (!valid(x + 1, y)) {
+                        wall(faces, v10, v11, b10, b11);
+                    } else if (!inner_x) {
+                        wall(faces, v10, v11, vertex(x + 1, y, x + 1, y),
+                            vertex(x + 1, y, x + 1, y + 1));
+                    }
+                    if (!valid(x, y + 1)) {
+                        wall(faces, v11, v01, b11, b01);
+                    } else if (!inner_y) {
+                        wall(faces, v11, v01, vertex(x, y + 1, x + 1, y + 1),
+                            vertex(x, y + 1, x, y + 1));
+                    }
+                    if (!valid(x - 1, y)) wall(faces, v01, v00, b01, b00);
+                    if (!valid(x, y - 1)) wall(faces, v00, v10, b00, b10);
+                }
+            }
+        }
+    }
+
+    /* Holes along the vertical lines through the corners - the walls and
+     * skirts of consecutive slots end in an edge each (from the later slot
+     * to the earlier one), the hole is the cycle of their reverses. */
+    std::vector<Faces> corner_faces(cheight);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int cy = 0; cy < cheight; ++cy) {
+        for (int cx = 0; cx < cwidth; ++cx) {
+            std::size_t idx = std::size_t(cy) * cwidth + cx;
+            if (types[idx] + bases[idx] <= 1) continue;
+
+            std::pair<std::uint32_t, std::uint32_t> edges[4];
+            int num_edges = 0;
+            for (int k = 0; k < 4; ++k) {
+                int s0 = ccw[k];
+                int s1 = ccw[(k + 1) % 4];
+                int x0 = cx - 1 + (s0 & 1), y0 = cy - 1 + (s0 >> 1);
+                int x1 = cx - 1 + (s1 & 1), y1 = cy - 1 + (s1 >> 1);
+                bool v0 = valid(x0, y0);
+                bool v1 = valid(x1, y1);
+                std::pair<std::uint32_t, std::uint32_t> edge;
+                if (v0 && v1) {
+                    edge.first = vertex(x1, y1, cx, cy);
+                    edge.second = vertex(x0, y0, cx, cy);
+                    if (edge.first == edge.second) continue;
+                } else if (v0) {
+                    edge.first = base_vertex(x0, y0, cx, cy);
+                    edge.second = vertex(x0, y0, cx, cy);
+                } else if (v1) {
+                    edge.first = vertex(x1, y1, cx, cy);
+                    edge.second = base_vertex(x1, y1, cx, cy);
+                } else {
+                    continue;
+                }
+
+                /* Opposite edges close each other. */
+                bool closed = false;
+                for (int j = 0; j < num_edges && !closed; ++j) {
+                    if (edges[j].first != edge.second
+                        || edges[j].second != edge.first) continue;
+                    edges[j] = edges[--num_edges];
+                    closed = true;
+                }
+                if (!closed) edges[num_edges++] = edge;
+            }
+            if (num_edges < 3) continue;
+
+            /* The edges form a single cycle (each vertex lies between two
+             * consecutive slots), the fan over it is degenerate but closes
+             * the surface. */
+            std::uint32_t cycle[4];
+            cycle[0] = edges[0].second;
+            cycle[1] = edges[0].first;
+            for (int i = 2; i < num_edges; ++i) {
+                for (int j = 1; j < num_edges; ++j) {
+                    if (edges[j].second != cycle[i - 1]) continue;
+                    cycle[i] = edges[j].first;
+                    break;
+                }
+            }
+            for (int i = 1; i + 1 < num_edges; ++i) {
+                triangle(&corner_faces[cy], cycle[0], cycle[i], cycle[i + 1]);
+            }
+        }
+    }
+
+    std::vector<unsigned int> & faces = mesh->get_faces();
+    for (Faces const & tfaces : tile_faces) {
+        faces.insert(faces.end(), tfaces.begin(), tfaces.end());
+    }
+    for (Faces const & cfaces : corner_faces) {
+        faces.insert(faces.end(), cfaces.begin(), cfaces.end());
+    }
+
+    return mesh;
+}
+
+#endif /* GEOM_HEIGHT_MAP_HEADER */
@@ -11,7 +11,7 @@
 
 #include <limits>
 #include <random>
-#include <future>
+#include <tuple>
 #include <vector>
 #include <cassert>
 #include <algorithm>
@@ -22,6 +22,8 @@
 
 #include "acc/bvh_tree.h"
 
+#include "util/task_scheduler.h"
+
 #include "transform.h"
 
 constexpr float eps = std::numeric_limits<float>::epsilon();
@@ -174,23 +176,26 @@ estimate_transform(std::vector<Correspondence> correspondences, float threshold)
     math::Vec3f c0, c1;
     std::tie(c0, c1) = center(&correspondences);
 
-    std::vector<std::future<std::tuple<math::Matrix3f, float, uint> > > futures;
-    for (int i = 0; i < 1000; ++i) {
-        std::vector<uint> samples = choose_random(3, 0, correspondences.size() - 1);
-        futures.push_back(std::async(std::launch::async,
-                estimate_rotation, std::cref(correspondences), samples, threshold
-            )
-        );
+    std::vector<std::vector<uint> > samples(1000);
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = choose_random(3, 0, correspondences.size() - 1);
     }
 
+    std::vector<std::tuple<math::Matrix3f, float, uint> > results(samples.size());
+    TaskScheduler::global().parallel_for(std::size_t(0), samples.size(),
+        [&] (std::size_t i) {
+            results[i] = estimate_rotation(correspondences, samples[i], threshold);
+        }
+    );
+
     uint max_inliers = 0;
     math::Matrix4f T;
     math::matrix_set_identity(&T);
-    for (std::size_t i = 0; i < futures.size(); ++i) {
+    for (std::size_t i = 0; i < results.size(); ++i) {
         math::Matrix3f R;
         float s;
         uint num_inliers;
-        std::tie(R, s, num_inliers) = futures[i].get();
+        std::tie(R, s, num_inliers) = results[i];
 
         if (num_inliers > max_inliers) {
             max_inliers = num_inliers;
@@ -9,7 +9,9 @@
 #ifndef GEOM_PLANE_ESTIMATION_HEADER
 #define GEOM_PLANE_ESTIMATION_HEADER
 
+#include <array>
 #include <random>
+#include <utility>
 
 #include "math/vector.h"
 #include "math/plane.h"
@@ -17,6 +19,8 @@
 
 #include "acc/primitives.h"
 
+#include "util/task_scheduler.h"
+
 math::Vec3f orthogonal(math::Vec3f const & vec) {
     math::Vec3f const n0(1.0f, 0.0f, 0.0f);
     math::Vec3f const n1(0.0f, 1.0f, 0.0f);
@@ -76,39 +80,46 @@ estimate_ground_plane(mve::TriangleMesh::ConstPtr cloud, acc::AABB<math::Vec3f>
 
     std::vector<math::Vec3f> const & verts = cloud->get_vertices();
 
-    std::vector<std::size_t> inliers;
-
     std::default_random_engine gen;
-    std::uniform_int_distribution<std::size_t> dis(0, verts.size());
+    std::uniform_int_distribution<std::size_t> dis(0, verts.size() - 1);
 
-    /* Estimate plane via RANSAC. */
-    #pragma omp parallel
-    {
-        std::vector<std::size_t> current_inliers;
-        current_inliers.reserve(verts.size());
-
-        #pragma omp for
-        for (std::size_t iteration = 0; iteration < 1000; ++iteration) {
-            current_inliers.clear();
-
-            math::Vec3f v1, v2, v3;
-            #pragma omp critical
-            {
-                v1 = verts[dis(gen)];
-                v2 = verts[dis(gen)];
-                v3 = verts[dis(gen)];
-            }
-            math::Plane3f plane(v1, v2, v3);
+    /* Draw samples upfront - the result does not depend on the scheduling. */
+    std::vector<std::array<std::size_t, 3> > samples(1000);
+    for (std::array<std::size_t, 3> & sample : samples) {
+        for (std::size_t & idx : sample) idx = dis(gen);
+    }
 
+    auto plane_from_sample = [&verts] (std::array<std::size_t, 3> const & sample) {
+        return math::Plane3f(verts[sample[0]], verts[sample[1]], verts[sample[2]]);
+    };
+
+    /* Estimate plane via RANSAC - count inliers (ties favour the earlier
+     * sample) and collect the inliers of the best plane only once. */
+    typedef std::pair<std::size_t, std::size_t> Score;
+    Score best = TaskScheduler::global().parallel_reduce(
+        std::size_t(0), samples.size(), Score(0, 0),
+        [&] (std::size_t iteration, Score * score) {
+            math::Plane3f plane = plane_from_sample(samples[iteration]);
+
+            std::size_t num_inliers = 0;
             for (std::size_t i = 0; i < verts.size(); ++i) {
-                if (std::abs(plane.point_dist(verts[i])) > threshold) continue;
-                current_inliers.push_back(i);
+                num_inliers += std::abs(plane.point_dist(verts[i])) <= threshold;
             }
 
-            #pragma omp critical
-            if (current_inliers.size() > inliers.size()) {
-                std::swap(current_inliers, inliers);
-            }
+            if (num_inliers > score->first) *score = Score(num_inliers, iteration);
+        },
+        [] (Score const & a, Score const & b) {
+            return b.first > a.first ? b : a;
+        }
+    );
+
+    std::vector<std::size_t> inliers;
+    inliers.reserve(best.first);
+    {
+        math::Plane3f plane = plane_from_sample(samples[best.second]);
+        for (std::size_t i = 0; i < verts.size(); ++i) {
+            if (std::abs(plane.point_dist(verts[i])) > threshold) continue;
+            inliers.push_back(i);
         }
     }
 
@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef GEOM_POINT_GRID_HEADER
+#define GEOM_POINT_GRID_HEADER
+
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <cstdlib>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "math/vector.h"
+
+#include "util/sort.h"
+
+/* Spreads the lower 21 bits of x such that two zero bits precede each bit. */
+inline std::uint64_t
+spread_bits(std::uint64_t x) {
+    x &= 0x1fffffull;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8) & 0x100f00f00f00f00full;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+
+inline std::uint64_t
+morton_code(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+    return spread_bits(x) | (spread_bits(y) << 1) | (spread_bits(z) << 2);
+}
+
+/* Uniform grid over a point set with cells stored in Morton order.
+ * Construction is parallel (O(n log n) sort of the cell codes) and the batched
+ * queries process the query points in Morton order and write into flat,
+ * caller owned result arrays (k entries per query). */
+template <typename IdxType = unsigned>
+class PointGrid {
+public:
+    typedef std::shared_ptr<PointGrid> Ptr;
+    typedef std::shared_ptr<const PointGrid> ConstPtr;
+
+private:
+    static constexpr std::uint32_t max_dim = 1u << 21;
+
+    float cell_size;
+    math::Vec3f min;
+    std::uint32_t dim[3];
+
+    /* Points and their original ids sorted by the Morton code of their cell. */
+    std::vector<math::Vec3f> verts;
+    std::vector<IdxType> ids;
+
+    /* Morton codes of the non empty cells and their first point. */
+    std::vector<std::uint64_t> cells;
+    std::vector<std::size_t> offsets;
+
+    std::uint32_t cell_coord(float v, int axis) const {
+        float c = (v - min[axis]) / cell_size;
+        if (c <= 0.0f) return 0u;
+        return std::min(static_cast<std::uint32_t>(c), dim[axis] - 1u);
+    }
+
+    template <typename Visitor>
+    void visit_cell(std::uint32_t x, std::uint32_t y, std::uint32_t z,
+        Visitor const & visitor) const;
+
+    template <typename Visitor>
+    void visit_shell(std::uint32_t const (&c)[3], std::uint32_t r,
+        Visitor const & visitor) const;
+
+    float unvisited_distance(math::Vec3f const & q,
+        std::uint32_t const (&c)[3], std::uint32_t r) const;
+
+    std::vector<std::size_t> morton_order(
+        std::vector<math::Vec3f> const & points) const;
+
+public:
+    /* A cell_size <= 0 triggers an estimate (see estimate_cell_size). */
+    PointGrid(std::vector<math::Vec3f> const & points, float cell_size = 0.0f);
+
+    static Ptr create(std::vector<math::Vec3f> const & points,
+        float cell_size = 0.0f)
+    {
+        return std::make_shared<PointGrid>(points, cell_size);
+    }
+
+    /* Estimates a cell size yielding roughly points_per_cell points per
+     * occupied cell for 2.5D point sets (e.g. aerial captures). */
+    static float estimate_cell_size(math::Vec3f const & min,
+        math::Vec3f const & max, std::size_t num_points,
+        float points_per_cell = 8.0f);
+
+    std::size_t num_points(void) const { return verts.size(); }
+    std::size_t num_cells(void) const { return cells.size(); }
+
+    /* Finds the k nearest neighbors within max_dist of point, sorted by
+     * (euclidean) distance. Returns the number of neighbors found and writes
+     * exactly k entries to the arrays (missing ones as IdxType(-1) and inf). */
+    std::size_t find_nns(math::Vec3f const & point, std::size_t k,
+        IdxType * nn_ids, float * nn_dists,
+        float max_dist = std::numeric_limits<float>::infinity()) const;
+
+    bool find_nn(math::Vec3f const & point, std::pair<IdxType, float> * nn,
+        float max_dist = std::numeric_limits<float>::infinity()) const;
+
+    /* Batched k nearest neighbor search - results of query i are stored in
+     * [i * k, (i + 1) * k) of nn_ids and nn_dists, the number of valid
+     * neighbors in counts (optional). Vectors are only resized if too small. */
+    void find_nns(std::vector<math::Vec3f> const & queries, std::size_t k,
+        std::vector<IdxType> * nn_ids, std::vector<float> * nn_dists,
+        std::vector<std::uint32_t> * counts = nullptr,
+        float max_dist = std::numeric_limits<float>::infinity()) const;
+
+    /* Batched radius search - returns the nearest max_results points within
+     * radius of each query with the same layout as the batched kNN search. */
+    void find_within(std::vector<math::Vec3f> const & queries, float radius,
+        std::size_t max_results, std::vector<IdxType> * nn_ids,
+        std::vector<float> * nn_dists, std::vector<std::uint32_t> * counts) const
+    {
+        find_nns(queries, max_results, nn_ids, nn_dists, counts, radius);
+    }
+};
+
+template <typename IdxType>
+float
+PointGrid<IdxType>::estimate_cell_size(math::Vec3f const & min,
+    math::Vec3f const & max, std::size_t num_points, float points_per_cell)
+{
+    float extents[3];
+    for (int i = 0; i < 3; ++i) extents[i] = max[i] - min[i];
+    std::sort(extents, extents + 3);
+
+    float density = points_per_cell / std::max<std::size_t>(num_points, 1);
+    if (extents[1] > 0.0f) return std::sqrt(extents[2] * extents[1] * density);
+    if (extents[2] > 0.0f) return extents[2] * density;
+    return 1.0f;
+}
+
+template <typename IdxType>
+PointGrid<IdxType>::PointGrid(std::vector<math::Vec3f> const & points,
+    float cell_size)
+{
+    std::size_t const n = points.size();
+
+    math::Vec3f max;
+    min = math::Vec3f(std::numeric_limits<float>::max());
+    max = math::Vec3f(std::numeric_limits<float>::lowest());
+    #pragma omp parallel
+    {
+        math::Vec3f tmin(std::numeric_limits<float>::max());
+        math::Vec3f tmax(std::numeric_limits<float>::lowest());
+
+        #pragma omp for nowait
+        for (std::size_t i = 0; i < n; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                tmin[j] = std::min(tmin[j], points[i][j]);
+                tmax[j] = std::max(tmax[j], points[i][j]);
+            }
+        }
+
+        #pragma omp critical
+        for (int j = 0; j < 3; ++j) {
+            min[j] = std::min(min[j], tmin[j]);
+            max[j] = std::max(max[j], tmax[j]);
+        }
+    }
+    if (n == 0) min = max = math::Vec3f(0.0f);
+
+    if (cell_size <= 0.0f) cell_size = estimate_cell_size(min, max, n);
+
+    /* Limit dimensions to the resolution of the Morton codes. */
+    for (int i = 0; i < 3; ++i) {
+        cell_size = std::max(cell_size, (max[i] - min[i]) / (max_dim - 1u));
+    }
+    this->cell_size = cell_size;
+
+    for (int i = 0; i < 3; ++i) {
+        dim[i] = static_cast<std::uint32_t>((max[i] - min[i]) / cell_size) + 1u;
+        dim[i] = std::min(dim[i], max_dim);
+    }
+
+    std::vector<std::pair<std::uint64_t, IdxType> > codes(n);
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < n; ++i) {
+        math::Vec3f const & p = points[i];
+        std::uint64_t code = morton_code(cell_coord(p[0], 0),
+            cell_coord(p[1], 1), cell_coord(p[2], 2));
+        codes[i] = std::make_pair(code, static_cast<IdxType>(i));
+    }
+
+    parallel_sort(codes.begin(), codes.end());
+
+    verts.resize(n);
+    ids.resize(n);
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < n; ++i) {
+        ids[i] = codes[i].second;
+        verts[i] = points[codes[i].second];
+    }
+
+    /* Extract cell ranges (serial compaction of the sorted codes). */
+    for (std::size_t i = 0; i < n; ++i) {
+        if (i != 0 && codes[i].first == codes[i - 1].first) continue;
+        cells.push_back(codes[i].first);
+        offsets.push_back(i);
+    }
+    offsets.push_back(n);
+}
+
+template <typename IdxType>
+template <typename Visitor>
+void
+PointGrid<IdxType>::visit_cell(std::uint32_t x, std::uint32_t y,
+    std::uint32_t z, Visitor const & visitor) const
+{
+    std::uint64_t code = morton_code(x, y, z);
+    auto it = std::lower_bound(cells.begin(), cells.end(), code);
+    if (it == cells.end() || *it != code) return;
+
+    std::size_t cell = std::distance(cells.begin(), it);
+    for (std::size_t i = offsets[cell]; i < offsets[cell + 1]; ++i) {
+        visitor(i);
+    }
+}
+
+template <typename IdxType>
+template <typename Visitor>
+void
+PointGrid<IdxType>::visit_shell(std::uint32_t const (&c)[3], std::uint32_t r,
+    Visitor const & visitor) const
+{
+    std::int64_t lo[3], hi[3];
+    for (int i = 0; i < 3; ++i) {
+        lo[i] = std::max<std::int64_t>(std::int64_t(c[i]) - r, 0);
+        hi[i] = std::min<std::int64_t>(std::int64_t(c[i]) + r, dim[i] - 1);
+    }
+
+    for (std::int64_t z = lo[2]; z <= hi[2]; ++z) {
+        bool zshell = std::abs(z - std::int64_t(c[2])) == r;
+        for (std::int64_t y = lo[1]; y <= hi[1]; ++y) {
+            bool yshell = zshell || std::abs(y - std::int64_t(c[1])) == r;
+            if (yshell) {
+                for (std::int64_t x = lo[0]; x <= hi[0]; ++x) {
+                    visit_cell(x, y, z, visitor);
+                }
+            } else {
+                /* Only the two cells on the x boundaries belong to the shell. */
+                std::int64_t x0 = std::int64_t(c[0]) - r;
+                std::int64_t x1 = std::int64_t(c[0]) + r;
+                if (x0 >= 0) visit_cell(x0, y, z, visitor);
+                if (x1 < dim[0] && r != 0) visit_cell(x1, y, z, visitor);
+            }
+        }
+    }
+}
+
+/* Lower bound on the distance between q and any cell outside the r-ring. */
+template <typename IdxType>
+float
+PointGrid<IdxType>::unvisited_distance(math::Vec3f const & q,
+    std::uint32_t const (&c)[3], std::uint32_t r) const
+{
+    float dist = std::numeric_limits<float>::infinity();
+    for (int i = 0; i < 3; ++i) {
+        if (c[i] >= r) {
+            float lower = min[i] + (float(c[i]) - r) * cell_size;
+            dist = std::min(dist, std::max(q[i] - lower, 0.0f));
+        }
+        if (std::uint64_t(c[i]) + r + 1 < dim[i]) {
+            float upper = min[i] + (float(c[i]) + r + 1) * cell_size;
+            dist = std::min(dist, std::max(upper - q[i], 0.0f));
+        }
+    }
+    return dist;
+}
+
+template <typename IdxType>
+std::size_t
+PointGrid<IdxType>::find_nns(math::Vec3f const & point, std::size_t k,
+    IdxType * nn_ids, float * nn_dists, float max_dist) const
+{
+    std::fill(nn_ids, nn_ids + k, IdxType(-1));
+    std::fill(nn_dists, nn_dists + k, std::numeric_limits<float>::infinity());
+    if (k == 0 || verts.empty()) return 0;
+
+    float const max_sq_dist = max_dist * max_dist;
+    std::size_t count = 0;
+
+    /* Insertion into the sorted result arrays (squared distances). */
+    auto visitor = [&] (std::size_t i) {
+        float sq_dist = (verts[i] - point).square_norm();
+        if (sq_dist > max_sq_dist) return;
+        if (count == k && sq_dist >= nn_dists[k - 1]) return;
+
+        std::size_t j = std::min(count, k - 1);
+        for (; j > 0 && nn_dists[j - 1] > sq_dist; --j) {
+            nn_dists[j] = nn_dists[j - 1];
+            nn_ids[j] = nn_ids[j - 1];
+        }
+        nn_dists[j] = sq_dist;
+        nn_ids[j] = ids[i];
+        count = std::min(count + 1, k);
+    };
+
+    std::uint32_t c[3];
+    for (int i = 0; i < 3; ++i) c[i] = cell_coord(point[i], i);
+    std::uint32_t max_r = std::max(dim[0], std::max(dim[1], dim[2]));
+
+    for (std::uint32_t r = 0; r < max_r; ++r) {
+        visit_shell(c, r, visitor);
+
+        float dist = unvisited_distance(point, c, r);
+        if (dist == std::numeric_limits<float>::infinity()) break;
+        if (dist > max_dist) break;
+        if (count == k && dist * dist >= nn_dists[k - 1]) break;
+    }
+
+    for (std::size_t i = 0; i < count; ++i) {
+        nn_dists[i] = std::sqrt(nn_dists[i]);
+    }
+
+    return count;
+}
+
+template <typename IdxType>
+bool
+PointGrid<IdxType>::find_nn(math::Vec3f const & point,
+    std::pair<IdxType, float> * nn, float max_dist) const
+{
+    IdxType id;
+    float dist;
+    if (find_nns(point, 1, &id, &dist, max_dist) == 0) return false;
+    if (nn != nullptr) *nn = std::make_pair(id, dist);
+    return true;
+}
+
+template <typename IdxType>
+std::vector<std::size_t>
+PointGrid<IdxType>::morton_order(std::vector<math::Vec3f> const & points) const
+{
+    std::vector<std::pair<std::uint64_t, std::size_t> > codes(points.size());
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        math::Vec3f const & p = points[i];
+        std::uint64_t code = morton_code(cell_coord(p[0], 0),
+            cell_coord(p[1], 1), cell_coord(p[2], 2));
+        codes[i] = std::make_pair(code, i);
+    }
+
+    parallel_sort(codes.begin(), codes.end());
+
+    std::vector<std::size_t> order(points.size());
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        order[i] = codes[i].second;
+    }
+    return order;
+}
+
+template <typename IdxType>
+void
+PointGrid<IdxType>::find_nns(std::vector<math::Vec3f> const & queries,
+    std::size_t k, std::vector<IdxType> * nn_ids, std::vector<float> * nn_dists,
+    std::vector<std::uint32_t> * counts, float max_dist) const
+{
+    std::size_t const n = queries.size();
+    if (nn_ids->size() < n * k) nn_ids->resize(n * k);
+    if (nn_dists->size() < n * k) nn_dists->resize(n * k);
+    if (counts != nullptr && counts->size() < n) counts->resize(n);
+
+    std::vector<std::size_t> order = morton_order(queries);
+
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (std::size_t i = 0; i < n; ++i) {
+        std::size_t q = order[i];
+        std::size_t count = find_nns(queries[q], k,
+            nn_ids->data() + q * k, nn_dists->data() + q * k, max_dist);
+        if (counts != nullptr) counts->at(q) = count;
+    }
+}
+
+#endif /* GEOM_POINT_GRID_HEADER */
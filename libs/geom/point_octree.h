@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef GEOM_POINT_OCTREE_HEADER
+#define GEOM_POINT_OCTREE_HEADER
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <fstream>
+#include <unordered_map>
+
+#include "math/vector.h"
+#include "math/matrix.h"
+
+#include "util/exception.h"
+#include "util/file_system.h"
+
+#include "mve/mesh.h"
+
+#include "acc/primitives.h"
+
+#define GEOM_POINT_OCTREE_FILE_HEADER "PTO"
+#define GEOM_POINT_OCTREE_FILE_VERSION "0.1"
+#define GEOM_POINT_OCTREE_INDEX "octree.idx"
+#define GEOM_POINT_OCTREE_POINTS "octree.bin"
+
+/* Multi-resolution point octree stored in a directory (index and point
+ * data). Each node stores a subsample of the points within its bounds
+ * (at most one point per cell of a grid_size^3 grid), the remaining points
+ * are passed on to its children - the points of all nodes are disjoint and
+ * rendering a node together with its ancestors refines the cloud. */
+struct PointOctreePoint {
+    float pos[3];
+    std::uint8_t color[4];
+};
+
+struct PointOctreeNode {
+    /* Child indices (x | y << 1 | z << 2), three bits per level. */
+    std::uint64_t key;
+    std::uint8_t level;
+    std::uint8_t child_mask;
+    std::uint32_t num_points;
+    std::uint64_t offset;
+};
+
+struct PointOctree {
+    std::string path;
+    math::Vec3f min;
+    float size;
+    std::uint32_t grid_size;
+    std::vector<PointOctreeNode> nodes;
+};
+
+inline std::uint64_t
+child_key(std::uint64_t key, int child) {
+    return (key << 3) | std::uint64_t(child);
+}
+
+inline acc::AABB<math::Vec3f>
+node_aabb(PointOctree const & octree, PointOctreeNode const & node) {
+    acc::AABB<math::Vec3f> aabb;
+    aabb.min = octree.min;
+    float size = octree.size;
+    for (int l = node.level - 1; l >= 0; --l) {
+        int child = (node.key >> (3 * l)) & 7;
+        size /= 2.0f;
+        for (int i = 0; i < 3; ++i) {
+            if (child & (1 << i)) aabb.min[i] += size;
+        }
+    }
+    aabb.max = aabb.min + math::Vec3f(size);
+    return aabb;
+}
+
+/* Distance between neighboring points of the node. */
+inline float
+node_spacing(PointOctree const & octree, PointOctreeNode const & node) {
+    return octree.size / (octree.grid_size * float(1u << node.level));
+}
+
+/* Node index for (level, key) - keys are unique per level. */
+inline std::unordered_map<std::uint64_t, std::size_t>
+index_nodes(PointOctree const & octree) {
+    std::unordered_map<std::uint64_t, std::size_t> index;
+    for (std::size_t i = 0; i < octree.nodes.size(); ++i) {
+        PointOctreeNode const & node = octree.nodes[i];
+        index[(std::uint64_t(node.level) << 58) | node.key] = i;
+    }
+    return index;
+}
+
+inline void
+save_point_octree_index(PointOctree const & octree) {
+    std::string filename = util::fs::join_path(octree.path, GEOM_POINT_OCTREE_INDEX);
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    if (!out.good()) {
+        throw util::FileException(filename, std::strerror(errno));
+    }
+
+    out << GEOM_POINT_OCTREE_FILE_HEADER << " "
+        << GEOM_POINT_OCTREE_FILE_VERSION << std::endl;
+    out.precision(std::numeric_limits<float>::max_digits10);
+    out << octree.min << " " << octree.size << " "
+        << octree.grid_size << " " << octree.nodes.size() << std::endl;
+    for (PointOctreeNode const & node : octree.nodes) {
+        out.write(reinterpret_cast<char const *>(&node.key), sizeof(node.key));
+        out.write(reinterpret_cast<char const *>(&node.level), sizeof(node.level));
+        out.write(reinterpret_cast<char const *>(&node.child_mask), sizeof(node.child_mask));
+        out.write(reinterpret_cast<char const *>(&node.num_points), sizeof(node.num_points));
+        out.write(reinterpret_cast<char const *>(&node.offset), sizeof(node.offset));
+    }
+    out.close();
+}
+
+inline PointOctree
+load_point_octree(std::string const & path) {
+    std::string filename = util::fs::join_path(path, GEOM_POINT_OCTREE_INDEX);
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.good()) {
+        throw util::FileException(filename, std::strerror(errno));
+    }
+
+    std::string header;
+    in >> header;
+    if (header != GEOM_POINT_OCTREE_FILE_HEADER) {
+        in.close();
+        throw util::FileException(filename, "Not a point octree file");
+    }
+
+    std::string version;
+    in >> version;
+    if (version != GEOM_POINT_OCTREE_FILE_VERSION) {
+        in.close();
+        throw util::FileException(filename, "Incompatible version of point octree file");
+    }
+
+    PointOctree octree;
+    octree.path = path;
+    std::size_t num_nodes;
+    for (int i = 0; i < 3; ++i) in >> octree.min[i];
+    in >> octree.size >> octree.grid_size >> num_nodes;
+
+    std::string buffer;
+    std::getline(in, buffer);
+    if (in.fail()) {
+        in.close();
+        throw util::FileException(filename, "Corrupt point octree file header");
+    }
+
+    octree.nodes.resize(num_nodes);
+    for (PointOctreeNode & node : octree.nodes) {
+        in.read(reinterpret_cast<char *>(&node.key), sizeof(node.key));
+        in.read(reinterpret_cast<char *>(&node.level), sizeof(node.level));
+        in.read(reinterpret_cast<char *>(&node.child_mask), sizeof(node.child_mask));
+        in.read(reinterpret_cast<char *>(&node.num_points), sizeof(node.num_points));
+        in.read(reinterpret_cast<char *>(&node.offset), sizeof(node.offset));
+    }
+    if (in.fail()) {
+        in.close();
+        throw util::FileException(filename, "Corrupt point octree file");
+    }
+    in.close();
+
+    return octree;
+}
+
+/* Reads the points of the node and applies the transform T. */
+inline mve::TriangleMesh::Ptr
+load_point_octree_node(PointOctree const & octree, PointOctreeNode const & node,
+    math::Matrix4f const & T)
+{
+    std::string filename = util::fs::join_path(octree.path, GEOM_POINT_OCTREE_POINTS);
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.good()) {
+        throw util::FileException(filename, std::strerror(errno));
+    }
+
+    std::vector<PointOctreePoint> points(node.num_points);
+    in.seekg(node.offset * sizeof(PointOctreePoint));
+    in.read(reinterpret_cast<char *>(points.data()),
+        points.size() * sizeof(PointOctreePoint));
+    if (in.fail()) {
+        in.close();
+        throw util::FileException(filename, "Corrupt point octree file");
+    }
+    in.close();
+
+    mve::TriangleMesh::Ptr mesh = mve::TriangleMesh::create();
+    std::vector<math::Vec3f> & verts = mesh->get_vertices();
+    std::vector<math::Vec4f> & colors = mesh->get_vertex_colors();
+    verts.resize(points.size());
+    colors.resize(points.size());
+
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        verts[i] = T.mult(math::Vec3f(points[i].pos), 1.0f);
+        for (int j = 0; j < 4; ++j) colors[i][j] = points[i].color[j] / 255.0f;
+    }
+
+    return mesh;
+}
+
+#endif /* GEOM_POINT_OCTREE_HEADER */
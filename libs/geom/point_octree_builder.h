@@ -0,0 +1,570 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef GEOM_POINT_OCTREE_BUILDER_HEADER
+#define GEOM_POINT_OCTREE_BUILDER_HEADER
+
+#include <map>
+#include <random>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+
+#include "util/exception.h"
+#include "util/file_system.h"
+#include "util/tokenizer.h"
+
+#include "geom/point_octree.h"
+
+#define GEOM_POINT_OCTREE_BATCH_SIZE (1 << 20)
+#define GEOM_POINT_OCTREE_MAX_LEVEL 19
+#define GEOM_POINT_OCTREE_COUNT_LEVEL 7
+
+/* Streaming reader for the vertices of ascii and binary little endian
+ * ply files - clouds which do not fit into memory are read in batches. */
+class PLYPointStream {
+private:
+    struct Property {
+        std::string name;
+        int size;
+        char type;
+    };
+
+    std::string filename;
+    std::ifstream in;
+    bool binary;
+    std::size_t num_vertices;
+    std::size_t num_read;
+    std::size_t stride;
+    std::vector<Property> props;
+    int pos_idx[3];
+    int color_idx[4];
+
+    double value(char const * ptr, Property const & prop) {
+        switch (prop.type) {
+        case 'b': return *reinterpret_cast<std::int8_t const *>(ptr);
+        case 'B': return *reinterpret_cast<std::uint8_t const *>(ptr);
+        case 'h': return *reinterpret_cast<std::int16_t const *>(ptr);
+        case 'H': return *reinterpret_cast<std::uint16_t const *>(ptr);
+        case 'i': return *reinterpret_cast<std::int32_t const *>(ptr);
+        case 'I': return *reinterpret_cast<std::uint32_t const *>(ptr);
+        case 'f': return *reinterpret_cast<float const *>(ptr);
+        default: return *reinterpret_cast<double const *>(ptr);
+        }
+    }
+
+public:
+    PLYPointStream(std::string const & filename)
+        : filename(filename), in(filename.c_str(), std::ios::binary),
+        binary(true), num_vertices(0), num_read(0), stride(0)
+    {
+        if (!in.good()) {
+            throw util::FileException(filename, std::strerror(errno));
+        }
+
+        static std::map<std::string, std::pair<int, char> > const types = {
+            {"char", {1, 'b'}}, {"int8", {1, 'b'}},
+            {"uchar", {1, 'B'}}, {"uint8", {1, 'B'}},
+            {"short", {2, 'h'}}, {"int16", {2, 'h'}},
+            {"ushort", {2, 'H'}}, {"uint16", {2, 'H'}},
+            {"int", {4, 'i'}}, {"int32", {4, 'i'}},
+            {"uint", {4, 'I'}}, {"uint32", {4, 'I'}},
+            {"float", {4, 'f'}}, {"float32", {4, 'f'}},
+            {"double", {8, 'd'}}, {"float64", {8, 'd'}}
+        };
+
+        std::fill(pos_idx, pos_idx + 3, -1);
+        std::fill(color_idx, color_idx + 4, -1);
+
+        std::string line;
+        std::getline(in, line);
+        if (line != "ply") {
+            throw util::FileException(filename, "Not a ply file");
+        }
+
+        bool vertex_element = false;
+        bool first_element = true;
+        while (std::getline(in, line) && line != "end_header") {
+            util::Tokenizer tok;
+            tok.split(line, ' ');
+            if (tok.empty()) continue;
+
+            if (tok[0] == "format" && tok.size() > 1) {
+                if (tok[1] == "ascii") {
+                    binary = false;
+                } else if (tok[1] != "binary_little_endian") {
+                    throw util::FileException(filename, "Unsupported ply format");
+                }
+            } else if (tok[0] == "element" && tok.size() > 2) {
+                vertex_element = tok[1] == "vertex";
+                if (vertex_element) {
+                    if (!first_element) {
+                        throw util::FileException(filename,
+                            "Vertex element has to be the first element");
+                    }
+                    num_vertices = tok.get_as<std::size_t>(2);
+                }
+                first_element = false;
+            } else if (tok[0] == "property" && vertex_element) {
+                if (tok.size() != 3 || types.count(tok[1]) == 0) {
+                    throw util::FileException(filename, "Unsupported vertex property");
+                }
+                std::pair<int, char> type = types.at(tok[1]);
+                props.push_back({tok[2], type.first, type.second});
+                stride += type.first;
+            }
+        }
+
+        char const * pos_names[] = {"x", "y", "z"};
+        char const * color_names[] = {"red", "green", "blue", "alpha"};
+        for (std::size_t i = 0; i < props.size(); ++i) {
+            for (int j = 0; j < 3; ++j) {
+                if (props[i].name == pos_names[j]) pos_idx[j] = i;
+            }
+            for (int j = 0; j < 4; ++j) {
+                if (props[i].name == color_names[j]
+                    || props[i].name == std::string("diffuse_") + color_names[j]) {
+                    color_idx[j] = i;
+                }
+            }
+        }
+        if (pos_idx[0] < 0 || pos_idx[1] < 0 || pos_idx[2] < 0) {
+            throw util::FileException(filename, "Missing vertex position");
+        }
+    }
+
+    std::size_t size(void) const {
+        return num_vertices;
+    }
+
+    /* Reads up to max_points vertices, returns false if all have been read. */
+    bool read(std::size_t max_points, std::vector<PointOctreePoint> * points) {
+        std::size_t n = std::min(max_points, num_vertices - num_read);
+        points->resize(n);
+        if (n == 0) return false;
+
+        std::vector<char> buffer(binary ? n * stride : 0);
+        std::vector<double> values(props.size());
+        if (binary) in.read(buffer.data(), buffer.size());
+
+        for (std::size_t i = 0; i < n; ++i) {
+            if (binary) {
+                char const * ptr = buffer.data() + i * stride;
+                for (std::size_t j = 0; j < props.size(); ++j) {
+                    values[j] = value(ptr, props[j]);
+                    ptr += props[j].size;
+                }
+            } else {
+                for (std::size_t j = 0; j < props.size(); ++j) in >> values[j];
+            }
+
+            PointOctreePoint & point = (*points)[i];
+            for (int j = 0; j < 3; ++j) point.pos[j] = values[pos_idx[j]];
+            for (int j = 0; j < 4; ++j) {
+                int idx = color_idx[j];
+                if (idx < 0) {
+                    point.color[j] = 255;
+                } else if (props[idx].type == 'f' || props[idx].type == 'd') {
+                    point.color[j] = std::min(std::max(values[idx], 0.0), 1.0) * 255.0 + 0.5;
+                } else {
+                    point.color[j] = std::min(std::max(values[idx], 0.0), 255.0);
+                }
+            }
+        }
+
+        if (in.fail()) {
+            throw util::FileException(filename, "Error reading ply file");
+        }
+
+        num_read += n;
+        return true;
+    }
+};
+
+inline std::uint32_t
+octree_cell(float v, float min, float size, std::uint32_t n) {
+    float c = (v - min) / size * n;
+    return std::min<std::uint32_t>(std::max(c, 0.0f), n - 1);
+}
+
+inline std::uint64_t
+octree_node_id(int level, std::uint64_t key) {
+    return (std::uint64_t(level) << 58) | key;
+}
+
+class PointOctreeBuilder {
+private:
+    PointOctree * octree;
+    std::ofstream out;
+    std::uint64_t num_written;
+    std::uint32_t grid_size;
+    std::size_t leaf_points;
+
+public:
+    struct Pending {
+        std::size_t node;
+        std::vector<PointOctreePoint> points;
+    };
+
+    PointOctreeBuilder(PointOctree * octree, std::uint32_t grid_size, std::size_t leaf_points)
+        : octree(octree), num_written(0), grid_size(grid_size),
+        leaf_points(leaf_points)
+    {
+        std::string filename = util::fs::join_path(octree->path, GEOM_POINT_OCTREE_POINTS);
+        out.open(filename.c_str(), std::ios::binary);
+        if (!out.good()) {
+            throw util::FileException(filename, std::strerror(errno));
+        }
+    }
+
+    std::size_t add_node(int level, std::uint64_t key) {
+        PointOctreeNode node;
+        node.key = key;
+        node.level = level;
+        node.child_mask = 0;
+        node.num_points = 0;
+        node.offset = 0;
+        octree->nodes.push_back(node);
+        return octree->nodes.size() - 1;
+    }
+
+    void write(std::size_t idx, std::vector<PointOctreePoint> const & points) {
+        PointOctreeNode & node = octree->nodes[idx];
+        node.offset = num_written;
+        node.num_points = points.size();
+        out.write(reinterpret_cast<char const *>(points.data()),
+            points.size() * sizeof(PointOctreePoint));
+        num_written += points.size();
+    }
+
+    void finish(void) {
+        out.close();
+        if (out.fail()) {
+            throw util::FileException(octree->path, "Could not write points");
+        }
+    }
+
+    /* Moves at most one point per grid cell of the node (in the order of
+     * the points) into sample, the remaining points stay in points.
+     * Nodes with at most max_points points keep all of them. */
+    void subsample(std::size_t idx, std::size_t max_points,
+        std::vector<PointOctreePoint> * points,
+        std::vector<PointOctreePoint> * sample)
+    {
+        PointOctreeNode const & node = octree->nodes[idx];
+        if (points->size() <= max_points || node.level >= GEOM_POINT_OCTREE_MAX_LEVEL) {
+            sample->swap(*points);
+            points->clear();
+            return;
+        }
+
+        acc::AABB<math::Vec3f> aabb = node_aabb(*octree, node);
+        float size = aabb.max[0] - aabb.min[0];
+
+        std::unordered_set<std::uint64_t> cells;
+        cells.reserve(points->size());
+        std::size_t num_rest = 0;
+        for (std::size_t i = 0; i < points->size(); ++i) {
+            PointOctreePoint const & point = (*points)[i];
+            std::uint64_t c = 0;
+            for (int j = 2; j >= 0; --j) {
+                c = c * grid_size + octree_cell(point.pos[j], aabb.min[j], size, grid_size);
+            }
+            if (cells.insert(c).second) {
+                sample->push_back(point);
+            } else {
+                (*points)[num_rest++] = point;
+            }
+        }
+        points->resize(num_rest);
+    }
+
+    /* Builds the subtree of the node in memory - all nodes but the root
+     * are written, the points of the root are returned. */
+    void build(std::size_t idx, std::vector<PointOctreePoint> * points,
+        std::vector<PointOctreePoint> * sample)
+    {
+        subsample(idx, leaf_points, points, sample);
+        if (points->empty()) return;
+
+        int level = octree->nodes[idx].level;
+        std::uint64_t key = octree->nodes[idx].key;
+        acc::AABB<math::Vec3f> aabb = node_aabb(*octree, octree->nodes[idx]);
+        float size = aabb.max[0] - aabb.min[0];
+
+        std::vector<PointOctreePoint> children[8];
+        for (PointOctreePoint const & point : *points) {
+            int child = 0;
+            for (int j = 0; j < 3; ++j) {
+                child |= octree_cell(point.pos[j], aabb.min[j], size, 2) << j;
+            }
+            children[child].push_back(point);
+        }
+        points->clear();
+        points->shrink_to_fit();
+
+        for (int i = 0; i < 8; ++i) {
+            if (children[i].empty()) continue;
+
+            octree->nodes[idx].child_mask |= 1 << i;
+            std::size_t cidx = add_node(level + 1, child_key(key, i));
+            std::vector<PointOctreePoint> csample;
+            build(cidx, &children[i], &csample);
+            write(cidx, csample);
+        }
+    }
+};
+
+/* Builds the point octree of the ply cloud into the (existing) directory
+ * path in three streaming passes - bounds, point counts and distribution of
+ * the points into chunks (largest nodes with at most chunk_points points),
+ * which are subdivided in memory. The levels above the chunks are built
+ * bottom up by moving sampled points of the chunk roots upwards. */
+inline PointOctree
+build_point_octree(std::string const & cloud, std::string const & path,
+    std::uint32_t grid_size, std::size_t chunk_points, std::size_t leaf_points)
+{
+    std::size_t const batch_size = GEOM_POINT_OCTREE_BATCH_SIZE;
+    int const count_level = GEOM_POINT_OCTREE_COUNT_LEVEL;
+
+    std::string chunk_dir = util::fs::join_path(path, "chunks");
+    if (!util::fs::dir_exists(chunk_dir.c_str())
+        && !util::fs::mkdir(chunk_dir.c_str())) {
+        throw util::FileException(chunk_dir, std::strerror(errno));
+    }
+
+    std::vector<PointOctreePoint> batch;
+    batch.reserve(batch_size);
+
+    /* Pass 1: bounds. */
+    PointOctree octree;
+    octree.path = path;
+    octree.grid_size = grid_size;
+    std::size_t num_points = 0;
+    {
+        PLYPointStream stream(cloud);
+        num_points = stream.size();
+        math::Vec3f min(std::numeric_limits<float>::max());
+        math::Vec3f max(std::numeric_limits<float>::lowest());
+        while (stream.read(batch_size, &batch)) {
+            for (PointOctreePoint const & point : batch) {
+                for (int j = 0; j < 3; ++j) {
+                    min[j] = std::min(min[j], point.pos[j]);
+                    max[j] = std::max(max[j], point.pos[j]);
+                }
+            }
+        }
+        octree.min = min;
+        octree.size = std::max((max - min).maximum() * 1.0001f, 1e-3f);
+    }
+
+    if (num_points == 0) {
+        throw util::FileException(cloud, "Cloud is empty");
+    }
+
+    /* Pass 2: point counts of a 2^count_level grid. */
+    std::uint32_t const n = 1u << count_level;
+    std::vector<std::vector<std::uint64_t> > counts(count_level + 1);
+    counts[count_level].resize(std::size_t(n) * n * n, 0);
+    {
+        PLYPointStream stream(cloud);
+        while (stream.read(batch_size, &batch)) {
+            for (PointOctreePoint const & point : batch) {
+                std::uint32_t c[3];
+                for (int j = 0; j < 3; ++j) {
+                    c[j] = octree_cell(point.pos[j], octree.min[j], octree.size, n);
+                }
+                counts[count_level][(std::size_t(c[2]) * n + c[1]) * n + c[0]] += 1;
+            }
+        }
+    }
+    for (int l = count_level - 1; l >= 0; --l) {
+        std::uint32_t ln = 1u << l;
+        counts[l].resize(std::size_t(ln) * ln * ln, 0);
+        for (std::uint32_t z = 0; z < 2 * ln; ++z) {
+            for (std::uint32_t y = 0; y < 2 * ln; ++y) {
+                for (std::uint32_t x = 0; x < 2 * ln; ++x) {
+                    counts[l][(std::size_t(z / 2) * ln + y / 2) * ln + x / 2] +=
+                        counts[l + 1][(std::size_t(z) * 2 * ln + y) * 2 * ln + x];
+                }
+            }
+        }
+    }
+
+    /* Chunks: largest nodes with at most chunk_points points. */
+    struct Chunk {
+        int level;
+        std::uint64_t key;
+        std::uint64_t num_points;
+    };
+    std::vector<Chunk> chunks;
+    std::vector<std::uint32_t> cell_chunks(counts[count_level].size(), 0);
+    std::function<void(int, std::uint64_t, std::uint32_t, std::uint32_t, std::uint32_t)> partition =
+        [&] (int level, std::uint64_t key, std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+            std::uint32_t ln = 1u << level;
+            std::uint64_t count = counts[level][(std::size_t(z) * ln + y) * ln + x];
+            if (count == 0) return;
+
+            if (count > chunk_points && level < count_level) {
+                for (int i = 0; i < 8; ++i) {
+                    partition(level + 1, child_key(key, i),
+                        2 * x + (i & 1), 2 * y + ((i >> 1) & 1), 2 * z + (i >> 2));
+                }
+                return;
+            }
+
+            std::uint32_t s = 1u << (count_level - level);
+            for (std::uint32_t cz = z * s; cz < (z + 1) * s; ++cz) {
+                for (std::uint32_t cy = y * s; cy < (y + 1) * s; ++cy) {
+                    for (std::uint32_t cx = x * s; cx < (x + 1) * s; ++cx) {
+                        cell_chunks[(std::size_t(cz) * n + cy) * n + cx] = chunks.size();
+                    }
+                }
+            }
+            chunks.push_back({level, key, count});
+        };
+    partition(0, 0, 0, 0, 0);
+
+    /* Pass 3: distribute points to chunk files. */
+    auto chunk_file = [&] (std::size_t i) -> std::string {
+        return util::fs::join_path(chunk_dir, "chunk_" + std::to_string(i) + ".bin");
+    };
+    {
+        for (std::size_t i = 0; i < chunks.size(); ++i) {
+            std::ofstream out(chunk_file(i).c_str(), std::ios::binary | std::ios::trunc);
+        }
+
+        std::vector<std::vector<PointOctreePoint> > buffers(chunks.size());
+        std::size_t num_buffered = 0;
+        auto flush = [&] (void) {
+            for (std::size_t i = 0; i < buffers.size(); ++i) {
+                if (buffers[i].empty()) continue;
+                std::ofstream out(chunk_file(i).c_str(), std::ios::binary | std::ios::app);
+                out.write(reinterpret_cast<char const *>(buffers[i].data()),
+                    buffers[i].size() * sizeof(PointOctreePoint));
+                if (!out.good()) {
+                    throw util::FileException(chunk_file(i), std::strerror(errno));
+                }
+                buffers[i].clear();
+            }
+            num_buffered = 0;
+        };
+
+        PLYPointStream stream(cloud);
+        while (stream.read(batch_size, &batch)) {
+            for (PointOctreePoint const & point : batch) {
+                std::uint32_t c[3];
+                for (int j = 0; j < 3; ++j) {
+                    c[j] = octree_cell(point.pos[j], octree.min[j], octree.size, n);
+                }
+                buffers[cell_chunks[(std::size_t(c[2]) * n + c[1]) * n + c[0]]].push_back(point);
+            }
+            num_buffered += batch.size();
+            if (num_buffered >= 16 * batch_size) flush();
+        }
+        flush();
+    }
+
+    /* Build the subtrees of the chunks. */
+    PointOctreeBuilder builder(&octree, grid_size, leaf_points);
+    std::map<std::uint64_t, PointOctreeBuilder::Pending> pending;
+    for (std::size_t i = 0; i < chunks.size(); ++i) {
+        std::vector<PointOctreePoint> points(chunks[i].num_points);
+        {
+            std::ifstream in(chunk_file(i).c_str(), std::ios::binary);
+            in.read(reinterpret_cast<char *>(points.data()),
+                points.size() * sizeof(PointOctreePoint));
+            if (in.fail()) {
+                throw util::FileException(chunk_file(i), "Could not read chunk");
+            }
+        }
+        util::fs::unlink(chunk_file(i).c_str());
+
+        /* Random order - the first point per grid cell is a random sample. */
+        std::mt19937 gen(i);
+        std::shuffle(points.begin(), points.end(), gen);
+
+        std::uint64_t id = octree_node_id(chunks[i].level, chunks[i].key);
+        PointOctreeBuilder::Pending & root = pending[id];
+        root.node = builder.add_node(chunks[i].level, chunks[i].key);
+        builder.build(root.node, &points, &root.points);
+    }
+    util::fs::rmdir(chunk_dir.c_str());
+
+    /* Build the levels above the chunks bottom up, subsampling the points
+     * of the children (the selected points move up). */
+    for (int level = count_level - 1; level >= 0; --level) {
+        std::map<std::uint64_t, std::vector<std::uint64_t> > parents;
+        for (auto const & elem : pending) {
+            PointOctreeNode const & node = octree.nodes[elem.second.node];
+            if (node.level != level + 1) continue;
+            parents[octree_node_id(level, node.key >> 3)].push_back(elem.first);
+        }
+
+        for (auto const & elem : parents) {
+            std::uint64_t key = elem.first & ((std::uint64_t(1) << 58) - 1);
+            PointOctreeBuilder::Pending & parent = pending[elem.first];
+            parent.node = builder.add_node(level, key);
+
+            std::vector<PointOctreePoint> points;
+            for (std::uint64_t id : elem.second) {
+                PointOctreeBuilder::Pending & child = pending[id];
+                octree.nodes[parent.node].child_mask |=
+                    1 << (octree.nodes[child.node].key & 7);
+                points.insert(points.end(), child.points.begin(), child.points.end());
+                child.points.clear();
+            }
+
+            std::mt19937 gen(elem.first);
+            std::shuffle(points.begin(), points.end(), gen);
+
+            builder.subsample(parent.node, 0, &points, &parent.points);
+
+            /* Return remaining points to the children. */
+            PointOctreeNode const & pnode = octree.nodes[parent.node];
+            acc::AABB<math::Vec3f> aabb = node_aabb(octree, pnode);
+            float size = aabb.max[0] - aabb.min[0];
+            std::map<int, std::uint64_t> child_ids;
+            for (std::uint64_t id : elem.second) {
+                child_ids[octree.nodes[pending[id].node].key & 7] = id;
+            }
+            for (PointOctreePoint const & point : points) {
+                int child = 0;
+                for (int j = 0; j < 3; ++j) {
+                    child |= octree_cell(point.pos[j], aabb.min[j], size, 2) << j;
+                }
+                pending[child_ids.at(child)].points.push_back(point);
+            }
+
+            for (std::uint64_t id : elem.second) {
+                builder.write(pending[id].node, pending[id].points);
+                pending.erase(id);
+            }
+        }
+    }
+
+    for (auto & elem : pending) {
+        builder.write(elem.second.node, elem.second.points);
+    }
+
+    builder.finish();
+
+    /* Sort nodes by level for top down traversals. */
+    std::stable_sort(octree.nodes.begin(), octree.nodes.end(),
+        [] (PointOctreeNode const & a, PointOctreeNode const & b) {
+            return a.level < b.level;
+        });
+
+    save_point_octree_index(octree);
+
+    return octree;
+}
+
+#endif /* GEOM_POINT_OCTREE_BUILDER_HEADER */
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef GEOM_PROJECTION_HEADER
+#define GEOM_PROJECTION_HEADER
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "math/vector.h"
+#include "math/matrix.h"
+
+#include "mve/camera.h"
+
+/* Number of points processed per block - the projections of a block fit
+ * into the L1 cache. */
+#define GEOM_PROJECTION_BLOCK_SIZE 1024
+
+/* Matrices of a camera for a given image size (plain row major arrays). */
+struct CameraProjection {
+    /* First three rows of the world to camera matrix. */
+    float w2c[12];
+    float calib[9];
+    float invcalib[9];
+    float c2w_rot[9];
+    float pos[3];
+    int width;
+    int height;
+};
+
+inline CameraProjection
+camera_projection(mve::CameraInfo const & cam, int width, int height) {
+    CameraProjection proj;
+    math::Matrix4f w2c;
+    cam.fill_world_to_cam(w2c.begin());
+    std::copy(w2c.begin(), w2c.begin() + 12, proj.w2c);
+    cam.fill_calibration(proj.calib, width, height);
+    cam.fill_inverse_calibration(proj.invcalib, width, height);
+    cam.fill_cam_to_world_rot(proj.c2w_rot);
+    cam.fill_camera_pos(proj.pos);
+    proj.width = width;
+    proj.height = height;
+    return proj;
+}
+
+/* Points as structure of arrays. */
+struct PointBatch {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+
+    PointBatch(void) {}
+
+    PointBatch(std::vector<math::Vec3f> const & points) {
+        assign(points.data(), points.size());
+    }
+
+    std::size_t size(void) const { return x.size(); }
+
+    void resize(std::size_t n) {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+    }
+
+    void assign(math::Vec3f const * points, std::size_t n) {
+        resize(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            x[i] = points[i][0];
+            y[i] = points[i][1];
+            z[i] = points[i][2];
+        }
+    }
+
+    void push_back(math::Vec3f const & point) {
+        x.push_back(point[0]);
+        y.push_back(point[1]);
+        z.push_back(point[2]);
+    }
+
+    math::Vec3f operator[](std::size_t i) const {
+        return math::Vec3f(x[i], y[i], z[i]);
+    }
+};
+
+/* Image coordinates follow MVE - pixel (i, j) covers [i, i + 1) x [j, j + 1).
+ * A point is inside if it lies within the image shrunk by border and its
+ * depth (along the optical axis) within (min_depth, max_depth]. */
+struct FrustumBounds {
+    float border;
+    float min_depth;
+    float max_depth;
+
+    FrustumBounds(float border = 0.0f, float min_depth = 0.0f,
+        float max_depth = std::numeric_limits<float>::infinity())
+        : border(border), min_depth(min_depth), max_depth(max_depth) {}
+};
+
+/* Projects n points (xs, ys, zs) into the camera - writes image coordinates
+ * (px, py), depths and the frustum test results (inside) and returns the
+ * number of points inside. Coordinates of points behind the camera are
+ * meaningless. */
+inline std::size_t
+project_points(CameraProjection const & proj, float const * xs,
+    float const * ys, float const * zs, std::size_t n,
+    FrustumBounds const & bounds, float * px, float * py, float * depth,
+    std::uint8_t * inside)
+{
+    float const * m = proj.w2c;
+    float const * k = proj.calib;
+    float const xmin = bounds.border;
+    float const ymin = bounds.border;
+    float const xmax = proj.width - bounds.border;
+    float const ymax = proj.height - bounds.border;
+
+    std::size_t num_inside = 0;
+    #pragma omp simd reduction(+:num_inside)
+    for (std::size_t i = 0; i < n; ++i) {
+        float cx = m[0] * xs[i] + m[1] * ys[i] + m[2] * zs[i] + m[3];
+        float cy = m[4] * xs[i] + m[5] * ys[i] + m[6] * zs[i] + m[7];
+        float cz = m[8] * xs[i] + m[9] * ys[i] + m[10] * zs[i] + m[11];
+        float u = k[0] * cx + k[1] * cy + k[2] * cz;
+        float v = k[3] * cx + k[4] * cy + k[5] * cz;
+        float w = k[6] * cx + k[7] * cy + k[8] * cz;
+        float x = u / w;
+        float y = v / w;
+        px[i] = x;
+        py[i] = y;
+        depth[i] = cz;
+
+        bool in = bounds.min_depth < cz && cz <= bounds.max_depth
+            && xmin <= x && x < xmax && ymin <= y && y < ymax;
+        inside[i] = in;
+        num_inside += in;
+    }
+    return num_inside;
+}
+
+/* Projections of a range of a point batch. */
+struct ProjectedPoints {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> depth;
+    std::vector<std::uint8_t> inside;
+
+    void resize(std::size_t n) {
+        x.resize(n);
+        y.resize(n);
+        depth.resize(n);
+        inside.resize(n);
+    }
+};
+
+/* Projects the points [first, first + count) of the batch. */
+inline std::size_t
+project_points(CameraProjection const & proj, PointBatch const & points,
+    std::size_t first, std::size_t count, FrustumBounds const & bounds,
+    ProjectedPoints * projected)
+{
+    projected->resize(count);
+    return project_points(proj, points.x.data() + first,
+        points.y.data() + first, points.z.data() + first, count, bounds,
+        projected->x.data(), projected->y.data(), projected->depth.data(),
+        projected->inside.data());
+}
+
+/* Indices of the points within the frustum of the camera (ascending). */
+inline void
+points_in_frustum(CameraProjection const & proj, PointBatch const & points,
+    FrustumBounds const & bounds, std::vector<std::uint32_t> * ids)
+{
+    ids->clear();
+    ProjectedPoints projected;
+    for (std::size_t first = 0; first < points.size();
+         first += GEOM_PROJECTION_BLOCK_SIZE)
+    {
+        std::size_t count = std::min<std::size_t>(GEOM_PROJECTION_BLOCK_SIZE,
+            points.size() - first);
+        if (project_points(proj, points, first, count, bounds, &projected) == 0) {
+            continue;
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            if (projected.inside[i]) ids->push_back(first + i);
+        }
+    }
+}
+
+/* Indices of the points within the frustum of each camera - the cameras
+ * are processed in parallel. */
+inline void
+points_in_frusta(std::vector<CameraProjection> const & projs,
+    PointBatch const & points, FrustumBounds const & bounds,
+    std::vector<std::vector<std::uint32_t> > * ids)
+{
+    ids->resize(projs.size());
+    #pragma omp parallel for schedule(dynamic)
+    for (std::size_t i = 0; i < projs.size(); ++i) {
+        points_in_frustum(projs[i], points, bounds, &ids->at(i));
+    }
+}
+
+/* World space directions (normalized) of the rays from the camera center
+ * through the image coordinates (px, py). */
+inline void
+backproject_pixels(CameraProjection const & proj, float const * px,
+    float const * py, std::size_t n, float * dx, float * dy, float * dz)
+{
+    /* Fold the inverse calibration into the rotation. */
+    float m[9];
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            m[r * 3 + c] = proj.c2w_rot[r * 3 + 0] * proj.invcalib[0 * 3 + c]
+                + proj.c2w_rot[r * 3 + 1] * proj.invcalib[1 * 3 + c]
+                + proj.c2w_rot[r * 3 + 2] * proj.invcalib[2 * 3 + c];
+        }
+    }
+
+    #pragma omp simd
+    for (std::size_t i = 0; i < n; ++i) {
+        float x = m[0] * px[i] + m[1] * py[i] + m[2];
+        float y = m[3] * px[i] + m[4] * py[i] + m[5];
+        float z = m[6] * px[i] + m[7] * py[i] + m[8];
+        float l = std::sqrt(x * x + y * y + z * z);
+        dx[i] = x / l;
+        dy[i] = y / l;
+        dz[i] = z / l;
+    }
+}
+
+/* World space points at the given depths (along the optical axis) behind
+ * the image coordinates (px, py) - inverse of project_points. */
+inline void
+backproject_pixels(CameraProjection const & proj, float const * px,
+    float const * py, float const * depth, std::size_t n,
+    float * xs, float * ys, float * zs)
+{
+    float const * k = proj.invcalib;
+    float const * r = proj.c2w_rot;
+    float const * c = proj.pos;
+
+    #pragma omp simd
+    for (std::size_t i = 0; i < n; ++i) {
+        float x = (k[0] * px[i] + k[1] * py[i] + k[2]) * depth[i];
+        float y = (k[3] * px[i] + k[4] * py[i] + k[5]) * depth[i];
+        float z = (k[6] * px[i] + k[7] * py[i] + k[8]) * depth[i];
+        xs[i] = c[0] + r[0] * x + r[1] * y + r[2] * z;
+        ys[i] = c[1] + r[3] * x + r[4] * y + r[5] * z;
+        zs[i] = c[2] + r[6] * x + r[7] * y + r[8] * z;
+    }
+}
+
+#endif /* GEOM_PROJECTION_HEADER */
@@ -18,7 +18,7 @@ mve::TriangleMesh::Ptr generate_sphere_mesh(float radius, uint subdivisions) {
     /* Derived from mve/apps/umve/scene_addins/addin_sphere_creator.cc */
 
     /* Initialize icosahedron */
-    static std::vector<math::Vec3f> verts = {
+    std::vector<math::Vec3f> verts = {
         {0.0f, -0.5257311f, 0.8506508f},
         {0.0f, 0.5257311f, 0.8506508f},
         {0.0f, -0.5257311f, -0.8506508f},
@@ -33,7 +33,7 @@ mve::TriangleMesh::Ptr generate_sphere_mesh(float radius, uint subdivisions) {
         {-0.5257311f, -0.8506508f, 0.0f}
     };
 
-    static std::vector<uint> faces = {
+    std::vector<uint> faces = {
         0, 4, 1,
         0, 9, 4,
         9, 5, 4,
@@ -0,0 +1,639 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <cmath>
+#include <map>
+#include <set>
+#include <random>
+#include <vector>
+#include <fstream>
+#include <limits>
+#include <cstdlib>
+#include <utility>
+#include <iostream>
+#include <unordered_map>
+#include <algorithm>
+
+#include "height_map.h"
+#include "point_grid.h"
+#include "point_octree_builder.h"
+#include "viewpoint_index.h"
+
+#define TEST(cond) if (!(cond)) { \
+    std::cerr << __FILE__ << ":" << __LINE__ << ": " #cond " failed" << std::endl; \
+    std::exit(EXIT_FAILURE); }
+
+/* Uniform points within [0, 100]^2 x [0, 5] (2.5D, like aerial captures),
+ * a dense cluster and duplicates. */
+std::vector<math::Vec3f>
+create_points(std::size_t n, std::mt19937 * gen) {
+    std::uniform_real_distribution<float> xy(0.0f, 100.0f);
+    std::uniform_real_distribution<float> z(0.0f, 5.0f);
+    std::normal_distribution<float> cluster(0.0f, 0.1f);
+
+    std::vector<math::Vec3f> points;
+    for (std::size_t i = 0; i < n; ++i) {
+        points.emplace_back(xy(*gen), xy(*gen), z(*gen));
+    }
+    for (std::size_t i = 0; i < n / 10; ++i) {
+        points.emplace_back(50.0f + cluster(*gen), 50.0f + cluster(*gen),
+            2.0f + cluster(*gen));
+    }
+    for (std::size_t i = 0; i < n / 100; ++i) {
+        points.push_back(points[i]);
+    }
+    return points;
+}
+
+/* Distances of all points to the query sorted ascending. */
+std::vector<std::pair<float, unsigned> >
+brute_force(std::vector<math::Vec3f> const & points, math::Vec3f const & query) {
+    std::vector<std::pair<float, unsigned> > dists(points.size());
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        dists[i] = std::make_pair((points[i] - query).norm(), unsigned(i));
+    }
+    std::sort(dists.begin(), dists.end());
+    return dists;
+}
+
+bool
+equal(float a, float b) {
+    return std::abs(a - b) <= 1e-4f * std::max(1.0f, std::abs(b));
+}
+
+/* Batched kNN results have to match a brute force search - ids are compared
+ * via their distances since equidistant points may be reported in any order. */
+void test_point_grid_knn(void) {
+    std::mt19937 gen(7);
+    std::vector<math::Vec3f> points = create_points(20000, &gen);
+
+    std::vector<math::Vec3f> queries = create_points(500, &gen);
+    queries.emplace_back(-50.0f, -50.0f, 100.0f);
+    queries.emplace_back(1000.0f, 1000.0f, 1000.0f);
+
+    std::vector<std::vector<std::pair<float, unsigned> > > gts;
+    for (math::Vec3f const & query : queries) {
+        gts.push_back(brute_force(points, query));
+    }
+
+    for (float cell_size : {0.0f, 0.5f, 20.0f}) {
+        PointGrid<unsigned> grid(points, cell_size);
+        TEST(grid.num_points() == points.size());
+
+        for (std::size_t k : {1, 8, 50}) {
+            std::vector<unsigned> ids;
+            std::vector<float> dists;
+            std::vector<std::uint32_t> counts;
+            grid.find_nns(queries, k, &ids, &dists, &counts);
+
+            for (std::size_t i = 0; i < queries.size(); ++i) {
+                std::vector<std::pair<float, unsigned> > const & gt = gts[i];
+
+                TEST(counts[i] == k);
+                for (std::size_t j = 0; j < k; ++j) {
+                    unsigned id = ids[i * k + j];
+                    float dist = dists[i * k + j];
+                    TEST(id < points.size());
+                    TEST(equal(dist, gt[j].first));
+                    TEST(equal((points[id] - queries[i]).norm(), dist));
+                    for (std::size_t l = 0; l < j; ++l) {
+                        TEST(ids[i * k + l] != id);
+                    }
+                }
+            }
+        }
+
+        std::pair<unsigned, float> nn;
+        TEST(grid.find_nn(queries[0], &nn));
+        TEST(equal(nn.second, gts[0][0].first));
+    }
+
+    /* More neighbors requested than available. */
+    std::vector<math::Vec3f> few(points.begin(), points.begin() + 5);
+    PointGrid<unsigned> grid(few);
+    std::vector<unsigned> ids(10);
+    std::vector<float> dists(10);
+    TEST(grid.find_nns(queries[0], 10, ids.data(), dists.data()) == 5);
+    for (std::size_t j = 5; j < 10; ++j) {
+        TEST(ids[j] == unsigned(-1));
+        TEST(dists[j] == std::numeric_limits<float>::infinity());
+    }
+
+    PointGrid<unsigned> empty(std::vector<math::Vec3f>{});
+    TEST(!empty.find_nn(queries[0], nullptr));
+
+    std::cout << "Passed (point grid knn)" << std::endl;
+}
+
+/* Radius queries have to return exactly the points within the radius (as
+ * long as max_results suffices) and the nearest max_results otherwise. */
+void test_point_grid_radius(void) {
+    std::mt19937 gen(11);
+    std::vector<math::Vec3f> points = create_points(20000, &gen);
+    std::vector<math::Vec3f> queries = create_points(300, &gen);
+
+    std::vector<std::vector<std::pair<float, unsigned> > > gts;
+    for (math::Vec3f const & query : queries) {
+        gts.push_back(brute_force(points, query));
+    }
+
+    PointGrid<unsigned> grid(points);
+    for (float radius : {0.05f, 1.0f, 3.0f}) {
+        std::size_t const max_results = 4096;
+        std::vector<unsigned> ids;
+        std::vector<float> dists;
+        std::vector<std::uint32_t> counts;
+        grid.find_within(queries, radius, max_results, &ids, &dists, &counts);
+
+        std::size_t total = 0;
+        for (std::size_t i = 0; i < queries.size(); ++i) {
+            std::vector<std::pair<float, unsigned> > const & gt = gts[i];
+
+            std::size_t num_within = 0;
+            while (num_within < gt.size() && gt[num_within].first <= radius) {
+                num_within += 1;
+            }
+            /* Points on the boundary may differ by rounding. */
+            if (num_within < gt.size()
+                && equal(gt[num_within].first, radius)) continue;
+            if (num_within > 0 && equal(gt[num_within - 1].first, radius)) continue;
+
+            TEST(counts[i] == std::min(num_within, max_results));
+
+            std::vector<unsigned> found(ids.begin() + i * max_results,
+                ids.begin() + i * max_results + counts[i]);
+            std::vector<unsigned> expected;
+            for (std::size_t j = 0; j < counts[i]; ++j) {
+                expected.push_back(gt[j].second);
+                TEST(dists[i * max_results + j] <= radius);
+            }
+            std::sort(found.begin(), found.end());
+            std::sort(expected.begin(), expected.end());
+            if (num_within <= max_results) TEST(found == expected);
+            total += counts[i];
+        }
+        TEST(radius < 1.0f || total > 0);
+    }
+
+    /* Truncation to the nearest results. */
+    std::vector<unsigned> ids;
+    std::vector<float> dists;
+    std::vector<std::uint32_t> counts;
+    std::vector<math::Vec3f> center(1, math::Vec3f(50.0f, 50.0f, 2.0f));
+    grid.find_within(center, 1.0f, 16, &ids, &dists, &counts);
+    std::vector<std::pair<float, unsigned> > gt = brute_force(points, center[0]);
+    TEST(counts[0] == 16);
+    for (std::size_t j = 0; j < 16; ++j) {
+        TEST(equal(dists[j], gt[j].first));
+    }
+
+    std::cout << "Passed (point grid radius)" << std::endl;
+}
+
+/* Direct triangulations have to be closed and consistently oriented - each
+ * directed edge has exactly one opposite edge - and enclose a positive volume,
+ * for smooth, planar and stepped heights with holes, also at the border. */
+void test_height_map_triangulation(void) {
+    float const lowest = std::numeric_limits<float>::lowest();
+    std::mt19937 gen(13);
+    std::uniform_real_distribution<float> noise(0.0f, 1.0f);
+
+    for (int run = 0; run < 20; ++run) {
+        int width = 20 + run * 3;
+        int height = 37 - run;
+        mve::FloatImage::Ptr hmap = mve::FloatImage::create(width, height, 1);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                float h = 0.0f;
+                switch (run % 4) {
+                case 0: h = 0.1f * x + 0.05f * y; break;
+                case 1: h = (x / 5 + y / 7) % 3 * 2.0f; break;
+                case 2: h = 3.0f * noise(gen); break;
+                case 3: h = (x < width / 2) ? 1.0f : 0.1f * noise(gen); break;
+                }
+                float p = (run < 4) ? 0.0f : 0.02f * (run % 8);
+                if (noise(gen) < p) h = lowest;
+                hmap->at(x, y, 0) = h;
+            }
+        }
+        /* Diagonal pinch. */
+        hmap->at(2, 2, 0) = lowest;
+        hmap->at(3, 3, 0) = lowest;
+
+        mve::TriangleMesh::Ptr mesh = triangulate_height_map(hmap,
+            math::Vec3f(-1.0f, 2.0f, 0.0f), 0.5f, 1.0f, 0.75f, 0.05f, 8);
+        std::vector<math::Vec3f> const & verts = mesh->get_vertices();
+        std::vector<unsigned int> const & faces = mesh->get_faces();
+        TEST(faces.size() % 3 == 0);
+        TEST(!faces.empty());
+
+        std::map<std::pair<unsigned, unsigned>, int> edges;
+        double volume = 0.0;
+        for (std::size_t i = 0; i < faces.size(); i += 3) {
+            for (int j = 0; j < 3; ++j) {
+                TEST(faces[i + j] < verts.size());
+                edges[std::make_pair(faces[i + j], faces[i + (j + 1) % 3])] += 1;
+            }
+            math::Vec3f const & a = verts[faces[i + 0]];
+            math::Vec3f const & b = verts[faces[i + 1]];
+            math::Vec3f const & c = verts[faces[i + 2]];
+            volume += a.dot(b.cross(c)) / 6.0;
+        }
+        for (auto const & edge : edges) {
+            TEST(edge.second == 1);
+            auto opposite = std::make_pair(edge.first.second, edge.first.first);
+            TEST(edges.count(opposite) == 1);
+        }
+        TEST(volume > 0.0);
+
+        std::vector<bool> used(verts.size(), false);
+        for (unsigned int v : faces) used[v] = true;
+        TEST(std::count(used.begin(), used.end(), false) == 0);
+    }
+
+    std::cout << "Passed (height map triangulation)" << std::endl;
+}
+
+/* The median network has to match a 3x3 nth_element median (holes included
+ * as values) on random maps with duplicates and holes. */
+void test_height_map_median(void) {
+    float const lowest = std::numeric_limits<float>::lowest();
+    std::mt19937 gen(19);
+    std::uniform_real_distribution<float> noise(0.0f, 1.0f);
+    std::uniform_int_distribution<int> level(0, 4);
+
+    for (int run = 0; run < 12; ++run) {
+        int width = 1 + run * 7;
+        int height = 2 + (run * 5) % 31;
+        mve::FloatImage::Ptr hmap = mve::FloatImage::create(width, height, 1);
+        for (int i = 0; i < hmap->get_value_amount(); ++i) {
+            float h = (run % 2) ? float(level(gen)) : 10.0f * noise(gen) - 5.0f;
+            hmap->at(i) = (noise(gen) < 0.3f) ? lowest : h;
+        }
+
+        mve::FloatImage::Ptr gt = mve::FloatImage::create(width, height, 1);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (y == 0 || y == height - 1 || x == 0 || x == width - 1) {
+                    gt->at(x, y, 0) = -1.0f;
+                    continue;
+                }
+                float heights[9];
+                for (int i = 0; i < 9; ++i) {
+                    heights[i] = hmap->at(x + i % 3 - 1, y + i / 3 - 1, 0);
+                }
+                std::nth_element(heights, heights + 4, heights + 9);
+                gt->at(x, y, 0) = heights[4];
+            }
+        }
+
+        median_filter(hmap, -1.0f);
+        for (int i = 0; i < hmap->get_value_amount(); ++i) {
+            TEST(hmap->at(i) == gt->at(i));
+        }
+    }
+
+    std::cout << "Passed (height map median)" << std::endl;
+}
+
+/* Holes within max_distance (chessboard distance) of a valid pixel have to
+ * be filled with a value within the range of the valid pixels, holes beyond
+ * have to stay holes, valid pixels stay untouched and the boundary is
+ * invalidated. */
+void test_height_map_fill_holes(void) {
+    float const lowest = std::numeric_limits<float>::lowest();
+    std::mt19937 gen(23);
+    std::uniform_real_distribution<float> noise(0.0f, 1.0f);
+
+    for (int run = 0; run < 12; ++run) {
+        int width = 3 + run * 9;
+        int height = 40 - run * 3;
+        int max_distance = run % 4;
+        mve::FloatImage::Ptr hmap = mve::FloatImage::create(width, height, 1);
+        hmap->fill(lowest);
+
+        /* Sparse valid pixels and a few valid blobs. */
+        float min = std::numeric_limits<float>::max();
+        float max = lowest;
+        auto set = [&] (int x, int y) {
+            if (x < 0 || x >= width || y < 0 || y >= height) return;
+            float h = 5.0f * noise(gen);
+            hmap->at(x, y, 0) = h;
+            min = std::min(min, h);
+            max = std::max(max, h);
+        };
+        for (int i = 0; i < width * height / 40; ++i) {
+            set(int(noise(gen) * width), int(noise(gen) * height));
+        }
+        for (int i = 0; i < 2; ++i) {
+            int cx = int(noise(gen) * width);
+            int cy = int(noise(gen) * height);
+            for (int y = cy - 2; y <= cy + 2; ++y) {
+                for (int x = cx - 2; x <= cx + 2; ++x) set(x, y);
+            }
+        }
+
+        mve::FloatImage::Ptr orig = hmap->duplicate();
+        fill_holes(hmap, max_distance);
+
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                float value = hmap->at(x, y, 0);
+                float before = orig->at(x, y, 0);
+                if (y == 0 || y == height - 1 || x == 0 || x == width - 1) {
+                    TEST(value == lowest);
+                    continue;
+                }
+                if (before != lowest) {
+                    TEST(value == before);
+                    continue;
+                }
+
+                int dist = std::numeric_limits<int>::max();
+                for (int ty = 0; ty < height; ++ty) {
+                    for (int tx = 0; tx < width; ++tx) {
+                        if (orig->at(tx, ty, 0) == lowest) continue;
+                        int d = std::max(std::abs(tx - x), std::abs(ty - y));
+                        dist = std::min(dist, d);
+                    }
+                }
+
+                if (dist <= max_distance) {
+                    TEST(value != lowest);
+                    TEST(min - 1e-4f <= value && value <= max + 1e-4f);
+                } else {
+                    TEST(value == lowest);
+                }
+            }
+        }
+    }
+
+    std::cout << "Passed (height map hole filling)" << std::endl;
+}
+
+/* Every point of the cloud has to end up in exactly one node (within its
+ * bounds) and the nodes must not contain two points within a cell of their
+ * subsampling grid (unless they are leaves) - the spacing halves per level. */
+void test_point_octree(void) {
+    std::mt19937 gen(17);
+    std::vector<math::Vec3f> points = create_points(30000, &gen);
+
+    char tmpl[] = "/tmp/geom_test.XXXXXX";
+    TEST(::mkdtemp(tmpl) != nullptr);
+    std::string dir = tmpl;
+    std::string cloud = util::fs::join_path(dir, "cloud.ply");
+    {
+        std::ofstream out(cloud.c_str(), std::ios::binary);
+        out << "ply\nformat binary_little_endian 1.0\n"
+            << "element vertex " << points.size() << "\n"
+            << "property float x\nproperty float y\nproperty float z\n"
+            << "property uchar red\nproperty uchar green\nproperty uchar blue\n"
+            << "end_header\n";
+        for (std::size_t i = 0; i < points.size(); ++i) {
+            out.write(reinterpret_cast<char const *>(points[i].begin()), 12);
+            std::uint8_t color[3] = {std::uint8_t(i), std::uint8_t(i >> 8), 7};
+            out.write(reinterpret_cast<char const *>(color), 3);
+        }
+        TEST(out.good());
+    }
+
+    std::uint32_t const grid_size = 8;
+    build_point_octree(cloud, dir, grid_size, 4000, 500);
+    PointOctree octree = load_point_octree(dir);
+    std::unordered_map<std::uint64_t, std::size_t> index = index_nodes(octree);
+    TEST(index.size() == octree.nodes.size());
+    TEST(octree.nodes[0].level == 0);
+
+    math::Matrix4f identity(0.0f);
+    for (int i = 0; i < 4; ++i) identity(i, i) = 1.0f;
+
+    std::vector<std::pair<math::Vec3f, int> > found;
+    for (std::size_t i = 0; i < octree.nodes.size(); ++i) {
+        PointOctreeNode const & node = octree.nodes[i];
+        TEST(i == 0 || octree.nodes[i - 1].level <= node.level);
+        for (int c = 0; c < 8; ++c) {
+            std::uint64_t id = (std::uint64_t(node.level + 1) << 58)
+                | child_key(node.key, c);
+            TEST(index.count(id) == ((node.child_mask >> c) & 1));
+        }
+        float spacing = node_spacing(octree, node);
+        TEST(equal(spacing, octree.size / grid_size / float(1 << node.level)));
+
+        acc::AABB<math::Vec3f> aabb = node_aabb(octree, node);
+        mve::TriangleMesh::Ptr mesh = load_point_octree_node(octree, node, identity);
+        std::vector<math::Vec3f> const & verts = mesh->get_vertices();
+        std::vector<math::Vec4f> const & colors = mesh->get_vertex_colors();
+        TEST(verts.size() == node.num_points);
+
+        std::vector<std::uint64_t> cells;
+        for (std::size_t j = 0; j < verts.size(); ++j) {
+            std::uint64_t cell = 0;
+            for (int k = 0; k < 3; ++k) {
+                TEST(aabb.min[k] - 1e-3f <= verts[j][k]);
+                TEST(verts[j][k] <= aabb.max[k] + 1e-3f);
+                cell = cell * grid_size + octree_cell(verts[j][k], aabb.min[k],
+                    aabb.max[k] - aabb.min[k], grid_size);
+            }
+            cells.push_back(cell);
+            int id = int(colors[j][0] * 255.0f + 0.5f)
+                | int(colors[j][1] * 255.0f + 0.5f) << 8;
+            found.emplace_back(verts[j], id);
+        }
+        std::sort(cells.begin(), cells.end());
+        bool unique = std::unique(cells.begin(), cells.end()) == cells.end();
+        TEST(unique || node.child_mask == 0);
+    }
+
+    /* Colors encode the lower 16 bits of the point ids. */
+    TEST(found.size() == points.size());
+    std::vector<std::pair<math::Vec3f, int> > expected;
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        expected.emplace_back(points[i], int(i & 0xffff));
+    }
+    auto less = [] (std::pair<math::Vec3f, int> const & a,
+        std::pair<math::Vec3f, int> const & b) {
+        return std::lexicographical_compare(a.first.begin(), a.first.end(),
+            b.first.begin(), b.first.end())
+            || (a.first == b.first && a.second < b.second);
+    };
+    std::sort(found.begin(), found.end(), less);
+    std::sort(expected.begin(), expected.end(), less);
+    for (std::size_t i = 0; i < found.size(); ++i) {
+        TEST(found[i].first == expected[i].first);
+        TEST(found[i].second == expected[i].second);
+    }
+
+    util::fs::unlink(cloud.c_str());
+    util::fs::unlink(util::fs::join_path(dir, GEOM_POINT_OCTREE_INDEX).c_str());
+    util::fs::unlink(util::fs::join_path(dir, GEOM_POINT_OCTREE_POINTS).c_str());
+    TEST(util::fs::rmdir(dir.c_str()));
+
+    std::cout << "Passed (point octree)" << std::endl;
+}
+
+/* Regions of the viewpoint index test - boxes, spheres and prisms over
+ * non-convex (star shaped) polygons, also exceeding the volume. */
+std::vector<QueryRegion>
+create_regions(std::size_t n, std::mt19937 * gen) {
+    std::uniform_real_distribution<float> xy(-10.0f, 110.0f);
+    std::uniform_real_distribution<float> z(-5.0f, 35.0f);
+    std::uniform_real_distribution<float> size(1.0f, 60.0f);
+
+    float const pi = std::acos(-1.0f);
+    std::vector<QueryRegion> regions;
+    for (std::size_t i = 0; i < n; ++i) {
+        math::Vec3f center(xy(*gen), xy(*gen), z(*gen));
+        float extent = size(*gen);
+        switch (i % 3) {
+        case 0:
+            regions.push_back(QueryRegion::box(center - math::Vec3f(extent),
+                center + math::Vec3f(extent / 2.0f)));
+            break;
+        case 1:
+            regions.push_back(QueryRegion::sphere(center, extent));
+            break;
+        default: {
+            std::vector<math::Vec2f> polygon;
+            for (int j = 0; j < 10; ++j) {
+                float radius = (j % 2) ? extent / 3.0f : extent;
+                float angle = 2.0f * pi * j / 10.0f;
+                polygon.emplace_back(center[0] + radius * std::cos(angle),
+                    center[1] + radius * std::sin(angle));
+            }
+            regions.push_back(QueryRegion::prism(polygon,
+                center[2] - extent / 2.0f, center[2] + extent / 2.0f));
+        }
+        }
+    }
+    return regions;
+}
+
+/* Best values of the volume positions within the region sorted descending. */
+std::vector<float>
+brute_force(Volume<std::uint32_t>::ConstPtr volume, QueryRegion const & region) {
+    std::vector<float> values;
+    for (std::uint32_t idx = 0; idx < volume->num_positions(); ++idx) {
+        if (!region.contains(volume->position(idx))) continue;
+        if (volume->has_summary(idx)) {
+            values.push_back(volume->summary(idx)[0].value);
+            continue;
+        }
+        mve::FloatImage::ConstPtr image = volume->at(idx);
+        if (image == nullptr) continue;
+        float value = std::numeric_limits<float>::lowest();
+        for (int i = 0; i < image->get_value_amount(); ++i) {
+            value = std::max(value, image->at(i));
+        }
+        values.push_back(value);
+    }
+    std::sort(values.rbegin(), values.rend());
+    return values;
+}
+
+/* Best k and stats queries of the viewpoint index have to match a brute force
+ * search over the volume - after construction and after incremental updates
+ * of histograms and summary entries. */
+void test_viewpoint_index(void) {
+    std::mt19937 gen(19);
+    std::uniform_real_distribution<float> value(0.0f, 1.0f);
+    std::uniform_int_distribution<int> kind(0, 3);
+
+    Volume<std::uint32_t>::Ptr volume = Volume<std::uint32_t>::create(24, 24, 8,
+        math::Vec3f(0.0f, 0.0f, 0.0f), math::Vec3f(100.0f, 100.0f, 30.0f));
+    volume->resize_summary(2);
+    auto histogram = [&] (void) {
+        mve::FloatImage::Ptr image = mve::FloatImage::create(8, 4, 1);
+        for (int i = 0; i < image->get_value_amount(); ++i) {
+            image->at(i) = value(gen);
+        }
+        return image;
+    };
+    /* Empty positions, histograms and summaries (also with histograms). */
+    for (std::uint32_t idx = 0; idx < volume->num_positions(); ++idx) {
+        int k = kind(gen);
+        if (k == 0) continue;
+        if (k != 2) volume->at(idx) = histogram();
+        if (k != 1) volume->summary(idx)[0].value = value(gen);
+    }
+
+    std::vector<QueryRegion> regions = create_regions(300, &gen);
+    QueryRegion const all = QueryRegion::box(math::Vec3f(-1.0f),
+        math::Vec3f(101.0f));
+    regions.push_back(all);
+
+    ViewpointIndex index(volume, 8.0f);
+    auto check = [&] (void) {
+        std::size_t num_empty = 0;
+        for (QueryRegion const & region : regions) {
+            std::vector<float> gt = brute_force(volume, region);
+            num_empty += gt.empty();
+
+            std::pair<std::size_t, float> stats = index.stats(region);
+            TEST(stats.first == gt.size());
+            TEST(gt.empty() || stats.second == gt[0]);
+
+            for (std::size_t k : {1u, 7u, 1000u}) {
+                std::vector<Viewpoint> best = index.best(region, k);
+                TEST(best.size() == std::min(k, gt.size()));
+                for (std::size_t i = 0; i < best.size(); ++i) {
+                    TEST(best[i].value == gt[i]);
+                    TEST(region.contains(best[i].pos));
+                    TEST(best[i].pos == volume->position(best[i].idx));
+                }
+            }
+        }
+        TEST(num_empty < regions.size() / 2);
+    };
+    check();
+
+    /* Replaced histograms and summary entries. */
+    std::set<std::uint32_t> changed;
+    for (std::uint32_t idx = 0; idx < volume->num_positions(); idx += 7) {
+        if (volume->has_summary(idx)) {
+            volume->summary(idx)[0].value = value(gen);
+        } else if (volume->at(idx) != nullptr) {
+            volume->at(idx) = histogram();
+        } else {
+            continue;
+        }
+        changed.insert(idx);
+    }
+    TEST(index.update(volume) == changed.size());
+    TEST(index.update(volume) == 0);
+    check();
+
+    /* Single histogram updates. */
+    for (std::uint32_t idx = 0; idx < volume->num_positions(); ++idx) {
+        if (volume->has_summary(idx) || volume->at(idx) == nullptr) continue;
+        mve::FloatImage::Ptr image = histogram();
+        image->at(5, 2, 0) = 2.0f;
+        volume->at(idx) = image;
+        index.update(idx, image);
+
+        std::vector<Viewpoint> best = index.best(all, 1);
+        TEST(best.size() == 1 && best[0].idx == idx && best[0].value == 2.0f);
+        image->at(5, 2, 0) = 1.5f;
+        index.update(idx, image);
+        break;
+    }
+    check();
+
+    std::cout << "Passed (viewpoint index)" << std::endl;
+}
+
+int main(void) {
+    test_point_grid_knn();
+    test_point_grid_radius();
+    test_height_map_triangulation();
+    test_height_map_median();
+    test_height_map_fill_holes();
+    test_point_octree();
+    test_viewpoint_index();
+
+    return EXIT_SUCCESS;
+}
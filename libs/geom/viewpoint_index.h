@@ -0,0 +1,776 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef GEOM_VIEWPOINT_INDEX_HEADER
+#define GEOM_VIEWPOINT_INDEX_HEADER
+
+#include <cmath>
+#include <queue>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+
+#include "math/vector.h"
+
+#include "acc/primitives.h"
+
+#include "mve/image.h"
+
+#include "point_grid.h"
+#include "volume.h"
+
+/* Query region - axis aligned box, sphere or vertical prism over a simple
+ * polygon in the xy plane. */
+class QueryRegion {
+public:
+    enum Type {
+        BOX,
+        SPHERE,
+        PRISM
+    };
+
+private:
+    Type type;
+    acc::AABB<math::Vec3f> aabb;
+    math::Vec3f center;
+    float radius;
+    std::vector<math::Vec2f> polygon;
+
+    bool polygon_contains(float x, float y) const;
+    bool polygon_crosses(acc::AABB<math::Vec3f> const & box) const;
+
+public:
+    static QueryRegion box(math::Vec3f const & min, math::Vec3f const & max);
+    static QueryRegion sphere(math::Vec3f const & center, float radius);
+    static QueryRegion prism(std::vector<math::Vec2f> const & polygon,
+        float zmin, float zmax);
+
+    acc::AABB<math::Vec3f> const & bounds(void) const { return aabb; }
+
+    bool contains(math::Vec3f const & point) const;
+
+    /* Conservative - false if the box might only partially be contained. */
+    bool contains(acc::AABB<math::Vec3f> const & box) const;
+
+    /* Conservative - true if the box might intersect the region. */
+    bool intersects(acc::AABB<math::Vec3f> const & box) const;
+};
+
+/* Points bucketed into uniform cells (sorted by Morton code) - regions are
+ * resolved to fully contained cells (aggregates can be used) and boundary
+ * cells (points have to be tested). */
+class CellIndex {
+protected:
+    float cell_size;
+    math::Vec3f min;
+    std::uint32_t dim[3];
+
+    std::vector<math::Vec3f> verts;
+    std::vector<std::uint64_t> cells;
+    /* Points of cell i are ids[offsets[i]] to ids[offsets[i + 1] - 1]. */
+    std::vector<std::size_t> offsets;
+    std::vector<std::uint32_t> ids;
+    std::vector<std::uint32_t> point_cells;
+    std::vector<acc::AABB<math::Vec3f> > cell_aabbs;
+
+    std::uint32_t cell_coord(float v, int axis) const {
+        float c = (v - min[axis]) / cell_size;
+        if (c <= 0.0f) return 0u;
+        return std::min(static_cast<std::uint32_t>(c), dim[axis] - 1u);
+    }
+
+    void build(std::vector<math::Vec3f> const & points, float cell_size);
+
+    /* Calls visitor(cell, inside) for each cell intersecting the region. */
+    template <typename Visitor>
+    void visit_cells(QueryRegion const & region, Visitor const & visitor) const;
+
+public:
+    std::size_t num_points(void) const { return verts.size(); }
+    std::size_t num_cells(void) const { return cells.size(); }
+};
+
+struct ReconstructabilityStats {
+    std::size_t num_vertices = 0;
+    /* Vertices with a reconstructability below the target. */
+    std::size_t num_insufficient = 0;
+    std::size_t num_unobserved = 0;
+    float min_recon = std::numeric_limits<float>::max();
+    float max_recon = std::numeric_limits<float>::lowest();
+    double sum_recon = 0.0;
+    double sum_observations = 0.0;
+
+    float avg_recon(void) const {
+        return num_vertices ? sum_recon / num_vertices : 0.0f;
+    }
+
+    float avg_observations(void) const {
+        return num_vertices ? sum_observations / num_vertices : 0.0f;
+    }
+
+    void add(float recon, float observations, float target) {
+        num_vertices += 1;
+        num_insufficient += recon < target;
+        num_unobserved += observations <= 0.0f;
+        min_recon = std::min(min_recon, recon);
+        max_recon = std::max(max_recon, recon);
+        sum_recon += recon;
+        sum_observations += observations;
+    }
+
+    void add(ReconstructabilityStats const & other) {
+        num_vertices += other.num_vertices;
+        num_insufficient += other.num_insufficient;
+        num_unobserved += other.num_unobserved;
+        min_recon = std::min(min_recon, other.min_recon);
+        max_recon = std::max(max_recon, other.max_recon);
+        sum_recon += other.sum_recon;
+        sum_observations += other.sum_observations;
+    }
+};
+
+/* Per vertex reconstructability and observation counts of the proxy cloud. */
+class ReconstructabilityIndex : public CellIndex {
+public:
+    typedef std::shared_ptr<ReconstructabilityIndex> Ptr;
+
+private:
+    float target;
+    std::vector<float> recons;
+    std::vector<float> observations;
+    std::vector<ReconstructabilityStats> cell_stats;
+
+    void update_cell(std::size_t cell);
+
+public:
+    /* Empty observations are treated as unknown (one observation). */
+    ReconstructabilityIndex(std::vector<math::Vec3f> const & verts,
+        std::vector<float> const & recons, std::vector<float> const & observations,
+        float target, float cell_size = 0.0f);
+
+    static Ptr create(std::vector<math::Vec3f> const & verts,
+        std::vector<float> const & recons, std::vector<float> const & observations,
+        float target, float cell_size = 0.0f)
+    {
+        return std::make_shared<ReconstructabilityIndex>(verts, recons,
+            observations, target, cell_size);
+    }
+
+    /* Updates the changed vertices only, returns their number. */
+    std::size_t update(std::vector<float> const & recons,
+        std::vector<float> const & observations);
+
+    void update(std::uint32_t id, float recon, float observations);
+
+    ReconstructabilityStats stats(QueryRegion const & region) const;
+
+    /* Ids of the k least reconstructable vertices within the region. */
+    std::vector<std::uint32_t> worst(QueryRegion const & region, std::size_t k) const;
+
+    float reconstructability(std::uint32_t id) const { return recons[id]; }
+};
+
+struct Viewpoint {
+    math::Vec3f pos;
+    /* Best (highest) value of the guidance volume and its direction. */
+    float value;
+    float theta;
+    float phi;
+    std::uint32_t idx;
+};
+
+/* Best values and directions of the guidance volume positions. */
+class ViewpointIndex : public CellIndex {
+public:
+    typedef std::shared_ptr<ViewpointIndex> Ptr;
+
+private:
+    /* Point id of each volume position (or -1). */
+    std::vector<std::uint32_t> point_ids;
+    std::vector<Viewpoint> viewpoints;
+    std::vector<float> cell_best;
+
+    void update_cell(std::size_t cell);
+
+public:
+    ViewpointIndex(Volume<std::uint32_t>::ConstPtr volume, float cell_size = 0.0f);
+
+    static Ptr create(Volume<std::uint32_t>::ConstPtr volume, float cell_size = 0.0f) {
+        return std::make_shared<ViewpointIndex>(volume, cell_size);
+    }
+
+    /* Summarizes a direction histogram by its highest value (see
+     * summarize_directions). */
+    static Viewpoint summarize(mve::FloatImage::ConstPtr image);
+
+    /* Summarizes a position by its summary layer entry or its histogram,
+     * returns false if it has neither. */
+    static bool summarize(Volume<std::uint32_t>::ConstPtr volume,
+        std::uint32_t idx, Viewpoint * viewpoint);
+
+    /* Updates the changed positions only, returns their number. */
+    std::size_t update(Volume<std::uint32_t>::ConstPtr volume);
+
+    void update(std::uint32_t idx, mve::FloatImage::ConstPtr image);
+
+    /* The k best viewpoints within the region sorted by descending value. */
+    std::vector<Viewpoint> best(QueryRegion const & region, std::size_t k) const;
+
+    /* Number of viewpoints and best value within the region. */
+    std::pair<std::size_t, float> stats(QueryRegion const & region) const;
+};
+
+inline QueryRegion
+QueryRegion::box(math::Vec3f const & min, math::Vec3f const & max) {
+    QueryRegion region;
+    region.type = BOX;
+    region.aabb.min = min;
+    region.aabb.max = max;
+    return region;
+}
+
+inline QueryRegion
+QueryRegion::sphere(math::Vec3f const & center, float radius) {
+    QueryRegion region;
+    region.type = SPHERE;
+    region.center = center;
+    region.radius = radius;
+    region.aabb.min = center - math::Vec3f(radius);
+    region.aabb.max = center + math::Vec3f(radius);
+    return region;
+}
+
+inline QueryRegion
+QueryRegion::prism(std::vector<math::Vec2f> const & polygon, float zmin, float zmax) {
+    QueryRegion region;
+    region.type = PRISM;
+    region.polygon = polygon;
+    region.aabb.min = math::Vec3f(std::numeric_limits<float>::max());
+    region.aabb.max = math::Vec3f(std::numeric_limits<float>::lowest());
+    for (math::Vec2f const & v : polygon) {
+        for (int i = 0; i < 2; ++i) {
+            region.aabb.min[i] = std::min(region.aabb.min[i], v[i]);
+            region.aabb.max[i] = std::max(region.aabb.max[i], v[i]);
+        }
+    }
+    region.aabb.min[2] = zmin;
+    region.aabb.max[2] = zmax;
+    return region;
+}
+
+inline bool
+QueryRegion::polygon_contains(float x, float y) const {
+    bool inside = false;
+    for (std::size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+        math::Vec2f const & a = polygon[i];
+        math::Vec2f const & b = polygon[j];
+        if ((a[1] > y) == (b[1] > y)) continue;
+        if (x < (b[0] - a[0]) * (y - a[1]) / (b[1] - a[1]) + a[0]) inside = !inside;
+    }
+    return inside;
+}
+
+/* Whether a polygon edge intersects the xy rectangle of the box. */
+inline bool
+QueryRegion::polygon_crosses(acc::AABB<math::Vec3f> const & box) const {
+    for (std::size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+        math::Vec2f const & a = polygon[j];
+        math::Vec2f d = polygon[i] - a;
+
+        /* Clip the edge against the rectangle (Liang-Barsky). */
+        float t0 = 0.0f, t1 = 1.0f;
+        bool outside = false;
+        for (int k = 0; k < 2 && !outside; ++k) {
+            if (d[k] == 0.0f) {
+                outside = a[k] < box.min[k] || a[k] > box.max[k];
+                continue;
+            }
+            float ta = (box.min[k] - a[k]) / d[k];
+            float tb = (box.max[k] - a[k]) / d[k];
+            t0 = std::max(t0, std::min(ta, tb));
+            t1 = std::min(t1, std::max(ta, tb));
+            outside = t0 > t1;
+        }
+        if (!outside) return true;
+    }
+    return false;
+}
+
+inline bool
+QueryRegion::contains(math::Vec3f const & point) const {
+    switch (type) {
+    case SPHERE:
+        return (point - center).square_norm() <= radius * radius;
+    case PRISM:
+        if (point[2] < aabb.min[2] || aabb.max[2] < point[2]) return false;
+        return polygon_contains(point[0], point[1]);
+    default:
+        for (int i = 0; i < 3; ++i) {
+            if (point[i] < aabb.min[i] || aabb.max[i] < point[i]) return false;
+        }
+        return true;
+    }
+}
+
+inline bool
+QueryRegion::contains(acc::AABB<math::Vec3f> const & box) const {
+    for (int i = 0; i < 3; ++i) {
+        if (box.min[i] < aabb.min[i] || aabb.max[i] < box.max[i]) return false;
+    }
+
+    switch (type) {
+    case SPHERE:
+        for (int i = 0; i < 8; ++i) {
+            math::Vec3f corner(
+                (i & 1) ? box.max[0] : box.min[0],
+                (i & 2) ? box.max[1] : box.min[1],
+                (i & 4) ? box.max[2] : box.min[2]);
+            if (!contains(corner)) return false;
+        }
+        return true;
+    case PRISM:
+        for (int i = 0; i < 4; ++i) {
+            float x = (i & 1) ? box.max[0] : box.min[0];
+            float y = (i & 2) ? box.max[1] : box.min[1];
+            if (!polygon_contains(x, y)) return false;
+        }
+        return !polygon_crosses(box);
+    default:
+        return true;
+    }
+}
+
+inline bool
+QueryRegion::intersects(acc::AABB<math::Vec3f> const & box) const {
+    for (int i = 0; i < 3; ++i) {
+        if (box.max[i] < aabb.min[i] || aabb.max[i] < box.min[i]) return false;
+    }
+
+    switch (type) {
+    case SPHERE: {
+        float sq_dist = 0.0f;
+        for (int i = 0; i < 3; ++i) {
+            float d = std::max(std::max(box.min[i] - center[i], 0.0f),
+                center[i] - box.max[i]);
+            sq_dist += d * d;
+        }
+        return sq_dist <= radius * radius;
+    }
+    case PRISM: {
+        if (polygon_contains(box.min[0], box.min[1])) return true;
+        if (polygon_crosses(box)) return true;
+        /* Polygon entirely within the rectangle. */
+        math::Vec2f const & v = polygon[0];
+        return box.min[0] <= v[0] && v[0] <= box.max[0]
+            && box.min[1] <= v[1] && v[1] <= box.max[1];
+    }
+    default:
+        return true;
+    }
+}
+
+inline void
+CellIndex::build(std::vector<math::Vec3f> const & points, float cell_size) {
+    std::size_t const n = points.size();
+    verts = points;
+
+    math::Vec3f max;
+    min = math::Vec3f(std::numeric_limits<float>::max());
+    max = math::Vec3f(std::numeric_limits<float>::lowest());
+    for (math::Vec3f const & p : points) {
+        for (int j = 0; j < 3; ++j) {
+            min[j] = std::min(min[j], p[j]);
+            max[j] = std::max(max[j], p[j]);
+        }
+    }
+    if (n == 0) min = max = math::Vec3f(0.0f);
+
+    /* Coarser than the grid for nearest neighbor queries - aggregates
+     * of fully contained cells replace the points. */
+    if (cell_size <= 0.0f) {
+        cell_size = PointGrid<>::estimate_cell_size(min, max, n, 256.0f);
+    }
+    for (int i = 0; i < 3; ++i) {
+        cell_size = std::max(cell_size, (max[i] - min[i]) / ((1u << 21) - 1u));
+    }
+    this->cell_size = cell_size;
+    for (int i = 0; i < 3; ++i) {
+        dim[i] = static_cast<std::uint32_t>((max[i] - min[i]) / cell_size) + 1u;
+    }
+
+    std::vector<std::pair<std::uint64_t, std::uint32_t> > codes(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        math::Vec3f const & p = points[i];
+        std::uint64_t code = morton_code(cell_coord(p[0], 0),
+            cell_coord(p[1], 1), cell_coord(p[2], 2));
+        codes[i] = std::make_pair(code, static_cast<std::uint32_t>(i));
+    }
+    std::sort(codes.begin(), codes.end());
+
+    cells.clear();
+    offsets.clear();
+    cell_aabbs.clear();
+    ids.resize(n);
+    point_cells.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        if (i == 0 || codes[i].first != codes[i - 1].first) {
+            cells.push_back(codes[i].first);
+            offsets.push_back(i);
+
+            math::Vec3f const & p = points[codes[i].second];
+            acc::AABB<math::Vec3f> aabb;
+            for (int j = 0; j < 3; ++j) {
+                aabb.min[j] = min[j] + cell_coord(p[j], j) * cell_size;
+                aabb.max[j] = aabb.min[j] + cell_size;
+            }
+            cell_aabbs.push_back(aabb);
+        }
+        ids[i] = codes[i].second;
+        point_cells[codes[i].second] = cells.size() - 1;
+    }
+    offsets.push_back(n);
+}
+
+template <typename Visitor>
+void
+CellIndex::visit_cells(QueryRegion const & region, Visitor const & visitor) const {
+    acc::AABB<math::Vec3f> const & bounds = region.bounds();
+    std::uint32_t lo[3], hi[3];
+    std::uint64_t num_candidates = 1;
+    for (int i = 0; i < 3; ++i) {
+        if (bounds.max[i] < min[i] || min[i] + dim[i] * cell_size < bounds.min[i]) return;
+        lo[i] = cell_coord(bounds.min[i], i);
+        hi[i] = cell_coord(bounds.max[i], i);
+        num_candidates *= hi[i] - lo[i] + 1;
+    }
+
+    auto visit = [&] (std::size_t cell) {
+        acc::AABB<math::Vec3f> const & aabb = cell_aabbs[cell];
+        if (!region.intersects(aabb)) return;
+        visitor(cell, region.contains(aabb));
+    };
+
+    /* Enumerate the cell range or scan the occupied cells if fewer. */
+    if (num_candidates > cells.size()) {
+        for (std::size_t cell = 0; cell < cells.size(); ++cell) visit(cell);
+        return;
+    }
+
+    for (std::uint32_t z = lo[2]; z <= hi[2]; ++z) {
+        for (std::uint32_t y = lo[1]; y <= hi[1]; ++y) {
+            for (std::uint32_t x = lo[0]; x <= hi[0]; ++x) {
+                std::uint64_t code = morton_code(x, y, z);
+                auto it = std::lower_bound(cells.begin(), cells.end(), code);
+                if (it == cells.end() || *it != code) continue;
+                visit(std::distance(cells.begin(), it));
+            }
+        }
+    }
+}
+
+inline
+ReconstructabilityIndex::ReconstructabilityIndex(
+    std::vector<math::Vec3f> const & verts, std::vector<float> const & recons,
+    std::vector<float> const & observations, float target, float cell_size)
+    : target(target), recons(recons), observations(observations)
+{
+    if (this->observations.empty()) this->observations.resize(verts.size(), 1.0f);
+    if (this->recons.size() != verts.size() || this->observations.size() != verts.size()) {
+        throw std::invalid_argument("Number of values does not match");
+    }
+
+    build(verts, cell_size);
+
+    cell_stats.resize(cells.size());
+    for (std::size_t cell = 0; cell < cells.size(); ++cell) update_cell(cell);
+}
+
+inline void
+ReconstructabilityIndex::update_cell(std::size_t cell) {
+    ReconstructabilityStats stats;
+    for (std::size_t i = offsets[cell]; i < offsets[cell + 1]; ++i) {
+        std::uint32_t id = ids[i];
+        stats.add(recons[id], observations[id], target);
+    }
+    cell_stats[cell] = stats;
+}
+
+inline void
+ReconstructabilityIndex::update(std::uint32_t id, float recon, float obs) {
+    recons[id] = recon;
+    observations[id] = obs;
+    update_cell(point_cells[id]);
+}
+
+inline std::size_t
+ReconstructabilityIndex::update(std::vector<float> const & nrecons,
+    std::vector<float> const & nobservations)
+{
+    if (nrecons.size() != recons.size()
+        || (!nobservations.empty() && nobservations.size() != recons.size())) {
+        throw std::invalid_argument("Number of values does not match");
+    }
+
+    std::vector<bool> dirty(cells.size(), false);
+    std::size_t num_changed = 0;
+    for (std::size_t id = 0; id < recons.size(); ++id) {
+        float obs = nobservations.empty() ? observations[id] : nobservations[id];
+        if (nrecons[id] == recons[id] && obs == observations[id]) continue;
+        recons[id] = nrecons[id];
+        observations[id] = obs;
+        dirty[point_cells[id]] = true;
+        num_changed += 1;
+    }
+
+    for (std::size_t cell = 0; cell < cells.size(); ++cell) {
+        if (dirty[cell]) update_cell(cell);
+    }
+
+    return num_changed;
+}
+
+inline ReconstructabilityStats
+ReconstructabilityIndex::stats(QueryRegion const & region) const {
+    ReconstructabilityStats ret;
+    visit_cells(region, [&] (std::size_t cell, bool inside) {
+        if (inside) {
+            ret.add(cell_stats[cell]);
+            return;
+        }
+        for (std::size_t i = offsets[cell]; i < offsets[cell + 1]; ++i) {
+            std::uint32_t id = ids[i];
+            if (!region.contains(verts[id])) continue;
+            ret.add(recons[id], observations[id], target);
+        }
+    });
+    return ret;
+}
+
+inline std::vector<std::uint32_t>
+ReconstructabilityIndex::worst(QueryRegion const & region, std::size_t k) const {
+    if (k == 0) return std::vector<std::uint32_t>();
+
+    /* Visit cells in order of their minimum - stop once no cell can improve
+     * on the k-th worst vertex. */
+    std::vector<std::pair<float, std::pair<std::size_t, bool> > > candidates;
+    visit_cells(region, [&] (std::size_t cell, bool inside) {
+        candidates.emplace_back(cell_stats[cell].min_recon, std::make_pair(cell, inside));
+    });
+    std::sort(candidates.begin(), candidates.end());
+
+    typedef std::pair<float, std::uint32_t> Entry;
+    std::priority_queue<Entry> heap;
+    for (auto const & candidate : candidates) {
+        if (heap.size() == k && candidate.first > heap.top().first) break;
+
+        std::size_t cell = candidate.second.first;
+        bool inside = candidate.second.second;
+        for (std::size_t i = offsets[cell]; i < offsets[cell + 1]; ++i) {
+            std::uint32_t id = ids[i];
+            if (!inside && !region.contains(verts[id])) continue;
+            Entry entry(recons[id], id);
+            if (heap.size() < k) {
+                heap.push(entry);
+            } else if (entry < heap.top()) {
+                heap.pop();
+                heap.push(entry);
+            }
+        }
+    }
+
+    std::vector<std::uint32_t> ret(heap.size());
+    for (std::size_t i = ret.size(); i > 0; --i) {
+        ret[i - 1] = heap.top().second;
+        heap.pop();
+    }
+    return ret;
+}
+
+inline Viewpoint
+ViewpointIndex::summarize(mve::FloatImage::ConstPtr image) {
+    Viewpoint viewpoint;
+    viewpoint.value = std::numeric_limits<float>::lowest();
+    viewpoint.theta = 0.0f;
+    viewpoint.phi = 0.0f;
+
+    float const pi = std::acos(-1.0f);
+    int const width = image->width();
+    int const height = image->height();
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float v = image->at(x, y, 0);
+            if (v > viewpoint.value) {
+                viewpoint.value = v;
+                viewpoint.theta = (0.5f + (y / (float) height) / 2.0f) * pi;
+                viewpoint.phi = (x / (float) width) * 2.0f * pi;
+            }
+        }
+    }
+    return viewpoint;
+}
+
+inline bool
+ViewpointIndex::summarize(Volume<std::uint32_t>::ConstPtr volume,
+    std::uint32_t idx, Viewpoint * viewpoint)
+{
+    if (volume->has_summary(idx)) {
+        VolumeDirection const & best = volume->summary(idx)[0];
+        viewpoint->value = best.value;
+        viewpoint->theta = best.theta;
+        viewpoint->phi = best.phi;
+        return true;
+    }
+
+    mve::FloatImage::ConstPtr image = volume->at(idx);
+    if (image == nullptr) return false;
+
+    *viewpoint = summarize(image);
+    return true;
+}
+
+inline
+ViewpointIndex::ViewpointIndex(Volume<std::uint32_t>::ConstPtr volume, float cell_size) {
+    std::vector<math::Vec3f> points;
+    point_ids.resize(volume->num_positions(), std::uint32_t(-1));
+    for (std::uint32_t idx = 0; idx < volume->num_positions(); ++idx) {
+        Viewpoint viewpoint;
+        if (!summarize(volume, idx, &viewpoint)) continue;
+
+        viewpoint.pos = volume->position(idx);
+        viewpoint.idx = idx;
+
+        point_ids[idx] = points.size();
+        points.push_back(viewpoint.pos);
+        viewpoints.push_back(viewpoint);
+    }
+
+    build(points, cell_size);
+
+    cell_best.resize(cells.size());
+    for (std::size_t cell = 0; cell < cells.size(); ++cell) update_cell(cell);
+}
+
+inline void
+ViewpointIndex::update_cell(std::size_t cell) {
+    float best = std::numeric_limits<float>::lowest();
+    for (std::size_t i = offsets[cell]; i < offsets[cell + 1]; ++i) {
+        best = std::max(best, viewpoints[ids[i]].value);
+    }
+    cell_best[cell] = best;
+}
+
+inline void
+ViewpointIndex::update(std::uint32_t idx, mve::FloatImage::ConstPtr image) {
+    std::uint32_t id = point_ids.at(idx);
+    if (id == std::uint32_t(-1)) {
+        throw std::invalid_argument("Position without histogram");
+    }
+
+    Viewpoint & viewpoint = viewpoints[id];
+    Viewpoint summary = summarize(image);
+    viewpoint.value = summary.value;
+    viewpoint.theta = summary.theta;
+    viewpoint.phi = summary.phi;
+    update_cell(point_cells[id]);
+}
+
+inline std::size_t
+ViewpointIndex::update(Volume<std::uint32_t>::ConstPtr volume) {
+    if (volume->num_positions() != point_ids.size()) {
+        throw std::invalid_argument("Volume dimensions do not match");
+    }
+
+    std::vector<bool> dirty(cells.size(), false);
+    std::size_t num_changed = 0;
+    for (std::uint32_t idx = 0; idx < volume->num_positions(); ++idx) {
+        std::uint32_t id = point_ids[idx];
+        Viewpoint summary;
+        if (id == std::uint32_t(-1) || !summarize(volume, idx, &summary)) continue;
+
+        Viewpoint & viewpoint = viewpoints[id];
+        if (summary.value == viewpoint.value && summary.theta == viewpoint.theta
+            && summary.phi == viewpoint.phi) continue;
+
+        viewpoint.value = summary.value;
+        viewpoint.theta = summary.theta;
+        viewpoint.phi = summary.phi;
+        dirty[point_cells[id]] = true;
+        num_changed += 1;
+    }
+
+    for (std::size_t cell = 0; cell < cells.size(); ++cell) {
+        if (dirty[cell]) update_cell(cell);
+    }
+
+    return num_changed;
+}
+
+inline std::vector<Viewpoint>
+ViewpointIndex::best(QueryRegion const & region, std::size_t k) const {
+    if (k == 0) return std::vector<Viewpoint>();
+
+    std::vector<std::pair<float, std::pair<std::size_t, bool> > > candidates;
+    visit_cells(region, [&] (std::size_t cell, bool inside) {
+        candidates.emplace_back(cell_best[cell], std::make_pair(cell, inside));
+    });
+    std::sort(candidates.rbegin(), candidates.rend());
+
+    typedef std::pair<float, std::uint32_t> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > heap;
+    for (auto const & candidate : candidates) {
+        if (heap.size() == k && candidate.first < heap.top().first) break;
+
+        std::size_t cell = candidate.second.first;
+        bool inside = candidate.second.second;
+        for (std::size_t i = offsets[cell]; i < offsets[cell + 1]; ++i) {
+            std::uint32_t id = ids[i];
+            if (!inside && !region.contains(verts[id])) continue;
+            Entry entry(viewpoints[id].value, id);
+            if (heap.size() < k) {
+                heap.push(entry);
+            } else if (heap.top() < entry) {
+                heap.pop();
+                heap.push(entry);
+            }
+        }
+    }
+
+    std::vector<Viewpoint> ret(heap.size());
+    for (std::size_t i = ret.size(); i > 0; --i) {
+        ret[i - 1] = viewpoints[heap.top().second];
+        heap.pop();
+    }
+    return ret;
+}
+
+inline std::pair<std::size_t, float>
+ViewpointIndex::stats(QueryRegion const & region) const {
+    std::size_t count = 0;
+    float best = std::numeric_limits<float>::lowest();
+    visit_cells(region, [&] (std::size_t cell, bool inside) {
+        if (inside) {
+            count += offsets[cell + 1] - offsets[cell];
+            best = std::max(best, cell_best[cell]);
+            return;
+        }
+        for (std::size_t i = offsets[cell]; i < offsets[cell + 1]; ++i) {
+            std::uint32_t id = ids[i];
+            if (!region.contains(verts[id])) continue;
+            count += 1;
+            best = std::max(best, viewpoints[id].value);
+        }
+    });
+    return std::make_pair(count, best);
+}
+
+#endif /* GEOM_VIEWPOINT_INDEX_HEADER */
@@ -9,10 +9,23 @@
 #ifndef GEOM_VOLUME_HEADER
 #define GEOM_VOLUME_HEADER
 
+#include <map>
+#include <limits>
+#include <string>
+#include <vector>
+
 #include "math/vector.h"
 
 #include "mve/image.h"
 
+/* Entry of the summary layer - a direction of the histogram (see
+ * summarize_directions) and its value, unused entries have an infinite value. */
+struct VolumeDirection {
+    float value;
+    float theta;
+    float phi;
+};
+
 template <typename IdxType>
 class Volume {
 public:
@@ -25,11 +38,16 @@ private:
     math::Vec3f min;
     math::Vec3f max;
     std::vector<mve::FloatImage::Ptr> values;
+    /* Key value pairs describing the values (keys without whitespace). */
+    std::map<std::string, std::string> meta;
+    /* Optional summary layer - the k best directions of each position. */
+    std::size_t k;
+    std::vector<VolumeDirection> summaries;
 
 public:
     Volume(IdxType width, IdxType height, IdxType depth,
         math::Vec3f min, math::Vec3f max)
-        : dim(width, height, depth), min(min), max(max) {
+        : dim(width, height, depth), min(min), max(max), k(0) {
         //static_assert(std::is_integral<IdxType>::value, "IdxType must be an integer type.");
         //static_assert(std::is_unsigned<IdxType>::value, "IdxType must be an unsigned type.");
         resolution = (max - min).cw_div(math::Vec3f(width, height, depth));
@@ -48,6 +66,9 @@ public:
     IdxType depth(void) const { return dim[2]; }
     math::Vector<IdxType, 3> dimension() const { return dim; }
 
+    std::map<std::string, std::string> & metadata(void) { return meta; }
+    std::map<std::string, std::string> const & metadata(void) const { return meta; }
+
     math::Vec3f position(math::Vector<IdxType, 3> pos) const {
         return min + resolution.cw_mult(math::Vec3f(pos));
     }
@@ -94,6 +115,30 @@ public:
     mve::FloatImage::Ptr & at(IdxType x, IdxType y, IdxType z) {
         return values[index(x, y, z)];
     }
+
+    /* Number of directions per position of the summary layer (0 if none). */
+    std::size_t summary_size(void) const { return k; }
+
+    /* Resizes the summary layer and clears all entries. */
+    void resize_summary(std::size_t size) {
+        VolumeDirection empty = {std::numeric_limits<float>::infinity(), 0.0f, 0.0f};
+        k = size;
+        summaries.assign(k * num_positions(), empty);
+    }
+
+    /* The summary_size() directions of the position sorted by descending value. */
+    VolumeDirection * summary(IdxType idx) {
+        return summaries.data() + idx * k;
+    }
+
+    VolumeDirection const * summary(IdxType idx) const {
+        return summaries.data() + idx * k;
+    }
+
+    bool has_summary(IdxType idx) const {
+        return k != 0 && summaries[idx * k].value
+            != std::numeric_limits<float>::infinity();
+    }
 };
 
 #endif /* GEOM_VOLUME_HEADER */
@@ -9,6 +9,7 @@
 #ifndef GEOM_VOLUME_IO_HEADER
 #define GEOM_VOLUME_IO_HEADER
 
+#include <vector>
 #include <cstring>
 #include <fstream>
 
@@ -17,10 +18,14 @@
 #include "volume.h"
 
 #define GEOM_VOLUME_FILE_HEADER "VOL"
-#define GEOM_VOLUME_FILE_VERSION "0.1"
+#define GEOM_VOLUME_FILE_VERSION "0.3"
 
+/* The summary layer is stored sparsely (positions with a summary) in front
+ * of the histograms - with histograms = false only the summary is saved. */
 template <typename IdxType>
-void save_volume(typename Volume<IdxType>::ConstPtr volume, std::string const & filename) {
+void save_volume(typename Volume<IdxType>::ConstPtr volume, std::string const & filename,
+    bool histograms = true)
+{
     std::ofstream out(filename.c_str(), std::ios::binary);
     if (!out.good()) {
         throw util::FileException(filename, std::strerror(errno));
@@ -31,9 +36,26 @@ void save_volume(typename Volume<IdxType>::ConstPtr volume, std::string const &
     out << volume->width() << " "
         << volume->height() << " "
         << volume->depth() << " " << std::endl;
-    out << volume->minimum() << " " << volume->maximum();
+    out << volume->minimum() << " " << volume->maximum() << std::endl;
+    out << volume->metadata().size();
+    for (auto const & entry : volume->metadata()) {
+        out << std::endl << entry.first << " " << entry.second;
+    }
 
+    std::vector<IdxType> summarized;
     for (IdxType i = 0; i < volume->num_positions(); ++i) {
+        if (volume->has_summary(i)) summarized.push_back(i);
+    }
+    std::size_t const k = volume->summary_size();
+    out << std::endl << k << " " << summarized.size() << std::endl;
+    out.write(reinterpret_cast<char const *>(summarized.data()),
+        summarized.size() * sizeof(IdxType));
+    for (IdxType i : summarized) {
+        out.write(reinterpret_cast<char const *>(volume->summary(i)),
+            k * sizeof(VolumeDirection));
+    }
+
+    for (IdxType i = 0; histograms && i < volume->num_positions(); ++i) {
         mve::FloatImage::ConstPtr image = volume->at(i);
         if (image == nullptr) continue;
         out << std::endl << i << " "
@@ -45,8 +67,12 @@ void save_volume(typename Volume<IdxType>::ConstPtr volume, std::string const &
     out.close();
 }
 
+/* With summary_only the histograms of volumes with a summary layer are
+ * not loaded (volumes without summary are loaded completely). */
 template <typename IdxType>
-typename Volume<IdxType>::Ptr load_volume(const std::string & filename) {
+typename Volume<IdxType>::Ptr load_volume(const std::string & filename,
+    bool summary_only = false)
+{
     std::ifstream in(filename.c_str(), std::ios::binary);
     if (!in.good()) {
         throw util::FileException(filename, std::strerror(errno));
@@ -64,7 +90,11 @@ typename Volume<IdxType>::Ptr load_volume(const std::string & filename) {
     std::string version;
     in >> version;
 
-    if (version != GEOM_VOLUME_FILE_VERSION) {
+    /* Version 0.1 files do not contain metadata, version 0.2 files
+     * no summary layer. */
+    bool has_summary = version == GEOM_VOLUME_FILE_VERSION;
+    bool has_metadata = has_summary || version == "0.2";
+    if (!has_metadata && version != "0.1") {
         in.close();
         throw util::FileException(filename, "Incompatible version of Volume file");
     }
@@ -90,6 +120,56 @@ typename Volume<IdxType>::Ptr load_volume(const std::string & filename) {
     typename Volume<IdxType>::Ptr volume;
     volume = Volume<IdxType>::create(width, height, depth, min, max);
 
+    std::size_t num_entries = 0;
+    if (has_metadata) {
+        if (!(in >> num_entries)) {
+            in.close();
+            throw util::FileException(filename, "Corrupt Volume file header");
+        }
+        std::getline(in, buffer);
+    }
+    for (std::size_t i = 0; i < num_entries; ++i) {
+        std::string key, value;
+        in >> key;
+        std::getline(in, value);
+        if (in.fail() || value.empty()) {
+            in.close();
+            throw util::FileException(filename, "Corrupt Volume file metadata");
+        }
+        volume->metadata()[key] = value.substr(1);
+    }
+
+    if (has_summary) {
+        std::size_t k = 0, num_summarized = 0;
+        if (!(in >> k >> num_summarized) || num_summarized > volume->num_positions()) {
+            in.close();
+            throw util::FileException(filename, "Corrupt Volume file summary");
+        }
+        std::getline(in, buffer);
+
+        std::vector<IdxType> summarized(num_summarized);
+        in.read(reinterpret_cast<char *>(summarized.data()),
+            num_summarized * sizeof(IdxType));
+        volume->resize_summary(k);
+        for (std::size_t i = 0; i < num_summarized && in.good(); ++i) {
+            if (summarized[i] >= volume->num_positions()) {
+                in.setstate(std::ios::failbit);
+                break;
+            }
+            in.read(reinterpret_cast<char *>(volume->summary(summarized[i])),
+                k * sizeof(VolumeDirection));
+        }
+        if (!in.good()) {
+            in.close();
+            throw util::FileException(filename, "Corrupt Volume file summary");
+        }
+
+        if (summary_only && k != 0) {
+            in.close();
+            return volume;
+        }
+    }
+
     IdxType idx = IdxType(-1);
     int iwidth = 0, iheight = 0, ichannels = 0;
     while(in >> idx >> iwidth >> iheight >> ichannels) {
@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef SIM_POINTOCTREERENDERER_HEADER
+#define SIM_POINTOCTREERENDERER_HEADER
+
+#include <array>
+#include <deque>
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <iostream>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "math/matrix_tools.h"
+
+#include "ogl/camera.h"
+#include "ogl/mesh_renderer.h"
+
+#include "geom/point_octree.h"
+
+#include "shader.h"
+
+/* Streams the nodes of a point octree (see geom/point_octree.h) by their
+ * screen space error. Nodes are loaded and transformed by a background
+ * thread, uploaded on update and evicted least recently used once the
+ * memory budget is exceeded. */
+class PointOctreeRenderer {
+public:
+    typedef std::shared_ptr<PointOctreeRenderer> Ptr;
+    typedef std::function<void(mve::TriangleMesh::Ptr)> NodeCallback;
+
+private:
+    struct Entry {
+        ogl::MeshRenderer::Ptr mr;
+        std::size_t bytes;
+        std::uint64_t last_used;
+    };
+
+    PointOctree octree;
+    std::vector<std::array<std::int64_t, 8> > children;
+    std::vector<acc::AABB<math::Vec3f> > aabbs;
+    math::Matrix4f T;
+    float scale;
+
+    Shader::Ptr shader;
+    std::size_t memory_budget;
+    std::size_t point_budget;
+    float min_spacing;
+
+    std::unordered_map<std::size_t, Entry> cache;
+    std::size_t cache_bytes = 0;
+    std::uint64_t frame = 0;
+    std::vector<std::size_t> visible;
+
+    NodeCallback callback;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::size_t> requests;
+    std::vector<std::size_t> loading;
+    std::vector<std::pair<std::size_t, mve::TriangleMesh::Ptr> > ready;
+    bool stop = false;
+    std::thread loader;
+
+    void load_nodes(void) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this] { return stop || !requests.empty(); });
+            if (stop) return;
+
+            std::size_t idx = requests.front();
+            requests.pop_front();
+            loading.push_back(idx);
+            NodeCallback node_callback = callback;
+            lock.unlock();
+
+            mve::TriangleMesh::Ptr mesh;
+            try {
+                mesh = load_point_octree_node(octree, octree.nodes[idx], T);
+                if (node_callback) node_callback(mesh);
+            } catch (std::exception & e) {
+                std::cerr << "Could not load octree node: " << e.what() << std::endl;
+            }
+
+            lock.lock();
+            loading.erase(std::find(loading.begin(), loading.end(), idx));
+            ready.emplace_back(idx, mesh);
+        }
+    }
+
+    bool in_frustum(math::Matrix4f const & vp, acc::AABB<math::Vec3f> const & aabb) {
+        int outside[6] = {0, 0, 0, 0, 0, 0};
+        for (int i = 0; i < 8; ++i) {
+            math::Vec4f corner(
+                (i & 1) ? aabb.max[0] : aabb.min[0],
+                (i & 2) ? aabb.max[1] : aabb.min[1],
+                (i & 4) ? aabb.max[2] : aabb.min[2], 1.0f);
+            math::Vec4f c = vp * corner;
+            for (int j = 0; j < 3; ++j) {
+                outside[2 * j + 0] += c[j] < -c[3];
+                outside[2 * j + 1] += c[j] > c[3];
+            }
+        }
+        return std::none_of(outside, outside + 6, [] (int n) { return n == 8; });
+    }
+
+public:
+    /* T is applied to the points of each node on load. */
+    PointOctreeRenderer(std::string const & path, Shader::Ptr shader,
+        math::Matrix4f const & T, std::size_t memory_budget = 1ull << 30,
+        std::size_t point_budget = 10000000, float min_spacing = 1.0f)
+        : octree(load_point_octree(path)), T(T), shader(shader),
+        memory_budget(memory_budget), point_budget(point_budget),
+        min_spacing(min_spacing)
+    {
+        std::unordered_map<std::uint64_t, std::size_t> index = index_nodes(octree);
+        children.resize(octree.nodes.size());
+        aabbs.resize(octree.nodes.size());
+        for (std::size_t i = 0; i < octree.nodes.size(); ++i) {
+            PointOctreeNode const & node = octree.nodes[i];
+            for (int j = 0; j < 8; ++j) {
+                std::uint64_t id = (std::uint64_t(node.level + 1) << 58)
+                    | child_key(node.key, j);
+                auto it = index.find(id);
+                children[i][j] = (node.child_mask & (1 << j)) && it != index.end()
+                    ? std::int64_t(it->second) : -1;
+            }
+
+            acc::AABB<math::Vec3f> aabb = node_aabb(octree, node);
+            acc::AABB<math::Vec3f> & taabb = aabbs[i];
+            taabb.min = math::Vec3f(std::numeric_limits<float>::max());
+            taabb.max = math::Vec3f(std::numeric_limits<float>::lowest());
+            for (int j = 0; j < 8; ++j) {
+                math::Vec3f corner(
+                    (j & 1) ? aabb.max[0] : aabb.min[0],
+                    (j & 2) ? aabb.max[1] : aabb.min[1],
+                    (j & 4) ? aabb.max[2] : aabb.min[2]);
+                corner = T.mult(corner, 1.0f);
+                for (int k = 0; k < 3; ++k) {
+                    taabb.min[k] = std::min(taabb.min[k], corner[k]);
+                    taabb.max[k] = std::max(taabb.max[k], corner[k]);
+                }
+            }
+        }
+
+        math::Matrix3f R;
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 3; ++c) R(r, c) = T(r, c);
+        }
+        scale = std::cbrt(std::abs(math::matrix_determinant(R)));
+
+        loader = std::thread(&PointOctreeRenderer::load_nodes, this);
+    }
+
+    ~PointOctreeRenderer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        loader.join();
+    }
+
+    /* Called by the loading thread for each loaded node. */
+    void set_node_callback(NodeCallback node_callback) {
+        std::lock_guard<std::mutex> lock(mutex);
+        callback = node_callback;
+    }
+
+    /* Uploads loaded nodes, selects the visible nodes and requests missing
+     * ones - returns true if the rendered points changed. */
+    bool update(ogl::Camera const & camera) {
+        frame += 1;
+        bool changed = false;
+
+        std::vector<std::pair<std::size_t, mve::TriangleMesh::Ptr> > loaded;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            loaded.swap(ready);
+        }
+        for (auto const & elem : loaded) {
+            Entry & entry = cache[elem.first];
+            entry.last_used = frame;
+            entry.bytes = 0;
+            if (elem.second == nullptr) continue;
+
+            entry.mr = ogl::MeshRenderer::create();
+            entry.mr->set_mesh(elem.second);
+            entry.mr->set_shader(shader->get_shader_program());
+            entry.mr->set_primitive(GL_POINTS);
+            entry.bytes = elem.second->get_vertices().size()
+                * (sizeof(math::Vec3f) + sizeof(math::Vec4f));
+            cache_bytes += entry.bytes;
+            changed = true;
+        }
+
+        /* Pixels per unit length at unit distance. */
+        float focal = (camera.height / 2.0f) * camera.z_near / camera.top;
+        math::Matrix4f vp = camera.proj * camera.view;
+
+        typedef std::pair<float, std::size_t> QueueEntry;
+        std::priority_queue<QueueEntry> queue;
+        std::vector<std::size_t> missing;
+        std::vector<std::size_t> selected;
+        std::size_t num_points = 0;
+
+        auto push = [&] (std::size_t idx) {
+            acc::AABB<math::Vec3f> const & aabb = aabbs[idx];
+            if (!in_frustum(vp, aabb)) return;
+            math::Vec3f center = (aabb.min + aabb.max) / 2.0f;
+            float radius = (aabb.max - aabb.min).norm() / 2.0f;
+            float distance = std::max((center - camera.pos).norm() - radius,
+                camera.z_near);
+            queue.emplace(radius / distance, idx);
+        };
+
+        if (!octree.nodes.empty()) push(0);
+        while (!queue.empty()) {
+            std::size_t idx = queue.top().second;
+            queue.pop();
+
+            PointOctreeNode const & node = octree.nodes[idx];
+            if (num_points + node.num_points > point_budget) break;
+            num_points += node.num_points;
+            selected.push_back(idx);
+
+            auto it = cache.find(idx);
+            if (it != cache.end()) {
+                it->second.last_used = frame;
+            } else {
+                missing.push_back(idx);
+            }
+
+            /* Refine while the point spacing is visible. */
+            acc::AABB<math::Vec3f> const & aabb = aabbs[idx];
+            math::Vec3f center = (aabb.min + aabb.max) / 2.0f;
+            float radius = (aabb.max - aabb.min).norm() / 2.0f;
+            float distance = std::max((center - camera.pos).norm() - radius,
+                camera.z_near);
+            float spacing = scale * node_spacing(octree, node) * focal / distance;
+            if (spacing < min_spacing) continue;
+
+            for (std::int64_t child : children[idx]) {
+                if (child >= 0) push(child);
+            }
+        }
+
+        if (selected != visible) {
+            visible.swap(selected);
+            changed = true;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.clear();
+            for (std::size_t idx : missing) {
+                if (std::find(loading.begin(), loading.end(), idx) != loading.end()) continue;
+                requests.push_back(idx);
+            }
+        }
+        cv.notify_one();
+
+        /* Evict least recently used nodes which are not visible. */
+        if (cache_bytes > memory_budget) {
+            std::vector<std::pair<std::uint64_t, std::size_t> > candidates;
+            for (auto const & elem : cache) {
+                if (elem.second.last_used == frame) continue;
+                candidates.emplace_back(elem.second.last_used, elem.first);
+            }
+            std::sort(candidates.begin(), candidates.end());
+            for (std::size_t i = 0; i < candidates.size() && cache_bytes > memory_budget; ++i) {
+                auto it = cache.find(candidates[i].second);
+                cache_bytes -= it->second.bytes;
+                cache.erase(it);
+            }
+        }
+
+        return changed;
+    }
+
+    void render(void) {
+        for (std::size_t idx : visible) {
+            auto it = cache.find(idx);
+            if (it == cache.end() || it->second.mr == nullptr) continue;
+            it->second.mr->draw();
+        }
+    }
+
+    std::size_t num_cached_bytes(void) const {
+        return cache_bytes;
+    }
+};
+
+#endif /* SIM_POINTOCTREERENDERER_HEADER */
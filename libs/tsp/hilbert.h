@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef TSP_HILBERT_HEADER
+#define TSP_HILBERT_HEADER
+
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+#include "math/vector.h"
+
+#include "defines.h"
+
+TSP_NAMESPACE_BEGIN
+
+/* Index of (x, y) along the Hilbert curve of a 2^bits x 2^bits grid. */
+inline std::uint64_t
+hilbert_index(std::uint32_t x, std::uint32_t y, int bits) {
+    std::uint32_t const n = 1u << bits;
+    std::uint64_t d = 0;
+    for (std::uint32_t s = n / 2; s > 0; s /= 2) {
+        std::uint32_t rx = (x & s) > 0;
+        std::uint32_t ry = (y & s) > 0;
+        d += std::uint64_t(s) * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+/* Orders the vertices along a Hilbert curve over their xy bounding box -
+ * consecutive vertices are close and every contiguous range of the order
+ * is spatially compact. */
+template <int N>
+std::vector<uint>
+hilbert_order(std::vector<math::Vector<float, N> > const & verts) {
+    math::Vec2f min(std::numeric_limits<float>::max());
+    math::Vec2f max(std::numeric_limits<float>::lowest());
+    for (math::Vector<float, N> const & vert : verts) {
+        for (int i = 0; i < 2; ++i) {
+            min[i] = std::min(min[i], vert[i]);
+            max[i] = std::max(max[i], vert[i]);
+        }
+    }
+
+    int const bits = 16;
+    float const scale = ((1u << bits) - 1)
+        / std::max(std::max(max[0] - min[0], max[1] - min[1]), 1e-6f);
+
+    std::vector<std::pair<std::uint64_t, uint> > keys(verts.size());
+    for (std::size_t i = 0; i < verts.size(); ++i) {
+        std::uint32_t x = (verts[i][0] - min[0]) * scale;
+        std::uint32_t y = (verts[i][1] - min[1]) * scale;
+        keys[i] = std::make_pair(hilbert_index(x, y, bits), uint(i));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<uint> order(verts.size());
+    for (std::size_t i = 0; i < keys.size(); ++i) order[i] = keys[i].second;
+    return order;
+}
+
+TSP_NAMESPACE_END
+
+#endif /* TSP_HILBERT_HEADER */
@@ -9,20 +9,45 @@
 #ifndef TSP_OPTIMIZE_HEADER
 #define TSP_OPTIMIZE_HEADER
 
+#include <deque>
+#include <random>
 #include <vector>
+#include <numeric>
+#include <utility>
+#include <algorithm>
+#include <initializer_list>
 
 #include "math/vector.h"
 
+#include "util/task_scheduler.h"
+
+#include "geom/point_grid.h"
+
 #include "defines.h"
+#include "hilbert.h"
+
+/* Largest tour optimized with a dense distance table (4 MB). */
+#define TSP_MAX_DENSE_SIZE 1024
+#define TSP_NUM_NEIGHBORS 10
 
 TSP_NAMESPACE_BEGIN
 
 float twoopt(std::vector<uint> * ids, float thresh, std::vector<float> const & sqdists);
 
+template <int N>
+float optimize_local(std::vector<uint> * ids,
+    std::vector<math::Vector<float, N> > const & verts,
+    std::size_t num_neighbors = TSP_NUM_NEIGHBORS);
+
+/* Optimizes the closed tour through the vertices ids (a permutation of
+ * [0, ids->size())) with iters random restarts of 2-opt over a dense
+ * distance table - larger tours are passed to optimize_local. */
 template <int N>
 float optimize(std::vector<uint> * ids, std::vector<math::Vector<float, N> > const & verts,
     int iters = 1000)
 {
+    if (ids->size() > TSP_MAX_DENSE_SIZE) return optimize_local(ids, verts);
+
     std::vector<float> sqdists((ids->size() - 1) * ids->size() / 2);
     for (std::size_t idx = 0, i = 1; i < ids->size(); ++i) {
         for (std::size_t j = 0; j < i; ++j) {
@@ -41,27 +66,224 @@ float optimize(std::vector<uint> * ids, std::vector<math::Vector<float, N> > con
     }
 
     float thresh = length / 10000.0f;
-    #pragma omp parallel
-    {
-        std::mt19937 gen;
-        std::vector<uint> nids(ids->size());
-        #pragma omp for
-        for (int i = 0; i < iters; ++i) {
-            gen.seed(i);
+
+    /* Random restarts - ties favour the earlier restart. */
+    typedef std::pair<float, std::vector<uint> > Tour;
+    Tour best = TaskScheduler::global().parallel_reduce(0, iters,
+        Tour(length, std::vector<uint>()),
+        [&] (int i, Tour * tour) {
+            std::mt19937 gen(i);
+            std::vector<uint> nids(ids->size());
             std::iota(nids.begin(), nids.end(), 0);
             std::shuffle(nids.begin(), nids.end(), gen);
             float nlength = twoopt(&nids, thresh, sqdists);
-            #pragma omp critical
-            if (nlength < length) {
-                std::swap(*ids, nids);
-                length = nlength;
+            if (nlength < tour->first) {
+                tour->first = nlength;
+                std::swap(tour->second, nids);
             }
+        },
+        [] (Tour const & a, Tour const & b) {
+            return b.first < a.first ? b : a;
         }
+    );
+
+    if (!best.second.empty()) {
+        std::swap(*ids, best.second);
+        length = best.first;
     }
 
     return length;
 }
 
+/* Optimizes the closed tour through the vertices ids with 2-opt and Or-opt
+ * moves restricted to the num_neighbors nearest neighbors of each vertex
+ * (don't look bits) - memory is linear in the number of vertices.
+ * Starts from the shorter of the given order and the Hilbert curve order.
+ * Neighbors are determined on the first three coordinates. */
+template <int N>
+float optimize_local(std::vector<uint> * ids,
+    std::vector<math::Vector<float, N> > const & verts, std::size_t num_neighbors)
+{
+    std::size_t const n = ids->size();
+
+    std::vector<math::Vector<float, N> > lverts(n);
+    for (std::size_t i = 0; i < n; ++i) lverts[i] = verts[ids->at(i)];
+
+    auto dist = [&lverts] (uint a, uint b) -> float {
+        return (lverts[a] - lverts[b]).norm();
+    };
+    auto length = [&] (std::vector<uint> const & order) {
+        float ret = dist(order.back(), order.front());
+        for (std::size_t i = 0; i < order.size() - 1; ++i) {
+            ret += dist(order[i], order[i + 1]);
+        }
+        return ret;
+    };
+
+    std::vector<uint> tour(n);
+    std::iota(tour.begin(), tour.end(), 0);
+    if (n < 5) return length(tour);
+
+    std::vector<uint> order = hilbert_order(lverts);
+    if (length(order) < length(tour)) std::swap(tour, order);
+
+    std::vector<uint> pos(n);
+    for (std::size_t i = 0; i < n; ++i) pos[tour[i]] = i;
+
+    /* Neighbor lists sorted by distance (without the vertex itself). */
+    std::size_t const k = std::min(num_neighbors, n - 1);
+    std::vector<uint> neighbors(n * k, uint(-1));
+    {
+        std::vector<math::Vec3f> points(n, math::Vec3f(0.0f));
+        for (std::size_t i = 0; i < n; ++i) {
+            for (int j = 0; j < std::min(N, 3); ++j) points[i][j] = lverts[i][j];
+        }
+        PointGrid<uint> grid(points);
+        std::vector<uint> nn_ids;
+        std::vector<float> nn_dists;
+        grid.find_nns(points, k + 1, &nn_ids, &nn_dists);
+        for (std::size_t i = 0; i < n; ++i) {
+            for (std::size_t j = 0, l = 0; j < k + 1 && l < k; ++j) {
+                uint id = nn_ids[i * (k + 1) + j];
+                if (id == uint(-1) || id == i) continue;
+                neighbors[i * k + l++] = id;
+            }
+        }
+    }
+
+    auto succ = [&] (uint a) { return tour[(pos[a] + 1) % n]; };
+    auto pred = [&] (uint a) { return tour[(pos[a] + n - 1) % n]; };
+
+    /* Reverses the path from a to b (or equivalently its complement). */
+    auto reverse = [&] (uint a, uint b) {
+        std::size_t i = pos[a];
+        std::size_t j = pos[b];
+        std::size_t len = (j + n - i) % n + 1;
+        if (2 * len > n) {
+            std::swap(i, j);
+            i = (i + 1) % n;
+            j = (j + n - 1) % n;
+            len = n - len;
+        }
+        for (std::size_t l = 0; l < len / 2; ++l) {
+            std::size_t u = (i + l) % n;
+            std::size_t v = (j + n - l) % n;
+            std::swap(tour[u], tour[v]);
+            pos[tour[u]] = u;
+            pos[tour[v]] = v;
+        }
+    };
+
+    /* Replaces the edges (a, b) and (c, d) by (a, c) and (b, d) - b follows
+     * a and d follows c in the same (but either) direction. */
+    auto move = [&] (uint a, uint b, uint c, uint) {
+        if (succ(a) == b) {
+            reverse(b, c);
+        } else {
+            reverse(c, b);
+        }
+    };
+
+    float const thresh = length(tour) / n * 1e-5f;
+
+    std::vector<bool> active(n, true);
+    std::deque<uint> queue(tour.begin(), tour.end());
+    auto activate = [&] (std::initializer_list<uint> cities) {
+        for (uint c : cities) {
+            if (active[c]) continue;
+            active[c] = true;
+            queue.push_back(c);
+        }
+    };
+
+    auto twoopt_move = [&] (uint a) -> bool {
+        for (int dir = 0; dir < 2; ++dir) {
+            uint b = dir ? pred(a) : succ(a);
+            float dab = dist(a, b);
+            for (std::size_t i = 0; i < k; ++i) {
+                uint c = neighbors[a * k + i];
+                if (c == uint(-1)) break;
+                float dac = dist(a, c);
+                if (dac >= dab) break;
+
+                uint d = dir ? pred(c) : succ(c);
+                if (c == b || d == a) continue;
+                float change = dac + dist(b, d) - dab - dist(c, d);
+                if (change >= -thresh) continue;
+
+                move(a, b, c, d);
+                activate({a, b, c, d});
+                return true;
+            }
+        }
+        return false;
+    };
+
+    /* Moves the segment of up to three vertices starting at a between a
+     * neighbor of its ends and that neighbor's successor or predecessor. */
+    auto oropt_move = [&] (uint a) -> bool {
+        uint s2 = a;
+        for (std::size_t len = 1; len <= 3 && len + 3 <= n; ++len, s2 = succ(s2)) {
+            uint s1 = a;
+            uint p = pred(s1);
+            uint q = succ(s2);
+            float gain = dist(p, s1) + dist(s2, q) - dist(p, q);
+            if (gain <= thresh) continue;
+
+            auto in_segment = [&] (uint c) {
+                return (pos[c] + n - pos[s1]) % n < len;
+            };
+
+            for (uint e : {s1, s2}) {
+                uint f = (e == s1) ? s2 : s1;
+                for (std::size_t i = 0; i < k; ++i) {
+                    uint c = neighbors[e * k + i];
+                    if (c == uint(-1)) break;
+                    float dec = dist(e, c);
+                    if (dec >= gain) break;
+                    if (in_segment(c)) continue;
+
+                    for (uint d : {succ(c), pred(c)}) {
+                        if (in_segment(d)) continue;
+                        float change = dec + dist(f, d) - dist(c, d) - gain;
+                        if (change >= -thresh) continue;
+
+                        /* Orient such that p, s1, s2, q and c, d follow
+                         * each other - two 2-opt moves insert the segment
+                         * reversed between c and d, a third flips it. */
+                        uint pp = p, t1 = s1, t2 = s2, qq = q;
+                        if (d != succ(c)) {
+                            std::swap(pp, qq);
+                            std::swap(t1, t2);
+                        }
+                        move(pp, t1, c, d);
+                        move(pp, c, qq, t2);
+                        if (e != t2) move(c, t2, t1, d);
+
+                        activate({p, q, s1, s2, c, d});
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    };
+
+    while (!queue.empty()) {
+        uint a = queue.front();
+        queue.pop_front();
+        active[a] = false;
+
+        if (!twoopt_move(a)) oropt_move(a);
+    }
+
+    std::vector<uint> tmp(n);
+    for (std::size_t i = 0; i < n; ++i) tmp[i] = ids->at(tour[i]);
+    std::swap(*ids, tmp);
+
+    return length(tour);
+}
+
 float twoopt(std::vector<uint> * ids, float thresh, std::vector<float> const & sqdists) {
     auto sqdist = [&ids, &sqdists] (std::size_t i, std::size_t j) {
         std::tie(j, i) = std::minmax(ids->at(i), ids->at(j));
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef TSP_PARTITION_HEADER
+#define TSP_PARTITION_HEADER
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
+
+#include "math/vector.h"
+
+#include "util/task_scheduler.h"
+
+#include "defines.h"
+#include "hilbert.h"
+#include "optimize.h"
+
+TSP_NAMESPACE_BEGIN
+
+template <int N>
+float
+tour_length(std::vector<uint> const & ids,
+    std::vector<math::Vector<float, N> > const & verts)
+{
+    if (ids.size() < 2) return 0.0f;
+
+    float length = (verts[ids.back()] - verts[ids.front()]).norm();
+    for (std::size_t i = 0; i < ids.size() - 1; ++i) {
+        length += (verts[ids[i + 1]] - verts[ids[i]]).norm();
+    }
+    return length;
+}
+
+/* Splits the vertices into k spatially compact tours of balanced length
+ * and optimizes each tour (concurrently, see optimize).
+ * The vertices are ordered along a Hilbert curve and the curve is cut into
+ * k ranges of equal weighted path length - no distance table over all
+ * vertices is required. The weights of each range are corrected by the
+ * ratio of optimized to estimated tour length in rebalance rounds, the
+ * split with the shortest longest tour is returned.
+ * If a tour exceeds max_length or max_size vertices k is increased. */
+template <int N>
+std::vector<std::vector<uint> >
+split(std::vector<math::Vector<float, N> > const & verts, std::size_t k,
+    float max_length = std::numeric_limits<float>::infinity(),
+    std::size_t max_size = 0, int iters = 64, int rounds = 2)
+{
+    std::size_t const n = verts.size();
+    if (n == 0) return std::vector<std::vector<uint> >();
+
+    k = std::max<std::size_t>(1, std::min(k, n));
+    if (max_size != 0) k = std::max(k, (n + max_size - 1) / max_size);
+
+    std::vector<uint> order = hilbert_order(verts);
+
+    /* Path length along the curve (closing edge of each range ignored). */
+    std::vector<float> steps(n, 0.0f);
+    for (std::size_t i = 1; i < n; ++i) {
+        steps[i] = (verts[order[i]] - verts[order[i - 1]]).norm();
+    }
+
+    /* Optimized tours are typically ~25% shorter than the curve. */
+    if (max_length < std::numeric_limits<float>::infinity()) {
+        double length = 0.75 * std::accumulate(steps.begin(), steps.end(), 0.0);
+        k = std::min(n, std::max<std::size_t>(k, std::ceil(length / max_length)));
+    }
+
+    std::vector<std::vector<uint> > best;
+    float best_length = std::numeric_limits<float>::infinity();
+
+    while (true) {
+        std::vector<float> weights = steps;
+        std::vector<std::size_t> last_cuts;
+        bool feasible = false;
+
+        for (int round = 0; round <= rounds; ++round) {
+            std::vector<double> prefix(n + 1, 0.0);
+            for (std::size_t i = 0; i < n; ++i) prefix[i + 1] = prefix[i] + weights[i];
+
+            /* Cut at the quantiles of the weighted path length. */
+            std::vector<std::size_t> cuts(k + 1, n);
+            cuts[0] = 0;
+            for (std::size_t j = 1; j < k; ++j) {
+                double target = prefix[n] * j / k;
+                std::size_t cut = std::lower_bound(prefix.begin() + 1,
+                    prefix.end(), target) - prefix.begin();
+                cuts[j] = std::max(cuts[j - 1] + 1, std::min(cut, n - (k - j)));
+            }
+            if (cuts == last_cuts) break;
+            last_cuts = cuts;
+
+            std::vector<std::vector<uint> > tours(k);
+            std::vector<float> lengths(k);
+            TaskScheduler::global().parallel_for(std::size_t(0), k, [&] (std::size_t j) {
+                std::vector<uint> & tour = tours[j];
+                tour.assign(order.begin() + cuts[j], order.begin() + cuts[j + 1]);
+
+                if (tour.size() >= 4) {
+                    std::vector<math::Vector<float, N> > tverts(tour.size());
+                    for (std::size_t i = 0; i < tour.size(); ++i) tverts[i] = verts[tour[i]];
+                    std::vector<uint> ids(tour.size());
+                    std::iota(ids.begin(), ids.end(), 0);
+                    optimize(&ids, tverts, iters);
+
+                    std::vector<uint> tmp(tour.size());
+                    for (std::size_t i = 0; i < ids.size(); ++i) tmp[i] = tour[ids[i]];
+                    std::swap(tour, tmp);
+                }
+
+                lengths[j] = tour_length(tour, verts);
+            }, std::size_t(1));
+
+            std::size_t max_tour_size = 0;
+            for (std::vector<uint> const & tour : tours) {
+                max_tour_size = std::max(max_tour_size, tour.size());
+            }
+            float length = *std::max_element(lengths.begin(), lengths.end());
+            bool valid = length <= max_length
+                && (max_size == 0 || max_tour_size <= max_size);
+
+            if ((valid && !feasible) || (valid == feasible && length < best_length)) {
+                best = tours;
+                best_length = length;
+                feasible = valid;
+            }
+
+            /* Rebalance - correct the weights of each range. */
+            for (std::size_t j = 0; j < k; ++j) {
+                double estimate = prefix[cuts[j + 1]] - prefix[cuts[j]];
+                if (estimate <= 0.0) continue;
+                float factor = lengths[j] / estimate;
+                for (std::size_t i = cuts[j]; i < cuts[j + 1]; ++i) weights[i] *= factor;
+            }
+        }
+
+        if (feasible || k == n) break;
+
+        k += 1;
+        best_length = std::numeric_limits<float>::infinity();
+    }
+
+    return best;
+}
+
+TSP_NAMESPACE_END
+
+#endif /* TSP_PARTITION_HEADER */
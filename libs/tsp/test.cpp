@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cstdlib>
+#include <numeric>
+#include <iostream>
+#include <algorithm>
+
+#include "optimize.h"
+#include "partition.h"
+
+#define TEST(cond) if (!(cond)) { \
+    std::cerr << __FILE__ << ":" << __LINE__ << ": " #cond " failed" << std::endl; \
+    std::exit(EXIT_FAILURE); }
+
+/* Views of an aerial capture - a lawnmower pattern over [0, size]^2 with
+ * jitter, varying altitude and a few duplicates. */
+std::vector<math::Vec3f>
+create_views(std::size_t n, float size, std::mt19937 * gen) {
+    std::uniform_real_distribution<float> xy(0.0f, size);
+    std::uniform_real_distribution<float> z(40.0f, 60.0f);
+    std::vector<math::Vec3f> views;
+    for (std::size_t i = 0; i < n; ++i) {
+        views.emplace_back(xy(*gen), xy(*gen), z(*gen));
+    }
+    for (std::size_t i = 0; i < n / 100; ++i) views[n - 1 - i] = views[i];
+    return views;
+}
+
+bool
+is_permutation(std::vector<uint> ids, std::size_t n) {
+    std::sort(ids.begin(), ids.end());
+    for (std::size_t i = 0; i < ids.size(); ++i) {
+        if (ids[i] != i) return false;
+    }
+    return ids.size() == n;
+}
+
+/* The neighbor list search has to yield valid tours close to the dense
+ * 2-opt with random restarts - also for subsets of the vertices. */
+void test_optimize_local(void) {
+    std::mt19937 gen(3);
+    for (std::size_t n : {5u, 12u, 500u}) {
+        std::vector<math::Vec3f> verts = create_views(n, 1000.0f, &gen);
+
+        std::vector<uint> dense(n);
+        std::iota(dense.begin(), dense.end(), 0);
+        float dense_length = tsp::optimize(&dense, verts, 10);
+        TEST(is_permutation(dense, n));
+
+        std::vector<uint> local(n);
+        std::iota(local.begin(), local.end(), 0);
+        std::shuffle(local.begin(), local.end(), gen);
+        float local_length = tsp::optimize_local(&local, verts);
+        TEST(is_permutation(local, n));
+        TEST(std::abs(local_length - tsp::tour_length(local, verts))
+            <= 1e-3f * local_length);
+        TEST(local_length <= 1.1f * dense_length);
+    }
+
+    /* Subset of the vertices. */
+    std::vector<math::Vec3f> verts = create_views(2000, 1000.0f, &gen);
+    std::vector<uint> ids;
+    for (uint i = 0; i < verts.size(); i += 3) ids.push_back(i);
+    std::vector<uint> tour = ids;
+    tsp::optimize_local(&tour, verts);
+    std::sort(tour.begin(), tour.end());
+    TEST(tour == ids);
+
+    std::cout << "Passed (optimize local)" << std::endl;
+}
+
+/* Splitting a realistic survey (100k views, 4 tours) must not fall back to
+ * dense distance tables (~1.25 GB per tour) - the tours have to cover all
+ * views, be balanced and improve on the Hilbert curve order. */
+void test_split_large(void) {
+    std::mt19937 gen(5);
+    std::size_t const n = 100000;
+    std::vector<math::Vec3f> verts = create_views(n, 5000.0f, &gen);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::vector<uint> > tours = tsp::split(verts, 4);
+    auto end = std::chrono::steady_clock::now();
+    TEST(tours.size() == 4);
+
+    std::vector<uint> all;
+    float min_length = std::numeric_limits<float>::max();
+    float max_length = 0.0f;
+    for (std::vector<uint> const & tour : tours) {
+        TEST(tour.size() > TSP_MAX_DENSE_SIZE);
+        all.insert(all.end(), tour.begin(), tour.end());
+        float length = tsp::tour_length(tour, verts);
+        min_length = std::min(min_length, length);
+        max_length = std::max(max_length, length);
+    }
+    TEST(is_permutation(all, n));
+    TEST(max_length <= 1.1f * min_length);
+
+    float curve_length = tsp::tour_length(tsp::hilbert_order(verts), verts);
+    TEST(4.0f * max_length < 0.9f * curve_length);
+
+    std::cout << "Passed (split large, "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+        << "ms)" << std::endl;
+}
+
+int main(void) {
+    test_optimize_local();
+    test_split_large();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTIL_ASYNC_LOAD_HEADER
+#define UTIL_ASYNC_LOAD_HEADER
+
+#include <mutex>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <type_traits>
+
+#include "util/io.h"
+#include "util/task_scheduler.h"
+
+#include "geom/point_grid.h"
+
+/* Result of an asynchronous load - get() waits for it (executing pending
+ * tasks meanwhile) and, like the helpers of util/io.h, prints the error and
+ * exits if the load failed. */
+template <typename T>
+class AsyncResult {
+private:
+    /* Shared with the producer - continuations are submitted to the
+     * scheduler once the result (or exception) is set. */
+    struct State {
+        std::promise<T> promise;
+        std::shared_future<T> future;
+        std::mutex mutex;
+        bool done;
+        std::vector<std::function<void(void)> > continuations;
+    };
+
+    std::shared_ptr<State> state;
+    std::string what;
+
+public:
+    AsyncResult(void) {}
+
+    explicit AsyncResult(std::string const & what)
+        : state(std::make_shared<State>()), what(what) {
+        state->future = state->promise.get_future().share();
+        state->done = false;
+    }
+
+    bool valid(void) const {
+        return state != nullptr;
+    }
+
+    bool ready(void) const {
+        return state->future.wait_for(std::chrono::seconds(0))
+            == std::future_status::ready;
+    }
+
+    std::string const & description(void) const {
+        return what;
+    }
+
+    T const & get(void) const;
+
+    /* The result of a ready load - rethrows its exception. */
+    T const & value(void) const {
+        return state->future.get();
+    }
+
+    /* Sets the result of produce (or its exception) and submits the
+     * continuations. */
+    template <typename Produce>
+    void fulfil(Produce produce) const;
+
+    /* Submits func to the scheduler once the result is set. */
+    void on_ready(std::function<void(void)> func) const;
+};
+
+template <typename T>
+T const &
+AsyncResult<T>::get(void) const {
+    TaskScheduler & scheduler = TaskScheduler::global();
+    while (!ready()) {
+        if (scheduler.run_one()) continue;
+        state->future.wait_for(std::chrono::milliseconds(1));
+    }
+
+    try {
+        return value();
+    } catch (std::exception& e) {
+        std::cerr << "\tCould not load " << what << ": " << e.what() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+template <typename T>
+template <typename Produce>
+void
+AsyncResult<T>::fulfil(Produce produce) const {
+    try {
+        state->promise.set_value(produce());
+    } catch (...) {
+        state->promise.set_exception(std::current_exception());
+    }
+
+    std::vector<std::function<void(void)> > continuations;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->done = true;
+        continuations.swap(state->continuations);
+    }
+
+    TaskScheduler & scheduler = TaskScheduler::global();
+    for (std::function<void(void)> const & func : continuations) {
+        scheduler.submit(func);
+    }
+}
+
+template <typename T>
+void
+AsyncResult<T>::on_ready(std::function<void(void)> func) const {
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->done) {
+            state->continuations.push_back(func);
+            return;
+        }
+    }
+    TaskScheduler::global().submit(func);
+}
+
+/* Runs load on an I/O thread. */
+template <typename Load>
+AsyncResult<typename std::result_of<Load()>::type>
+load_async(std::string const & what, Load load) {
+    typedef typename std::result_of<Load()>::type T;
+    AsyncResult<T> result(what);
+    TaskScheduler::global().async_io([result, load] { result.fulfil(load); });
+    return result;
+}
+
+/* Runs build with the result of input on a worker once it is available -
+ * neither blocks a thread while waiting nor exits if input failed (its
+ * exception is passed on to the returned result). */
+template <typename Input, typename Build>
+AsyncResult<typename std::result_of<Build(Input)>::type>
+then(AsyncResult<Input> const & input, Build build) {
+    typedef typename std::result_of<Build(Input)>::type T;
+    AsyncResult<T> result(input.description());
+    input.on_ready([input, result, build] {
+        result.fulfil([&input, &build] { return build(input.value()); });
+    });
+    return result;
+}
+
+/* Runs load on an I/O thread and build with its result on a worker - the
+ * I/O threads are not occupied with computations. */
+template <typename Load, typename Build>
+AsyncResult<typename std::result_of<Build(typename std::result_of<Load()>::type)>::type>
+load_async(std::string const & what, Load load, Build build) {
+    return then(load_async(what, load), build);
+}
+
+inline AsyncResult<mve::TriangleMesh::Ptr>
+load_mesh_async(std::string const & path) {
+    return load_async("mesh " + path, [path] {
+        return mve::geom::load_ply_mesh(path);
+    });
+}
+
+inline AsyncResult<acc::BVHTree<uint, math::Vec3f>::Ptr>
+load_mesh_as_bvh_tree_async(std::string const & path) {
+    return load_async("mesh " + path,
+        [path] { return mve::geom::load_ply_mesh(path); },
+        [] (mve::TriangleMesh::Ptr mesh) { return build_bvh_tree(mesh); });
+}
+
+inline AsyncResult<acc::KDTree<3, uint>::Ptr>
+load_mesh_as_kd_tree_async(std::string const & path) {
+    return load_async("mesh " + path,
+        [path] { return mve::geom::load_ply_mesh(path); },
+        [] (mve::TriangleMesh::Ptr mesh) { return build_kd_tree(mesh); });
+}
+
+/* Point grid of the mesh vertices, to be used as build of load_async or
+ * then - e.g. chained to load_mesh_async to read the mesh only once. */
+inline PointGrid<uint>::Ptr
+build_point_grid(mve::TriangleMesh::ConstPtr mesh, float cell_size = 0.0f) {
+    return PointGrid<uint>::create(mesh->get_vertices(), cell_size);
+}
+
+#endif /* UTIL_ASYNC_LOAD_HEADER */
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTIL_BATCH_NORMALIZE_HEADER
+#define UTIL_BATCH_NORMALIZE_HEADER
+
+#include <limits>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+
+#include "util/file_list.h"
+#include "util/file_system.h"
+#include "util/quantile_sketch.h"
+
+/* Normalizes the files of the file list spec (see expand_file_list) into
+ * out_dir with a common range in two parallel streaming passes - range
+ * estimation over the reference files (the files if refs is empty) with one
+ * quantile sketch per thread and normalization of each file. At most one
+ * file per thread is held in memory. Bounds which are not given (lowest or
+ * max) are the eps / 2 and 1 - eps / 2 quantiles.
+ * insert(path, &sketch) adds the values of a file to the sketch and
+ * normalize(path, out_path, min, max) returns the number of outliers - both
+ * throw on errors. Prints errors and exits if any file fails. */
+template <typename Insert, typename Normalize> int
+batch_normalize(std::string const & spec, std::vector<std::string> const & refs,
+    std::string const & out_dir, float min, float max, float eps,
+    Insert insert, Normalize normalize)
+{
+    std::vector<std::string> files;
+    std::vector<std::string> names;
+    try {
+        files = expand_file_list(spec);
+        if (!files.empty()) names = output_file_names(files);
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    if (files.empty()) {
+        std::cerr << "No files given" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (!util::fs::dir_exists(out_dir.c_str())
+        && !util::fs::mkdir(out_dir.c_str())) {
+        std::cerr << "Could not create output directory" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<std::string> const & paths = refs.empty() ? files : refs;
+
+    bool estimate = min == std::numeric_limits<float>::lowest()
+        || max == std::numeric_limits<float>::max();
+
+    bool failed = false;
+    if (estimate) {
+        QuantileSketch sketch;
+        #pragma omp parallel
+        {
+            QuantileSketch local;
+            #pragma omp for schedule(dynamic) nowait
+            for (std::size_t i = 0; i < paths.size(); ++i) {
+                try {
+                    insert(paths[i], &local);
+                } catch (std::exception& e) {
+                    #pragma omp critical
+                    {
+                        std::cerr << "Could not load " << paths[i] << ": "
+                            << e.what() << std::endl;
+                        failed = true;
+                    }
+                }
+            }
+
+            #pragma omp critical
+            sketch.merge(local);
+        }
+
+        if (failed) std::exit(EXIT_FAILURE);
+
+        if (sketch.size() == 0) {
+            std::cerr << "No valid values" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+
+        std::cout << sketch.size() << " valid values" << std::endl;
+        std::cout << "Minimal value: " << sketch.minimum() << std::endl;
+        std::cout << "Maximal value: " << sketch.maximum() << std::endl;
+
+        if (min == std::numeric_limits<float>::lowest()) {
+            min = sketch.quantile(eps / 2.0f);
+        }
+        if (max == std::numeric_limits<float>::max()) {
+            max = sketch.quantile(1.0f - eps / 2.0f);
+        }
+    }
+    std::cout << "Normalizing range " << min << " - " << max << std::endl;
+
+    int num_outliers = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(+:num_outliers)
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        std::string out = util::fs::join_path(out_dir, names[i]);
+        try {
+            num_outliers += normalize(files[i], out, min, max);
+        } catch (std::exception& e) {
+            #pragma omp critical
+            {
+                std::cerr << "Could not normalize " << files[i] << ": "
+                    << e.what() << std::endl;
+                failed = true;
+            }
+        }
+    }
+
+    if (failed) std::exit(EXIT_FAILURE);
+
+    return num_outliers;
+}
+
+#endif /* UTIL_BATCH_NORMALIZE_HEADER */
@@ -6,29 +6,26 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#ifndef UTIL_CIO_HEADER
+#define UTIL_CIO_HEADER
+
 #include <iostream>
+#include <stdexcept>
 
 #include "mve/mesh_io_ply.h"
 #include "cacc/point_cloud.h"
 
-cacc::PointCloud<cacc::HOST>::Ptr
-load_point_cloud(std::string const & path)
+/* Host point cloud of the mesh vertices (normals are computed for meshes
+ * with faces) - throws if the cloud has no normals. */
+inline cacc::PointCloud<cacc::HOST>::Ptr
+create_point_cloud(mve::TriangleMesh::Ptr mesh)
 {
-    mve::TriangleMesh::Ptr mesh;
-    try {
-        mesh = mve::geom::load_ply_mesh(path);
-    } catch (std::exception& e) {
-        std::cerr << "\tCould not load point cloud: " << e.what() << std::endl;
-        std::exit(EXIT_FAILURE);
-    }
-
     if (!mesh->has_vertex_normals() && mesh->get_faces().size() != 0) {
         mesh->recalc_normals(false, true);
     }
 
     if (!mesh->has_vertex_normals()) {
-        std::cerr << "\tPoint cloud has no vertex normals." << std::endl;
-        std::exit(EXIT_FAILURE);
+        throw std::runtime_error("Point cloud has no vertex normals.");
     }
 
     std::vector<math::Vec3f> const & vertices = mesh->get_vertices();
@@ -49,3 +46,30 @@ load_point_cloud(std::string const & path)
     return ret;
 }
 
+/* Point cloud of an already loaded mesh (e.g. see load_mesh_async). */
+cacc::PointCloud<cacc::HOST>::Ptr
+load_point_cloud(mve::TriangleMesh::Ptr mesh)
+{
+    try {
+        return create_point_cloud(mesh);
+    } catch (std::exception& e) {
+        std::cerr << "\t" << e.what() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+cacc::PointCloud<cacc::HOST>::Ptr
+load_point_cloud(std::string const & path)
+{
+    mve::TriangleMesh::Ptr mesh;
+    try {
+        mesh = mve::geom::load_ply_mesh(path);
+    } catch (std::exception& e) {
+        std::cerr << "\tCould not load point cloud: " << e.what() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    return load_point_cloud(mesh);
+}
+
+#endif /* UTIL_CIO_HEADER */
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTIL_COLORMAP_HEADER
+#define UTIL_COLORMAP_HEADER
+
+#include <cmath>
+#include <cstdint>
+
+#include "math/vector.h"
+
+/* Color of value linearly interpolated between the 256 entries of the
+ * colormap (see col/maps), returns false for values out of [0, 1]. */
+inline bool
+colormap_lookup(float const (*colormap)[3], float value, math::Vec3f * color)
+{
+    if (!(0.0f <= value && value <= 1.0f)) return false;
+
+    std::uint8_t lidx = std::floor(value * 255.0f);
+    float t = value * 255.0f - lidx;
+    std::uint8_t hidx = lidx == 255 ? 255 : lidx + 1;
+
+    math::Vec3f lc(colormap[lidx]);
+    math::Vec3f hc(colormap[hidx]);
+    *color = (1.0f - t) * lc + t * hc;
+    return true;
+}
+
+#endif /* UTIL_COLORMAP_HEADER */
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTIL_FILE_LIST_HEADER
+#define UTIL_FILE_LIST_HEADER
+
+#include <glob.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "util/tokenizer.h"
+#include "util/file_system.h"
+
+/* Expands a file list specification - "@FILE" (one path per line), a glob
+ * pattern or a comma separated list of paths. */
+inline std::vector<std::string>
+expand_file_list(std::string const & spec) {
+    std::vector<std::string> files;
+
+    if (!spec.empty() && spec[0] == '@') {
+        std::ifstream in(spec.substr(1).c_str());
+        if (!in.good()) {
+            throw std::runtime_error("Could not open file list " + spec.substr(1));
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty()) files.push_back(line);
+        }
+    } else if (spec.find_first_of("*?[") != std::string::npos) {
+        glob_t result;
+        int ret = glob(spec.c_str(), 0, nullptr, &result);
+        if (ret == 0) {
+            for (std::size_t i = 0; i < result.gl_pathc; ++i) {
+                files.push_back(result.gl_pathv[i]);
+            }
+        }
+        globfree(&result);
+        if (ret != 0 && ret != GLOB_NOMATCH) {
+            throw std::runtime_error("Could not expand " + spec);
+        }
+    } else {
+        util::Tokenizer tok;
+        tok.split(spec, ',');
+        files.assign(tok.begin(), tok.end());
+    }
+
+    return files;
+}
+
+/* Output file names for the files (within one output directory) - their
+ * basenames or, if those collide, their paths relative to the common parent
+ * directory with '/' replaced by '_'. */
+inline std::vector<std::string>
+output_file_names(std::vector<std::string> const & files) {
+    std::vector<std::string> names(files.size());
+    std::unordered_set<std::string> unique;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        names[i] = util::fs::basename(files[i]);
+        unique.insert(names[i]);
+    }
+    if (unique.size() == files.size()) return names;
+
+    std::vector<std::string> paths(files.size());
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        paths[i] = util::fs::abspath(files[i]);
+    }
+
+    std::size_t prefix = paths[0].rfind('/') + 1;
+    for (std::string const & path : paths) {
+        std::size_t n = 0;
+        while (n < prefix && n < path.size() && path[n] == paths[0][n]) n += 1;
+        prefix = paths[0].rfind('/', n - 1) + 1;
+    }
+
+    unique.clear();
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        names[i] = paths[i].substr(prefix);
+        std::replace(names[i].begin(), names[i].end(), '/', '_');
+        if (!unique.insert(names[i]).second) {
+            throw std::runtime_error("Ambiguous output file name " + names[i]);
+        }
+    }
+
+    return names;
+}
+
+/* Size and modification time (in nanoseconds) of the file - files rewritten
+ * within the same second with the same size are still told apart. */
+inline bool
+stat_file(std::string const & filename, std::int64_t * size, std::int64_t * mtime) {
+    struct stat st;
+    if (::stat(filename.c_str(), &st) != 0) return false;
+    *size = st.st_size;
+    *mtime = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+    return true;
+}
+
+/* Name of a temporary file next to filename which is unique per process
+ * and call - concurrent writers never rename each others files. */
+inline std::string
+temp_file_name(std::string const & filename) {
+    static std::atomic<unsigned> counter(0);
+    return filename + "." + std::to_string(::getpid()) + "."
+        + std::to_string(counter++) + ".tmp";
+}
+
+#endif /* UTIL_FILE_LIST_HEADER */
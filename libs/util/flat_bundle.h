@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTIL_FLAT_BUNDLE_HEADER
+#define UTIL_FLAT_BUNDLE_HEADER
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "util/exception.h"
+#include "util/file_system.h"
+
+#include "mve/camera.h"
+#include "mve/bundle_io.h"
+
+#include "util/file_list.h"
+#include "util/task_scheduler.h"
+
+#define UTIL_FLAT_BUNDLE_FILE_HEADER "FBUNDLE"
+#define UTIL_FLAT_BUNDLE_FILE_VERSION 1
+#define UTIL_FLAT_BUNDLE_CACHE_EXT ".bin"
+
+/* Structure of arrays representation of a MVE bundle (synth_0.out) - tools
+ * can scan cameras, features and track references without per feature
+ * objects. The references of feature i are [ref_offsets[i], ref_offsets[i + 1]).
+ * The arrays live in a single buffer which is either memory mapped from the
+ * cache file written on the first load or filled by a parallel parser. */
+class FlatBundle {
+public:
+    typedef std::shared_ptr<FlatBundle> Ptr;
+    typedef std::shared_ptr<const FlatBundle> ConstPtr;
+
+    struct Header {
+        char signature[8];
+        std::uint32_t version;
+        std::uint32_t camera_size;
+        std::uint64_t num_cameras;
+        std::uint64_t num_features;
+        std::uint64_t num_refs;
+        /* Size and modification time of the text bundle (see stat_file). */
+        std::int64_t source_size;
+        std::int64_t source_mtime;
+    };
+
+private:
+    enum Section {
+        CAMERAS, POSITIONS, COLORS, REF_OFFSETS,
+        REF_VIEWS, REF_FEATURES, REF_POSITIONS, NUM_SECTIONS
+    };
+
+    Header header;
+    std::size_t offsets[NUM_SECTIONS + 1];
+
+    std::vector<std::uint64_t> storage;
+    void * mapping;
+    std::size_t mapping_size;
+    char * data;
+
+    FlatBundle() : mapping(nullptr), mapping_size(0), data(nullptr) {}
+
+    /* Computes the (8 byte aligned) section offsets and the total size. */
+    void layout(void);
+
+    void allocate(std::size_t num_cameras, std::size_t num_features,
+        std::size_t num_refs);
+
+    template <typename T>
+    T * section(Section s) const {
+        return reinterpret_cast<T *>(data + offsets[s]);
+    }
+
+    static bool map(std::string const & filename, Header const & expected, Ptr * ret);
+    static Ptr convert(mve::Bundle::ConstPtr bundle);
+
+public:
+    ~FlatBundle();
+
+    FlatBundle(FlatBundle const &) = delete;
+    FlatBundle & operator=(FlatBundle const &) = delete;
+
+    /* Maps the cache file of the bundle if it is up to date, otherwise
+     * parses the text file and (with use_cache) writes the cache. */
+    static Ptr load(std::string const & filename, bool use_cache = true);
+
+    /* Parses a bundle as written by mve::save_mve_bundle (line layout)
+     * in parallel - throws on other formatting (see load). */
+    static Ptr parse(std::string const & filename);
+
+    void save(std::string const & filename) const;
+
+    std::size_t num_cameras(void) const { return header.num_cameras; }
+    std::size_t num_features(void) const { return header.num_features; }
+    std::size_t num_refs(void) const { return header.num_refs; }
+
+    mve::CameraInfo const * cameras(void) const {
+        return section<mve::CameraInfo>(CAMERAS);
+    }
+    /* xyz per feature. */
+    float const * positions(void) const { return section<float>(POSITIONS); }
+    /* rgb [0, 1] per feature. */
+    float const * colors(void) const { return section<float>(COLORS); }
+    std::uint64_t const * ref_offsets(void) const {
+        return section<std::uint64_t>(REF_OFFSETS);
+    }
+    std::int32_t const * ref_views(void) const {
+        return section<std::int32_t>(REF_VIEWS);
+    }
+    std::int32_t const * ref_features(void) const {
+        return section<std::int32_t>(REF_FEATURES);
+    }
+    /* xy per reference. */
+    float const * ref_positions(void) const { return section<float>(REF_POSITIONS); }
+
+    std::size_t num_refs(std::size_t feature) const {
+        return ref_offsets()[feature + 1] - ref_offsets()[feature];
+    }
+};
+
+inline
+FlatBundle::~FlatBundle() {
+    if (mapping != nullptr) ::munmap(mapping, mapping_size);
+}
+
+inline void
+FlatBundle::layout(void) {
+    std::size_t const sizes[NUM_SECTIONS] = {
+        header.num_cameras * sizeof(mve::CameraInfo),
+        header.num_features * 3 * sizeof(float),
+        header.num_features * 3 * sizeof(float),
+        (header.num_features + 1) * sizeof(std::uint64_t),
+        header.num_refs * sizeof(std::int32_t),
+        header.num_refs * sizeof(std::int32_t),
+        header.num_refs * 2 * sizeof(float)
+    };
+
+    offsets[0] = (sizeof(Header) + 7) & ~std::size_t(7);
+    for (int s = 0; s < NUM_SECTIONS; ++s) {
+        offsets[s + 1] = (offsets[s] + sizes[s] + 7) & ~std::size_t(7);
+    }
+}
+
+inline void
+FlatBundle::allocate(std::size_t num_cameras, std::size_t num_features,
+    std::size_t num_refs)
+{
+    std::memset(&header, 0, sizeof(Header));
+    std::strncpy(header.signature, UTIL_FLAT_BUNDLE_FILE_HEADER, sizeof(header.signature));
+    header.version = UTIL_FLAT_BUNDLE_FILE_VERSION;
+    header.camera_size = sizeof(mve::CameraInfo);
+    header.num_cameras = num_cameras;
+    header.num_features = num_features;
+    header.num_refs = num_refs;
+    layout();
+
+    storage.assign(offsets[NUM_SECTIONS] / sizeof(std::uint64_t), 0);
+    data = reinterpret_cast<char *>(storage.data());
+}
+
+inline bool
+FlatBundle::map(std::string const & filename, Header const & expected, Ptr * ret)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || std::size_t(st.st_size) < sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+
+    void * mapping = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) return false;
+
+    Ptr bundle(new FlatBundle());
+    bundle->mapping = mapping;
+    bundle->mapping_size = st.st_size;
+    bundle->data = static_cast<char *>(mapping);
+    std::memcpy(&bundle->header, mapping, sizeof(Header));
+
+    Header const & header = bundle->header;
+    if (std::strncmp(header.signature, expected.signature, sizeof(header.signature)) != 0
+        || header.version != expected.version
+        || header.camera_size != expected.camera_size
+        || header.source_size != expected.source_size
+        || header.source_mtime != expected.source_mtime) {
+        return false;
+    }
+
+    bundle->layout();
+    if (bundle->offsets[NUM_SECTIONS] != bundle->mapping_size) return false;
+
+    *ret = bundle;
+    return true;
+}
+
+inline FlatBundle::Ptr
+FlatBundle::convert(mve::Bundle::ConstPtr bundle) {
+    mve::Bundle::Cameras const & cameras = bundle->get_cameras();
+    mve::Bundle::Features const & features = bundle->get_features();
+
+    std::size_t num_refs = 0;
+    for (mve::Bundle::Feature3D const & feature : features) {
+        num_refs += feature.refs.size();
+    }
+
+    Ptr ret(new FlatBundle());
+    ret->allocate(cameras.size(), features.size(), num_refs);
+
+    std::copy(cameras.begin(), cameras.end(), ret->section<mve::CameraInfo>(CAMERAS));
+
+    float * positions = ret->section<float>(POSITIONS);
+    float * colors = ret->section<float>(COLORS);
+    std::uint64_t * ref_offsets = ret->section<std::uint64_t>(REF_OFFSETS);
+    std::int32_t * ref_views = ret->section<std::int32_t>(REF_VIEWS);
+    std::int32_t * ref_features = ret->section<std::int32_t>(REF_FEATURES);
+    float * ref_positions = ret->section<float>(REF_POSITIONS);
+
+    std::size_t k = 0;
+    for (std::size_t i = 0; i < features.size(); ++i) {
+        mve::Bundle::Feature3D const & feature = features[i];
+        std::copy(feature.pos, feature.pos + 3, positions + 3 * i);
+        std::copy(feature.color, feature.color + 3, colors + 3 * i);
+        ref_offsets[i] = k;
+        for (mve::Bundle::Feature2D const & ref : feature.refs) {
+            ref_views[k] = ref.view_id;
+            ref_features[k] = ref.feature_id;
+            std::copy(ref.pos, ref.pos + 2, ref_positions + 2 * k);
+            k += 1;
+        }
+    }
+    ref_offsets[features.size()] = k;
+
+    return ret;
+}
+
+/* Parses the text format written by mve::save_mve_bundle - cameras are
+ * parsed sequentially, features (three lines each: position, color and
+ * references) concurrently in two passes (reference counts, then values).
+ * Throws if the file does not follow this layout. */
+inline FlatBundle::Ptr
+FlatBundle::parse(std::string const & filename) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.good()) throw util::FileException(filename, std::strerror(errno));
+
+    in.seekg(0, in.end);
+    std::size_t const size = in.tellg();
+    in.seekg(0, in.beg);
+    /* Zero terminated for strtof and friends. */
+    std::vector<char> buffer(size + 1, '\0');
+    in.read(buffer.data(), size);
+    if (!in.good()) throw util::FileException(filename, std::strerror(errno));
+    in.close();
+
+    char const * ptr = buffer.data();
+    char * end = nullptr;
+
+    if (std::strncmp(ptr, "drews 1.0", 9) != 0) {
+        throw util::FileException(filename, "Invalid file signature");
+    }
+    ptr += 9;
+
+    auto next_long = [&] (long * value) {
+        *value = std::strtol(ptr, &end, 10);
+        if (end == ptr) throw util::FileException(filename, "Invalid bundle");
+        ptr = end;
+    };
+    auto next_float = [&] (float * value) {
+        *value = std::strtof(ptr, &end);
+        if (end == ptr) throw util::FileException(filename, "Invalid bundle");
+        ptr = end;
+    };
+
+    long num_cameras, num_features;
+    next_long(&num_cameras);
+    next_long(&num_features);
+    if (num_cameras < 0 || num_features < 0) {
+        throw util::FileException(filename, "Invalid bundle");
+    }
+
+    std::vector<mve::CameraInfo> cameras(num_cameras);
+    for (mve::CameraInfo & cam : cameras) {
+        next_float(&cam.flen);
+        next_float(&cam.dist[0]);
+        next_float(&cam.dist[1]);
+        for (int j = 0; j < 9; ++j) next_float(&cam.rot[j]);
+        for (int j = 0; j < 3; ++j) next_float(&cam.trans[j]);
+    }
+
+    /* Skip the remainder of the last camera line. */
+    ptr = std::strchr(ptr, '\n');
+    ptr = (ptr == nullptr) ? buffer.data() + size : ptr + 1;
+    std::size_t const begin = ptr - buffer.data();
+
+    /* Line starts of the feature section. */
+    std::size_t const chunk_size = 1 << 20;
+    std::size_t const num_chunks = (size - begin + chunk_size - 1) / chunk_size;
+    std::vector<std::vector<std::size_t> > chunk_lines(num_chunks);
+    TaskScheduler & scheduler = TaskScheduler::global();
+    scheduler.parallel_for(std::size_t(0), num_chunks, [&] (std::size_t c) {
+        std::size_t first = begin + c * chunk_size;
+        std::size_t last = std::min(first + chunk_size, size);
+        for (std::size_t i = first; i < last; ++i) {
+            if (buffer[i] == '\n' && i + 1 < size) chunk_lines[c].push_back(i + 1);
+        }
+    }, std::size_t(1));
+
+    std::vector<std::size_t> lines;
+    lines.reserve(3 * num_features);
+    if (begin < size) lines.push_back(begin);
+    for (std::vector<std::size_t> const & chunk : chunk_lines) {
+        lines.insert(lines.end(), chunk.begin(), chunk.end());
+    }
+    /* Trailing empty lines. */
+    while (!lines.empty() && std::strspn(&buffer[lines.back()], " \t\r\n")
+        == size - lines.back()) lines.pop_back();
+
+    if (lines.size() != 3 * std::size_t(num_features)) {
+        throw util::FileException(filename, "Unexpected bundle layout");
+    }
+
+    std::vector<std::uint64_t> counts(num_features + 1, 0);
+    std::atomic<bool> valid(true);
+    scheduler.parallel_for(std::size_t(0), std::size_t(num_features), [&] (std::size_t i) {
+        char const * line = &buffer[lines[3 * i + 2]];
+        char * line_end;
+        long count = std::strtol(line, &line_end, 10);
+        if (line_end == line || count < 0) valid = false;
+        counts[i + 1] = std::max(count, 0l);
+    });
+    if (!valid) throw util::FileException(filename, "Invalid bundle");
+
+    for (long i = 0; i < num_features; ++i) counts[i + 1] += counts[i];
+
+    Ptr ret(new FlatBundle());
+    ret->allocate(num_cameras, num_features, counts.back());
+
+    std::copy(cameras.begin(), cameras.end(), ret->section<mve::CameraInfo>(CAMERAS));
+
+    float * positions = ret->section<float>(POSITIONS);
+    float * colors = ret->section<float>(COLORS);
+    std::uint64_t * ref_offsets = ret->section<std::uint64_t>(REF_OFFSETS);
+    std::int32_t * ref_views = ret->section<std::int32_t>(REF_VIEWS);
+    std::int32_t * ref_features = ret->section<std::int32_t>(REF_FEATURES);
+    float * ref_positions = ret->section<float>(REF_POSITIONS);
+    std::copy(counts.begin(), counts.end(), ref_offsets);
+
+    scheduler.parallel_for(std::size_t(0), std::size_t(num_features), [&] (std::size_t i) {
+        char const * cur;
+        char * next;
+        auto parse_floats = [&] (float * values, int n) {
+            for (int j = 0; j < n; ++j) {
+                values[j] = std::strtof(cur, &next);
+                if (next == cur) valid = false;
+                cur = next;
+            }
+        };
+        auto parse_int = [&] () -> std::int32_t {
+            long value = std::strtol(cur, &next, 10);
+            if (next == cur) valid = false;
+            cur = next;
+            return value;
+        };
+
+        cur = &buffer[lines[3 * i]];
+        parse_floats(positions + 3 * i, 3);
+
+        cur = &buffer[lines[3 * i + 1]];
+        parse_floats(colors + 3 * i, 3);
+        for (int j = 0; j < 3; ++j) colors[3 * i + j] /= 255.0f;
+
+        cur = &buffer[lines[3 * i + 2]];
+        parse_int();
+        for (std::uint64_t k = counts[i]; k < counts[i + 1]; ++k) {
+            ref_views[k] = parse_int();
+            ref_features[k] = parse_int();
+            parse_floats(ref_positions + 2 * k, 2);
+        }
+    });
+    if (!valid) throw util::FileException(filename, "Invalid bundle");
+
+    return ret;
+}
+
+inline void
+FlatBundle::save(std::string const & filename) const {
+    std::string tmp = temp_file_name(filename);
+    std::ofstream out(tmp.c_str(), std::ios::binary);
+    if (!out.good()) throw util::FileException(tmp, std::strerror(errno));
+
+    out.write(reinterpret_cast<char const *>(&header), sizeof(Header));
+    out.write(data + sizeof(Header), offsets[NUM_SECTIONS] - sizeof(Header));
+    out.close();
+
+    if (!out.good() || std::rename(tmp.c_str(), filename.c_str()) != 0) {
+        util::fs::unlink(tmp.c_str());
+        throw util::FileException(filename, std::strerror(errno));
+    }
+}
+
+inline FlatBundle::Ptr
+FlatBundle::load(std::string const & filename, bool use_cache) {
+    Header expected;
+    std::memset(&expected, 0, sizeof(Header));
+    std::strncpy(expected.signature, UTIL_FLAT_BUNDLE_FILE_HEADER, sizeof(expected.signature));
+    expected.version = UTIL_FLAT_BUNDLE_FILE_VERSION;
+    expected.camera_size = sizeof(mve::CameraInfo);
+    if (!stat_file(filename, &expected.source_size, &expected.source_mtime)) {
+        throw util::FileException(filename, std::strerror(errno));
+    }
+
+    std::string cache = filename + UTIL_FLAT_BUNDLE_CACHE_EXT;
+    Ptr ret;
+    if (use_cache && map(cache, expected, &ret)) return ret;
+
+    try {
+        ret = parse(filename);
+    } catch (util::FileException & e) {
+        /* Not written by mve::save_mve_bundle - slow but tolerant. */
+        ret = convert(mve::load_mve_bundle(filename));
+    }
+    ret->header.source_size = expected.source_size;
+    ret->header.source_mtime = expected.source_mtime;
+    std::memcpy(ret->data, &ret->header, sizeof(Header));
+
+    if (use_cache) {
+        try {
+            ret->save(cache);
+        } catch (std::exception & e) {
+            std::cerr << "Warning: could not save bundle cache: "
+                << e.what() << std::endl;
+        }
+    }
+
+    return ret;
+}
+
+#endif /* UTIL_FLAT_BUNDLE_HEADER */
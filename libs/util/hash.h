@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTIL_HASH_HEADER
+#define UTIL_HASH_HEADER
+
+#include <cstdint>
+#include <string>
+
+/* Incremental 64 bit FNV-1a hash - not cryptographic but sufficient to
+ * address files and parameters. */
+class Hash {
+private:
+    std::uint64_t state;
+
+public:
+    Hash() : state(14695981039346656037ull) {}
+
+    void update(void const * data, std::size_t size) {
+        unsigned char const * bytes = static_cast<unsigned char const *>(data);
+        for (std::size_t i = 0; i < size; ++i) {
+            state = (state ^ bytes[i]) * 1099511628211ull;
+        }
+    }
+
+    /* Includes the length to keep concatenations unambiguous. */
+    void update(std::string const & str) {
+        std::uint64_t size = str.size();
+        update(&size, sizeof(size));
+        update(str.data(), str.size());
+    }
+
+    std::uint64_t digest() const {
+        return state;
+    }
+
+    std::string hex() const {
+        static char const digits[] = "0123456789abcdef";
+        std::string ret(16, '0');
+        for (int i = 0; i < 16; ++i) {
+            ret[15 - i] = digits[(state >> (4 * i)) & 0xf];
+        }
+        return ret;
+    }
+};
+
+#endif /* UTIL_HASH_HEADER */
@@ -6,31 +6,47 @@
  * of the BSD 3-Clause license. See the LICENSE.txt file for details.
  */
 
+#ifndef UTIL_IO_HEADER
+#define UTIL_IO_HEADER
+
 #include <fstream>
 #include <cstring>
 
-#include "mve/scene.h"
 #include "mve/camera.h"
 #include "mve/mesh_io_ply.h"
 
 #include "acc/kd_tree.h"
 #include "acc/bvh_tree.h"
 
+#include "util/scene_index.h"
+
 void load_scene_as_trajectory(std::string const & path, std::vector<mve::CameraInfo> * trajectory) {
-    mve::Scene::Ptr scene;
+    std::vector<SceneView> views;
     try {
-        scene = mve::Scene::create(path);
+        views = load_scene_views(path);
     } catch (std::exception& e) {
         std::cerr << "Could not open scene: " << e.what() << std::endl;
         std::exit(EXIT_FAILURE);
     }
 
-    for (mve::View::Ptr const & view : scene->get_views()) {
-        if (view == nullptr) continue;
-        trajectory->push_back(view->get_camera());
+    for (SceneView const & view : views) {
+        if (view.id < 0) continue;
+        trajectory->push_back(view.camera);
     }
 }
 
+/* Acceleration structures of loaded meshes (see util/async_load.h). */
+inline acc::KDTree<3, uint>::Ptr
+build_kd_tree(mve::TriangleMesh::ConstPtr mesh) {
+    return acc::KDTree<3, uint>::create(mesh->get_vertices());
+}
+
+inline acc::BVHTree<uint, math::Vec3f>::Ptr
+build_bvh_tree(mve::TriangleMesh::ConstPtr mesh) {
+    return acc::BVHTree<uint, math::Vec3f>::create(mesh->get_faces(),
+        mesh->get_vertices());
+}
+
 acc::KDTree<3, uint>::Ptr
 load_mesh_as_kd_tree(std::string const & path)
 {
@@ -42,8 +58,7 @@ load_mesh_as_kd_tree(std::string const & path)
         std::exit(EXIT_FAILURE);
     }
 
-    std::vector<math::Vec3f> const & vertices = mesh->get_vertices();
-    return acc::KDTree<3, uint>::create(vertices);
+    return build_kd_tree(mesh);
 }
 
 acc::BVHTree<uint, math::Vec3f>::Ptr
@@ -57,9 +72,7 @@ load_mesh_as_bvh_tree(std::string const & path)
         std::exit(EXIT_FAILURE);
     }
 
-    std::vector<math::Vec3f> const & vertices = mesh->get_vertices();
-    std::vector<uint> const & faces = mesh->get_faces();
-    return acc::BVHTree<uint, math::Vec3f>::create(faces, vertices);
+    return build_bvh_tree(mesh);
 }
 
 template <typename T> void
@@ -87,3 +100,5 @@ load_vector(std::string const & filename) {
 
     return ret;
 }
+
+#endif /* UTIL_IO_HEADER */
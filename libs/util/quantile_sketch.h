@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTIL_QUANTILE_SKETCH_HEADER
+#define UTIL_QUANTILE_SKETCH_HEADER
+
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+/* Mergeable quantile sketch (hierarchy of compactors) - level l holds
+ * values of weight 2^l, full levels are sorted and every other value is
+ * promoted. Exact minimum and maximum, rank error in the order of
+ * log2(n / k) / k, exact for less than k values. Compaction offsets
+ * alternate deterministically - merging in a fixed order is reproducible. */
+class QuantileSketch {
+private:
+    std::size_t k;
+    std::uint64_t n;
+    float min;
+    float max;
+    std::vector<std::vector<float> > levels;
+    std::vector<std::uint8_t> offsets;
+
+    void compress(void) {
+        for (std::size_t l = 0; l < levels.size(); ++l) {
+            if (levels[l].size() < k) continue;
+
+            if (l + 1 == levels.size()) {
+                levels.emplace_back();
+                offsets.push_back(0);
+            }
+
+            std::vector<float> & level = levels[l];
+            std::sort(level.begin(), level.end());
+
+            /* Keep the largest value of odd sized levels. */
+            float rest = level.back();
+            bool odd = level.size() % 2 == 1;
+            std::size_t size = level.size() - odd;
+
+            std::vector<float> & next = levels[l + 1];
+            for (std::size_t i = offsets[l]; i < size; i += 2) {
+                next.push_back(level[i]);
+            }
+            offsets[l] ^= 1;
+
+            level.clear();
+            if (odd) level.push_back(rest);
+        }
+    }
+
+public:
+    QuantileSketch(std::size_t k = 4096)
+        : k(std::max<std::size_t>(k, 2)), n(0),
+        min(std::numeric_limits<float>::max()),
+        max(std::numeric_limits<float>::lowest()),
+        levels(1), offsets(1, 0) {}
+
+    void insert(float value) {
+        n += 1;
+        min = std::min(min, value);
+        max = std::max(max, value);
+        levels[0].push_back(value);
+        if (levels[0].size() >= k) compress();
+    }
+
+    void merge(QuantileSketch const & other) {
+        n += other.n;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        if (levels.size() < other.levels.size()) {
+            levels.resize(other.levels.size());
+            offsets.resize(other.levels.size(), 0);
+        }
+        for (std::size_t l = 0; l < other.levels.size(); ++l) {
+            levels[l].insert(levels[l].end(),
+                other.levels[l].begin(), other.levels[l].end());
+        }
+        compress();
+    }
+
+    std::uint64_t size(void) const {
+        return n;
+    }
+
+    float minimum(void) const {
+        return min;
+    }
+
+    float maximum(void) const {
+        return max;
+    }
+
+    /* Value of (approximate) rank q * (n - 1), q in [0, 1]. */
+    float quantile(double q) const {
+        if (n == 0) return std::numeric_limits<float>::quiet_NaN();
+        if (q <= 0.0) return min;
+        if (q >= 1.0) return max;
+
+        std::vector<std::pair<float, std::uint64_t> > values;
+        std::uint64_t total = 0;
+        for (std::size_t l = 0; l < levels.size(); ++l) {
+            for (float value : levels[l]) {
+                values.emplace_back(value, std::uint64_t(1) << l);
+                total += std::uint64_t(1) << l;
+            }
+        }
+        std::sort(values.begin(), values.end());
+
+        double rank = q * (total - 1);
+        std::uint64_t cumulative = 0;
+        for (std::pair<float, std::uint64_t> const & value : values) {
+            cumulative += value.second;
+            if (cumulative > rank) return value.first;
+        }
+        return max;
+    }
+};
+
+#endif /* UTIL_QUANTILE_SKETCH_HEADER */
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTIL_SCENE_INDEX_HEADER
+#define UTIL_SCENE_INDEX_HEADER
+
+#include <map>
+#include <cstdio>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include "util/exception.h"
+#include "util/file_system.h"
+#include "util/ini_parser.h"
+
+#include "mve/camera.h"
+#include "mve/image_io.h"
+
+#include "util/file_list.h"
+#include "util/task_scheduler.h"
+
+#define UTIL_SCENE_INDEX_FILE_HEADER "SVI"
+#define UTIL_SCENE_INDEX_FILE_VERSION "0.1"
+#define UTIL_SCENE_INDEX_FILENAME "views.idx"
+
+/* Metadata of a view - what most tools need from a scene without
+ * instantiating mve::View objects. */
+struct SceneView {
+    int id;
+    std::string name;
+    std::string directory;
+    mve::CameraInfo camera;
+    /* Dimensions of the indexed image (zero if not present). */
+    int width;
+    int height;
+};
+
+/* Size and modification time (nanoseconds, see stat_file) of the files a
+ * view entry was created from. */
+struct SceneViewStamp {
+    std::int64_t meta_size;
+    std::int64_t meta_mtime;
+    std::int64_t image_size;
+    std::int64_t image_mtime;
+
+    bool operator==(SceneViewStamp const & other) const {
+        return meta_size == other.meta_size && meta_mtime == other.meta_mtime
+            && image_size == other.image_size && image_mtime == other.image_mtime;
+    }
+};
+
+/* Filename of the image (any extension) within the view directory. */
+inline std::string
+find_view_image(std::string const & view_dir, std::string const & image) {
+    util::fs::Directory dir(view_dir);
+    for (util::fs::File const & file : dir) {
+        if (file.is_dir) continue;
+        std::size_t pos = file.name.find_last_of('.');
+        if (file.name.compare(0, pos, image) != 0) continue;
+        return file.get_absolute_name();
+    }
+    return std::string();
+}
+
+inline SceneViewStamp
+stamp_view(std::string const & view_dir, std::string const & image,
+    std::string * image_file)
+{
+    SceneViewStamp stamp = {-1, -1, -1, -1};
+    std::string meta_file = util::fs::join_path(view_dir, "meta.ini");
+    if (!stat_file(meta_file, &stamp.meta_size, &stamp.meta_mtime)) {
+        throw util::FileException(meta_file, std::strerror(errno));
+    }
+    if (!image.empty()) {
+        *image_file = find_view_image(view_dir, image);
+        if (!image_file->empty()) {
+            stat_file(*image_file, &stamp.image_size, &stamp.image_mtime);
+        }
+    }
+    return stamp;
+}
+
+/* Parses meta.ini and the image headers (mirrors mve::View). */
+inline SceneView
+read_view(std::string const & view_dir, std::string const & image_file) {
+    std::string meta_file = util::fs::join_path(view_dir, "meta.ini");
+    std::ifstream in(meta_file.c_str());
+    if (!in.good()) {
+        throw util::FileException(meta_file, std::strerror(errno));
+    }
+
+    std::map<std::string, std::string> meta;
+    util::parse_ini(in, &meta);
+    in.close();
+
+    auto parse = [&meta] (std::string const & key, float * values, int n) {
+        auto it = meta.find(key);
+        if (it == meta.end()) return;
+        std::stringstream ss(it->second);
+        for (int i = 0; i < n; ++i) ss >> values[i];
+    };
+
+    SceneView view;
+    view.id = -1;
+    auto it = meta.find("view.id");
+    if (it != meta.end()) view.id = std::atoi(it->second.c_str());
+    it = meta.find("view.name");
+    if (it != meta.end()) view.name = it->second;
+    view.directory = util::fs::basename(view_dir);
+
+    mve::CameraInfo & cam = view.camera;
+    parse("camera.focal_length", &cam.flen, 1);
+    parse("camera.pixel_aspect", &cam.paspect, 1);
+    parse("camera.principal_point", cam.ppoint, 2);
+    parse("camera.radial_distortion", cam.dist, 2);
+    parse("camera.rotation", cam.rot, 9);
+    parse("camera.translation", cam.trans, 3);
+
+    view.width = 0;
+    view.height = 0;
+    if (!image_file.empty()) {
+        mve::image::ImageHeaders headers = mve::image::load_file_headers(image_file);
+        view.width = headers.width;
+        view.height = headers.height;
+    }
+
+    return view;
+}
+
+template <typename T> void
+write_value(std::ostream & out, T const & value) {
+    out.write(reinterpret_cast<char const *>(&value), sizeof(T));
+}
+
+template <typename T> void
+read_value(std::istream & in, T * value) {
+    in.read(reinterpret_cast<char *>(value), sizeof(T));
+}
+
+inline void
+write_string(std::ostream & out, std::string const & str) {
+    write_value(out, std::uint32_t(str.size()));
+    out.write(str.data(), str.size());
+}
+
+inline void
+read_string(std::istream & in, std::string * str) {
+    std::uint32_t size = 0;
+    read_value(in, &size);
+    if (!in.good() || size > (1u << 16)) {
+        in.setstate(std::ios::failbit);
+        return;
+    }
+    str->resize(size);
+    in.read(&(*str)[0], size);
+}
+
+typedef std::map<std::string, std::pair<SceneViewStamp, SceneView> > SceneIndex;
+
+/* Returns an empty index if the file does not exist, is corrupt or was
+ * created for another image. */
+inline SceneIndex
+load_scene_index(std::string const & filename, std::string const & image) {
+    SceneIndex index;
+
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.good()) return index;
+
+    std::string header, version, indexed_image;
+    in >> header >> version;
+    in.get();
+    if (header != UTIL_SCENE_INDEX_FILE_HEADER
+        || version != UTIL_SCENE_INDEX_FILE_VERSION) return index;
+
+    read_string(in, &indexed_image);
+    if (indexed_image != image) return index;
+
+    std::uint32_t num_views = 0;
+    read_value(in, &num_views);
+    for (std::uint32_t i = 0; i < num_views && in.good(); ++i) {
+        SceneViewStamp stamp;
+        SceneView view;
+        read_value(in, &stamp);
+        read_value(in, &view.id);
+        read_string(in, &view.name);
+        read_string(in, &view.directory);
+        read_value(in, &view.camera);
+        read_value(in, &view.width);
+        read_value(in, &view.height);
+        index[view.directory] = std::make_pair(stamp, view);
+    }
+
+    if (!in.good()) return SceneIndex();
+
+    return index;
+}
+
+/* Writes to a temporary file first - concurrent readers never see a
+ * partially written index. */
+inline void
+save_scene_index(SceneIndex const & index, std::string const & image,
+    std::string const & filename)
+{
+    std::string tmp = temp_file_name(filename);
+    std::ofstream out(tmp.c_str(), std::ios::binary);
+    if (!out.good()) throw util::FileException(tmp, std::strerror(errno));
+
+    out << UTIL_SCENE_INDEX_FILE_HEADER << " "
+        << UTIL_SCENE_INDEX_FILE_VERSION << std::endl;
+    write_string(out, image);
+    write_value(out, std::uint32_t(index.size()));
+    for (auto const & entry : index) {
+        SceneViewStamp const & stamp = entry.second.first;
+        SceneView const & view = entry.second.second;
+        write_value(out, stamp);
+        write_value(out, view.id);
+        write_string(out, view.name);
+        write_string(out, view.directory);
+        write_value(out, view.camera);
+        write_value(out, view.width);
+        write_value(out, view.height);
+    }
+    out.close();
+
+    if (!out.good() || std::rename(tmp.c_str(), filename.c_str()) != 0) {
+        util::fs::unlink(tmp.c_str());
+        throw util::FileException(filename, std::strerror(errno));
+    }
+}
+
+/* Loads the view metadata of a MVE scene - the result is indexed by view
+ * id like mve::Scene::get_views(), missing views have id -1.
+ * Metadata files are small, they are parsed concurrently on the workers.
+ * With use_index the metadata (and the dimensions of image) is cached in
+ * SCENE/views.idx - entries are reused as long as size and modification
+ * time of meta.ini and the image match, added or changed views are parsed
+ * and the index is updated. */
+inline std::vector<SceneView>
+load_scene_views(std::string const & path, std::string const & image = "",
+    bool use_index = true)
+{
+    std::string views_dir = util::fs::join_path(path, "views");
+    if (!util::fs::dir_exists(views_dir.c_str())) {
+        throw util::FileException(views_dir, "Not a MVE scene");
+    }
+
+    std::vector<std::string> view_dirs;
+    util::fs::Directory dir(views_dir);
+    for (util::fs::File const & file : dir) {
+        if (!file.is_dir) continue;
+        if (file.name.size() < 4) continue;
+        if (file.name.compare(file.name.size() - 4, 4, ".mve") != 0) continue;
+        view_dirs.push_back(file.name);
+    }
+    std::sort(view_dirs.begin(), view_dirs.end());
+
+    std::string index_file = util::fs::join_path(path, UTIL_SCENE_INDEX_FILENAME);
+    SceneIndex index;
+    if (use_index) index = load_scene_index(index_file, image);
+
+    std::size_t const num_dirs = view_dirs.size();
+    std::vector<SceneViewStamp> stamps(num_dirs);
+    std::vector<SceneView> views(num_dirs);
+    std::vector<std::string> errors(num_dirs);
+    std::atomic<std::size_t> num_parsed(0);
+
+    TaskScheduler::global().parallel_for(std::size_t(0), num_dirs,
+        [&] (std::size_t i) {
+            std::string view_dir = util::fs::join_path(views_dir, view_dirs[i]);
+            try {
+                std::string image_file;
+                stamps[i] = stamp_view(view_dir, image, &image_file);
+
+                auto it = index.find(view_dirs[i]);
+                if (it != index.end() && it->second.first == stamps[i]) {
+                    views[i] = it->second.second;
+                    return;
+                }
+
+                views[i] = read_view(view_dir, image_file);
+                num_parsed += 1;
+            } catch (std::exception & e) {
+                errors[i] = e.what();
+            }
+        });
+
+    for (std::string const & error : errors) {
+        if (!error.empty()) throw std::runtime_error(error);
+    }
+
+    bool stale = num_parsed != 0 || index.size() != num_dirs;
+    if (use_index && stale) {
+        SceneIndex new_index;
+        for (std::size_t i = 0; i < num_dirs; ++i) {
+            new_index[view_dirs[i]] = std::make_pair(stamps[i], views[i]);
+        }
+        try {
+            save_scene_index(new_index, image, index_file);
+        } catch (std::exception & e) {
+            std::cerr << "Warning: could not save scene index: "
+                << e.what() << std::endl;
+        }
+    }
+
+    std::vector<SceneView> ret;
+    for (SceneView const & view : views) {
+        if (view.id < 0) {
+            throw std::runtime_error("View " + view.directory + " has no id");
+        }
+        if (static_cast<std::size_t>(view.id) >= ret.size()) {
+            SceneView missing;
+            missing.id = -1;
+            missing.width = 0;
+            missing.height = 0;
+            ret.resize(view.id + 1, missing);
+        }
+        if (ret[view.id].id >= 0) {
+            throw std::runtime_error("Duplicate view id " + std::to_string(view.id));
+        }
+        ret[view.id] = view;
+    }
+
+    return ret;
+}
+
+#endif /* UTIL_SCENE_INDEX_HEADER */
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTIL_SORT_HEADER
+#define UTIL_SORT_HEADER
+
+#include <thread>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+
+/* Sorts chunks in parallel and merges them pairwise (also in parallel). */
+template <typename RandomIt, typename Compare>
+void parallel_sort(RandomIt first, RandomIt last, Compare comp) {
+    std::ptrdiff_t const n = std::distance(first, last);
+
+    std::ptrdiff_t num_chunks = std::max(1u, std::thread::hardware_concurrency());
+    num_chunks = std::min(num_chunks, n / (1 << 14) + 1);
+
+    if (num_chunks == 1) {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    std::vector<std::ptrdiff_t> bounds(num_chunks + 1);
+    for (std::ptrdiff_t i = 0; i <= num_chunks; ++i) {
+        bounds[i] = (n * i) / num_chunks;
+    }
+
+    #pragma omp parallel for schedule(static, 1)
+    for (std::ptrdiff_t i = 0; i < num_chunks; ++i) {
+        std::sort(first + bounds[i], first + bounds[i + 1], comp);
+    }
+
+    for (std::ptrdiff_t width = 1; width < num_chunks; width *= 2) {
+        #pragma omp parallel for schedule(static, 1)
+        for (std::ptrdiff_t i = 0; i < num_chunks; i += 2 * width) {
+            if (i + width >= num_chunks) continue;
+            std::ptrdiff_t mid = bounds[i + width];
+            std::ptrdiff_t end = bounds[std::min(i + 2 * width, num_chunks)];
+            std::inplace_merge(first + bounds[i], first + mid, first + end, comp);
+        }
+    }
+}
+
+template <typename RandomIt>
+void parallel_sort(RandomIt first, RandomIt last) {
+    typedef typename std::iterator_traits<RandomIt>::value_type T;
+    parallel_sort(first, last, std::less<T>());
+}
+
+#endif /* UTIL_SORT_HEADER */
@@ -0,0 +1,486 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTIL_TASKSCHEDULER_HEADER
+#define UTIL_TASKSCHEDULER_HEADER
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <future>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Work-stealing task scheduler with task dependencies.
+ *
+ * Each worker owns a deque - tasks spawned by a worker are pushed to and
+ * popped from the back of its own deque (depth first, cache friendly),
+ * idle workers steal from the front of the others. Waiting threads
+ * (including workers) execute pending tasks instead of blocking, nested
+ * parallelism therefore neither deadlocks nor oversubscribes.
+ *
+ * Both the workers and OpenMP teams use all hardware threads - to avoid
+ * oversubscription, OpenMP regions within tasks run with a single thread
+ * and parallel_for/parallel_reduce within active OpenMP regions run
+ * serially on the calling thread.
+ *
+ * Blocking I/O should not occupy workers - submit it via async_io which
+ * uses a few dedicated threads and a bounded queue (submitting blocks
+ * while the queue is full, which bounds the memory held by pending
+ * writes). */
+class TaskScheduler {
+public:
+    class Task;
+    typedef std::shared_ptr<Task> TaskHandle;
+
+    class Task {
+    private:
+        friend class TaskScheduler;
+
+        std::function<void(void)> func;
+        std::exception_ptr exception;
+        /* Unfinished dependencies (+1 while the task is submitted). */
+        std::atomic<int> pending;
+        std::atomic<bool> finished;
+        std::atomic<bool> waited;
+        std::mutex mutex;
+        std::vector<TaskHandle> successors;
+
+    public:
+        Task(std::function<void(void)> func)
+            : func(func), pending(1), finished(false), waited(false) {}
+
+        bool done(void) const {
+            return finished;
+        }
+    };
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<TaskHandle> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable done_cv;
+    std::deque<TaskHandle> injected;
+    std::atomic<std::size_t> num_queued;
+    bool stop;
+
+    std::mutex io_mutex;
+    std::condition_variable io_cv;
+    std::condition_variable io_full_cv;
+    std::deque<std::function<void(void)> > io_tasks;
+    std::vector<std::thread> io_threads;
+    std::size_t max_io_tasks;
+    bool io_stop;
+
+    unsigned concurrency;
+
+    struct WorkerSlot {
+        TaskScheduler const * owner;
+        int id;
+    };
+
+    static WorkerSlot & worker_slot(void) {
+        static thread_local WorkerSlot slot = {nullptr, -1};
+        return slot;
+    }
+
+    /* Worker index of the calling thread or -1. */
+    int worker_id(void) const {
+        WorkerSlot const & slot = worker_slot();
+        return slot.owner == this ? slot.id : -1;
+    }
+
+    void schedule(TaskHandle task);
+    TaskHandle acquire(void);
+    void execute(TaskHandle task);
+    void finish(TaskHandle task);
+    void work(int id);
+    void work_io(void);
+
+public:
+    /* Zero threads means one per hardware thread. */
+    explicit TaskScheduler(unsigned num_threads = 0,
+        unsigned num_io_threads = 2, std::size_t max_io_tasks = 16);
+    ~TaskScheduler();
+
+    TaskScheduler(TaskScheduler const &) = delete;
+    TaskScheduler & operator=(TaskScheduler const &) = delete;
+
+    /* Process wide scheduler. */
+    static TaskScheduler & global(void);
+
+    unsigned num_threads(void) const {
+        return concurrency;
+    }
+
+    /* Runs func once all dependencies finished. */
+    TaskHandle submit(std::function<void(void)> func,
+        std::vector<TaskHandle> const & deps = std::vector<TaskHandle>());
+
+    /* Executes other tasks until the task finished, rethrows its exception. */
+    void wait(TaskHandle const & task);
+
+    void wait(std::vector<TaskHandle> const & tasks) {
+        for (TaskHandle const & task : tasks) wait(task);
+    }
+
+    /* Executes a single pending task if available. */
+    bool run_one(void);
+
+    /* Calls func(i) for i in [begin, end) in chunks of grain indices
+     * (zero selects a grain with ~4 chunks per thread). */
+    template <typename Index, typename Func>
+    void parallel_for(Index begin, Index end, Func const & func,
+        Index grain = Index(0));
+
+    /* Folds [begin, end) chunkwise with func(i, &value) starting from init
+     * and combines the chunk values in index order - the result does not
+     * depend on the scheduling. */
+    template <typename T, typename Index, typename Func, typename Reduce>
+    T parallel_reduce(Index begin, Index end, T const & init,
+        Func const & func, Reduce const & reduce, Index grain = Index(0));
+
+    /* Runs func on an I/O thread, blocks while max_io_tasks are pending. */
+    template <typename Func>
+    std::future<typename std::result_of<Func()>::type> async_io(Func func);
+};
+
+inline
+TaskScheduler::TaskScheduler(unsigned num_threads, unsigned num_io_threads,
+    std::size_t max_io_tasks)
+    : num_queued(0), stop(false), max_io_tasks(std::max<std::size_t>(1, max_io_tasks)),
+    io_stop(false)
+{
+    if (num_threads == 0) {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    concurrency = num_threads;
+
+    /* The thread calling wait() participates as well. */
+    unsigned num_workers = std::max(1u, num_threads - 1);
+    for (unsigned i = 0; i < num_workers; ++i) {
+        workers.emplace_back(new Worker());
+    }
+    for (unsigned i = 0; i < num_workers; ++i) {
+        threads.emplace_back(&TaskScheduler::work, this, i);
+    }
+    for (unsigned i = 0; i < num_io_threads; ++i) {
+        io_threads.emplace_back(&TaskScheduler::work_io, this);
+    }
+}
+
+inline
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(io_mutex);
+        io_stop = true;
+    }
+    io_cv.notify_all();
+    for (std::thread & thread : io_threads) thread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+    for (std::thread & thread : threads) thread.join();
+}
+
+inline TaskScheduler &
+TaskScheduler::global(void) {
+    static TaskScheduler scheduler;
+    return scheduler;
+}
+
+inline void
+TaskScheduler::schedule(TaskHandle task) {
+    /* Counted first - the count may exceed but never undercut the queued tasks. */
+    num_queued += 1;
+
+    int id = worker_id();
+    if (id >= 0) {
+        Worker & worker = *workers[id];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(task);
+    } else {
+        std::lock_guard<std::mutex> lock(mutex);
+        injected.push_back(task);
+    }
+
+    {
+        /* Synchronize with workers about to sleep. */
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    cv.notify_one();
+}
+
+inline TaskScheduler::TaskHandle
+TaskScheduler::acquire(void) {
+    if (num_queued == 0) return nullptr;
+
+    int id = worker_id();
+    if (id >= 0) {
+        Worker & worker = *workers[id];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.tasks.empty()) {
+            TaskHandle task = worker.tasks.back();
+            worker.tasks.pop_back();
+            num_queued -= 1;
+            return task;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!injected.empty()) {
+            TaskHandle task = injected.front();
+            injected.pop_front();
+            num_queued -= 1;
+            return task;
+        }
+    }
+
+    /* Steal the oldest (typically largest) task of another worker. */
+    std::size_t num_workers = workers.size();
+    std::size_t offset = id >= 0 ? id + 1 : 0;
+    for (std::size_t i = 0; i < num_workers; ++i) {
+        Worker & victim = *workers[(offset + i) % num_workers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty()) continue;
+        TaskHandle task = victim.tasks.front();
+        victim.tasks.pop_front();
+        num_queued -= 1;
+        return task;
+    }
+
+    return nullptr;
+}
+
+inline void
+TaskScheduler::execute(TaskHandle task) {
+#ifdef _OPENMP
+    int num_omp_threads = omp_get_max_threads();
+    omp_set_num_threads(1);
+#endif
+    try {
+        task->func();
+    } catch (...) {
+        task->exception = std::current_exception();
+    }
+#ifdef _OPENMP
+    omp_set_num_threads(num_omp_threads);
+#endif
+    task->func = nullptr;
+    finish(task);
+}
+
+inline void
+TaskScheduler::finish(TaskHandle task) {
+    std::vector<TaskHandle> successors;
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->finished = true;
+        successors.swap(task->successors);
+    }
+
+    for (TaskHandle const & successor : successors) {
+        if (--successor->pending == 0) schedule(successor);
+    }
+
+    if (task->waited) {
+        std::lock_guard<std::mutex> lock(mutex);
+        done_cv.notify_all();
+    }
+}
+
+inline void
+TaskScheduler::work(int id) {
+    worker_slot() = {this, id};
+
+    while (true) {
+        TaskHandle task = acquire();
+        if (task != nullptr) {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return stop || num_queued > 0; });
+        if (stop) return;
+    }
+}
+
+inline void
+TaskScheduler::work_io(void) {
+    std::unique_lock<std::mutex> lock(io_mutex);
+    while (true) {
+        io_cv.wait(lock, [this] { return io_stop || !io_tasks.empty(); });
+        /* Pending tasks are completed before shutdown. */
+        if (io_tasks.empty()) return;
+
+        std::function<void(void)> func = std::move(io_tasks.front());
+        io_tasks.pop_front();
+        io_full_cv.notify_one();
+
+        lock.unlock();
+        func();
+        lock.lock();
+    }
+}
+
+inline TaskScheduler::TaskHandle
+TaskScheduler::submit(std::function<void(void)> func,
+    std::vector<TaskHandle> const & deps)
+{
+    TaskHandle task = std::make_shared<Task>(func);
+    for (TaskHandle const & dep : deps) {
+        if (dep == nullptr) continue;
+        std::lock_guard<std::mutex> lock(dep->mutex);
+        if (dep->finished) continue;
+        task->pending += 1;
+        dep->successors.push_back(task);
+    }
+
+    if (--task->pending == 0) schedule(task);
+
+    return task;
+}
+
+inline bool
+TaskScheduler::run_one(void) {
+    TaskHandle task = acquire();
+    if (task == nullptr) return false;
+    execute(task);
+    return true;
+}
+
+inline void
+TaskScheduler::wait(TaskHandle const & task) {
+    if (task == nullptr) return;
+
+    task->waited = true;
+    while (!task->finished) {
+        if (run_one()) continue;
+
+        /* Nothing to help with - sleep until a task finishes or new work
+         * arrives (the timeout covers tasks becoming ready elsewhere). */
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait_for(lock, std::chrono::milliseconds(1), [&task, this] {
+            return task->finished || num_queued > 0;
+        });
+    }
+
+    if (task->exception) std::rethrow_exception(task->exception);
+}
+
+template <typename Index, typename Func>
+void
+TaskScheduler::parallel_for(Index begin, Index end, Func const & func, Index grain) {
+    if (end <= begin) return;
+
+    Index n = end - begin;
+    if (grain <= Index(0)) {
+        grain = std::max(Index(1), Index(n / Index(4 * num_threads())));
+    }
+    bool serial = n <= grain;
+#ifdef _OPENMP
+    serial = serial || omp_get_active_level() > 0;
+#endif
+    if (serial) {
+        for (Index i = begin; i < end; ++i) func(i);
+        return;
+    }
+
+    std::vector<TaskHandle> tasks;
+    tasks.reserve(n / grain + 1);
+    for (Index first = begin; first < end; first += std::min(grain, Index(end - first))) {
+        Index last = first + std::min(grain, Index(end - first));
+        tasks.push_back(submit([first, last, &func] {
+            for (Index i = first; i < last; ++i) func(i);
+        }));
+    }
+
+    /* Wait for all tasks before rethrowing to keep func alive. */
+    std::exception_ptr exception;
+    for (TaskHandle const & task : tasks) {
+        try {
+            wait(task);
+        } catch (...) {
+            if (!exception) exception = std::current_exception();
+        }
+    }
+    if (exception) std::rethrow_exception(exception);
+}
+
+template <typename T, typename Index, typename Func, typename Reduce>
+T
+TaskScheduler::parallel_reduce(Index begin, Index end, T const & init,
+    Func const & func, Reduce const & reduce, Index grain)
+{
+    if (end <= begin) return init;
+
+    Index n = end - begin;
+    if (grain <= Index(0)) {
+        grain = std::max(Index(1), Index(n / Index(4 * num_threads())));
+    }
+
+    Index num_chunks = (n + grain - 1) / grain;
+    std::vector<T> values(num_chunks, init);
+    parallel_for(Index(0), num_chunks, [&] (Index chunk) {
+        Index first = begin + chunk * grain;
+        Index last = first + std::min(grain, Index(end - first));
+        for (Index i = first; i < last; ++i) func(i, &values[chunk]);
+    }, Index(1));
+
+    T value = values[0];
+    for (Index chunk = 1; chunk < num_chunks; ++chunk) {
+        value = reduce(value, values[chunk]);
+    }
+    return value;
+}
+
+template <typename Func>
+std::future<typename std::result_of<Func()>::type>
+TaskScheduler::async_io(Func func) {
+    typedef typename std::result_of<Func()>::type R;
+    std::shared_ptr<std::packaged_task<R()> > task =
+        std::make_shared<std::packaged_task<R()> >(std::move(func));
+    std::future<R> future = task->get_future();
+
+    if (io_threads.empty()) {
+        (*task)();
+        return future;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(io_mutex);
+        io_full_cv.wait(lock, [this] { return io_tasks.size() < max_io_tasks; });
+        io_tasks.push_back([task] { (*task)(); });
+    }
+    io_cv.notify_one();
+
+    return future;
+}
+
+#endif /* UTIL_TASKSCHEDULER_HEADER */
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "mve/bundle_io.h"
+
+#include "task_scheduler.h"
+#include "flat_bundle.h"
+
+#define TEST(cond) if (!(cond)) { \
+    std::cerr << __FILE__ << ":" << __LINE__ << ": " #cond " failed" << std::endl; \
+    std::exit(EXIT_FAILURE); }
+
+/* Tasks of a random DAG have to start after all their dependencies
+ * finished - also if dependencies finish while the task is submitted. */
+void test_dependencies(void) {
+    for (unsigned num_threads : {1u, 2u, 8u}) {
+        TaskScheduler scheduler(num_threads, 0);
+        std::mt19937 gen(num_threads);
+
+        std::size_t const num_tasks = 2000;
+        std::vector<TaskScheduler::TaskHandle> tasks;
+        std::vector<std::atomic<bool> > finished(num_tasks);
+        std::atomic<int> violations(0);
+        for (std::size_t i = 0; i < num_tasks; ++i) {
+            finished[i] = false;
+            std::vector<std::size_t> ids;
+            std::vector<TaskScheduler::TaskHandle> deps;
+            for (int j = 0; j < 3 && i > 0; ++j) {
+                ids.push_back(std::uniform_int_distribution<std::size_t>(0, i - 1)(gen));
+                deps.push_back(tasks[ids.back()]);
+            }
+            tasks.push_back(scheduler.submit([&, i, ids] {
+                for (std::size_t id : ids) violations += !finished[id];
+                finished[i] = true;
+            }, deps));
+        }
+        scheduler.wait(tasks);
+
+        TEST(violations == 0);
+        for (std::size_t i = 0; i < num_tasks; ++i) {
+            TEST(finished[i]);
+            TEST(tasks[i]->done());
+        }
+    }
+
+    std::cout << "Passed (dependencies)" << std::endl;
+}
+
+/* Exceptions are rethrown by wait and by parallel_for (after all chunks
+ * finished) - successors of failed tasks are still executed. */
+void test_exceptions(void) {
+    TaskScheduler scheduler(4, 0);
+
+    TaskScheduler::TaskHandle failed = scheduler.submit([] {
+        throw std::runtime_error("task");
+    });
+    std::atomic<bool> successor(false);
+    TaskScheduler::TaskHandle next = scheduler.submit([&] { successor = true; },
+        {failed});
+
+    bool caught = false;
+    try {
+        scheduler.wait(failed);
+    } catch (std::runtime_error& e) {
+        caught = std::string(e.what()) == "task";
+    }
+    TEST(caught);
+    scheduler.wait(next);
+    TEST(successor);
+
+    std::atomic<int> count(0);
+    caught = false;
+    try {
+        scheduler.parallel_for(0, 1000, [&] (int i) {
+            count += 1;
+            if (i % 100 == 7) throw std::runtime_error("chunk");
+        }, 10);
+    } catch (std::runtime_error& e) {
+        caught = std::string(e.what()) == "chunk";
+    }
+    TEST(caught);
+    /* All chunks run, the failing ones stop at their exception. */
+    TEST(count == 90 * 10 + 10 * 8);
+
+    std::cout << "Passed (exceptions)" << std::endl;
+}
+
+/* Nested parallel_for and parallel_reduce within tasks neither deadlock
+ * (also with a single thread) nor lose iterations. */
+void test_nested(void) {
+    for (unsigned num_threads : {1u, 4u}) {
+        TaskScheduler scheduler(num_threads, 0);
+
+        std::vector<TaskScheduler::TaskHandle> tasks;
+        std::vector<std::atomic<long> > sums(16);
+        for (std::size_t t = 0; t < sums.size(); ++t) {
+            sums[t] = 0;
+            tasks.push_back(scheduler.submit([&, t] {
+                scheduler.parallel_for(0, 64, [&] (int i) {
+                    long sum = scheduler.parallel_reduce(0, 100, 0L,
+                        [i] (int j, long * value) { *value += i * j; },
+                        [] (long a, long b) { return a + b; }, 7);
+                    sums[t] += sum;
+                }, 1);
+            }));
+        }
+        scheduler.wait(tasks);
+
+        /* sum_i sum_j i * j = (63 * 64 / 2) * (99 * 100 / 2) */
+        for (std::size_t t = 0; t < sums.size(); ++t) {
+            TEST(sums[t] == 2016L * 4950L);
+        }
+    }
+
+    std::cout << "Passed (nested)" << std::endl;
+}
+
+/* The waiting thread executes pending tasks itself - with the only worker
+ * blocked, the awaited task can only run on the caller. */
+void test_wait(void) {
+    TaskScheduler scheduler(2, 0);
+
+    std::atomic<bool> started(false);
+    std::atomic<bool> release(false);
+    TaskScheduler::TaskHandle blocker = scheduler.submit([&] {
+        started = true;
+        while (!release) std::this_thread::yield();
+    });
+    while (!started) std::this_thread::yield();
+
+    std::thread::id caller = std::this_thread::get_id();
+    std::thread::id executor;
+    TaskScheduler::TaskHandle task = scheduler.submit([&] {
+        executor = std::this_thread::get_id();
+        release = true;
+    });
+    scheduler.wait(task);
+    scheduler.wait(blocker);
+    TEST(executor == caller);
+
+    std::cout << "Passed (wait)" << std::endl;
+}
+
+#ifdef _OPENMP
+/* OpenMP regions within tasks use a single thread and parallel_for within
+ * OpenMP regions runs on the calling thread - the pools do not multiply. */
+void test_openmp(void) {
+    TaskScheduler scheduler(4, 0);
+
+    int max_threads = omp_get_max_threads();
+    std::atomic<int> max_team(0);
+    scheduler.parallel_for(0, 64, [&] (int) {
+        #pragma omp parallel
+        {
+            int n = omp_get_num_threads();
+            int m = max_team;
+            while (n > m && !max_team.compare_exchange_weak(m, n));
+        }
+    }, 1);
+    TEST(max_team == 1);
+    TEST(omp_get_max_threads() == max_threads);
+
+    std::atomic<int> foreign(0);
+    #pragma omp parallel num_threads(4)
+    {
+        std::thread::id self = std::this_thread::get_id();
+        scheduler.parallel_for(0, 100, [&] (int) {
+            foreign += std::this_thread::get_id() != self;
+        }, 1);
+    }
+    TEST(foreign == 0);
+
+    std::cout << "Passed (openmp)" << std::endl;
+}
+#endif
+
+/* Writes a bundle in the layout of mve::save_mve_bundle - features with and
+ * without references and an unused camera. The views of the references are
+ * shifted by shift (the size does not change). */
+void
+write_bundle(std::string const & filename, int shift) {
+    std::mt19937 gen(13);
+    std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+    std::uniform_int_distribution<int> count(0, 5);
+
+    std::ofstream out(filename.c_str());
+    int const num_cameras = 4;
+    int const num_features = 500;
+    out << "drews 1.0" << std::endl;
+    out << num_cameras << " " << num_features << std::endl;
+    for (int i = 0; i < num_cameras; ++i) {
+        if (i == 2) {
+            out << "0 0 0\n0 0 0\n0 0 0\n0 0 0\n0 0 0" << std::endl;
+            continue;
+        }
+        out << 0.8f + i * 0.01f << " " << 1e-3f * i << " " << -2e-5f << std::endl;
+        for (int j = 0; j < 3; ++j) {
+            out << dist(gen) << " " << dist(gen) << " " << dist(gen) << std::endl;
+        }
+        out << dist(gen) << " " << dist(gen) << " " << dist(gen) << std::endl;
+    }
+    for (int i = 0; i < num_features; ++i) {
+        out << dist(gen) << " " << dist(gen) << " " << dist(gen) << std::endl;
+        out << i % 256 << " " << (3 * i) % 256 << " " << 255 << std::endl;
+        int n = count(gen);
+        out << n;
+        for (int j = 0; j < n; ++j) {
+            out << " " << (i + j + shift) % num_cameras << " " << i * 7 + j
+                << " " << dist(gen) << " " << dist(gen);
+        }
+        out << std::endl;
+    }
+    TEST(out.good());
+}
+
+bool
+equal(mve::Bundle::ConstPtr bundle, FlatBundle::ConstPtr flat) {
+    mve::Bundle::Cameras const & cameras = bundle->get_cameras();
+    mve::Bundle::Features const & features = bundle->get_features();
+    if (flat->num_cameras() != cameras.size()) return false;
+    if (flat->num_features() != features.size()) return false;
+
+    for (std::size_t i = 0; i < cameras.size(); ++i) {
+        mve::CameraInfo const & a = cameras[i];
+        mve::CameraInfo const & b = flat->cameras()[i];
+        bool same = a.flen == b.flen && a.dist[0] == b.dist[0]
+            && a.dist[1] == b.dist[1]
+            && std::equal(a.rot, a.rot + 9, b.rot)
+            && std::equal(a.trans, a.trans + 3, b.trans);
+        if (!same) return false;
+    }
+
+    std::size_t num_refs = 0;
+    for (std::size_t i = 0; i < features.size(); ++i) {
+        mve::Bundle::Feature3D const & feature = features[i];
+        if (!std::equal(feature.pos, feature.pos + 3, flat->positions() + 3 * i)) {
+            return false;
+        }
+        for (int j = 0; j < 3; ++j) {
+            if (std::abs(feature.color[j] - flat->colors()[3 * i + j]) > 1e-6f) {
+                return false;
+            }
+        }
+        if (flat->num_refs(i) != feature.refs.size()) return false;
+        for (std::size_t j = 0; j < feature.refs.size(); ++j) {
+            mve::Bundle::Feature2D const & ref = feature.refs[j];
+            std::size_t k = flat->ref_offsets()[i] + j;
+            bool same = ref.view_id == flat->ref_views()[k]
+                && ref.feature_id == flat->ref_features()[k]
+                && ref.pos[0] == flat->ref_positions()[2 * k]
+                && ref.pos[1] == flat->ref_positions()[2 * k + 1];
+            if (!same) return false;
+        }
+        num_refs += feature.refs.size();
+    }
+    return flat->num_refs() == num_refs;
+}
+
+/* The fast parser has to match mve::load_mve_bundle and the cache has to be
+ * invalidated by rewrites within the same second (same size). */
+void test_flat_bundle(void) {
+    char tmpl[] = "/tmp/util_test.XXXXXX";
+    TEST(::mkdtemp(tmpl) != nullptr);
+    std::string dir = tmpl;
+    std::string filename = util::fs::join_path(dir, "synth_0.out");
+    std::string cache = filename + UTIL_FLAT_BUNDLE_CACHE_EXT;
+
+    write_bundle(filename, 0);
+    mve::Bundle::Ptr bundle = mve::load_mve_bundle(filename);
+    TEST(equal(bundle, FlatBundle::parse(filename)));
+    TEST(equal(bundle, FlatBundle::load(filename, false)));
+    TEST(!util::fs::file_exists(cache.c_str()));
+
+    /* Written and mapped cache. */
+    timespec times[2] = {{1500000000, 100}, {1500000000, 100}};
+    TEST(::utimensat(AT_FDCWD, filename.c_str(), times, 0) == 0);
+    TEST(equal(bundle, FlatBundle::load(filename)));
+    TEST(util::fs::file_exists(cache.c_str()));
+    TEST(equal(bundle, FlatBundle::load(filename)));
+    TEST(util::fs::Directory(dir).size() == 2);
+
+    /* Same size and second, different nanoseconds. */
+    struct stat before, after;
+    TEST(::stat(filename.c_str(), &before) == 0);
+    write_bundle(filename, 1);
+    times[0].tv_nsec = times[1].tv_nsec = 200;
+    TEST(::utimensat(AT_FDCWD, filename.c_str(), times, 0) == 0);
+    TEST(::stat(filename.c_str(), &after) == 0);
+    TEST(before.st_size == after.st_size);
+    mve::Bundle::Ptr changed = mve::load_mve_bundle(filename);
+    TEST(!equal(bundle, FlatBundle::parse(filename)));
+    TEST(equal(changed, FlatBundle::load(filename)));
+
+    util::fs::unlink(filename.c_str());
+    util::fs::unlink(cache.c_str());
+    TEST(util::fs::rmdir(dir.c_str()));
+
+    std::cout << "Passed (flat bundle)" << std::endl;
+}
+
+int main(void) {
+    test_dependencies();
+    test_exceptions();
+    test_nested();
+    test_wait();
+    test_flat_bundle();
+#ifdef _OPENMP
+    test_openmp();
+#endif
+
+    return EXIT_SUCCESS;
+}
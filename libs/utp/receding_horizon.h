@@ -0,0 +1,373 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#ifndef UTP_RECEDING_HORIZON_HEADER
+#define UTP_RECEDING_HORIZON_HEADER
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "math/vector.h"
+#include "math/matrix.h"
+#include "math/matrix_tools.h"
+
+#include "defines.h"
+
+UTP_NAMESPACE_BEGIN
+
+#define UTP_NUM_MOTION_PRIMITIVES 27
+
+struct State {
+    math::Vec3f pos;
+    math::Vec3f vel;
+};
+
+struct Waypoint {
+    math::Vec3f pos;
+    math::Matrix3f rot;
+    float score;
+};
+
+/* Candidate successors relative to the direction of motion
+ * (3 step lengths x 3 headings x 3 pitches, in units of the current speed)
+ * and their preference weights - straight ahead is preferred. */
+struct MotionPrimitives {
+    std::array<math::Vec3f, UTP_NUM_MOTION_PRIMITIVES> offsets;
+    std::array<float, UTP_NUM_MOTION_PRIMITIVES> weights;
+};
+
+inline MotionPrimitives
+motion_primitives(void) {
+    float const pi = std::acos(-1.0f);
+
+    MotionPrimitives prims;
+    for (int z = 0; z < 3; ++z) {
+        for (int y = 0; y < 3; ++y) {
+            for (int x = 0; x < 3; ++x) {
+                float r = 1.0f + (z - 1) * 0.25f;
+                float phi = (y - 1) * (pi / 8.0f);
+                float theta = pi / 2 + (x - 1) * (pi / 8.0f);
+
+                int idx = (z * 3 + y) * 3 + x;
+                math::Vec3f & offset = prims.offsets[idx];
+                offset[0] = r * std::sin(theta) * std::cos(phi);
+                offset[1] = r * std::sin(theta) * std::sin(phi);
+                offset[2] = r * std::cos(theta);
+
+                prims.weights[idx] = 1.0f
+                    - (math::Vec3f(1.0f, 0.0f, 0.0f) - offset).norm() / 10.0f;
+            }
+        }
+    }
+    return prims;
+}
+
+/* Position reached from state with the offset of a motion primitive,
+ * the step length is the speed but at least min_step. */
+inline math::Vec3f
+successor(State const & state, math::Vec3f const & offset, float min_step)
+{
+    float speed = state.vel.norm();
+    math::Vec3f rx = speed > 0.0f ? state.vel / speed : math::Vec3f(1.0f, 0.0f, 0.0f);
+
+    math::Vec3f up(0.0f, 0.0f, 1.0f);
+    if (std::abs(up.dot(rx)) >= 0.99f) up = math::Vec3f(1.0f, 0.0f, 0.0f);
+
+    math::Vec3f ry = up.cross(rx).normalize();
+    math::Vec3f rz = rx.cross(ry).normalize();
+
+    math::Vec3f rel_offset = rx * offset[0] + ry * offset[1] + rz * offset[2];
+    return state.pos + rel_offset * std::max(speed, min_step);
+}
+
+/* Anytime planner for the next waypoints of a vehicle.
+ * The tree of motion primitive sequences is searched with beam searches
+ * of doubling width, starting with the previous plan (shifted by the
+ * executed waypoints) and a greedy rollout, i.e. a complete plan is
+ * available after a few evaluations and improves with the budget.
+ * Evaluations are cached within a call and stop before the deadline is
+ * missed - the duration of the next evaluation is predicted by the recent
+ * evaluations (ignoring single outliers like preemptions). If not even
+ * one evaluation fits into the budget the remainder of the previous plan
+ * is returned.
+ * The search order does not depend on timing: a plan is the result of the
+ * first Plan::evaluations evaluations, with max_evaluations (and a
+ * deterministic score function) planning is reproducible.
+ * Budgets are measured with the given clock (e.g. simulated time). */
+class RecedingHorizonPlanner {
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::function<Clock::time_point(void)> ClockFunction;
+
+    /* Score (> 0) and orientation of a view at pos reached from state,
+     * values <= 0 mark infeasible views. Scores are weighted with the
+     * preference of the motion primitive. */
+    typedef std::function<float(State const & state, math::Vec3f const & pos,
+        math::Matrix3f * rot)> ScoreFunction;
+
+    struct Options {
+        /* Number of planned waypoints. */
+        std::size_t horizon = 5;
+        /* Weight of waypoint i is discount^i. */
+        float discount = 0.9f;
+        float min_step = 0.5f;
+        /* Maximum number of evaluations per call (0 - unlimited). */
+        std::size_t max_evaluations = 0;
+        /* Distance within which the vehicle is considered to be at a
+         * waypoint of the previous plan. */
+        float warm_start_tolerance = 0.25f;
+        /* Time reserved for assembling the plan. */
+        std::chrono::microseconds reserve = std::chrono::microseconds(100);
+    };
+
+    struct Plan {
+        std::vector<Waypoint> waypoints;
+        float score;
+        std::size_t evaluations;
+        /* Width of the last completed beam search (0 - none completed). */
+        std::size_t beam_width;
+        /* All waypoints of the horizon were planned. */
+        bool complete;
+        std::chrono::microseconds latency;
+    };
+
+private:
+    struct Node {
+        int parent;
+        int primitive;
+        std::size_t depth;
+        State state;
+        Waypoint waypoint;
+        float value;
+        bool feasible;
+        std::array<int, UTP_NUM_MOTION_PRIMITIVES> children;
+    };
+
+    Options opts;
+    ScoreFunction score;
+    ClockFunction now;
+    MotionPrimitives prims;
+
+    std::vector<Node> nodes;
+    std::vector<int> last_primitives;
+    std::vector<Waypoint> last_waypoints;
+
+    /* Durations of the recent evaluations (ring buffer). */
+    std::array<Clock::duration, 32> durations;
+    std::size_t num_durations;
+    Clock::duration estimate;
+
+    Clock::time_point deadline;
+    bool unlimited;
+    std::size_t evaluations;
+    int best;
+
+    bool better(Node const & a, Node const & b) const {
+        if (a.depth != b.depth) return a.depth > b.depth;
+        return a.value > b.value;
+    }
+
+    /* Updates the estimate - the slowest of the recent durations ignoring
+     * the slowest sixteenth. */
+    void record_duration(Clock::duration duration) {
+        durations[num_durations % durations.size()] = duration;
+        num_durations += 1;
+
+        std::size_t n = std::min(num_durations, durations.size());
+        std::array<Clock::duration, 32> tmp = durations;
+        std::size_t k = n - 1 - n / 16;
+        std::nth_element(tmp.begin(), tmp.begin() + k, tmp.begin() + n);
+        estimate = tmp[k];
+    }
+
+    /* Returns the child or -1 if the budget is exhausted. */
+    int child(int parent, int primitive) {
+        int id = nodes[parent].children[primitive];
+        if (id >= 0) return id;
+
+        if (opts.max_evaluations != 0 && evaluations >= opts.max_evaluations) {
+            return -1;
+        }
+        Clock::time_point start = now();
+        /* Evaluations may take slightly longer than the estimate. */
+        Clock::duration margin = estimate + estimate / 8 + opts.reserve;
+        if (!unlimited && start + margin > deadline) return -1;
+
+        Node node;
+        node.parent = parent;
+        node.primitive = primitive;
+        node.depth = nodes[parent].depth + 1;
+        node.children.fill(-1);
+
+        State const & state = nodes[parent].state;
+        node.waypoint.pos = successor(state, prims.offsets[primitive], opts.min_step);
+        math::matrix_set_identity(&node.waypoint.rot);
+        node.waypoint.score = prims.weights[primitive]
+            * score(state, node.waypoint.pos, &node.waypoint.rot);
+        node.feasible = node.waypoint.score > 0.0f;
+
+        node.state.pos = node.waypoint.pos;
+        node.state.vel = node.waypoint.pos - state.pos;
+        float weight = std::pow(opts.discount, float(node.depth - 1));
+        node.value = nodes[parent].value + weight * node.waypoint.score;
+
+        evaluations += 1;
+        record_duration(now() - start);
+
+        id = nodes.size();
+        nodes.push_back(node);
+        nodes[parent].children[primitive] = id;
+
+        if (node.feasible && (best == 0 || better(node, nodes[best]))) best = id;
+
+        return id;
+    }
+
+    /* Follows the primitives as far as feasible and completes the plan
+     * greedily, returns false if the budget is exhausted. */
+    bool rollout(std::vector<int> const & primitives) {
+        int id = 0;
+        for (std::size_t i = 0; i < primitives.size() && i < opts.horizon; ++i) {
+            int next = child(id, primitives[i]);
+            if (next < 0) return false;
+            if (!nodes[next].feasible) break;
+            id = next;
+        }
+
+        while (nodes[id].depth < opts.horizon) {
+            int next = -1;
+            for (int i = 0; i < UTP_NUM_MOTION_PRIMITIVES; ++i) {
+                int c = child(id, i);
+                if (c < 0) return false;
+                if (!nodes[c].feasible) continue;
+                if (next < 0 || nodes[c].value > nodes[next].value) next = c;
+            }
+            if (next < 0) break;
+            id = next;
+        }
+        return true;
+    }
+
+    /* Returns -1 if the budget is exhausted, 0 if the tree was searched
+     * exhaustively and 1 otherwise. */
+    int beam_search(std::size_t width) {
+        bool pruned = false;
+        std::vector<int> beam(1, 0);
+        for (std::size_t d = 0; d < opts.horizon && !beam.empty(); ++d) {
+            std::vector<int> candidates;
+            for (int id : beam) {
+                for (int i = 0; i < UTP_NUM_MOTION_PRIMITIVES; ++i) {
+                    int c = child(id, i);
+                    if (c < 0) return -1;
+                    if (nodes[c].feasible) candidates.push_back(c);
+                }
+            }
+
+            std::stable_sort(candidates.begin(), candidates.end(),
+                [this] (int a, int b) { return nodes[a].value > nodes[b].value; });
+            if (candidates.size() > width) {
+                candidates.resize(width);
+                pruned = true;
+            }
+            std::swap(beam, candidates);
+        }
+        return pruned ? 1 : 0;
+    }
+
+public:
+    RecedingHorizonPlanner(Options const & opts, ScoreFunction const & score,
+        ClockFunction const & now = Clock::now)
+        : opts(opts), score(score), now(now), prims(motion_primitives()),
+        num_durations(0), estimate(Clock::duration::zero()) {}
+
+    Options & options(void) { return opts; }
+
+    /* Plans the next waypoints from state within budget
+     * (zero - no time limit, requires max_evaluations). */
+    Plan plan(State const & state, std::chrono::microseconds budget) {
+        Clock::time_point start = now();
+        deadline = start + budget;
+        unlimited = budget.count() == 0;
+        evaluations = 0;
+        best = 0;
+
+        nodes.clear();
+        nodes.emplace_back();
+        nodes[0].parent = -1;
+        nodes[0].primitive = -1;
+        nodes[0].depth = 0;
+        nodes[0].state = state;
+        nodes[0].value = 0.0f;
+        nodes[0].feasible = true;
+        nodes[0].children.fill(-1);
+
+        /* Warm start - skip the waypoints the vehicle reached. */
+        std::size_t skip = 0;
+        for (std::size_t i = 0; i < last_waypoints.size(); ++i) {
+            float dist = (last_waypoints[i].pos - state.pos).norm();
+            if (dist <= opts.warm_start_tolerance) skip = i + 1;
+        }
+        std::vector<int> warm(last_primitives.begin() + skip, last_primitives.end());
+        std::vector<Waypoint> remainder(last_waypoints.begin() + skip,
+            last_waypoints.end());
+
+        Plan plan;
+        plan.beam_width = 0;
+
+        bool exhausted = !rollout(warm);
+        for (std::size_t width = 1; !exhausted; width *= 2) {
+            int ret = beam_search(width);
+            if (ret >= 0) plan.beam_width = width;
+            exhausted = ret <= 0;
+        }
+
+        std::vector<int> ids;
+        for (int id = best; id > 0; id = nodes[id].parent) ids.push_back(id);
+        std::reverse(ids.begin(), ids.end());
+
+        last_primitives.clear();
+        last_waypoints.clear();
+        for (int id : ids) {
+            last_primitives.push_back(nodes[id].primitive);
+            last_waypoints.push_back(nodes[id].waypoint);
+        }
+        plan.score = nodes[best].value;
+
+        /* An outlier must not stall the planner - relearn if nothing fit. */
+        if (evaluations == 0) {
+            for (Clock::duration & duration : durations) duration /= 2;
+            estimate /= 2;
+        }
+
+        if (evaluations == 0 && !remainder.empty()) {
+            last_primitives.swap(warm);
+            last_waypoints.swap(remainder);
+            plan.score = 0.0f;
+            for (std::size_t i = 0; i < last_waypoints.size(); ++i) {
+                plan.score += std::pow(opts.discount, float(i))
+                    * last_waypoints[i].score;
+            }
+        }
+
+        plan.waypoints = last_waypoints;
+        plan.evaluations = evaluations;
+        plan.complete = plan.waypoints.size() == opts.horizon;
+        plan.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            now() - start);
+        return plan;
+    }
+};
+
+UTP_NAMESPACE_END
+
+#endif /* UTP_RECEDING_HORIZON_HEADER */
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2016-2018, Nils Moehrle
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD 3-Clause license. See the LICENSE.txt file for details.
+ */
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#include "receding_horizon.h"
+
+#define TEST(cond) if (!(cond)) { \
+    std::cerr << __FILE__ << ":" << __LINE__ << ": " #cond " failed" << std::endl; \
+    std::exit(EXIT_FAILURE); }
+
+typedef std::chrono::steady_clock Clock;
+
+/* Views close to the goal score best, views below the ground are
+ * infeasible - each evaluation takes (at least) cost. */
+utp::RecedingHorizonPlanner::ScoreFunction
+goal_score(math::Vec3f const & goal, std::chrono::microseconds cost) {
+    return [goal, cost] (utp::State const &, math::Vec3f const & pos,
+        math::Matrix3f *) -> float
+    {
+        Clock::time_point end = Clock::now() + cost;
+        while (Clock::now() < end);
+        if (pos[2] < 0.0f) return 0.0f;
+        return 1.0f / (1.0f + (goal - pos).norm());
+    };
+}
+
+utp::State
+initial_state(void) {
+    utp::State state;
+    state.pos = math::Vec3f(0.0f, 0.0f, 10.0f);
+    state.vel = math::Vec3f(1.0f, 0.0f, 0.0f);
+    return state;
+}
+
+/* The search order does not depend on timing. */
+void test_deterministic(void) {
+    utp::RecedingHorizonPlanner::Options opts;
+    opts.horizon = 4;
+    opts.max_evaluations = 400;
+
+    math::Vec3f goal(5.0f, 8.0f, 12.0f);
+    utp::RecedingHorizonPlanner a(opts, goal_score(goal, std::chrono::microseconds(0)));
+    utp::RecedingHorizonPlanner b(opts, goal_score(goal, std::chrono::microseconds(20)));
+
+    utp::State state = initial_state();
+    for (int i = 0; i < 5; ++i) {
+        utp::RecedingHorizonPlanner::Plan pa = a.plan(state, std::chrono::microseconds(0));
+        utp::RecedingHorizonPlanner::Plan pb = b.plan(state, std::chrono::microseconds(0));
+        TEST(pa.complete && pb.complete);
+        TEST(pa.evaluations == opts.max_evaluations);
+        TEST(pa.evaluations == pb.evaluations);
+        TEST(pa.score == pb.score);
+        TEST(pa.waypoints.size() == pb.waypoints.size());
+        for (std::size_t j = 0; j < pa.waypoints.size(); ++j) {
+            TEST(pa.waypoints[j].pos == pb.waypoints[j].pos);
+        }
+
+        state.vel = pa.waypoints[0].pos - state.pos;
+        state.pos = pa.waypoints[0].pos;
+    }
+
+    std::cout << "Passed (deterministic)" << std::endl;
+}
+
+/* More evaluations never yield a worse plan and the greedy rollout is
+ * improved by the beam searches. */
+void test_anytime(void) {
+    math::Vec3f goal(-2.0f, 6.0f, 8.0f);
+    float last_score = 0.0f;
+    for (std::size_t max_evaluations : {5, 27 * 5, 500, 2000, 8000}) {
+        utp::RecedingHorizonPlanner::Options opts;
+        opts.horizon = 5;
+        opts.max_evaluations = max_evaluations;
+        utp::RecedingHorizonPlanner planner(opts,
+            goal_score(goal, std::chrono::microseconds(0)));
+
+        utp::RecedingHorizonPlanner::Plan plan =
+            planner.plan(initial_state(), std::chrono::microseconds(0));
+        TEST(plan.evaluations <= max_evaluations);
+        TEST(plan.score >= last_score);
+        TEST(plan.complete == (max_evaluations >= 27 * 5));
+        if (max_evaluations >= 2000) TEST(plan.beam_width >= 2);
+        last_score = plan.score;
+    }
+
+    std::cout << "Passed (anytime)" << std::endl;
+}
+
+/* The plan of the next step starts with the remaining waypoints of the
+ * previous plan - horizon - 1 evaluations suffice for a complete plan. */
+void test_warm_start(void) {
+    math::Vec3f goal(10.0f, -6.0f, 14.0f);
+    utp::RecedingHorizonPlanner::Options opts;
+    opts.horizon = 5;
+    opts.max_evaluations = 2000;
+    utp::RecedingHorizonPlanner planner(opts,
+        goal_score(goal, std::chrono::microseconds(0)));
+
+    utp::State state = initial_state();
+    utp::RecedingHorizonPlanner::Plan plan = planner.plan(state,
+        std::chrono::microseconds(0));
+    TEST(plan.complete);
+
+    state.vel = plan.waypoints[0].pos - state.pos;
+    state.pos = plan.waypoints[0].pos;
+
+    planner.options().max_evaluations = opts.horizon - 1;
+    utp::RecedingHorizonPlanner::Plan next = planner.plan(state,
+        std::chrono::microseconds(0));
+    TEST(next.waypoints.size() == opts.horizon - 1);
+    for (std::size_t i = 0; i < next.waypoints.size(); ++i) {
+        TEST((next.waypoints[i].pos - plan.waypoints[i + 1].pos).norm() < 1e-4f);
+    }
+
+    std::cout << "Passed (warm start)" << std::endl;
+}
+
+/* Simulated time - only advanced by the evaluations. */
+struct SimulatedClock {
+    Clock::time_point time;
+    std::size_t evaluations = 0;
+
+    utp::RecedingHorizonPlanner::ClockFunction function(void) {
+        return [this] (void) { return time; };
+    }
+};
+
+/* goal_score with the durations of the evaluations taken from costs
+ * (cyclic) in simulated time. */
+utp::RecedingHorizonPlanner::ScoreFunction
+simulated_score(math::Vec3f const & goal,
+    std::vector<std::chrono::microseconds> const & costs, SimulatedClock * clock)
+{
+    utp::RecedingHorizonPlanner::ScoreFunction score =
+        goal_score(goal, std::chrono::microseconds(0));
+    return [=] (utp::State const & state, math::Vec3f const & pos,
+        math::Matrix3f * rot) -> float
+    {
+        clock->time += costs[clock->evaluations++ % costs.size()];
+        return score(state, pos, rot);
+    };
+}
+
+/* With simulated durations no evaluation is started if its predicted end
+ * lies past the deadline - calls never exceed the budget (once the duration
+ * has been learned) and use it up to the predicted duration. Single outliers
+ * only delay the call they occur in. */
+void test_budget(void) {
+    math::Vec3f goal(20.0f, 20.0f, 20.0f);
+    std::chrono::microseconds const cost(200);
+    std::chrono::microseconds const margin = cost + cost / 8
+        + utp::RecedingHorizonPlanner::Options().reserve;
+
+    /* Also just short of the predicted end of the eleventh evaluation. */
+    std::vector<std::chrono::microseconds> budgets = {
+        std::chrono::microseconds(2000), std::chrono::microseconds(5000),
+        std::chrono::microseconds(20000),
+        margin + 10 * cost - std::chrono::microseconds(1)};
+    for (std::chrono::microseconds budget : budgets) {
+        /* Constant durations - the number of evaluations is exact. */
+        {
+            SimulatedClock clock;
+            std::vector<std::chrono::microseconds> costs(1, cost);
+            utp::RecedingHorizonPlanner::Options opts;
+            opts.horizon = 6;
+            utp::RecedingHorizonPlanner planner(opts,
+                simulated_score(goal, costs, &clock), clock.function());
+
+            utp::State state = initial_state();
+            planner.plan(state, budget);
+
+            std::size_t expected = (budget - margin) / cost + 1;
+            for (int i = 0; i < 10; ++i) {
+                utp::RecedingHorizonPlanner::Plan plan = planner.plan(state, budget);
+                TEST(plan.latency <= budget);
+                TEST(plan.evaluations == expected);
+                TEST(plan.evaluations * cost <= budget);
+
+                state.vel = plan.waypoints[0].pos - state.pos;
+                state.pos = plan.waypoints[0].pos;
+            }
+        }
+
+        /* Varying durations and a single outlier (preemption). */
+        {
+            SimulatedClock clock;
+            std::vector<std::chrono::microseconds> costs = {cost, cost / 2,
+                cost * 3 / 4, cost / 4, cost, cost / 2, cost / 4, cost * 3 / 4};
+            for (int i = 0; i < 3; ++i) costs.insert(costs.end(), costs.begin(), costs.end());
+            costs[37] = cost * 20;
+            utp::RecedingHorizonPlanner::Options opts;
+            opts.horizon = 6;
+            utp::RecedingHorizonPlanner planner(opts,
+                simulated_score(goal, costs, &clock), clock.function());
+
+            utp::State state = initial_state();
+            planner.plan(state, budget);
+
+            for (int i = 0; i < 10; ++i) {
+                std::size_t first = clock.evaluations;
+                utp::RecedingHorizonPlanner::Plan plan = planner.plan(state, budget);
+                bool outlier = false;
+                for (std::size_t j = first; j < clock.evaluations; ++j) {
+                    outlier = outlier || j % costs.size() == 37;
+                }
+                TEST(outlier || plan.latency <= budget);
+                TEST(plan.latency + margin > budget);
+
+                state.vel = plan.waypoints[0].pos - state.pos;
+                state.pos = plan.waypoints[0].pos;
+            }
+        }
+    }
+
+    std::cout << "Passed (budget)" << std::endl;
+}
+
+/* Smoke test on the wall clock - calls may be delayed by the scheduler
+ * (or the hypervisor), the median call has to meet the budget. */
+void test_latency(void) {
+    math::Vec3f goal(20.0f, 20.0f, 20.0f);
+    std::chrono::microseconds const cost(200);
+
+    for (int budget_ms : {5, 20}) {
+        std::chrono::microseconds budget(budget_ms * 1000);
+        utp::RecedingHorizonPlanner::Options opts;
+        opts.horizon = 6;
+        utp::RecedingHorizonPlanner planner(opts, goal_score(goal, cost));
+
+        /* Let the planner learn the duration of an evaluation. */
+        utp::State state = initial_state();
+        planner.plan(state, budget);
+
+        int const num_calls = 10;
+        std::vector<std::chrono::microseconds> latencies;
+        for (int i = 0; i < num_calls; ++i) {
+            Clock::time_point start = Clock::now();
+            utp::RecedingHorizonPlanner::Plan plan = planner.plan(state, budget);
+            latencies.push_back(std::chrono::duration_cast<
+                std::chrono::microseconds>(Clock::now() - start));
+
+            TEST(plan.latency <= latencies.back());
+            if (plan.waypoints.empty()) continue;
+
+            state.vel = plan.waypoints[0].pos - state.pos;
+            state.pos = plan.waypoints[0].pos;
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        TEST(latencies[num_calls / 2] <= budget);
+
+        std::cout << "Passed (" << budget_ms << "ms budget, median latency "
+            << latencies[num_calls / 2].count() << "us)" << std::endl;
+    }
+}
+
+/* Without time for a single evaluation the remainder of the previous plan
+ * is returned immediately. */
+void test_fallback(void) {
+    math::Vec3f goal(-8.0f, 4.0f, 6.0f);
+    std::chrono::microseconds const cost(500);
+    utp::RecedingHorizonPlanner::Options opts;
+    opts.horizon = 3;
+    utp::RecedingHorizonPlanner planner(opts, goal_score(goal, cost));
+
+    utp::State state = initial_state();
+    utp::RecedingHorizonPlanner::Plan plan = planner.plan(state,
+        std::chrono::milliseconds(500));
+    TEST(plan.complete);
+
+    state.vel = plan.waypoints[0].pos - state.pos;
+    state.pos = plan.waypoints[0].pos;
+
+    utp::RecedingHorizonPlanner::Plan next = planner.plan(state,
+        std::chrono::microseconds(100));
+    TEST(next.evaluations == 0);
+    TEST(!next.complete);
+    TEST(next.latency < cost);
+    TEST(next.waypoints.size() == opts.horizon - 1);
+    for (std::size_t i = 0; i < next.waypoints.size(); ++i) {
+        TEST(next.waypoints[i].pos == plan.waypoints[i + 1].pos);
+    }
+
+    std::cout << "Passed (fallback)" << std::endl;
+}
+
+int main(void) {
+    test_deterministic();
+    test_anytime();
+    test_warm_start();
+    test_budget();
+    test_latency();
+    test_fallback();
+
+    return EXIT_SUCCESS;
+}
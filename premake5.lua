@@ -76,3 +76,6 @@ workspace "uavmvs"
     include("apps/evaluate_reconstruction")
     include("apps/evaluate_ground_sampling")
     include("apps/estimate_capture_difficulty")
+    include("apps/query_viewpoints")
+
+    include("apps/run_pipeline")